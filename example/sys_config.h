@@ -50,19 +50,29 @@
 //vendor-specific requests support
 #define USBD_VSR                                            0
 
+//IO queued per endpoint with usbd_ep_queue_*. 0 - disabled
+#define USBD_EP_QUEUE                                       0
+
 #define USBD_IO_SIZE                                        128
 
 #define USBD_CDC_ACM_CLASS                                  1
 #define USBD_RNDIS_CLASS                                    0
+//CDC NCM. CDC ECM interfaces are also served
+#define USBD_NCM_CLASS                                      0
 #define USBD_HID_KBD_CLASS                                  0
 #define USBD_CCID_CLASS                                     0
 #define USBD_MSC_CLASS                                      0
+//USB attached SCSI. SCSI_TASK_DEPTH required
+#define USBD_UAS_CLASS                                      0
 
 //----------------------- CDC ACM Device class ----------------------------------------
-//At least EP size required, or data will be lost. Double EP size is recommended
+//At least EP size required, or data will be lost. Double EP size is recommended.
+//TX stream of few EP sizes is sent in multi-packet transfers
 #define USBD_CDC_ACM_TX_STREAM_SIZE                         32
 #define USBD_CDC_ACM_RX_STREAM_SIZE                         32
 #define USBD_CDC_ACM_FLOW_CONTROL                           1
+//IO based mode: user IO is transferred as is, up to N queued IO per direction. Stream sizes must be 0
+#define USBD_CDC_ACM_BULK_QUEUE                             0
 
 #define USBD_CDC_ACM_DEBUG                                  1
 #define USBD_CDC_ACM_DEBUG_FLOW                             0
@@ -72,8 +82,23 @@
 #define USBD_RNDIS_DEBUG_REQUESTS                           0
 #define USBD_RNDIS_DEBUG_FLOW                               0
 
-//must be more than MTU + MAC. And fully fit in EP size
+//must be more than MTU + MAC. And fully fit in EP size. Transfer size, few small packets are aggregated in it
 #define USBD_RNDIS_MAX_PACKET_SIZE                          2048
+#define USBD_RNDIS_MAX_PACKETS_PER_TRANSFER                 8
+//wait for more packets before sending IN transfer. 0 - only while previous transfer is on the air
+#define USBD_RNDIS_TX_FLUSH_MS                              0
+
+//------------------------- NCM Device class ------------------------------------------
+#define USBD_NCM_DEBUG                                      1
+#define USBD_NCM_DEBUG_REQUESTS                             0
+#define USBD_NCM_DEBUG_FLOW                                 0
+
+//NTB size in both directions. At least 2048 by spec. Whole ECM frame must fit too
+#define USBD_NCM_MAX_NTB_SIZE                               2048
+//max datagrams in IN NTB
+#define USBD_NCM_MAX_DATAGRAMS                              8
+//wait for more packets before sending IN NTB. 0 - only while previous NTB is on the air
+#define USBD_NCM_TX_FLUSH_MS                                0
 
 //------------------------------ HIDD class -------------------------------------------
 #define USBD_HID_DEBUG_ERRORS                               0
@@ -99,6 +124,14 @@
 
 //only one LUN supported for now
 #define USBD_MSC_LUN_COUNT                                  1
+
+//------------------------------ UASD class -------------------------------------------
+#define USBD_UAS_DEBUG_ERRORS                               0
+#define USBD_UAS_DEBUG_REQUESTS                             0
+#define USBD_UAS_DEBUG_IO                                   0
+
+//Generally sector_size * num_sectors
+#define USBD_UAS_IO_SIZE                                    4096
 //-------------------------------- SCSI ----------------------------------------------
 #define SCSI_SENSE_DEPTH                                    10
 //can be disabled for flash memory saving
@@ -106,6 +139,10 @@
 #define SCSI_VERIFY_SUPPORTED                               0
 //send PASS before data was written
 #define SCSI_WRITE_CACHE                                    1
+//IO buffers per transfer. Storage and host IO are overlapped for 2 and more
+#define SCSI_IO_BUFFERS                                     2
+//tagged command queue depth for UAS. 0 - untagged only
+#define SCSI_TASK_DEPTH                                     0
 //SATA over SCSI. Just stub for more verbose error processing
 //Found on some linux recent kernels
 #define SCSI_SAT                                            0
@@ -210,7 +247,8 @@
 //Each session internal IO size. Smaller may require more often requests
 //to TCP/IP stack, bigger consumes more memory. Default to MSS.
 #define WEBS_IO_SIZE                                        1460
-//Maximum request size. If request is bigger, it will be responded with "payload too large"
+//Maximum request header size. If header is bigger, it will be responded with "payload too large".
+//Request body is not limited, it is streamed to handler by reads
 #define WEBS_MAX_PAYLOAD                                    8192
 
 //---------------------------- TLS server---------------------------------------------
@@ -239,7 +277,31 @@
 #define VFS_BER                                             1
 #define VFS_BER_DEBUG_INFO                                  1
 #define VFS_BER_DEBUG_ERRORS                                1
-
+//commit BER remap after N block writes. Also on vfs_flush(), file close and transaction commit
+#define VFS_BER_COMMIT_WRITES                               16
+//append remap changes to superblock's block instead of new superblock. Only for storage with sector write
+//granularity (SD/MMC): flash, erasing whole page on partial write, can lose superblock on power fail
+#define VFS_BER_REMAP_LOG                                   0
+//idle tick of BER background commit and static wear leveling, ms. 0 to disable
+#define VFS_BER_GC_MS                                       1000
+//move cold data, when erase count spread exceeds
+#define VFS_BER_WEAR_SPREAD                                 64
+//max blocks moved per idle tick
+#define VFS_BER_GC_BLOCKS                                   1
+
+//LRU sector cache for FAT/directory sectors. 0 to disable
+#define VFS_CACHE_SECTORS                                   8
+//delay sector writes till eviction/flush. Flushed on file close, unmount and vfs_flush()
+#define VFS_CACHE_WRITE_BACK                                1
+
+//sync delayed FAT/directory writes after first change, ms. 0 to sync on file close, remove and vfs_flush() only
+#define VFS_FLUSH_TIMEOUT_MS                                1000
+//intent journal in reserved sector. Half-finished operations are rolled back on mount
+#define VFS_FAT_JOURNAL                                     1
+
+//max sectors per single file data transfer. Contiguous clusters are read/written at once.
+//Buffer is never less than cluster size
+#define VFS_MAX_CHUNK_SECTORS                               8
 //align data sectors by cluster start offset (recommended to enable for flash storage)
 #define VFS_CLUSTER_ALIGN                                   1
 //update modify/access time (recommended to disable for flash storage)
@@ -253,6 +315,12 @@
 #define CO_PROCESS_PRIORITY                                161
 
 #define CO_LSS_MASTER                                      0
+//SDO segmented/block transfer timeout
+#define CO_SDO_TIMEOUT_MS                                  1000
+//segments per SDO block, 1..127
+#define CO_SDO_BLOCK_SIZE                                  32
+//TIME producer period, 0 - only on canopen_time_set
+#define CO_TIME_PERIOD_MS                                  1000
 
 #define CO_DEBUG                                           1
 
@@ -284,6 +284,8 @@ void stm32_can_init_write(EXO* exo, IPC* ipc)
                     exo->can.queue.entry[exo->can.queue.head].param2 = ipc->param2;
                     exo->can.queue.entry[exo->can.queue.head].param3 = ipc->param3;
             exo->can.queue.head = next_pos;
+            exo->can.error = OK;
+            return;
         }else{                    // queue full
             exo->can.error = BUSY;
             return;
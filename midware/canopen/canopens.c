@@ -9,192 +9,71 @@
 #define CO_DEF_HEATBEART              2000 // in ms
 #define CO_DEF_TIM_BUSRESTART         4000 // in ms
 
-#define CO_MIN_INHIBIT_TIME          5000 // in us
-
-#define TIMER_PDO_MASK                (1UL <<31)
-#define COT_PDO                       (TIMER_PDO_MASK +1)
-#define COT_INHIBIT                   (TIMER_PDO_MASK +2)
-#define CO_OD_ENTRY_EVENT_TIME_1TPDO   0x051800
-#define CO_OD_ENTRY_INHIBIT_TIME       CO_OD_IDX(0x1800, 3)
-#define CO_OD_ENTRY_ERROR_REG          CO_OD_IDX(0x1001, 0)
-
 #define IS_MY_ID          ((co->rec_msg.id & 0x7F) == co->id)
+//index major, subindex minor
+#define CO_OD_KEY(idx)    ((CO_OD_INDEX(idx) << 8) | (CO_OD_SUBINDEX(idx) & 0xFF))
 
 #include <string.h>
 
-static void pdo_start_timer(CO* co)
-{
-    CO_OD_ENTRY* entry = co_od_find_idx(co->od, CO_OD_ENTRY_EVENT_TIME_1TPDO);
-    if (entry == NULL)
-        return;
-    if(entry->data)
-        timer_start_ms(co->tpdo.timer, entry->data);
-}
-
-static void pdo_send(CO* co, uint32_t cob_id, uint32_t data, uint32_t len)
+//----------- OD index --------------
+static void co_od_index_build(CO* co)
 {
-    if (co->co_state != Operational)
+    uint32_t i, j, count, key;
+    CO_OD_ENTRY* entry;
+    for (count = 0; (count < co->od_size / sizeof(CO_OD_ENTRY)) && co->od[count].idx; ++count) {}
+    co->od_count = 0;
+    co->od_index = malloc(count * sizeof(CO_OD_ENTRY*));
+    if (co->od_index == NULL)
         return;
-    co->out_msg.id = cob_id;
-    co->out_msg.data.lo = data;
-    co->out_msg.data.hi = 0;
-    co->out_msg.data_len = len;
-    can_write(&co->out_msg, &co->can_state);
-    if((!co->tpdo.inhibit) && (co->tpdo.inhibit_time))
-        {
-            timer_start_us(co->tpdo.inhibit_timer, co->tpdo.inhibit_time);
-            co->tpdo.inhibit = true;
-        }
-}
-
-void pdo_data_changed(CO* co, CO_OD_ENTRY* entry, uint32_t data)
-{
-    int i;
-    for (i = 0; i < CO_MAX_TPDO; i++)
+    //insertion sort: OD is usually already ordered, so it's linear
+    for (i = 0; i < count; ++i)
     {
-        if (entry != co->tpdo.od_var[i])
-            continue;
-        if(co->tpdo.inhibit)
-        {
-            co->tpdo.updated_msk |= (1 << i);
-            continue;
-        }
-        pdo_send(co, co->tpdo.cob_id[i]->data, data, entry->len & 0xff);
-        timer_stop(co->tpdo.timer, COT_PDO, HAL_CANOPEN);
-        pdo_start_timer(co);
+        entry = &co->od[i];
+        key = CO_OD_KEY(entry->idx);
+        for (j = i; (j > 0) && (CO_OD_KEY(co->od_index[j - 1]->idx) > key); --j)
+            co->od_index[j] = co->od_index[j - 1];
+        co->od_index[j] = entry;
     }
+    co->od_count = count;
 }
 
-uint32_t pdo_tpdo_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data)
+CO_OD_ENTRY* co_od_lookup(CO* co, uint32_t idx)
 {
-    switch (entry->idx)
+    uint32_t key, mid_key;
+    int lo, hi, mid;
+    //no memory for index
+    if (co->od_index == NULL)
+        return co_od_find_idx(co->od, idx);
+    key = CO_OD_KEY(idx);
+    lo = 0;
+    hi = (int)co->od_count - 1;
+    while (lo <= hi)
     {
-    case CO_OD_ENTRY_EVENT_TIME_1TPDO:   //event timer first TPDO in  ms
-        if((data < 100) && (data != 0))
-            data = 100;
-        entry->data = data;
-        break;
-    case CO_OD_ENTRY_INHIBIT_TIME:   // in us
-        if((data < CO_MIN_INHIBIT_TIME) && (data != 0))
-            data = CO_MIN_INHIBIT_TIME;
-        entry->data = data;
-        co->tpdo.inhibit_time = data;
-        break;
-    }
-
-    return SDO_ERROR_OK;
-}
-
-void pdo_timeout(CO* co, uint32_t timer)
-{
-    int i;
-    switch (timer)
-    {
-    case COT_PDO:
-        for (i = 0; i < co->tpdo.count; i++)
-            pdo_send(co, co->tpdo.cob_id[i]->data, co->tpdo.od_var[i]->data, co->tpdo.od_var[i]->len & 0xff);
-        pdo_start_timer(co);
-        break;
-    case COT_INHIBIT:
-        co->tpdo.inhibit = false;
-        for (i = 0; i < co->tpdo.count; i++)
-            if(co->tpdo.updated_msk & (1 << i))
-                pdo_send(co, co->tpdo.cob_id[i]->data, co->tpdo.od_var[i]->data, co->tpdo.od_var[i]->len & 0xff);
-        co->tpdo.updated_msk = 0;
-        break;
+        mid = (lo + hi) >> 1;
+        mid_key = CO_OD_KEY(co->od_index[mid]->idx);
+        if (mid_key == key)
+            return co->od_index[mid];
+        if (mid_key < key)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
     }
+    return NULL;
 }
 
-void pdo_init(CO* co)
+void co_default_cob_id(CO* co, uint32_t idx, uint32_t base)
 {
-    CO_OD_ENTRY* entry;
-    int i;
-    uint32_t idx;
-    if(co->co_state != Operational)
-    {
-        co->tpdo.count = 0;
-        co->rpdo.count = 0;
+    uint32_t cob_id;
+    CO_OD_ENTRY* entry = co_od_lookup(co, idx);
+    if (entry == NULL)
         return;
-    }
-//search TPDO
-    for (i = 0; i < CO_MAX_TPDO; i++)
-    {
-        entry = co_od_find_idx(co->od, CO_OD_IDX(0x1800 + i, 1));
-        if (entry == NULL)
-            break;
-        co->tpdo.cob_id[i] = entry;
-        entry->data = (entry->data & ~MSK_ID) | co->id;
-        entry = co_od_find_idx(co->od, CO_OD_IDX(0x1A00 + i, 1));
-        if (entry == NULL)
-            break;
-        idx = (entry->data >> 16) | ((entry->data << 8) & 0x00FF0000);
-        co->tpdo.od_var[i] = co_od_find_idx(co->od, idx);
-        if (co->tpdo.od_var[i] == NULL)
-            break;
-    }
-    co->tpdo.count = i;
-//search RPDO
-    for (i = 0; i < CO_MAX_RPDO; i++)
-    {
-        entry = co_od_find_idx(co->od, CO_OD_IDX(0x1400 + i, 1));
-        if (entry == NULL)
-            break;
-        entry->data = (entry->data & ~MSK_ID) | co->id;
-        co->rpdo.cob_id[i] = entry;
-        entry = co_od_find_idx(co->od, CO_OD_IDX(0x1600 + i, 1));
-        if (entry == NULL)
-            break;
-        idx = (entry->data >> 16) | ((entry->data << 8) & 0x00FF0000);
-        co->rpdo.od_var[i] = co_od_find_idx(co->od, idx);
-        if (co->rpdo.od_var[i] == NULL)
-            break;
-    }
-    co->rpdo.count = i;
-}
-
-void pdo_bus_init(CO* co)
-{
-    pdo_init(co);
-    pdo_start_timer(co);
-}
-
-void pdo_bus_error(CO* co)
-{
-    timer_stop(co->tpdo.timer, COT_PDO, HAL_CANOPEN);
-}
-
-static inline bool pdo_is_rec_rpdo(CO* co)
-{
-    int i;
-    uint32_t data;
-    for (i = 0; i < co->rpdo.count; i++)
-    {
-        if (co->rec_msg.id == co->rpdo.cob_id[i]->data)
-        {
-            data = co->rec_msg.data.lo;
-            if (co->rec_msg.data_len < (co->rpdo.od_var[i]->len & 0xFF))
-                break;
-            co->rpdo.od_var[i]->data = data;
-            ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_OD_CHANGE),
-                    co->rpdo.od_var[i]->idx, data, 0);
-            return true;
-        }
-    }
-    return false;
+    cob_id = entry->data & MSK_COB_ID;
+    //written by SDO or configured in OD, keep it
+    if ((cob_id != base) && (cob_id != base + co->default_id))
+        return;
+    entry->data = (entry->data & ~MSK_COB_ID) | (base + co->id);
 }
 
-static inline void pdo_tpdo_req(CO* co, uint32_t id)
-{
-    int i;
-    for (i = 0; i < CO_MAX_TPDO; i++)
-    {
-        if (co->tpdo.cob_id[i]->data == id)
-        {
-            pdo_send(co, id, co->tpdo.od_var[i]->data, co->tpdo.od_var[i]->len & 0xff);
-            return;
-        }
-    }
-}
 //----------------------------------------
 void co_led_change(CO* co, LED_STATE state)
 {
@@ -203,7 +82,7 @@ void co_led_change(CO* co, LED_STATE state)
 
 static void heartbeat_init(CO* co)
 {
-    CO_OD_ENTRY* entry = co_od_find_idx(co->od, CO_OD_ENTRY_HEARTBEAT_TIME);
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_ENTRY_HEARTBEAT_TIME);
     if (co->bus_state != BUS_RUN)
         return;
     if (entry == NULL)
@@ -226,8 +105,18 @@ static inline void bus_init(CO* co) // can bus ready after init or restore after
     co->out_msg.id = NODE_GUARD + co->id;
     can_write(&co->out_msg, &co->can_state);
     co->co_state = Operational;
+    //predefined connection set, once for each node-id
+    if (co->default_id != co->id)
+    {
+        pdo_default_cob_id(co);
+        emcy_default_cob_id(co);
+        co->default_id = co->id;
+    }
     heartbeat_init(co);
     pdo_init(co);
+    sync_init(co);
+    emcy_init(co);
+    time_init(co);
 }
 
 static inline void bus_error(CO* co)
@@ -241,6 +130,9 @@ static inline void bus_error(CO* co)
         led = LED_INIT;
     co_led_change(co, led);
     pdo_bus_error(co);
+    sync_bus_error(co);
+    emcy_bus_error(co);
+    time_bus_error(co);
 }
 
 static inline void init(CO* co)
@@ -249,12 +141,15 @@ static inline void init(CO* co)
     memset(co, 0, sizeof(CO));
     co->od = NULL;
     co->od_size = 0;
+    co->od_index = NULL;
+    co->od_count = 0;
+    co->domains = NULL;
+    co->domains_count = 0;
 }
 
 static inline void open(CO* co, IPC* ipc) // HANDLE device, IO* io)
 {
     IO* io = (IO*)ipc->param2;
-    CO_OD_ENTRY* od;
     if (co->od)
     {
         error (ERROR_ALREADY_CONFIGURED);
@@ -265,6 +160,7 @@ static inline void open(CO* co, IPC* ipc) // HANDLE device, IO* io)
     co->od_size = io->data_size;
     co->od = malloc(co->od_size);
     memcpy(co->od, io_data(io), co->od_size);
+    co_od_index_build(co);
 
     co->timers.bus = timer_create(COT_BUS, HAL_CANOPEN);
     co->timers.heartbeat = timer_create(COT_HEARTBEAT, HAL_CANOPEN);
@@ -285,18 +181,12 @@ static inline void open(CO* co, IPC* ipc) // HANDLE device, IO* io)
     co->bus_state = BUS_INIT;
     timer_start_us(co->timers.bus, 30 * 1000000ul / baud);
     co->out_msg.rtr = 0;
-    co->tpdo.timer = timer_create(COT_PDO, HAL_CANOPEN);
-    co->tpdo.inhibit_timer = timer_create(COT_INHIBIT, HAL_CANOPEN);
+    pdo_open(co);
     pdo_init(co);
-
-    od = co_od_find_idx(co->od, CO_OD_ENTRY_INHIBIT_TIME);
-    if(od)
-    {
-        if( (od->data > 0) && (od->data < CO_MIN_INHIBIT_TIME) )
-            od->data = CO_MIN_INHIBIT_TIME;
-        co->tpdo.inhibit_time  = od->data;
-    }else
-        co->tpdo.inhibit_time  = 0;
+    sdo_open(co);
+    sync_open(co);
+    emcy_open(co);
+    time_open(co);
 
 #if (CO_DEBUG)
     printf("LSS serial:%x \n", co->lss.lss_id.serial);
@@ -306,7 +196,12 @@ static inline void open(CO* co, IPC* ipc) // HANDLE device, IO* io)
 
 static inline void close(CO* co)
 {
+    sdo_close(co);
+    free(co->od_index);
     free(co->od);
+    co->od_index = NULL;
+    co->od = NULL;
+    co->od_count = 0;
 }
 
 static inline void bus_state_change(CO* co)
@@ -374,19 +269,6 @@ static inline void bus_timeout(CO* co)
     }
 }
 //----------- SDO --------------
-static void co_sdo_slave_replay(CO* co, uint8_t cmd, uint32_t data)
-{
-    SDO_PKT* pkt = (SDO_PKT*)&co->out_msg.data;
-    co->out_msg.data_len = 8;
-    co->out_msg.id = SDOtx + co->id;
-    co->out_msg.rtr = 0;
-    co->out_msg.data.hi = co->rec_msg.data.hi;
-    co->out_msg.data.lo = co->rec_msg.data.lo;
-    pkt->cmd = cmd;
-    pkt->data = data;
-    can_write(&co->out_msg, &co->can_state);
-}
-
 static inline uint32_t co_sdo_save_od(CO* co, CO_OD_ENTRY* entry, uint32_t data)
 {
     uint32_t size;
@@ -399,12 +281,23 @@ static inline uint32_t co_sdo_save_od(CO* co, CO_OD_ENTRY* entry, uint32_t data)
 
 static inline uint32_t co_sdo_comm_changed(CO* co, CO_OD_ENTRY* entry, uint32_t data)
 {
-    if ((CO_OD_INDEX(entry->index) & 0xFF00) == 0x1800)
-    {
-        return pdo_tpdo_param_change(co, entry, data);
-    }
+    if ((CO_OD_INDEX(entry->idx) >= 0x1400) && (CO_OD_INDEX(entry->idx) < 0x1C00))
+        return pdo_param_change(co, entry, data);
     switch(CO_OD_INDEX(entry->idx))
     {
+    case CO_OD_INDEX_SYNC_COB_ID:
+    case CO_OD_INDEX_SYNC_PERIOD:
+    case CO_OD_INDEX_SYNC_WINDOW:
+    case CO_OD_INDEX_SYNC_OVERFLOW:
+        return sync_param_change(co, entry, data);
+    case CO_OD_INDEX_ERROR_HISTORY:
+    case CO_OD_INDEX_EMCY_COB_ID:
+    case CO_OD_INDEX_EMCY_INHIBIT:
+        return emcy_param_change(co, entry, data);
+    case CO_OD_INDEX_TIME_COB_ID:
+        entry->data = data;
+        time_init(co);
+        return SDO_ERROR_OK;
     case CO_OD_INDEX_SAVE_OD:
         return co_sdo_save_od(co, entry, data);
     case CO_OD_INDEX_RESTORE_OD:
@@ -427,45 +320,18 @@ static inline uint32_t co_sdo_comm_changed(CO* co, CO_OD_ENTRY* entry, uint32_t
     return SDO_ERROR_OK;
 }
 
-static inline void co_sdo_slave_request(CO* co)
+uint32_t co_od_download(CO* co, CO_OD_ENTRY* entry, uint32_t data)
 {
-    SDO_PKT* pkt = (SDO_PKT*)&co->rec_msg.data;
-    CO_OD_ENTRY* entry = co_od_find(co->od, pkt->index, pkt->subindex);
-    if (entry == NULL)
-    {
-        co_sdo_slave_replay(co, SDO_CMD_ABORT, SDO_ERROR_NOT_EXIST);
-        return;
-    }
-    switch (pkt->cmd & SDO_CMD_MSK)
-    {
-    case SDO_CMD_DOWNLOAD_REQ:
-        if (CO_OD_IS_RW(entry))
-        {
-            uint32_t err_code = 0;
-            if( CO_OD_INDEX(entry->index) < CO_OD_FIRST_USER_INDEX)
-                err_code = co_sdo_comm_changed(co, entry, pkt->data);
-            else
-            {
-                pdo_data_changed(co, entry, pkt->data);
-                ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_OD_CHANGE), entry->idx, pkt->data, 0);
-                entry->data = pkt->data;
-            }
-//            = co_sdo_changed(co, entry, pkt->data);
-            if (err_code == SDO_ERROR_OK)
-                co_sdo_slave_replay(co, SDO_CMD_DOWNLOAD_RESP, 0);
-            else
-            co_sdo_slave_replay(co, SDO_CMD_ABORT, err_code);
-        } else
-        co_sdo_slave_replay(co, SDO_CMD_ABORT, SDO_ERROR_READONLY);
-        break;
-    case SDO_CMD_UPLOAD_REQ:
-        co_sdo_slave_replay(co, SDO_CMD_UPLOAD_RESP | 0x03 | ((4 - (entry->len & 0x0F)) << 2), entry->data);
-        break;
-    default:
-        break;
-    }
-
+    if (!CO_OD_IS_RW(entry))
+        return SDO_ERROR_READONLY;
+    if (CO_OD_INDEX(entry->index) < CO_OD_FIRST_USER_INDEX)
+        return co_sdo_comm_changed(co, entry, data);
+    entry->data = data;
+    pdo_data_changed(co, entry);
+    ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_OD_CHANGE), entry->idx, data, 0);
+    return SDO_ERROR_OK;
 }
+
 #if (CO_LSS_MASTER)
 static inline void co_sdo_master_replay(CO* co)
 {
@@ -538,13 +404,16 @@ static inline void can_received(CO* co)
         pdo_tpdo_req(co, co->rec_msg.id);
         return;
     }
+    if (sync_is_rec_sync(co) || time_is_rec_time(co))
+        return;
     if (pdo_is_rec_rpdo(co))
         return;
     switch (co->rec_msg.id & MSK_FUNC)
     {
 #if (CO_LSS_MASTER)
         case SDOtx:         // from slave(server) to master(client)
-        co_sdo_master_replay(co);
+        if (!sdo_client_response(co))
+            co_sdo_master_replay(co);
         break;
 #endif // CO_LSS_MASTER
     case NMT:
@@ -554,7 +423,7 @@ static inline void can_received(CO* co)
 //        if ((!IS_MY_ID) || (co->rec_msg.data_len != 8))
         if (!IS_MY_ID)
             break;
-        co_sdo_slave_request(co);
+        sdo_server_request(co);
         break;
     }
 }
@@ -565,29 +434,10 @@ static inline void co_get_OD(CO* co, IPC* ipc)
     ipc->param3 = io->data_size;
 }
 
-static inline void co_fault(CO* co, uint32_t error_code)
-{
-    CO_OD_ENTRY* entry= co_od_find_idx(co->od, CO_OD_ENTRY_ERROR_REG);
-    if(entry)
-    {
-        if(error_code)
-            entry->data = 1;
-        else
-            entry->data = 0;
-    }
-    if (co->co_state != Operational)
-        return;
-    co->out_msg.id = SYNC + co->id;
-    co->out_msg.data.lo = error_code;
-    co->out_msg.data.hi = 0;
-    co->out_msg.data_len = 8;
-    can_write(&co->out_msg, &co->can_state);
-
-}
-
 static inline void canopen_request(CO* co, IPC* ipc)
 {
     CO_OD_ENTRY* entry;
+    TIME time;
     switch (HAL_ITEM(ipc->cmd))
     {
     case IPC_OPEN:
@@ -601,11 +451,9 @@ static inline void canopen_request(CO* co, IPC* ipc)
         break;
     case IPC_CO_ID_CHANGED:
         bus_init(co);
-        pdo_start_timer(co);
-//        pdo_init(co);
         break;
     case IPC_TIMEOUT:
-        if (ipc->param1 & TIMER_PDO_MASK)
+        if (ipc->param1 & CO_TIMER_PDO_MASK)
         {
             pdo_timeout(co, ipc->param1);
             break;
@@ -621,21 +469,49 @@ static inline void canopen_request(CO* co, IPC* ipc)
         case COT_LSS:
             lss_timeout(co);
             break;
+        case COT_SDO:
+        case COT_SDO_CLIENT:
+            sdo_timeout(co, ipc->param1);
+            break;
+        case COT_SYNC:
+        case COT_SYNC_WINDOW:
+            sync_timeout(co, ipc->param1);
+            break;
+        case COT_EMCY:
+            emcy_timeout(co);
+            break;
+        case COT_TIME:
+            time_timeout(co);
+            break;
         }
         break;
     case IPC_CO_FAULT:
-        co_fault(co, ipc->param2);
+        emcy_error(co, ipc->param2);
+        break;
+    case IPC_CO_GET_TIME:
+        time_get(co, &time);
+        ipc->param1 = time.day;
+        ipc->param2 = time.ms;
+        break;
+    case IPC_CO_SET_TIME:
+        time.day = ipc->param1;
+        time.ms = ipc->param2;
+        time_set(co, &time);
         break;
 
     case IPC_CO_GET_OD:
         co_get_OD(co,ipc);
         break;
+    case IPC_CO_DOMAIN_READ:
+    case IPC_CO_DOMAIN_WRITE:
+        sdo_domain_request(co, ipc);
+        break;
     case IPC_CO_OD_CHANGE:
-        entry = co_od_find_idx(co->od, ipc->param1);
+        entry = co_od_lookup(co, ipc->param1);
         if (entry)// if(CO_OD_INDEX(entry->idx) >= 0x2000)
         {
-            pdo_data_changed(co, entry, ipc->param2);
             entry->data = ipc->param2;
+            pdo_data_changed(co, entry);
         }
 //            co_sdo_changed(co, entry, ipc->param2);
         break;
@@ -650,6 +526,12 @@ static inline void canopen_request(CO* co, IPC* ipc)
         case IPC_CO_SDO_REQUEST:
         co_sdo_init_request(co, ipc);
         break;
+        case IPC_CO_SDO_DOWNLOAD:
+        case IPC_CO_SDO_UPLOAD:
+        case IPC_CO_SDO_BLOCK_DOWNLOAD:
+        case IPC_CO_SDO_BLOCK_UPLOAD:
+        sdo_client_request(co, ipc);
+        break;
         case IPC_CO_SEND_PDO:
         if (co->co_state != Operational)
         break;
@@ -677,6 +559,7 @@ static inline void can_request(CO* co, IPC* ipc)
     case IPC_CAN_TXC:
         if ((co->can_state.error == ARBITRATION_LOST) | (co->can_state.error == BUSOFF_ABORT))
             bus_state_change(co);
+        sdo_tx_complete(co);
         break;
     case IPC_READ:
         if (co->bus_state != BUS_RUN)
@@ -11,5 +11,10 @@ typedef struct _CO CO;
 
 
 void co_led_change(CO* co, LED_STATE state);
+CO_OD_ENTRY* co_od_lookup(CO* co, uint32_t idx);
+//validate and apply SDO download of regular object. Return SDO abort code
+uint32_t co_od_download(CO* co, CO_OD_ENTRY* entry, uint32_t data);
+//predefined connection set: base + node-id, only if COB-ID still holds predefined value
+void co_default_cob_id(CO* co, uint32_t idx, uint32_t base);
 
 #endif //CANOPENS_H
@@ -7,6 +7,11 @@
 #include "canopen.h"
 #include "can.h"
 #include "co_lss.h"
+#include "co_pdo.h"
+#include "co_sdo.h"
+#include "co_sync.h"
+#include "co_emcy.h"
+#include "co_time.h"
 #include "co_def.h"
 
 typedef enum {
@@ -23,24 +28,15 @@ typedef enum {
 typedef enum {
     COT_BUS = 0,
     COT_HEARTBEAT,
-    COT_LSS
+    COT_LSS,
+    COT_SDO,
+    COT_SDO_CLIENT,
+    COT_SYNC,
+    COT_SYNC_WINDOW,
+    COT_EMCY,
+    COT_TIME
 } CO_TIMER;
 
-typedef struct {
-    HANDLE timer;
-    uint32_t count;
-    uint32_t updated_msk;
-    HANDLE inhibit_timer;
-    uint32_t inhibit_time;  // in us
-    bool inhibit;
-    CO_OD_ENTRY* cob_id[CO_MAX_TPDO];
-    CO_OD_ENTRY*  od_var[CO_MAX_TPDO];
-}CO_TPDO;
-typedef struct {
-    uint32_t count;
-    CO_OD_ENTRY* cob_id[CO_MAX_RPDO];
-    CO_OD_ENTRY*  od_var[CO_MAX_RPDO];
-}CO_RPDO;
 //------------------------
 typedef struct _CO{
     HANDLE can, device;
@@ -54,12 +50,27 @@ typedef struct _CO{
     CAN_STATE_t can_state;
 //canopen
     uint8_t id;
+    //node-id of predefined COB-IDs, 0 - not applied yet
+    uint8_t default_id;
     CO_OD_ENTRY* od;
     uint32_t od_size;
+    //sorted by index/subindex, for binary search
+    CO_OD_ENTRY** od_index;
+    uint32_t od_count;
     CO_STATE co_state;
     LSS_t lss;
     CO_TPDO tpdo;
     CO_RPDO rpdo;
+    CO_SYNC sync;
+    CO_EMCY emcy;
+    CO_TIME time;
+    CO_SDO sdo_server;
+#if (CO_LSS_MASTER)
+    CO_SDO sdo_client;
+#endif // CO_LSS_MASTER
+    //server buffers of domain objects
+    CO_DOMAIN* domains;
+    uint32_t domains_count;
 } CO;
 
 #pragma pack(push,1)
@@ -62,24 +62,58 @@
 #define SDO_CMD_UPLOAD_REQ          (2 << 5)
 #define SDO_CMD_UPLOAD_RESP         (2 << 5)
 #define SDO_CMD_ABORT               (4 << 5)
+#define SDO_CS(cmd)                 ((cmd) >> 5)
+#define SDO_CMD(cs)                 ((cs) << 5)
+
+//expedited, size indicated, bytes without data
+#define SDO_E                        (1 << 1)
+#define SDO_S                        (1 << 0)
+#define SDO_N(cmd)                   (((cmd) >> 2) & 3)
+//segment: toggle, bytes without data, last
+#define SDO_T                        (1 << 4)
+#define SDO_SEG_N(cmd)               (((cmd) >> 1) & 7)
+#define SDO_C                        (1 << 0)
+//block: CRC support, size indicated, subcommand
+#define SDO_BLOCK_CRC                (1 << 2)
+#define SDO_BLOCK_S                  (1 << 1)
+#define SDO_BLOCK_SUB_MSK            0x03
+#define SDO_BLOCK_END_N(cmd)         (((cmd) >> 2) & 7)
+#define SDO_BLOCK_LAST               (1 << 7)
+#define SDO_BLOCK_SEQNO_MSK          0x7F
+#define SDO_SEGMENT_SIZE             7
 
 #define SDO_SAVE_MAGIC               0x65766173
 #define SDO_RESTORE_MAGIC            0x64616F6C
 
 #define SDO_ERROR_OK                 0
+#define SDO_ERROR_TOGGLE             0x05030000
+#define SDO_ERROR_TIMEOUT            0x05040000
+#define SDO_ERROR_COMMAND            0x05040001
+#define SDO_ERROR_BLOCK_SIZE         0x05040002
+#define SDO_ERROR_SEQUENCE           0x05040003
+#define SDO_ERROR_CRC                0x05040004
+#define SDO_ERROR_OUT_OF_MEMORY      0x05040005
 #define SDO_ERROR_READONLY           0x06010002
 #define SDO_ERROR_NOT_EXIST          0x06020000
+#define SDO_ERROR_NOT_MAPPABLE       0x06040041
+#define SDO_ERROR_PDO_LEN            0x06040042
 #define SDO_ERROR_ACCESS_FAIL        0x06060000
 #define SDO_ERROR_DATA_LEN           0x06070010
+#define SDO_ERROR_DATA_LEN_HIGH      0x06070012
+#define SDO_ERROR_DATA_LEN_LOW       0x06070013
 #define SDO_ERROR_DATA_RANGE         0x06090030
 #define SDO_ERROR_STORE              0x08000020
+#define SDO_ERROR_DATA_DEV_STATE     0x08000022
+#define SDO_ERROR_NO_DATA            0x08000024
 
 #define MSK_ID                       0x7F
 #define MSK_FUNC                     (0x0F <<7)
+#define MSK_COB_ID                   0x1FFFFFFF
 
 // Function Codes
 #define NMT                          (0x0 << 7)
 #define SYNC                         (0x1 << 7)
+#define EMCY                         (0x1 << 7)
 #define TIME_STAMP                   (0x2 << 7)
 #define SDOtx                        (0xB << 7)
 #define SDOrx                        (0xC << 7)
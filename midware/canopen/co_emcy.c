@@ -0,0 +1,146 @@
+#include "canopens_private.h"
+#include "co_emcy.h"
+#include "can.h"
+#include "systime.h"
+
+#define CO_OD_ENTRY_ERROR_REG         CO_OD_IDX(0x1001, 0)
+#define CO_EMCY_HISTORY_MAX           254
+
+static uint8_t emcy_err_reg(uint16_t code)
+{
+    switch (code >> 12)
+    {
+    case 0x2:
+        return CO_ERR_REG_GENERIC | CO_ERR_REG_CURRENT;
+    case 0x3:
+        return CO_ERR_REG_GENERIC | CO_ERR_REG_VOLTAGE;
+    case 0x4:
+        return CO_ERR_REG_GENERIC | CO_ERR_REG_TEMPERATURE;
+    case 0x8:
+        return CO_ERR_REG_GENERIC | CO_ERR_REG_COMMUNICATION;
+    case 0xF:
+        if ((code >> 8) == 0xFF)
+            return CO_ERR_REG_GENERIC | CO_ERR_REG_MANUFACTURER;
+        break;
+    }
+    return CO_ERR_REG_GENERIC;
+}
+
+//newest error is in subindex 1
+static void emcy_history_add(CO* co, uint32_t error)
+{
+    unsigned int i, count;
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_ERROR_HISTORY, 0));
+    if ((entry == NULL) || (co->emcy.history_max == 0))
+        return;
+    count = entry->data;
+    if (count < co->emcy.history_max)
+        ++count;
+    entry->data = count;
+    for (i = count; i > 1; --i)
+        co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_ERROR_HISTORY, i))->data = co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_ERROR_HISTORY, i - 1))->data;
+    co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_ERROR_HISTORY, 1))->data = error;
+}
+
+static void emcy_send(CO* co, uint32_t error)
+{
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_EMCY_COB_ID, 0));
+    uint32_t cob_id = entry ? entry->data : EMCY + co->id;
+    uint8_t err_reg = 0;
+    if (cob_id & CO_EMCY_COB_ID_INVALID)
+        return;
+    entry = co_od_lookup(co, CO_OD_ENTRY_ERROR_REG);
+    if (entry)
+        err_reg = entry->data;
+    //error code, error register, additional info
+    co->out_msg.id = cob_id & CO_EMCY_COB_ID_MSK;
+    co->out_msg.rtr = 0;
+    co->out_msg.data_len = 8;
+    co->out_msg.data.lo = (error & 0xFFFF) | (err_reg << 16) | (((error >> 16) & 0xFF) << 24);
+    co->out_msg.data.hi = error >> 24;
+    can_write(&co->out_msg, &co->can_state);
+    entry = co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_EMCY_INHIBIT, 0));
+    if (entry && entry->data)
+    {
+        co->emcy.inhibit = true;
+        timer_start_us(co->emcy.timer, entry->data * 100);
+    }
+}
+
+static void emcy_stop(CO* co)
+{
+    timer_stop(co->emcy.timer, COT_EMCY, HAL_CANOPEN);
+    co->emcy.inhibit = false;
+    co->emcy.head = co->emcy.count = 0;
+}
+
+void emcy_open(CO* co)
+{
+    co->emcy.timer = timer_create(COT_EMCY, HAL_CANOPEN);
+    for (co->emcy.history_max = 0; co->emcy.history_max < CO_EMCY_HISTORY_MAX; ++co->emcy.history_max)
+        if (co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_ERROR_HISTORY, co->emcy.history_max + 1)) == NULL)
+            break;
+}
+
+void emcy_default_cob_id(CO* co)
+{
+    co_default_cob_id(co, CO_OD_IDX(CO_OD_INDEX_EMCY_COB_ID, 0), EMCY);
+}
+
+void emcy_init(CO* co)
+{
+    emcy_stop(co);
+}
+
+void emcy_bus_error(CO* co)
+{
+    emcy_stop(co);
+}
+
+void emcy_error(CO* co, uint32_t error)
+{
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_ENTRY_ERROR_REG);
+    if (error & 0xFFFF)
+    {
+        if (entry)
+            entry->data |= emcy_err_reg(error & 0xFFFF);
+        emcy_history_add(co, error);
+    }
+    else if (entry)
+        entry->data = 0;
+    if (co->co_state != Operational)
+        return;
+    if (co->emcy.inhibit)
+    {
+        //queue overflow: error is in history anyway
+        if (co->emcy.count < CO_EMCY_QUEUE_SIZE)
+            co->emcy.queue[(co->emcy.head + co->emcy.count++) % CO_EMCY_QUEUE_SIZE] = error;
+        return;
+    }
+    emcy_send(co, error);
+}
+
+void emcy_timeout(CO* co)
+{
+    uint32_t error;
+    co->emcy.inhibit = false;
+    if (co->emcy.count == 0)
+        return;
+    error = co->emcy.queue[co->emcy.head];
+    co->emcy.head = (co->emcy.head + 1) % CO_EMCY_QUEUE_SIZE;
+    --co->emcy.count;
+    emcy_send(co, error);
+}
+
+uint32_t emcy_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data)
+{
+    //only clear of error history is allowed
+    if ((CO_OD_INDEX(entry->idx) == CO_OD_INDEX_ERROR_HISTORY) && ((CO_OD_SUBINDEX(entry->idx) != 0) || data))
+        return SDO_ERROR_DATA_RANGE;
+    //COB-ID can't be changed while EMCY is valid
+    if ((CO_OD_INDEX(entry->idx) == CO_OD_INDEX_EMCY_COB_ID) && ((entry->data & CO_EMCY_COB_ID_INVALID) == 0) &&
+        ((data & CO_EMCY_COB_ID_MSK) != (entry->data & CO_EMCY_COB_ID_MSK)))
+        return SDO_ERROR_DATA_DEV_STATE;
+    entry->data = data;
+    return SDO_ERROR_OK;
+}
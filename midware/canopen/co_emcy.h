@@ -0,0 +1,41 @@
+#ifndef CO_EMCY_H
+#define CO_EMCY_H
+
+#include "canopens.h"
+
+#define CO_EMCY_COB_ID_INVALID        (1UL << 31)
+#define CO_EMCY_COB_ID_MSK            0x7FF
+//errors waiting end of inhibit time
+#define CO_EMCY_QUEUE_SIZE            4
+
+//error register 0x1001
+#define CO_ERR_REG_GENERIC            (1 << 0)
+#define CO_ERR_REG_CURRENT            (1 << 1)
+#define CO_ERR_REG_VOLTAGE            (1 << 2)
+#define CO_ERR_REG_TEMPERATURE        (1 << 3)
+#define CO_ERR_REG_COMMUNICATION      (1 << 4)
+#define CO_ERR_REG_PROFILE            (1 << 5)
+#define CO_ERR_REG_MANUFACTURER       (1 << 7)
+
+typedef struct {
+    HANDLE timer;
+    //error code | additional info << 16
+    uint32_t queue[CO_EMCY_QUEUE_SIZE];
+    uint8_t head, count;
+    //subindexes of pre-defined error field 0x1003
+    uint8_t history_max;
+    bool inhibit;
+} CO_EMCY;
+
+void emcy_open(CO* co);
+//node-id to predefined COB-ID, not on each init: SDO written COB-ID is kept
+void emcy_default_cob_id(CO* co);
+void emcy_init(CO* co);
+void emcy_bus_error(CO* co);
+//error code in low 16 bits, additional info in high. 0 - error reset
+void emcy_error(CO* co, uint32_t error);
+void emcy_timeout(CO* co);
+//SDO write to 0x1003, 0x1014, 0x1015
+uint32_t emcy_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data);
+
+#endif //CO_EMCY_H
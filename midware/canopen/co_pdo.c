@@ -0,0 +1,394 @@
+#include "canopens_private.h"
+#include "co_pdo.h"
+#include "can.h"
+#include "systime.h"
+#include <string.h>
+
+#define CO_MIN_INHIBIT_TIME           5000 // in us
+#define CO_MIN_EVENT_TIME             100  // in ms
+
+#define CO_PDO_MAP_IDX(map)           CO_OD_IDX((map) >> 16, ((map) >> 8) & 0xFF)
+#define CO_PDO_BITS_MSK(bits)         (((bits) < 32) ? ((1UL << (bits)) - 1) : 0xFFFFFFFF)
+
+//------------------ mapping ---------------------
+static uint32_t pdo_map_entry(CO* co, uint32_t map, bool rx, CO_OD_ENTRY** entry, uint8_t* bits)
+{
+    unsigned int size;
+    *entry = co_od_lookup(co, CO_PDO_MAP_IDX(map));
+    if (*entry == NULL)
+        return SDO_ERROR_NOT_EXIST;
+    size = ((*entry)->len & 0xFF) * 8;
+    *bits = map & 0xFF;
+    //no length in mapping: whole object
+    if (*bits == 0)
+        *bits = size;
+    if ((*bits == 0) || (*bits > 32) || (*bits > size))
+        return SDO_ERROR_NOT_MAPPABLE;
+    if (rx && !CO_OD_IS_RW((*entry)))
+        return SDO_ERROR_NOT_MAPPABLE;
+    return SDO_ERROR_OK;
+}
+
+static uint32_t pdo_map_check(CO* co, uint16_t index, unsigned int count)
+{
+    unsigned int i, total;
+    uint32_t res;
+    CO_OD_ENTRY* map;
+    CO_OD_ENTRY* entry;
+    uint8_t bits;
+    if (count > CO_PDO_MAP_MAX)
+        return SDO_ERROR_DATA_RANGE;
+    for (i = 0, total = 0; i < count; ++i)
+    {
+        map = co_od_lookup(co, CO_OD_IDX(index, i + 1));
+        if (map == NULL)
+            return SDO_ERROR_NOT_EXIST;
+        if ((res = pdo_map_entry(co, map->data, (index & 0xFE00) == 0x1600, &entry, &bits)) != SDO_ERROR_OK)
+            return res;
+        total += bits;
+    }
+    if (total > 64)
+        return SDO_ERROR_PDO_LEN;
+    return SDO_ERROR_OK;
+}
+
+static bool pdo_map_resolve(CO* co, CO_PDO* pdo, uint16_t index, bool rx)
+{
+    unsigned int i, count, total;
+    CO_OD_ENTRY* map;
+    pdo->map_count = 0;
+    pdo->len = 0;
+    map = co_od_lookup(co, CO_OD_IDX(index, 0));
+    //no number of entries: single object mapped
+    count = map ? map->data : 1;
+    if (count > CO_PDO_MAP_MAX)
+        return false;
+    for (i = 0, total = 0; i < count; ++i)
+    {
+        map = co_od_lookup(co, CO_OD_IDX(index, i + 1));
+        if (map == NULL)
+            return false;
+        if (pdo_map_entry(co, map->data, rx, &pdo->map[i], &pdo->bits[i]) != SDO_ERROR_OK)
+            return false;
+        total += pdo->bits[i];
+    }
+    if (total > 64)
+        return false;
+    pdo->map_count = count;
+    pdo->len = (total + 7) >> 3;
+    return true;
+}
+
+static bool pdo_is_mapped(CO_PDO* pdo, CO_OD_ENTRY* entry)
+{
+    unsigned int i;
+    for (i = 0; i < pdo->map_count; ++i)
+        if (pdo->map[i] == entry)
+            return true;
+    return false;
+}
+
+static void pdo_pack(CO_PDO* pdo, uint32_t* lo, uint32_t* hi)
+{
+    unsigned int i, pos;
+    uint64_t value = 0;
+    for (i = 0, pos = 0; i < pdo->map_count; pos += pdo->bits[i++])
+        value |= ((uint64_t)(pdo->map[i]->data & CO_PDO_BITS_MSK(pdo->bits[i]))) << pos;
+    *lo = (uint32_t)value;
+    *hi = (uint32_t)(value >> 32);
+}
+
+//application is notified only on value change, so cyclic RPDO doesn't flood its IPC queue
+static void pdo_unpack(CO* co, CO_PDO* pdo, uint32_t lo, uint32_t hi)
+{
+    unsigned int i, pos;
+    uint32_t data;
+    uint64_t value = ((uint64_t)hi << 32) | lo;
+    for (i = 0, pos = 0; i < pdo->map_count; pos += pdo->bits[i++])
+    {
+        data = (uint32_t)(value >> pos) & CO_PDO_BITS_MSK(pdo->bits[i]);
+        if (pdo->map[i]->data == data)
+            continue;
+        pdo->map[i]->data = data;
+        ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_OD_CHANGE), pdo->map[i]->idx, data, 0);
+    }
+}
+
+//------------------ TPDO ---------------------
+static void pdo_send(CO* co, unsigned int num)
+{
+    CO_PDO* pdo = &co->tpdo.pdo[num];
+    if (co->co_state != Operational)
+        return;
+    if (pdo->cob_id->data & CO_PDO_COB_ID_INVALID)
+        return;
+    co->out_msg.id = pdo->cob_id->data & CO_PDO_COB_ID_MSK;
+    co->out_msg.data_len = pdo->len;
+    pdo_pack(pdo, &co->out_msg.data.lo, &co->out_msg.data.hi);
+    can_write(&co->out_msg, &co->can_state);
+    co->tpdo.updated_msk &= ~(1 << num);
+}
+
+static void pdo_start_timer(CO* co, unsigned int num)
+{
+    timer_stop(co->tpdo.timer[num], CO_TIMER_PDO_MASK | num, HAL_CANOPEN);
+    if ((co->tpdo.pdo[num].type >= CO_PDO_EVENT_MANUFACTURER) && co->tpdo.event_time[num])
+        timer_start_ms(co->tpdo.timer[num], co->tpdo.event_time[num]);
+}
+
+static void pdo_event_send(CO* co, unsigned int num)
+{
+    if (co->tpdo.inhibit_msk & (1 << num))
+    {
+        co->tpdo.updated_msk |= (1 << num);
+        return;
+    }
+    pdo_send(co, num);
+    if (co->tpdo.inhibit_time[num])
+    {
+        timer_start_us(co->tpdo.inhibit_timer[num], co->tpdo.inhibit_time[num]);
+        co->tpdo.inhibit_msk |= (1 << num);
+    }
+    pdo_start_timer(co, num);
+}
+
+static uint32_t pdo_get_param(CO* co, uint16_t index, uint8_t subindex, uint32_t def)
+{
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_IDX(index, subindex));
+    return entry ? entry->data : def;
+}
+
+static void pdo_stop(CO* co)
+{
+    unsigned int i;
+    for (i = 0; i < co->tpdo.count; ++i)
+    {
+        timer_stop(co->tpdo.timer[i], CO_TIMER_PDO_MASK | i, HAL_CANOPEN);
+        timer_stop(co->tpdo.inhibit_timer[i], CO_TIMER_PDO_MASK | CO_TIMER_PDO_INHIBIT | i, HAL_CANOPEN);
+    }
+    co->tpdo.updated_msk = 0;
+    co->tpdo.inhibit_msk = 0;
+    co->tpdo.sync_start_msk = 0;
+    co->rpdo.sync_msk = 0;
+}
+
+void pdo_open(CO* co)
+{
+    unsigned int i;
+    for (i = 0; i < CO_MAX_TPDO; ++i)
+    {
+        co->tpdo.timer[i] = timer_create(CO_TIMER_PDO_MASK | i, HAL_CANOPEN);
+        co->tpdo.inhibit_timer[i] = timer_create(CO_TIMER_PDO_MASK | CO_TIMER_PDO_INHIBIT | i, HAL_CANOPEN);
+    }
+}
+
+void pdo_default_cob_id(CO* co)
+{
+    unsigned int i;
+    for (i = 0; i < CO_PDO_PREDEFINED; ++i)
+    {
+        co_default_cob_id(co, CO_OD_IDX(0x1800 + i, 1), 0x180 + (i << 8));
+        co_default_cob_id(co, CO_OD_IDX(0x1400 + i, 1), 0x200 + (i << 8));
+    }
+}
+
+void pdo_init(CO* co)
+{
+    CO_OD_ENTRY* entry;
+    CO_PDO* pdo;
+    unsigned int i;
+    pdo_stop(co);
+    co->tpdo.count = 0;
+    co->rpdo.count = 0;
+    if (co->co_state != Operational)
+        return;
+//search TPDO
+    for (i = 0; i < CO_MAX_TPDO; i++)
+    {
+        pdo = &co->tpdo.pdo[i];
+        entry = co_od_lookup(co, CO_OD_IDX(0x1800 + i, 1));
+        if (entry == NULL)
+            break;
+        pdo->cob_id = entry;
+        if (!pdo_map_resolve(co, pdo, 0x1A00 + i, false))
+            break;
+        pdo->type = pdo_get_param(co, 0x1800 + i, 2, CO_PDO_EVENT_PROFILE);
+        co->tpdo.inhibit_time[i] = pdo_get_param(co, 0x1800 + i, 3, 0);
+        co->tpdo.event_time[i] = pdo_get_param(co, 0x1800 + i, 5, 0);
+        co->tpdo.sync_count[i] = 0;
+        co->tpdo.sync_start[i] = pdo_get_param(co, 0x1800 + i, 6, 0);
+        if (co->tpdo.sync_start[i])
+            co->tpdo.sync_start_msk |= (1 << i);
+    }
+    co->tpdo.count = i;
+//search RPDO
+    for (i = 0; i < CO_MAX_RPDO; i++)
+    {
+        pdo = &co->rpdo.pdo[i];
+        entry = co_od_lookup(co, CO_OD_IDX(0x1400 + i, 1));
+        if (entry == NULL)
+            break;
+        pdo->cob_id = entry;
+        if (!pdo_map_resolve(co, pdo, 0x1600 + i, true))
+            break;
+        pdo->type = pdo_get_param(co, 0x1400 + i, 2, CO_PDO_EVENT_PROFILE);
+    }
+    co->rpdo.count = i;
+    for (i = 0; i < co->tpdo.count; ++i)
+        pdo_start_timer(co, i);
+}
+
+void pdo_bus_error(CO* co)
+{
+    pdo_stop(co);
+}
+
+void pdo_data_changed(CO* co, CO_OD_ENTRY* entry)
+{
+    unsigned int i;
+    for (i = 0; i < co->tpdo.count; i++)
+    {
+        if (!pdo_is_mapped(&co->tpdo.pdo[i], entry))
+            continue;
+        if (co->tpdo.pdo[i].type >= CO_PDO_EVENT_MANUFACTURER)
+            pdo_event_send(co, i);
+        else if (co->tpdo.pdo[i].type == CO_PDO_SYNC_ACYCLIC)
+            co->tpdo.updated_msk |= (1 << i);
+    }
+}
+
+void pdo_timeout(CO* co, uint32_t timer)
+{
+    unsigned int num = timer & 0xFF;
+    if (num >= co->tpdo.count)
+        return;
+    if (timer & CO_TIMER_PDO_INHIBIT)
+    {
+        co->tpdo.inhibit_msk &= ~(1 << num);
+        if (co->tpdo.updated_msk & (1 << num))
+            pdo_event_send(co, num);
+    }
+    else
+        pdo_event_send(co, num);
+}
+
+void pdo_sync(CO* co, uint8_t counter)
+{
+    unsigned int i;
+    CO_PDO* pdo;
+    //RPDO received before SYNC are applied first
+    for (i = 0; i < co->rpdo.count; ++i)
+    {
+        if ((co->rpdo.sync_msk & (1 << i)) == 0)
+            continue;
+        pdo_unpack(co, &co->rpdo.pdo[i], co->rpdo.lo[i], co->rpdo.hi[i]);
+    }
+    co->rpdo.sync_msk = 0;
+
+    for (i = 0; i < co->tpdo.count; ++i)
+    {
+        pdo = &co->tpdo.pdo[i];
+        if (pdo->type == CO_PDO_SYNC_ACYCLIC)
+        {
+            if (co->tpdo.updated_msk & (1 << i))
+                pdo_send(co, i);
+        }
+        else if (pdo->type <= CO_PDO_SYNC_MAX)
+        {
+            //first transmission on SYNC with counter equal to start value
+            if ((co->tpdo.sync_start_msk & (1 << i)) && counter)
+            {
+                if (counter != co->tpdo.sync_start[i])
+                    continue;
+                co->tpdo.sync_start_msk &= ~(1 << i);
+                co->tpdo.sync_count[i] = pdo->type - 1;
+            }
+            if (++co->tpdo.sync_count[i] >= pdo->type)
+            {
+                co->tpdo.sync_count[i] = 0;
+                pdo_send(co, i);
+            }
+        }
+    }
+}
+
+bool pdo_is_rec_rpdo(CO* co)
+{
+    unsigned int i;
+    CO_PDO* pdo;
+    for (i = 0; i < co->rpdo.count; i++)
+    {
+        pdo = &co->rpdo.pdo[i];
+        if ((pdo->cob_id->data & CO_PDO_COB_ID_INVALID) || (co->rec_msg.id != (pdo->cob_id->data & CO_PDO_COB_ID_MSK)))
+            continue;
+        //short PDO is ignored
+        if (co->rec_msg.data_len < pdo->len)
+            return true;
+        if (pdo->type <= CO_PDO_SYNC_MAX)
+        {
+            if (co->sync.outside_window)
+                return true;
+            co->rpdo.lo[i] = co->rec_msg.data.lo;
+            co->rpdo.hi[i] = co->rec_msg.data.hi;
+            co->rpdo.sync_msk |= (1 << i);
+        }
+        else
+            pdo_unpack(co, pdo, co->rec_msg.data.lo, co->rec_msg.data.hi);
+        return true;
+    }
+    return false;
+}
+
+void pdo_tpdo_req(CO* co, uint32_t id)
+{
+    unsigned int i;
+    CO_PDO* pdo;
+    for (i = 0; i < co->tpdo.count; i++)
+    {
+        pdo = &co->tpdo.pdo[i];
+        if (((pdo->cob_id->data & CO_PDO_COB_ID_MSK) == id) && ((pdo->cob_id->data & CO_PDO_COB_ID_NO_RTR) == 0))
+        {
+            pdo_send(co, i);
+            return;
+        }
+    }
+}
+
+uint32_t pdo_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data)
+{
+    uint32_t res;
+    CO_OD_ENTRY* map;
+    uint8_t bits;
+    uint16_t index = CO_OD_INDEX(entry->idx);
+    uint8_t subindex = CO_OD_SUBINDEX(entry->idx);
+    switch (index & 0xFE00)
+    {
+    case 0x1800:
+        switch (subindex)
+        {
+        case 3:  // inhibit time in us
+            if ((data < CO_MIN_INHIBIT_TIME) && (data != 0))
+                data = CO_MIN_INHIBIT_TIME;
+            break;
+        case 5:  // event timer in ms
+            if ((data < CO_MIN_EVENT_TIME) && (data != 0))
+                data = CO_MIN_EVENT_TIME;
+            break;
+        }
+        break;
+    case 0x1600:
+    case 0x1A00:
+        if (subindex == 0)
+            res = pdo_map_check(co, index, data);
+        else if (data)
+            res = pdo_map_entry(co, data, (index & 0xFE00) == 0x1600, &map, &bits);
+        else
+            res = SDO_ERROR_OK;
+        if (res != SDO_ERROR_OK)
+            return res;
+        break;
+    }
+    entry->data = data;
+    pdo_init(co);
+    return SDO_ERROR_OK;
+}
@@ -0,0 +1,72 @@
+#ifndef CO_PDO_H
+#define CO_PDO_H
+
+#include "canopens.h"
+
+#define CO_PDO_MAP_MAX                8
+
+//transmission types
+#define CO_PDO_SYNC_ACYCLIC           0
+#define CO_PDO_SYNC_MAX               240
+#define CO_PDO_EVENT_MANUFACTURER     254
+#define CO_PDO_EVENT_PROFILE          255
+
+#define CO_PDO_COB_ID_INVALID         (1UL << 31)
+#define CO_PDO_COB_ID_NO_RTR          (1UL << 30)
+#define CO_PDO_COB_ID_MSK             0x1FFFFFFF
+//first PDOs of predefined connection set
+#define CO_PDO_PREDEFINED             4
+
+//timer param: mask | [inhibit] | PDO number
+#define CO_TIMER_PDO_MASK             (1UL << 31)
+#define CO_TIMER_PDO_INHIBIT          (1 << 8)
+
+typedef struct {
+    CO_OD_ENTRY* cob_id;
+    CO_OD_ENTRY* map[CO_PDO_MAP_MAX];
+    uint8_t bits[CO_PDO_MAP_MAX];
+    uint8_t map_count;
+    uint8_t len;    // in bytes
+    uint8_t type;
+} CO_PDO;
+
+typedef struct {
+    CO_PDO pdo[CO_MAX_TPDO];
+    HANDLE timer[CO_MAX_TPDO];
+    HANDLE inhibit_timer[CO_MAX_TPDO];
+    uint32_t inhibit_time[CO_MAX_TPDO];  // in us
+    uint32_t event_time[CO_MAX_TPDO];    // in ms
+    uint8_t sync_count[CO_MAX_TPDO];
+    //SYNC start value, PDO waiting for it in mask
+    uint8_t sync_start[CO_MAX_TPDO];
+    uint32_t sync_start_msk;
+    uint32_t count;
+    //event PDO changed during inhibit time or acyclic PDO waiting for SYNC
+    uint32_t updated_msk;
+    uint32_t inhibit_msk;
+} CO_TPDO;
+
+typedef struct {
+    CO_PDO pdo[CO_MAX_RPDO];
+    uint32_t count;
+    //synchronous RPDO data, applied on next SYNC
+    uint32_t sync_msk;
+    uint32_t lo[CO_MAX_RPDO];
+    uint32_t hi[CO_MAX_RPDO];
+} CO_RPDO;
+
+void pdo_open(CO* co);
+//node-id to predefined COB-IDs, not on each init: SDO written COB-ID is kept
+void pdo_default_cob_id(CO* co);
+void pdo_init(CO* co);
+void pdo_bus_error(CO* co);
+void pdo_data_changed(CO* co, CO_OD_ENTRY* entry);
+void pdo_timeout(CO* co, uint32_t timer);
+//counter - SYNC counter, 0 if not used
+void pdo_sync(CO* co, uint8_t counter);
+bool pdo_is_rec_rpdo(CO* co);
+void pdo_tpdo_req(CO* co, uint32_t id);
+//SDO write to PDO communication or mapping parameters
+uint32_t pdo_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data);
+
+#endif //CO_PDO_H
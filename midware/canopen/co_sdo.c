@@ -0,0 +1,784 @@
+#include "canopens_private.h"
+#include "co_sdo.h"
+#include "can.h"
+#include "systime.h"
+#include <string.h>
+
+#define SDO_FRAME(co)                 ((uint8_t*)&(co)->out_msg.data)
+
+//CRC-16-CCITT, polynom 0x1021, initial value 0
+static uint16_t sdo_crc16(const uint8_t* data, unsigned int size)
+{
+    unsigned int i, j;
+    uint16_t crc = 0;
+    for (i = 0; i < size; ++i)
+    {
+        crc ^= (uint16_t)data[i] << 8;
+        for (j = 0; j < 8; ++j)
+            crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+static uint8_t* sdo_frame(CO* co, CO_SDO* sdo, uint8_t cmd, bool mux)
+{
+    uint8_t* f = SDO_FRAME(co);
+    co->out_msg.id = sdo->cob_id;
+    co->out_msg.data_len = 8;
+    co->out_msg.rtr = 0;
+    co->out_msg.data.lo = 0;
+    co->out_msg.data.hi = 0;
+    f[0] = cmd;
+    if (!mux)
+        return f + 1;
+    f[1] = CO_OD_INDEX(sdo->idx) & 0xFF;
+    f[2] = CO_OD_INDEX(sdo->idx) >> 8;
+    f[3] = CO_OD_SUBINDEX(sdo->idx);
+    return f + 4;
+}
+
+static inline CAN_ERROR sdo_send(CO* co)
+{
+    return can_write(&co->out_msg, &co->can_state);
+}
+
+static void sdo_send_u32(CO* co, CO_SDO* sdo, uint8_t cmd, uint32_t data)
+{
+    memcpy(sdo_frame(co, sdo, cmd, true), &data, sizeof(uint32_t));
+    sdo_send(co);
+}
+
+static void sdo_timer_start(CO_SDO* sdo)
+{
+    timer_stop(sdo->timer, sdo->timer_param, HAL_CANOPEN);
+    timer_start_ms(sdo->timer, CO_SDO_TIMEOUT_MS);
+}
+
+static void sdo_reset(CO_SDO* sdo)
+{
+    sdo->pos = sdo->block_pos = 0;
+    sdo->toggle = sdo->seqno = 0;
+    sdo->crc = sdo->size_indicated = sdo->busy = sdo->last = false;
+}
+
+//res - transferred size or error, client only
+static void sdo_finish(CO* co, CO_SDO* sdo, int res)
+{
+    timer_stop(sdo->timer, sdo->timer_param, HAL_CANOPEN);
+    sdo->state = SDO_STATE_IDLE;
+    sdo->busy = false;
+#if (CO_LSS_MASTER)
+    if (sdo->io != NULL)
+    {
+        io_complete_ex(sdo->process, HAL_IO_CMD(HAL_CANOPEN, sdo->cmd), sdo->param1, sdo->io, res);
+        sdo->io = NULL;
+    }
+#endif // CO_LSS_MASTER
+}
+
+static void sdo_abort(CO* co, CO_SDO* sdo, uint32_t code)
+{
+    int res;
+    sdo_send_u32(co, sdo, SDO_CMD_ABORT, code);
+    switch (code)
+    {
+    case SDO_ERROR_TIMEOUT:
+        res = ERROR_TIMEOUT;
+        break;
+    case SDO_ERROR_CRC:
+        res = ERROR_CRC;
+        break;
+    case SDO_ERROR_DATA_LEN_HIGH:
+        res = ERROR_IO_BUFFER_TOO_SMALL;
+        break;
+    default:
+        res = ERROR_INVALID_FRAME;
+    }
+    sdo_finish(co, sdo, res);
+}
+
+//------------------------- segmented --------------------------------
+static void sdo_segment_send(CO* co, CO_SDO* sdo)
+{
+    unsigned int size = sdo->size - sdo->pos;
+    uint8_t cmd;
+    if (size > SDO_SEGMENT_SIZE)
+        size = SDO_SEGMENT_SIZE;
+    //same for upload segment response
+    cmd = SDO_CMD(DOWNLOAD_SEGMENT_REQUEST) | (sdo->toggle ? SDO_T : 0) | ((SDO_SEGMENT_SIZE - size) << 1);
+    if (sdo->pos + size >= sdo->size)
+        cmd |= SDO_C;
+    memcpy(sdo_frame(co, sdo, cmd, false), sdo->data + sdo->pos, size);
+    sdo->pos += size;
+    sdo_send(co);
+    sdo_timer_start(sdo);
+}
+
+static uint32_t sdo_segment_receive(CO_SDO* sdo, const uint8_t* f)
+{
+    unsigned int size;
+    if (((f[0] & SDO_T) ? 1 : 0) != sdo->toggle)
+        return SDO_ERROR_TOGGLE;
+    size = SDO_SEGMENT_SIZE - SDO_SEG_N(f[0]);
+    if (sdo->pos + size > sdo->max)
+        return SDO_ERROR_DATA_LEN_HIGH;
+    memcpy(sdo->data + sdo->pos, f + 1, size);
+    sdo->pos += size;
+    sdo->last = (f[0] & SDO_C) != 0;
+    if (sdo->size_indicated && (sdo->pos > sdo->size))
+        return SDO_ERROR_DATA_LEN_HIGH;
+    if (sdo->size_indicated && sdo->last && (sdo->pos < sdo->size))
+        return SDO_ERROR_DATA_LEN_LOW;
+    return SDO_ERROR_OK;
+}
+
+//------------------------- block --------------------------------
+static void sdo_block_send(CO* co, CO_SDO* sdo)
+{
+    unsigned int pos, size;
+    uint8_t cmd;
+    sdo->busy = false;
+    while (sdo->seqno < sdo->blksize)
+    {
+        pos = sdo->block_pos + sdo->seqno * SDO_SEGMENT_SIZE;
+        size = sdo->size - pos;
+        if (size > SDO_SEGMENT_SIZE)
+            size = SDO_SEGMENT_SIZE;
+        cmd = sdo->seqno + 1;
+        if (pos + size >= sdo->size)
+            cmd |= SDO_BLOCK_LAST;
+        memcpy(sdo_frame(co, sdo, cmd, false), sdo->data + pos, size);
+        //tx queue is full, continue on tx complete
+        if (sdo_send(co) == BUSY)
+        {
+            sdo->busy = true;
+            break;
+        }
+        ++sdo->seqno;
+        if (cmd & SDO_BLOCK_LAST)
+            break;
+    }
+    sdo_timer_start(sdo);
+}
+
+static uint32_t sdo_block_ack(CO* co, CO_SDO* sdo, const uint8_t* f)
+{
+    unsigned int n;
+    uint16_t crc;
+    uint8_t* d;
+    if (f[1] > sdo->seqno)
+        return SDO_ERROR_SEQUENCE;
+    if ((f[2] == 0) || (f[2] > SDO_BLOCK_SEQNO_MSK))
+        return SDO_ERROR_BLOCK_SIZE;
+    sdo->block_pos += f[1] * SDO_SEGMENT_SIZE;
+    sdo->blksize = f[2];
+    sdo->seqno = 0;
+    if (sdo->block_pos < sdo->size)
+    {
+        sdo_block_send(co, sdo);
+        return SDO_ERROR_OK;
+    }
+    n = (SDO_SEGMENT_SIZE - sdo->size % SDO_SEGMENT_SIZE) % SDO_SEGMENT_SIZE;
+    crc = sdo->crc ? sdo_crc16(sdo->data, sdo->size) : 0;
+    //same for block upload end
+    d = sdo_frame(co, sdo, SDO_CMD(BLOCK_DOWNLOAD_REQUEST) | (n << 2) | SDO_BCS_END_DOWNLOAD_REQUEST, false);
+    d[0] = crc & 0xFF;
+    d[1] = crc >> 8;
+    sdo_send(co);
+    sdo->state = SDO_STATE_BLOCK_SEND_END;
+    sdo_timer_start(sdo);
+    return SDO_ERROR_OK;
+}
+
+static uint32_t sdo_block_receive(CO* co, CO_SDO* sdo, const uint8_t* f)
+{
+    unsigned int pos, size;
+    uint8_t seqno = f[0] & SDO_BLOCK_SEQNO_MSK;
+    uint8_t* d;
+    if (seqno == sdo->seqno + 1)
+    {
+        pos = sdo->block_pos + sdo->seqno * SDO_SEGMENT_SIZE;
+        if (pos >= sdo->max)
+            return SDO_ERROR_DATA_LEN_HIGH;
+        //rest of last segment can be padding, checked at the end
+        size = sdo->max - pos;
+        if (size > SDO_SEGMENT_SIZE)
+            size = SDO_SEGMENT_SIZE;
+        memcpy(sdo->data + pos, f + 1, size);
+        ++sdo->seqno;
+        if (f[0] & SDO_BLOCK_LAST)
+            sdo->last = true;
+    }
+    //end of sub-block. On lost segment sender will repeat after acknowledged one
+    if ((f[0] & SDO_BLOCK_LAST) || (seqno >= sdo->blksize))
+    {
+        //same for block upload response
+        d = sdo_frame(co, sdo, SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BSS_DOWNLOAD_RESPONSE, false);
+        d[0] = sdo->seqno;
+        d[1] = sdo->blksize;
+        sdo_send(co);
+        sdo->block_pos += sdo->seqno * SDO_SEGMENT_SIZE;
+        sdo->seqno = 0;
+        if (sdo->last)
+            sdo->state = SDO_STATE_BLOCK_RECEIVE_END;
+    }
+    sdo_timer_start(sdo);
+    return SDO_ERROR_OK;
+}
+
+static uint32_t sdo_block_end(CO_SDO* sdo, const uint8_t* f)
+{
+    unsigned int n = SDO_BLOCK_END_N(f[0]);
+    if ((f[0] & SDO_BLOCK_SUB_MSK) != SDO_BCS_END_DOWNLOAD_REQUEST)
+        return SDO_ERROR_COMMAND;
+    if (n > sdo->block_pos)
+        return SDO_ERROR_DATA_LEN_LOW;
+    sdo->pos = sdo->block_pos - n;
+    if ((sdo->pos > sdo->max) || (sdo->size_indicated && (sdo->pos > sdo->size)))
+        return SDO_ERROR_DATA_LEN_HIGH;
+    if (sdo->size_indicated && (sdo->pos < sdo->size))
+        return SDO_ERROR_DATA_LEN_LOW;
+    if (sdo->crc && ((f[1] | (f[2] << 8)) != sdo_crc16(sdo->data, sdo->pos)))
+        return SDO_ERROR_CRC;
+    return SDO_ERROR_OK;
+}
+
+//------------------------- server --------------------------------
+static CO_DOMAIN* sdo_domain_find(CO* co, CO_OD_ENTRY* entry)
+{
+    unsigned int i;
+    for (i = 0; i < co->domains_count; ++i)
+        if (co->domains[i].entry == entry)
+            return &co->domains[i];
+    return NULL;
+}
+
+static uint32_t sdo_server_object(CO* co, CO_SDO* sdo, bool download)
+{
+    CO_DOMAIN* domain;
+    sdo->entry = co_od_lookup(co, sdo->idx);
+    if (sdo->entry == NULL)
+        return SDO_ERROR_NOT_EXIST;
+    if (download && !CO_OD_IS_RW(sdo->entry))
+        return SDO_ERROR_READONLY;
+    sdo_reset(sdo);
+    domain = sdo_domain_find(co, sdo->entry);
+    if (domain != NULL)
+    {
+        sdo->data = domain->data;
+        sdo->max = sdo->entry->data;
+        sdo->size = domain->size;
+        return SDO_ERROR_OK;
+    }
+    sdo->value = download ? 0 : sdo->entry->data;
+    sdo->data = (uint8_t*)&sdo->value;
+    sdo->max = sdo->entry->len & 0xFF;
+    if (sdo->max > sizeof(uint32_t))
+        sdo->max = sizeof(uint32_t);
+    sdo->size = sdo->max;
+    return SDO_ERROR_OK;
+}
+
+static uint32_t sdo_server_download(CO* co, CO_SDO* sdo)
+{
+    CO_DOMAIN* domain = sdo_domain_find(co, sdo->entry);
+    if (domain == NULL)
+        return co_od_download(co, sdo->entry, sdo->value);
+    domain->size = sdo->pos;
+    ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_OD_CHANGE), sdo->entry->idx, domain->size, 0);
+    return SDO_ERROR_OK;
+}
+
+static uint32_t sdo_server_initiate(CO* co, CO_SDO* sdo, const uint8_t* f)
+{
+    uint32_t res, size;
+    memcpy(&size, f + 4, sizeof(uint32_t));
+    sdo->idx = CO_OD_IDX(f[1] | (f[2] << 8), f[3]);
+    switch (SDO_CS(f[0]))
+    {
+    case INITIATE_DOWNLOAD_REQUEST:
+        if ((res = sdo_server_object(co, sdo, true)) != SDO_ERROR_OK)
+            return res;
+        if (f[0] & SDO_E)
+        {
+            if (sdo->data == (uint8_t*)&sdo->value)
+                res = co_od_download(co, sdo->entry, size);
+            else
+            {
+                sdo->pos = (f[0] & SDO_S) ? 4 - SDO_N(f[0]) : 4;
+                if (sdo->pos > sdo->max)
+                    return SDO_ERROR_DATA_LEN_HIGH;
+                memcpy(sdo->data, f + 4, sdo->pos);
+                res = sdo_server_download(co, sdo);
+            }
+            if (res == SDO_ERROR_OK)
+                sdo_send_u32(co, sdo, SDO_CMD(INITIATE_DOWNLOAD_RESPONSE), 0);
+            return res;
+        }
+        sdo->size_indicated = (f[0] & SDO_S) != 0;
+        sdo->size = size;
+        if (sdo->size_indicated && (size > sdo->max))
+            return SDO_ERROR_DATA_LEN_HIGH;
+        sdo->state = SDO_STATE_SEGMENT_RECEIVE;
+        sdo_send_u32(co, sdo, SDO_CMD(INITIATE_DOWNLOAD_RESPONSE), 0);
+        break;
+    case INITIATE_UPLOAD_REQUEST:
+        if ((res = sdo_server_object(co, sdo, false)) != SDO_ERROR_OK)
+            return res;
+        if (sdo->data == (uint8_t*)&sdo->value)
+        {
+            sdo_send_u32(co, sdo, SDO_CMD_UPLOAD_RESP | 0x03 | ((4 - (sdo->entry->len & 0x0F)) << 2), sdo->entry->data);
+            return SDO_ERROR_OK;
+        }
+        sdo->state = SDO_STATE_SEGMENT_SEND;
+        sdo_send_u32(co, sdo, SDO_CMD(INITIATE_UPLOAD_RESPONSE) | SDO_S, sdo->size);
+        break;
+    case BLOCK_DOWNLOAD_REQUEST:
+        if ((f[0] & SDO_C) != SDO_BCS_INITIATE_DOWNLOAD_REQUEST)
+            return SDO_ERROR_COMMAND;
+        if ((res = sdo_server_object(co, sdo, true)) != SDO_ERROR_OK)
+            return res;
+        sdo->crc = (f[0] & SDO_BLOCK_CRC) != 0;
+        sdo->size_indicated = (f[0] & SDO_BLOCK_S) != 0;
+        sdo->size = size;
+        if (sdo->size_indicated && (size > sdo->max))
+            return SDO_ERROR_DATA_LEN_HIGH;
+        sdo->blksize = CO_SDO_BLOCK_SIZE;
+        sdo->state = SDO_STATE_BLOCK_RECEIVE;
+        sdo_frame(co, sdo, SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BLOCK_CRC | SDO_BSS_INITIATE_DOWNLOAD_RESPONSE, true)[0] = sdo->blksize;
+        sdo_send(co);
+        break;
+    case BLOCK_UPLOAD_REQUEST:
+        if ((f[0] & SDO_BLOCK_SUB_MSK) != SDO_BCS_INITIATE_UPLOAD_REQUEST)
+            return SDO_ERROR_COMMAND;
+        if ((res = sdo_server_object(co, sdo, false)) != SDO_ERROR_OK)
+            return res;
+        if ((f[4] == 0) || (f[4] > SDO_BLOCK_SEQNO_MSK))
+            return SDO_ERROR_BLOCK_SIZE;
+        if (sdo->size == 0)
+            return SDO_ERROR_NO_DATA;
+        sdo->crc = (f[0] & SDO_BLOCK_CRC) != 0;
+        sdo->blksize = f[4];
+        sdo->state = SDO_STATE_BLOCK_START;
+        sdo_send_u32(co, sdo, SDO_CMD(BLOCK_UPLOAD_RESPONSE) | SDO_BLOCK_CRC | SDO_BLOCK_S | SDO_BSS_INITIATE_UPLOAD_RESPONSE, sdo->size);
+        break;
+    default:
+        return SDO_ERROR_COMMAND;
+    }
+    sdo_timer_start(sdo);
+    return SDO_ERROR_OK;
+}
+
+void sdo_server_request(CO* co)
+{
+    CO_SDO* sdo = &co->sdo_server;
+    const uint8_t* f = (const uint8_t*)&co->rec_msg.data;
+    uint32_t res = SDO_ERROR_OK;
+    sdo->cob_id = SDOtx + co->id;
+    //block segments have no command specifier. Sequence number 0 is abort
+    if ((sdo->state == SDO_STATE_BLOCK_RECEIVE) && (f[0] != SDO_CMD_ABORT))
+    {
+        if ((res = sdo_block_receive(co, sdo, f)) != SDO_ERROR_OK)
+            sdo_abort(co, sdo, res);
+        return;
+    }
+    if (SDO_CS(f[0]) == ABORT_TRANSFER_REQUEST)
+    {
+        sdo_finish(co, sdo, ERROR_NAK);
+        return;
+    }
+    switch (sdo->state)
+    {
+    case SDO_STATE_IDLE:
+        res = sdo_server_initiate(co, sdo, f);
+        break;
+    case SDO_STATE_SEGMENT_RECEIVE:
+        if (SDO_CS(f[0]) != DOWNLOAD_SEGMENT_REQUEST)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if ((res = sdo_segment_receive(sdo, f)) != SDO_ERROR_OK)
+            break;
+        if (sdo->last && ((res = sdo_server_download(co, sdo)) != SDO_ERROR_OK))
+            break;
+        sdo_frame(co, sdo, SDO_CMD(DOWNLOAD_SEGMENT_RESPONSE) | (sdo->toggle ? SDO_T : 0), false);
+        sdo_send(co);
+        sdo->toggle ^= 1;
+        if (sdo->last)
+            sdo_finish(co, sdo, 0);
+        else
+            sdo_timer_start(sdo);
+        break;
+    case SDO_STATE_SEGMENT_SEND:
+        if (SDO_CS(f[0]) != UPLOAD_SEGMENT_REQUEST)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if (((f[0] & SDO_T) ? 1 : 0) != sdo->toggle)
+        {
+            res = SDO_ERROR_TOGGLE;
+            break;
+        }
+        sdo_segment_send(co, sdo);
+        sdo->toggle ^= 1;
+        if (sdo->pos >= sdo->size)
+            sdo_finish(co, sdo, 0);
+        break;
+    case SDO_STATE_BLOCK_START:
+        if (f[0] != (SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BCS_START_UPLOAD))
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        sdo->state = SDO_STATE_BLOCK_SEND;
+        sdo_block_send(co, sdo);
+        break;
+    case SDO_STATE_BLOCK_SEND:
+        if (f[0] != (SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BCS_UPLOAD_RESPONSE))
+            res = SDO_ERROR_COMMAND;
+        else
+            res = sdo_block_ack(co, sdo, f);
+        break;
+    case SDO_STATE_BLOCK_SEND_END:
+        if (f[0] != (SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BCS_END_UPLOAD_REQUEST))
+            res = SDO_ERROR_COMMAND;
+        else
+            sdo_finish(co, sdo, 0);
+        break;
+    case SDO_STATE_BLOCK_RECEIVE_END:
+        if (SDO_CS(f[0]) != BLOCK_DOWNLOAD_REQUEST)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if ((res = sdo_block_end(sdo, f)) != SDO_ERROR_OK)
+            break;
+        if ((res = sdo_server_download(co, sdo)) != SDO_ERROR_OK)
+            break;
+        sdo_frame(co, sdo, SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BSS_END_DOWNLOAD_RESPONSE, false);
+        sdo_send(co);
+        sdo_finish(co, sdo, 0);
+        break;
+    default:
+        res = SDO_ERROR_COMMAND;
+    }
+    if (res != SDO_ERROR_OK)
+        sdo_abort(co, sdo, res);
+}
+
+//------------------------- client --------------------------------
+#if (CO_LSS_MASTER)
+static void sdo_client_complete(CO* co, CO_SDO* sdo)
+{
+    sdo->io->data_size = sdo->pos;
+    sdo_finish(co, sdo, sdo->pos);
+}
+
+static void sdo_client_segment_request(CO* co, CO_SDO* sdo)
+{
+    sdo_frame(co, sdo, SDO_CMD(UPLOAD_SEGMENT_REQUEST) | (sdo->toggle ? SDO_T : 0), false);
+    sdo_send(co);
+    sdo_timer_start(sdo);
+}
+
+static uint32_t sdo_client_initiate(CO* co, CO_SDO* sdo, const uint8_t* f)
+{
+    uint32_t size;
+    if (((f[1] | (f[2] << 8)) != CO_OD_INDEX(sdo->idx)) || (f[3] != CO_OD_SUBINDEX(sdo->idx)))
+        return SDO_ERROR_COMMAND;
+    memcpy(&size, f + 4, sizeof(uint32_t));
+    switch (sdo->cmd)
+    {
+    case IPC_CO_SDO_DOWNLOAD:
+        if (SDO_CS(f[0]) != INITIATE_DOWNLOAD_RESPONSE)
+            return SDO_ERROR_COMMAND;
+        sdo->state = SDO_STATE_SEGMENT_SEND;
+        sdo_segment_send(co, sdo);
+        break;
+    case IPC_CO_SDO_UPLOAD:
+        if (SDO_CS(f[0]) != INITIATE_UPLOAD_RESPONSE)
+            return SDO_ERROR_COMMAND;
+        if (f[0] & SDO_E)
+        {
+            sdo->pos = (f[0] & SDO_S) ? 4 - SDO_N(f[0]) : 4;
+            if (sdo->pos > sdo->max)
+                return SDO_ERROR_DATA_LEN_HIGH;
+            memcpy(sdo->data, f + 4, sdo->pos);
+            sdo_client_complete(co, sdo);
+            break;
+        }
+        sdo->size_indicated = (f[0] & SDO_S) != 0;
+        sdo->size = size;
+        if (sdo->size_indicated && (size > sdo->max))
+            return SDO_ERROR_DATA_LEN_HIGH;
+        sdo->state = SDO_STATE_SEGMENT_RECEIVE;
+        sdo_client_segment_request(co, sdo);
+        break;
+    case IPC_CO_SDO_BLOCK_DOWNLOAD:
+        if ((f[0] & ~SDO_BLOCK_CRC) != (SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BSS_INITIATE_DOWNLOAD_RESPONSE))
+            return SDO_ERROR_COMMAND;
+        if ((f[4] == 0) || (f[4] > SDO_BLOCK_SEQNO_MSK))
+            return SDO_ERROR_BLOCK_SIZE;
+        sdo->crc = (f[0] & SDO_BLOCK_CRC) != 0;
+        sdo->blksize = f[4];
+        sdo->state = SDO_STATE_BLOCK_SEND;
+        sdo_block_send(co, sdo);
+        break;
+    default:
+        if ((f[0] & ~(SDO_BLOCK_CRC | SDO_BLOCK_S)) != (SDO_CMD(BLOCK_UPLOAD_RESPONSE) | SDO_BSS_INITIATE_UPLOAD_RESPONSE))
+            return SDO_ERROR_COMMAND;
+        sdo->crc = (f[0] & SDO_BLOCK_CRC) != 0;
+        sdo->size_indicated = (f[0] & SDO_BLOCK_S) != 0;
+        sdo->size = size;
+        if (sdo->size_indicated && (size > sdo->max))
+            return SDO_ERROR_DATA_LEN_HIGH;
+        sdo->blksize = CO_SDO_BLOCK_SIZE;
+        sdo->state = SDO_STATE_BLOCK_RECEIVE;
+        sdo_frame(co, sdo, SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BCS_START_UPLOAD, false);
+        sdo_send(co);
+        sdo_timer_start(sdo);
+    }
+    return SDO_ERROR_OK;
+}
+
+void sdo_client_request(CO* co, IPC* ipc)
+{
+    CO_SDO* sdo = &co->sdo_client;
+    IO* io = (IO*)ipc->param2;
+    if (sdo->state != SDO_STATE_IDLE)
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
+    sdo_reset(sdo);
+    sdo->cmd = HAL_ITEM(ipc->cmd);
+    sdo->param1 = ipc->param1;
+    sdo->idx = ipc->param1 & 0xFFFFFF;
+    sdo->cob_id = SDOrx + (ipc->param1 >> 24);
+    sdo->data = io_data(io);
+    switch (sdo->cmd)
+    {
+    case IPC_CO_SDO_DOWNLOAD:
+        sdo->size = sdo->max = io->data_size;
+        sdo_send_u32(co, sdo, SDO_CMD(INITIATE_DOWNLOAD_REQUEST) | SDO_S, sdo->size);
+        break;
+    case IPC_CO_SDO_BLOCK_DOWNLOAD:
+        if (io->data_size == 0)
+        {
+            error(ERROR_INVALID_PARAMS);
+            return;
+        }
+        sdo->size = sdo->max = io->data_size;
+        sdo_send_u32(co, sdo, SDO_CMD(BLOCK_DOWNLOAD_REQUEST) | SDO_BLOCK_CRC | SDO_BLOCK_S | SDO_BCS_INITIATE_DOWNLOAD_REQUEST, sdo->size);
+        break;
+    default:
+        io->data_size = 0;
+        sdo->size = 0;
+        sdo->max = ipc->param3;
+        if (sdo->max > io_get_free(io))
+            sdo->max = io_get_free(io);
+        if (sdo->cmd == IPC_CO_SDO_UPLOAD)
+            sdo_send_u32(co, sdo, SDO_CMD(INITIATE_UPLOAD_REQUEST), 0);
+        else
+        {
+            //block size, no protocol switch
+            sdo_send_u32(co, sdo, SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BLOCK_CRC | SDO_BCS_INITIATE_UPLOAD_REQUEST, CO_SDO_BLOCK_SIZE);
+        }
+    }
+    sdo->process = ipc->process;
+    sdo->io = io;
+    sdo->state = SDO_STATE_INITIATE;
+    sdo_timer_start(sdo);
+    error(ERROR_SYNC);
+}
+
+bool sdo_client_response(CO* co)
+{
+    CO_SDO* sdo = &co->sdo_client;
+    const uint8_t* f = (const uint8_t*)&co->rec_msg.data;
+    uint32_t res = SDO_ERROR_OK;
+    if ((sdo->state == SDO_STATE_IDLE) || (co->rec_msg.id != sdo->cob_id - SDOrx + SDOtx))
+        return false;
+    if ((sdo->state == SDO_STATE_BLOCK_RECEIVE) && (f[0] != SDO_CMD_ABORT))
+    {
+        if ((res = sdo_block_receive(co, sdo, f)) != SDO_ERROR_OK)
+            sdo_abort(co, sdo, res);
+        return true;
+    }
+    if (SDO_CS(f[0]) == ABORT_TRANSFER_REQUEST)
+    {
+        sdo_finish(co, sdo, ERROR_NAK);
+        return true;
+    }
+    switch (sdo->state)
+    {
+    case SDO_STATE_INITIATE:
+        res = sdo_client_initiate(co, sdo, f);
+        break;
+    case SDO_STATE_SEGMENT_SEND:
+        if (SDO_CS(f[0]) != DOWNLOAD_SEGMENT_RESPONSE)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if (((f[0] & SDO_T) ? 1 : 0) != sdo->toggle)
+        {
+            res = SDO_ERROR_TOGGLE;
+            break;
+        }
+        sdo->toggle ^= 1;
+        if (sdo->pos >= sdo->size)
+            sdo_finish(co, sdo, sdo->size);
+        else
+            sdo_segment_send(co, sdo);
+        break;
+    case SDO_STATE_SEGMENT_RECEIVE:
+        if (SDO_CS(f[0]) != UPLOAD_SEGMENT_RESPONSE)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if ((res = sdo_segment_receive(sdo, f)) != SDO_ERROR_OK)
+            break;
+        sdo->toggle ^= 1;
+        if (sdo->last)
+            sdo_client_complete(co, sdo);
+        else
+            sdo_client_segment_request(co, sdo);
+        break;
+    case SDO_STATE_BLOCK_SEND:
+        if (f[0] != (SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BSS_DOWNLOAD_RESPONSE))
+            res = SDO_ERROR_COMMAND;
+        else
+            res = sdo_block_ack(co, sdo, f);
+        break;
+    case SDO_STATE_BLOCK_SEND_END:
+        if (f[0] != (SDO_CMD(BLOCK_DOWNLOAD_RESPONSE) | SDO_BSS_END_DOWNLOAD_RESPONSE))
+            res = SDO_ERROR_COMMAND;
+        else
+            sdo_finish(co, sdo, sdo->size);
+        break;
+    case SDO_STATE_BLOCK_RECEIVE_END:
+        if (SDO_CS(f[0]) != BLOCK_UPLOAD_RESPONSE)
+        {
+            res = SDO_ERROR_COMMAND;
+            break;
+        }
+        if ((res = sdo_block_end(sdo, f)) != SDO_ERROR_OK)
+            break;
+        sdo_frame(co, sdo, SDO_CMD(BLOCK_UPLOAD_REQUEST) | SDO_BCS_END_UPLOAD_REQUEST, false);
+        sdo_send(co);
+        sdo_client_complete(co, sdo);
+        break;
+    default:
+        res = SDO_ERROR_COMMAND;
+    }
+    if (res != SDO_ERROR_OK)
+        sdo_abort(co, sdo, res);
+    return true;
+}
+#endif // CO_LSS_MASTER
+
+//------------------------- common --------------------------------
+void sdo_open(CO* co)
+{
+    unsigned int i, count;
+    CO_DOMAIN* domain;
+    co->sdo_server.timer_param = COT_SDO;
+    co->sdo_server.timer = timer_create(COT_SDO, HAL_CANOPEN);
+#if (CO_LSS_MASTER)
+    co->sdo_client.timer_param = COT_SDO_CLIENT;
+    co->sdo_client.timer = timer_create(COT_SDO_CLIENT, HAL_CANOPEN);
+#endif // CO_LSS_MASTER
+    for (i = 0, count = 0; (i < co->od_size / sizeof(CO_OD_ENTRY)) && co->od[i].idx; ++i)
+        if (co->od[i].len & OD_DOMAIN)
+            ++count;
+    if (count == 0)
+        return;
+    co->domains = malloc(count * sizeof(CO_DOMAIN));
+    if (co->domains == NULL)
+        return;
+    for (i = 0; (co->domains_count < count) && co->od[i].idx; ++i)
+    {
+        if ((co->od[i].len & OD_DOMAIN) == 0)
+            continue;
+        domain = &co->domains[co->domains_count];
+        domain->data = malloc(co->od[i].data);
+        if (domain->data == NULL)
+        {
+            --count;
+            continue;
+        }
+        domain->entry = &co->od[i];
+        domain->size = 0;
+        ++co->domains_count;
+    }
+}
+
+void sdo_close(CO* co)
+{
+    unsigned int i;
+    for (i = 0; i < co->domains_count; ++i)
+        free(co->domains[i].data);
+    free(co->domains);
+    co->domains = NULL;
+    co->domains_count = 0;
+}
+
+void sdo_timeout(CO* co, uint32_t timer)
+{
+    CO_SDO* sdo = &co->sdo_server;
+#if (CO_LSS_MASTER)
+    if (timer == COT_SDO_CLIENT)
+        sdo = &co->sdo_client;
+#endif // CO_LSS_MASTER
+    if (sdo->state != SDO_STATE_IDLE)
+        sdo_abort(co, sdo, SDO_ERROR_TIMEOUT);
+}
+
+void sdo_tx_complete(CO* co)
+{
+    if (co->sdo_server.busy)
+        sdo_block_send(co, &co->sdo_server);
+#if (CO_LSS_MASTER)
+    if (co->sdo_client.busy)
+        sdo_block_send(co, &co->sdo_client);
+#endif // CO_LSS_MASTER
+}
+
+void sdo_domain_request(CO* co, IPC* ipc)
+{
+    IO* io = (IO*)ipc->param2;
+    CO_OD_ENTRY* entry = co_od_lookup(co, ipc->param1);
+    CO_DOMAIN* domain = (entry == NULL) ? NULL : sdo_domain_find(co, entry);
+    if (domain == NULL)
+    {
+        error(ERROR_NOT_FOUND);
+        return;
+    }
+    switch (HAL_ITEM(ipc->cmd))
+    {
+    case IPC_CO_DOMAIN_READ:
+        if (domain->size > ipc->param3)
+        {
+            error(ERROR_INVALID_LENGTH);
+            return;
+        }
+        io->data_size = 0;
+        io_data_append(io, domain->data, domain->size);
+        break;
+    default:
+        if (io->data_size > entry->data)
+        {
+            error(ERROR_INVALID_LENGTH);
+            return;
+        }
+        memcpy(domain->data, io_data(io), io->data_size);
+        domain->size = io->data_size;
+        break;
+    }
+    io_complete(ipc->process, HAL_IO_CMD(HAL_CANOPEN, HAL_ITEM(ipc->cmd)), ipc->param1, io);
+    error(ERROR_SYNC);
+}
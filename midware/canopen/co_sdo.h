@@ -0,0 +1,63 @@
+#ifndef CO_SDO_H
+#define CO_SDO_H
+
+#include "canopens.h"
+#include "io.h"
+
+typedef enum {
+    SDO_STATE_IDLE = 0,
+    //client: waiting initiate response
+    SDO_STATE_INITIATE,
+    SDO_STATE_SEGMENT_SEND,
+    SDO_STATE_SEGMENT_RECEIVE,
+    //server: block upload initiated, waiting start
+    SDO_STATE_BLOCK_START,
+    SDO_STATE_BLOCK_SEND,
+    SDO_STATE_BLOCK_SEND_END,
+    SDO_STATE_BLOCK_RECEIVE,
+    SDO_STATE_BLOCK_RECEIVE_END
+} CO_SDO_STATE;
+
+typedef struct {
+    CO_SDO_STATE state;
+    HANDLE timer;
+    uint32_t timer_param;
+    uint32_t idx;
+    //transmit COB-ID
+    uint32_t cob_id;
+    uint8_t* data;
+    uint32_t size, pos, max;
+    //block: sub-block start
+    uint32_t block_pos;
+    uint8_t toggle, seqno, blksize;
+    bool crc, size_indicated, busy, last;
+    //server
+    CO_OD_ENTRY* entry;
+    uint32_t value;
+    //client
+    HANDLE process;
+    IO* io;
+    uint32_t cmd, param1;
+} CO_SDO;
+
+//server copy of domain object. Max size is in entry data
+typedef struct {
+    CO_OD_ENTRY* entry;
+    uint8_t* data;
+    uint32_t size;
+} CO_DOMAIN;
+
+void sdo_open(CO* co);
+void sdo_close(CO* co);
+void sdo_server_request(CO* co);
+void sdo_timeout(CO* co, uint32_t timer);
+//CAN tx queue is free again
+void sdo_tx_complete(CO* co);
+void sdo_domain_request(CO* co, IPC* ipc);
+#if (CO_LSS_MASTER)
+void sdo_client_request(CO* co, IPC* ipc);
+//false if response is not for client transfer
+bool sdo_client_response(CO* co);
+#endif // CO_LSS_MASTER
+
+#endif //CO_SDO_H
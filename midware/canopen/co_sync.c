@@ -0,0 +1,140 @@
+#include "canopens_private.h"
+#include "co_sync.h"
+#include "can.h"
+#include "systime.h"
+
+static uint32_t sync_get_param(CO* co, uint16_t index, uint32_t def)
+{
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_IDX(index, 0));
+    return entry ? entry->data : def;
+}
+
+static void sync_stop(CO* co)
+{
+    timer_stop(co->sync.timer, COT_SYNC, HAL_CANOPEN);
+    timer_stop(co->sync.window_timer, COT_SYNC_WINDOW, HAL_CANOPEN);
+    co->sync.outside_window = false;
+}
+
+//next SYNC is scheduled from previous, not from now, so timer latency is not accumulated
+static void sync_start_timer(CO* co)
+{
+    SYSTIME period, now;
+    us_to_systime(co->sync.period, &period);
+    systime_add(&co->sync.next, &period, &co->sync.next);
+    get_uptime(&now);
+    //late more than period (bus off, blocking) - restart phase from now
+    if (systime_compare(&now, &co->sync.next) <= 0)
+        systime_add(&now, &period, &co->sync.next);
+    systime_sub(&now, &co->sync.next, &now);
+    timer_start(co->sync.timer, &now);
+}
+
+static void sync_process(CO* co, uint8_t counter)
+{
+    co->sync.outside_window = false;
+    if (co->sync.window)
+    {
+        timer_stop(co->sync.window_timer, COT_SYNC_WINDOW, HAL_CANOPEN);
+        timer_start_us(co->sync.window_timer, co->sync.window);
+    }
+    pdo_sync(co, counter);
+}
+
+static void sync_send(CO* co)
+{
+    co->out_msg.id = co->sync.cob_id & CO_SYNC_COB_ID_MSK;
+    co->out_msg.rtr = 0;
+    co->out_msg.data_len = 0;
+    if (co->sync.overflow)
+    {
+        if (++co->sync.counter > co->sync.overflow)
+            co->sync.counter = 1;
+        co->out_msg.data_len = 1;
+        co->out_msg.data.b0 = co->sync.counter;
+    }
+    can_write(&co->out_msg, &co->can_state);
+    //no loopback on CAN, producer is consumer too
+    sync_process(co, co->sync.counter);
+}
+
+void sync_open(CO* co)
+{
+    co->sync.timer = timer_create(COT_SYNC, HAL_CANOPEN);
+    co->sync.window_timer = timer_create(COT_SYNC_WINDOW, HAL_CANOPEN);
+}
+
+void sync_init(CO* co)
+{
+    sync_stop(co);
+    co->sync.cob_id = sync_get_param(co, CO_OD_INDEX_SYNC_COB_ID, SYNC);
+    co->sync.period = sync_get_param(co, CO_OD_INDEX_SYNC_PERIOD, 0);
+    co->sync.window = sync_get_param(co, CO_OD_INDEX_SYNC_WINDOW, 0);
+    co->sync.overflow = sync_get_param(co, CO_OD_INDEX_SYNC_OVERFLOW, 0);
+    co->sync.counter = 0;
+    co->sync.producer = (co->sync.cob_id & CO_SYNC_COB_ID_PRODUCER) != 0;
+    if (co->co_state != Operational)
+        return;
+    if (co->sync.producer && co->sync.period)
+    {
+        get_uptime(&co->sync.next);
+        sync_start_timer(co);
+    }
+}
+
+void sync_bus_error(CO* co)
+{
+    sync_stop(co);
+}
+
+bool sync_is_rec_sync(CO* co)
+{
+    if (co->rec_msg.id != (co->sync.cob_id & CO_SYNC_COB_ID_MSK))
+        return false;
+    //SYNC from another producer is configuration error, ignore
+    if (co->sync.producer)
+        return true;
+    co->sync.counter = 0;
+    if (co->sync.overflow && co->rec_msg.data_len)
+        co->sync.counter = co->rec_msg.data.b0;
+    sync_process(co, co->sync.counter);
+    return true;
+}
+
+void sync_timeout(CO* co, uint32_t timer)
+{
+    switch (timer)
+    {
+    case COT_SYNC:
+        if (!co->sync.producer || (co->sync.period == 0))
+            break;
+        sync_start_timer(co);
+        sync_send(co);
+        break;
+    case COT_SYNC_WINDOW:
+        co->sync.outside_window = true;
+        break;
+    }
+}
+
+uint32_t sync_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data)
+{
+    switch (CO_OD_INDEX(entry->idx))
+    {
+    case CO_OD_INDEX_SYNC_OVERFLOW:
+        //counter overflow can't be changed while communication cycle period is non-zero
+        if (co->sync.period)
+            return SDO_ERROR_DATA_DEV_STATE;
+        if ((data == 1) || (data > CO_SYNC_COUNTER_MAX))
+            return SDO_ERROR_DATA_RANGE;
+        break;
+    case CO_OD_INDEX_SYNC_COB_ID:
+        //COB-ID can't be changed while producer is active, even in the same write that disables it
+        if (co->sync.producer && ((data & CO_SYNC_COB_ID_MSK) != (co->sync.cob_id & CO_SYNC_COB_ID_MSK)))
+            return SDO_ERROR_DATA_DEV_STATE;
+        break;
+    }
+    entry->data = data;
+    sync_init(co);
+    return SDO_ERROR_OK;
+}
@@ -0,0 +1,32 @@
+#ifndef CO_SYNC_H
+#define CO_SYNC_H
+
+#include "canopens.h"
+#include "systime.h"
+
+#define CO_SYNC_COB_ID_PRODUCER       (1UL << 30)
+#define CO_SYNC_COB_ID_MSK            0x7FF
+//max counter overflow value
+#define CO_SYNC_COUNTER_MAX           240
+
+typedef struct {
+    HANDLE timer, window_timer;
+    //producer: next SYNC time in uptime
+    SYSTIME next;
+    uint32_t cob_id;
+    uint32_t period, window;    // in us
+    uint8_t counter, overflow;
+    bool producer;
+    //synchronous RPDO are discarded until next SYNC
+    bool outside_window;
+} CO_SYNC;
+
+void sync_open(CO* co);
+void sync_init(CO* co);
+void sync_bus_error(CO* co);
+bool sync_is_rec_sync(CO* co);
+void sync_timeout(CO* co, uint32_t timer);
+//SDO write to 0x1005, 0x1006, 0x1007, 0x1019
+uint32_t sync_param_change(CO* co, CO_OD_ENTRY* entry, uint32_t data);
+
+#endif //CO_SYNC_H
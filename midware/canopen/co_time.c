@@ -0,0 +1,94 @@
+#include "canopens_private.h"
+#include "co_time.h"
+#include "can.h"
+#include "systime.h"
+
+//ms after midnight, 28 bits
+#define CO_TIME_MS_MSK                0x0FFFFFFF
+
+static uint32_t time_cob_id(CO* co)
+{
+    CO_OD_ENTRY* entry = co_od_lookup(co, CO_OD_IDX(CO_OD_INDEX_TIME_COB_ID, 0));
+    //no 0x1012 entry - TIME is not supported, neither consumed nor produced
+    return entry ? entry->data : TIME_STAMP;
+}
+
+static void time_send(CO* co)
+{
+    TIME time;
+    uint32_t cob_id = time_cob_id(co);
+    if ((co->co_state != Operational) || ((cob_id & CO_TIME_COB_ID_PRODUCER) == 0))
+        return;
+    time_get(co, &time);
+    co->out_msg.id = cob_id & CO_TIME_COB_ID_MSK;
+    co->out_msg.rtr = 0;
+    co->out_msg.data_len = 6;
+    co->out_msg.data.lo = time.ms & CO_TIME_MS_MSK;
+    co->out_msg.data.hi = (time.day - CO_TIME_EPOCH_DATE) & 0xFFFF;
+    can_write(&co->out_msg, &co->can_state);
+}
+
+void time_open(CO* co)
+{
+    co->time.timer = timer_create(COT_TIME, HAL_CANOPEN);
+    co->time.time.day = CO_TIME_EPOCH_DATE;
+    co->time.time.ms = 0;
+    get_uptime(&co->time.uptime);
+}
+
+void time_init(CO* co)
+{
+    timer_stop(co->time.timer, COT_TIME, HAL_CANOPEN);
+#if (CO_TIME_PERIOD_MS)
+    if ((co->co_state == Operational) && (time_cob_id(co) & CO_TIME_COB_ID_PRODUCER))
+        timer_start_ms(co->time.timer, CO_TIME_PERIOD_MS);
+#endif //CO_TIME_PERIOD_MS
+}
+
+void time_bus_error(CO* co)
+{
+    timer_stop(co->time.timer, COT_TIME, HAL_CANOPEN);
+}
+
+bool time_is_rec_time(CO* co)
+{
+    uint32_t cob_id = time_cob_id(co);
+    if (((cob_id & CO_TIME_COB_ID_CONSUMER) == 0) || (co->rec_msg.id != (cob_id & CO_TIME_COB_ID_MSK)))
+        return false;
+    if (co->rec_msg.data_len < 6)
+        return true;
+    get_uptime(&co->time.uptime);
+    co->time.time.ms = co->rec_msg.data.lo & CO_TIME_MS_MSK;
+    co->time.time.day = CO_TIME_EPOCH_DATE + (co->rec_msg.data.hi & 0xFFFF);
+    ipc_post_inline(co->device, HAL_CMD(HAL_CANOPEN, IPC_CO_TIME), co->time.time.day, co->time.time.ms, 0);
+    return true;
+}
+
+void time_timeout(CO* co)
+{
+    time_send(co);
+#if (CO_TIME_PERIOD_MS)
+    timer_start_ms(co->time.timer, CO_TIME_PERIOD_MS);
+#endif //CO_TIME_PERIOD_MS
+}
+
+void time_get(CO* co, TIME* time)
+{
+    SYSTIME elapsed;
+    systime_elapsed(&co->time.uptime, &elapsed);
+    time->day = co->time.time.day + elapsed.sec / SEC_IN_DAY;
+    time->ms = co->time.time.ms + (elapsed.sec % SEC_IN_DAY) * 1000 + elapsed.usec / 1000;
+    if (time->ms >= MSEC_IN_DAY)
+    {
+        time->ms -= MSEC_IN_DAY;
+        ++time->day;
+    }
+}
+
+void time_set(CO* co, TIME* time)
+{
+    co->time.time.day = time->day;
+    co->time.time.ms = time->ms;
+    get_uptime(&co->time.uptime);
+    time_send(co);
+}
@@ -0,0 +1,29 @@
+#ifndef CO_TIME_H
+#define CO_TIME_H
+
+#include "canopens.h"
+#include "systime.h"
+
+#define CO_TIME_COB_ID_CONSUMER       (1UL << 31)
+#define CO_TIME_COB_ID_PRODUCER       (1UL << 30)
+#define CO_TIME_COB_ID_MSK            0x7FF
+//01.01.1984, TIME_OF_DAY epoch
+#define CO_TIME_EPOCH_DATE            724275
+
+typedef struct {
+    HANDLE timer;
+    //network time at uptime, running by systime between TIME messages
+    TIME time;
+    SYSTIME uptime;
+} CO_TIME;
+
+void time_open(CO* co);
+void time_init(CO* co);
+void time_bus_error(CO* co);
+bool time_is_rec_time(CO* co);
+void time_timeout(CO* co);
+void time_get(CO* co, TIME* time);
+//producer also sends TIME
+void time_set(CO* co, TIME* time);
+
+#endif //CO_TIME_H
@@ -85,10 +85,16 @@ void AES_encrypt(const unsigned char *in, unsigned char *out,
                  const AES_KEY *key);
 void AES_decrypt(const unsigned char *in, unsigned char *out,
                  const AES_KEY *key);
+void AES_decrypt2(const unsigned char *in, unsigned char *out,
+                  const AES_KEY *key);
 
 void AES_cbc_encrypt(const unsigned char *in, unsigned char *out,
                      size_t length, const AES_KEY *key,
                      unsigned char *ivec, const int enc);
+/* bulk decrypt, len must be multiple of AES_BLOCK_SIZE. in and out can overlap */
+void AES_cbc_decrypt(const unsigned char *in, unsigned char *out,
+                     size_t length, const AES_KEY *key,
+                     unsigned char *ivec);
 
 
 #ifdef  __cplusplus
@@ -53,6 +53,7 @@
 
 #include "aes.h"
 #include "openssl.h"
+#include <string.h>
 
 void AES_cbc_encrypt(const unsigned char *in, unsigned char *out,
                      size_t len, const AES_KEY *key,
@@ -62,7 +63,43 @@ void AES_cbc_encrypt(const unsigned char *in, unsigned char *out,
     if (enc)
         CRYPTO_cbc128_encrypt(in, out, len, key, ivec,
                               (block128_f) AES_encrypt);
+    else if ((len % AES_BLOCK_SIZE) == 0)
+        AES_cbc_decrypt(in, out, len, key, ivec);
     else
         CRYPTO_cbc128_decrypt(in, out, len, key, ivec,
                               (block128_f) AES_decrypt);
 }
+
+static inline void AES_cbc_xor(unsigned char *out, const unsigned char *a, const unsigned char *b)
+{
+    int n;
+    for (n = 0; n < AES_BLOCK_SIZE; ++n)
+        out[n] = a[n] ^ b[n];
+}
+
+void AES_cbc_decrypt(const unsigned char *in, unsigned char *out,
+                     size_t len, const AES_KEY *key,
+                     unsigned char *ivec)
+{
+    unsigned char tmp[AES_BLOCK_SIZE * 2];
+    unsigned char c[AES_BLOCK_SIZE];
+
+    //2 blocks per iteration
+    for (; len >= AES_BLOCK_SIZE * 2; len -= AES_BLOCK_SIZE * 2, in += AES_BLOCK_SIZE * 2, out += AES_BLOCK_SIZE * 2)
+    {
+        //next iv, before it is overwritten
+        memcpy(c, in + AES_BLOCK_SIZE, AES_BLOCK_SIZE);
+        AES_decrypt2(in, tmp, key);
+        //second block first - in place safe
+        AES_cbc_xor(out + AES_BLOCK_SIZE, tmp + AES_BLOCK_SIZE, in);
+        AES_cbc_xor(out, tmp, ivec);
+        memcpy(ivec, c, AES_BLOCK_SIZE);
+    }
+    if (len >= AES_BLOCK_SIZE)
+    {
+        memcpy(c, in, AES_BLOCK_SIZE);
+        AES_decrypt(in, tmp, key);
+        AES_cbc_xor(out, tmp, ivec);
+        memcpy(ivec, c, AES_BLOCK_SIZE);
+    }
+}
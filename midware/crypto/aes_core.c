@@ -1000,3 +1000,66 @@ void AES_decrypt(const unsigned char *in, unsigned char *out,
     PUTU32(out + 12, s3);
 }
 
+#define AES_DEC_ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk)                                            \
+    t0 = Td0[(s0 >> 24)] ^ Td1[(s3 >> 16) & 0xff] ^ Td2[(s2 >> 8) & 0xff] ^ Td3[(s1) & 0xff] ^ (rk)[0]; \
+    t1 = Td0[(s1 >> 24)] ^ Td1[(s0 >> 16) & 0xff] ^ Td2[(s3 >> 8) & 0xff] ^ Td3[(s2) & 0xff] ^ (rk)[1]; \
+    t2 = Td0[(s2 >> 24)] ^ Td1[(s1 >> 16) & 0xff] ^ Td2[(s0 >> 8) & 0xff] ^ Td3[(s3) & 0xff] ^ (rk)[2]; \
+    t3 = Td0[(s3 >> 24)] ^ Td1[(s2 >> 16) & 0xff] ^ Td2[(s1 >> 8) & 0xff] ^ Td3[(s0) & 0xff] ^ (rk)[3]
+
+#define AES_DEC_LAST(out, a, b, c, d, k)                                                             \
+    PUTU32(out, ((u32)Td4[(a >> 24)] << 24) ^ ((u32)Td4[(b >> 16) & 0xff] << 16) ^                    \
+                ((u32)Td4[(c >> 8) & 0xff] << 8) ^ ((u32)Td4[(d) & 0xff]) ^ (k))
+
+/*
+ * Decrypt two consecutive blocks with interleaved rounds.
+ * Shares round key loads and loop overhead between blocks,
+ * independent table lookups can be pipelined.
+ * in and out can overlap
+ */
+void AES_decrypt2(const unsigned char *in, unsigned char *out,
+                  const AES_KEY *key)
+{
+    const u32 *rk;
+    u32 s0, s1, s2, s3, t0, t1, t2, t3;
+    u32 u0, u1, u2, u3, v0, v1, v2, v3;
+    int r;
+
+    rk = key->rd_key;
+
+    s0 = GETU32(in     ) ^ rk[0];
+    s1 = GETU32(in +  4) ^ rk[1];
+    s2 = GETU32(in +  8) ^ rk[2];
+    s3 = GETU32(in + 12) ^ rk[3];
+    u0 = GETU32(in + 16) ^ rk[0];
+    u1 = GETU32(in + 20) ^ rk[1];
+    u2 = GETU32(in + 24) ^ rk[2];
+    u3 = GETU32(in + 28) ^ rk[3];
+    /*
+     * Nr - 1 full rounds:
+     */
+    r = key->rounds >> 1;
+    for (;;) {
+        AES_DEC_ROUND(t0, t1, t2, t3, s0, s1, s2, s3, rk + 4);
+        AES_DEC_ROUND(v0, v1, v2, v3, u0, u1, u2, u3, rk + 4);
+
+        rk += 8;
+        if (--r == 0) {
+            break;
+        }
+
+        AES_DEC_ROUND(s0, s1, s2, s3, t0, t1, t2, t3, rk);
+        AES_DEC_ROUND(u0, u1, u2, u3, v0, v1, v2, v3, rk);
+    }
+    /*
+     * apply last round and
+     * map cipher state to byte array block:
+     */
+    AES_DEC_LAST(out     , t0, t3, t2, t1, rk[0]);
+    AES_DEC_LAST(out +  4, t1, t0, t3, t2, rk[1]);
+    AES_DEC_LAST(out +  8, t2, t1, t0, t3, rk[2]);
+    AES_DEC_LAST(out + 12, t3, t2, t1, t0, rk[3]);
+    AES_DEC_LAST(out + 16, v0, v3, v2, v1, rk[0]);
+    AES_DEC_LAST(out + 20, v1, v0, v3, v2, rk[1]);
+    AES_DEC_LAST(out + 24, v2, v1, v0, v3, rk[2]);
+    AES_DEC_LAST(out + 28, v3, v2, v1, v0, rk[3]);
+}
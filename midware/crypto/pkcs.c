@@ -8,6 +8,11 @@
 #include <stdint.h>
 #include <string.h>
 
+#define SHA256_DIGEST_INFO_SIZE                         19
+#define SHA256_HASH_SIZE                                32
+static const uint8_t __SHA256_DIGEST_INFO[SHA256_DIGEST_INFO_SIZE] = {0x30, 0x31, 0x30, 0x0d, 0x06, 0x09, 0x60, 0x86, 0x48, 0x01,
+                                                                      0x65, 0x03, 0x04, 0x02, 0x01, 0x05, 0x00, 0x04, 0x20};
+
 int eme_pkcs1_v1_15_decode(const void* em, unsigned int em_size, void* m, unsigned int m_max)
 {
     const uint8_t* emc = em;
@@ -27,6 +32,23 @@ int eme_pkcs1_v1_15_decode(const void* em, unsigned int em_size, void* m, unsign
     return em_size - offset;
 }
 
+bool emsa_pkcs1_v1_15_encode_sha256(const void* hash, void* em, unsigned int em_size)
+{
+    uint8_t* emc = em;
+    unsigned int ps_size;
+    //EM = 0x00 || 0x01 || PS || 0x00 || DigestInfo || H, at least 8 bytes of PS
+    if (em_size < SHA256_DIGEST_INFO_SIZE + SHA256_HASH_SIZE + 11)
+        return false;
+    ps_size = em_size - SHA256_DIGEST_INFO_SIZE - SHA256_HASH_SIZE - 3;
+    emc[0] = 0x00;
+    emc[1] = 0x01;
+    memset(emc + 2, 0xff, ps_size);
+    emc[2 + ps_size] = 0x00;
+    memcpy(emc + 3 + ps_size, __SHA256_DIGEST_INFO, SHA256_DIGEST_INFO_SIZE);
+    memcpy(emc + 3 + ps_size + SHA256_DIGEST_INFO_SIZE, hash, SHA256_HASH_SIZE);
+    return true;
+}
+
 int pkcs7_decode(void* em_m, unsigned int size)
 {
     int i, padding;
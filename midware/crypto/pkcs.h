@@ -7,7 +7,10 @@
 #ifndef PKCS_H
 #define PKCS_H
 
+#include <stdbool.h>
+
 int eme_pkcs1_v1_15_decode(const void *em, unsigned int em_size, void* m, unsigned int m_max);
+bool emsa_pkcs1_v1_15_encode_sha256(const void* hash, void* em, unsigned int em_size);
 int pkcs7_decode(void* em_m, unsigned int size);
 unsigned int pkcs7_encode(void* m, unsigned int size, unsigned int block_size);
 
@@ -0,0 +1,191 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#include "x25519.h"
+#include <string.h>
+
+//GF(2^255 - 19) element: 16 limbs, 16 bit each, signed 64 bit for carry room
+typedef int64_t GF[16];
+
+static const GF __121665 = {0xdb41, 1};
+static const uint8_t __X25519_BASE[X25519_KEY_SIZE] = {9};
+
+static void gf_carry(GF o)
+{
+    int i;
+    int64_t c;
+    for (i = 0; i < 16; ++i)
+    {
+        o[i] += (1LL << 16);
+        c = o[i] >> 16;
+        o[(i + 1) * (i < 15)] += c - 1 + 37 * (c - 1) * (i == 15);
+        o[i] -= c << 16;
+    }
+}
+
+//constant time conditional swap
+static void gf_cswap(GF p, GF q, int b)
+{
+    int i;
+    int64_t t, c = ~(b - 1);
+    for (i = 0; i < 16; ++i)
+    {
+        t = c & (p[i] ^ q[i]);
+        p[i] ^= t;
+        q[i] ^= t;
+    }
+}
+
+static void gf_pack(uint8_t* o, const GF n)
+{
+    int i, j, b;
+    GF m, t;
+    for (i = 0; i < 16; ++i)
+        t[i] = n[i];
+    gf_carry(t);
+    gf_carry(t);
+    gf_carry(t);
+    for (j = 0; j < 2; ++j)
+    {
+        m[0] = t[0] - 0xffed;
+        for(i = 1; i < 15; ++i)
+        {
+            m[i] = t[i] - 0xffff - ((m[i - 1] >> 16) & 1);
+            m[i - 1] &= 0xffff;
+        }
+        m[15] = t[15] - 0x7fff - ((m[14] >> 16) & 1);
+        b = (m[15] >> 16) & 1;
+        m[14] &= 0xffff;
+        gf_cswap(t, m, 1 - b);
+    }
+    for (i = 0; i < 16; ++i)
+    {
+        o[2 * i] = t[i] & 0xff;
+        o[2 * i + 1] = t[i] >> 8;
+    }
+}
+
+static void gf_unpack(GF o, const uint8_t* n)
+{
+    int i;
+    for (i = 0; i < 16; ++i)
+        o[i] = n[2 * i] + ((int64_t)n[2 * i + 1] << 8);
+    o[15] &= 0x7fff;
+}
+
+static void gf_add(GF o, const GF a, const GF b)
+{
+    int i;
+    for (i = 0; i < 16; ++i)
+        o[i] = a[i] + b[i];
+}
+
+static void gf_sub(GF o, const GF a, const GF b)
+{
+    int i;
+    for (i = 0; i < 16; ++i)
+        o[i] = a[i] - b[i];
+}
+
+static void gf_mul(GF o, const GF a, const GF b)
+{
+    int i, j;
+    int64_t t[31];
+    for (i = 0; i < 31; ++i)
+        t[i] = 0;
+    for (i = 0; i < 16; ++i)
+        for (j = 0; j < 16; ++j)
+            t[i + j] += a[i] * b[j];
+    for (i = 0; i < 15; ++i)
+        t[i] += 38 * t[i + 16];
+    for (i = 0; i < 16; ++i)
+        o[i] = t[i];
+    gf_carry(o);
+    gf_carry(o);
+}
+
+static void gf_inv(GF o, const GF i)
+{
+    GF c;
+    int a;
+    for (a = 0; a < 16; ++a)
+        c[a] = i[a];
+    //i^(p - 2)
+    for (a = 253; a >= 0; --a)
+    {
+        gf_mul(c, c, c);
+        if ((a != 2) && (a != 4))
+            gf_mul(c, c, i);
+    }
+    for (a = 0; a < 16; ++a)
+        o[a] = c[a];
+}
+
+void x25519(uint8_t* out, const uint8_t* scalar, const uint8_t* point)
+{
+    uint8_t z[X25519_KEY_SIZE];
+    int64_t r;
+    int i;
+    GF x, a, b, c, d, e, f;
+
+    memcpy(z, scalar, X25519_KEY_SIZE);
+    z[31] = (z[31] & 127) | 64;
+    z[0] &= 248;
+    gf_unpack(x, point);
+    for (i = 0; i < 16; ++i)
+    {
+        b[i] = x[i];
+        d[i] = a[i] = c[i] = 0;
+    }
+    a[0] = d[0] = 1;
+    //Montgomery ladder
+    for (i = 254; i >= 0; --i)
+    {
+        r = (z[i >> 3] >> (i & 7)) & 1;
+        gf_cswap(a, b, r);
+        gf_cswap(c, d, r);
+        gf_add(e, a, c);
+        gf_sub(a, a, c);
+        gf_add(c, b, d);
+        gf_sub(b, b, d);
+        gf_mul(d, e, e);
+        gf_mul(f, a, a);
+        gf_mul(a, c, a);
+        gf_mul(c, b, e);
+        gf_add(e, a, c);
+        gf_sub(a, a, c);
+        gf_mul(b, a, a);
+        gf_sub(c, d, f);
+        gf_mul(a, c, __121665);
+        gf_add(a, a, d);
+        gf_mul(c, c, a);
+        gf_mul(a, d, f);
+        gf_mul(d, b, x);
+        gf_mul(b, e, e);
+        gf_cswap(a, b, r);
+        gf_cswap(c, d, r);
+    }
+    gf_inv(c, c);
+    gf_mul(a, a, c);
+    gf_pack(out, a);
+    //secure erase
+    memset(z, 0x00, X25519_KEY_SIZE);
+}
+
+void x25519_public_key(uint8_t* pub, const uint8_t* priv)
+{
+    x25519(pub, priv, __X25519_BASE);
+}
+
+bool x25519_shared_secret(uint8_t* shared, const uint8_t* priv, const uint8_t* peer)
+{
+    int i;
+    uint8_t acc = 0;
+    x25519(shared, priv, peer);
+    for (i = 0; i < X25519_KEY_SIZE; ++i)
+        acc |= shared[i];
+    return acc != 0;
+}
@@ -0,0 +1,21 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#ifndef X25519_H
+#define X25519_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define X25519_KEY_SIZE                                 32
+
+//RFC 7748. Constant time, scalar is clamped internally
+void x25519(uint8_t* out, const uint8_t* scalar, const uint8_t* point);
+void x25519_public_key(uint8_t* pub, const uint8_t* priv);
+//returns false on all-zero shared secret (small order peer point)
+bool x25519_shared_secret(uint8_t* shared, const uint8_t* priv, const uint8_t* peer);
+
+#endif // X25519_H
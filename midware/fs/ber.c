@@ -9,10 +9,12 @@
 #include "../../userspace/stdio.h"
 #include "../../userspace/stdlib.h"
 #include "../../userspace/error.h"
+#include "../../userspace/systime.h"
 #include "sys_config.h"
 #include <string.h>
 
 #define BER_MAGIC                           0x426b7189
+#define BER_LOG_MAGIC                       0x4c72426b
 #define BER_TRANSACTION_INCREMENT           64
 
 #define BER_BLOCK_UNUSED                    0xffff
@@ -34,8 +36,27 @@ typedef struct {
     uint32_t total_blocks;
     uint32_t crc_count;
 } BER_HEADER_TYPE;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t crc;
+    //superblock revision and sector number in log
+    uint32_t revision;
+    uint16_t seq;
+    uint16_t count;
+    uint32_t crc_count;
+} BER_LOG_HEADER;
+
+//lblock is BER_BLOCK_UNUSED for stat only update
+typedef struct {
+    uint16_t lblock;
+    uint16_t pblock;
+    uint32_t stat;
+} BER_LOG_ENTRY;
 #pragma pack(pop)
 
+#define BER_LOG_ENTRIES_MAX                 ((FAT_SECTOR_SIZE - sizeof(BER_LOG_HEADER)) / sizeof(BER_LOG_ENTRY))
+
 typedef struct {
     uint16_t lblock;
     uint16_t pblock;
@@ -46,6 +67,10 @@ typedef struct {
         BER header
         <blocks remap list>
         <blocks stat list>
+        <remap log sectors till end of block>
+
+        With VFS_BER_REMAP_LOG log sectors are appended on commit, superblock is rewritten to new block only when log is full.
+        Otherwise each commit writes new superblock.
  */
 static void ber_rollback_trans(VFSS_TYPE* vfss);
 static inline void ber_trans_clear_buffer(VFSS_TYPE *vfss)
@@ -54,23 +79,6 @@ static inline void ber_trans_clear_buffer(VFSS_TYPE *vfss)
         array_destroy(&vfss->ber.trans_buffer);
 }
 
-static inline bool ber_trans_is_pblock_lock(VFSS_TYPE *vfss, uint16_t pblock)
-{
-    int i;
-    BER_TRANS_ENTRY* entry;
-    if(vfss->ber.trans_buffer == NULL)
-        return false;
-    for (i = 0; i < array_size(vfss->ber.trans_buffer); i++)
-    {
-        entry = (BER_TRANS_ENTRY*)array_at(vfss->ber.trans_buffer, i);
-        if (entry == NULL)
-            return false;
-        if (entry->pblock == pblock)
-            return true;
-    }
-    return false;
-}
-
 static inline bool ber_trans_add_block(VFSS_TYPE *vfss, uint16_t lblock)
 {
     int i;
@@ -102,6 +110,7 @@ bool ber_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
 {
     unsigned int i, size_sectors, lblock, pblock, pblock_offset, sectors_to_read;
     uint8_t* buf = vfss_get_buf(vfss);
+    vfss->ber.busy = true;
     size_sectors = size / FAT_SECTOR_SIZE;
     for (i = 0; i < size_sectors; i += sectors_to_read)
     {
@@ -116,7 +125,9 @@ bool ber_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
         sectors_to_read = vfss->ber.volume.block_sectors - pblock_offset;
         if (sectors_to_read > size_sectors - i)
             sectors_to_read = size_sectors - i;
-        if (pblock == BER_BLOCK_UNUSED)
+        if (lblock == vfss->ber.wlblock)
+            memcpy(buf + i * FAT_SECTOR_SIZE, (uint8_t*)io_data(vfss->ber.wio) + pblock_offset * FAT_SECTOR_SIZE, sectors_to_read * FAT_SECTOR_SIZE);
+        else if (pblock == BER_BLOCK_UNUSED)
             memset(buf + i * FAT_SECTOR_SIZE, BER_MAGIC_FLASH_UNINITIALIZED, sectors_to_read * FAT_SECTOR_SIZE);
         else
         {
@@ -133,24 +144,103 @@ bool ber_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
     return true;
 }
 
-static uint16_t ber_find_best(VFSS_TYPE* vfss)
+#define BER_HEAP_KEY(vfss, pblock)          BER_STAT_VALUE((vfss)->ber.stat_list[(pblock)])
+
+static void ber_heap_push(VFSS_TYPE* vfss, uint16_t pblock)
 {
-    uint16_t best_pblock, i;
-    uint32_t best_pblock_stat;
-    best_pblock = BER_BLOCK_UNUSED;
-    best_pblock_stat = 0xffffffff;
-    for (i = 0; i < vfss->ber.total_blocks; ++i)
+    unsigned int i, parent;
+    uint16_t* heap = vfss->ber.heap;
+    for (i = vfss->ber.heap_size++; i; i = parent)
     {
-        if(ber_trans_is_pblock_lock(vfss, i))
-            continue;
-        if (vfss->ber.stat_list[i] & BER_STAT_BLOCK_USED)
-            continue;
-        if (BER_STAT_VALUE(vfss->ber.stat_list[i]) < best_pblock_stat)
+        parent = (i - 1) / 2;
+        if (BER_HEAP_KEY(vfss, heap[parent]) <= BER_HEAP_KEY(vfss, pblock))
+            break;
+        heap[i] = heap[parent];
+    }
+    heap[i] = pblock;
+}
+
+static uint16_t ber_heap_remove(VFSS_TYPE* vfss, unsigned int index)
+{
+    unsigned int i, child, parent;
+    uint16_t pblock, last;
+    uint16_t* heap = vfss->ber.heap;
+    pblock = heap[index];
+    last = heap[--vfss->ber.heap_size];
+    if (index == vfss->ber.heap_size)
+        return pblock;
+    for (i = index; i; i = parent)
+    {
+        parent = (i - 1) / 2;
+        if (BER_HEAP_KEY(vfss, heap[parent]) <= BER_HEAP_KEY(vfss, last))
+            break;
+        heap[i] = heap[parent];
+    }
+    //not moved up
+    if (i == index)
+    {
+        for (; (child = i * 2 + 1) < vfss->ber.heap_size; i = child)
         {
-            best_pblock = i;
-            best_pblock_stat = BER_STAT_VALUE(vfss->ber.stat_list[i]);
+            if ((child + 1 < vfss->ber.heap_size) && (BER_HEAP_KEY(vfss, heap[child + 1]) < BER_HEAP_KEY(vfss, heap[child])))
+                ++child;
+            if (BER_HEAP_KEY(vfss, last) <= BER_HEAP_KEY(vfss, heap[child]))
+                break;
+            heap[i] = heap[child];
         }
     }
+    heap[i] = last;
+    return pblock;
+}
+
+static uint16_t ber_heap_pop(VFSS_TYPE* vfss)
+{
+    if (vfss->ber.heap_size == 0)
+        return BER_BLOCK_UNUSED;
+    return ber_heap_remove(vfss, 0);
+}
+
+#if (VFS_BER_GC_MS)
+//most worn free block is one of the leaves, but heap is small enough for full scan on idle
+static unsigned int ber_heap_worn(VFSS_TYPE* vfss)
+{
+    unsigned int i, worn;
+    for (i = 1, worn = 0; i < vfss->ber.heap_size; ++i)
+    {
+        if (BER_HEAP_KEY(vfss, vfss->ber.heap[i]) > BER_HEAP_KEY(vfss, vfss->ber.heap[worn]))
+            worn = i;
+    }
+    return worn;
+}
+
+static uint16_t ber_heap_pop_worn(VFSS_TYPE* vfss)
+{
+    if (vfss->ber.heap_size == 0)
+        return BER_BLOCK_UNUSED;
+    return ber_heap_remove(vfss, ber_heap_worn(vfss));
+}
+#endif //VFS_BER_GC_MS
+
+static void ber_heap_build(VFSS_TYPE* vfss)
+{
+    uint16_t i;
+    vfss->ber.heap_size = 0;
+    for (i = 0; i < vfss->ber.total_blocks; ++i)
+    {
+        if ((vfss->ber.stat_list[i] & BER_STAT_BLOCK_USED) == 0)
+            ber_heap_push(vfss, i);
+    }
+}
+
+//least worn free block. Released blocks are not in heap till commit, so transaction data is never overwritten
+static uint16_t ber_find_best(VFSS_TYPE* vfss, bool worn)
+{
+    uint16_t best_pblock;
+#if (VFS_BER_GC_MS)
+    if (worn)
+        best_pblock = ber_heap_pop_worn(vfss);
+    else
+#endif //VFS_BER_GC_MS
+        best_pblock = ber_heap_pop(vfss);
     if (best_pblock == BER_BLOCK_UNUSED)
     {
 #if (VFS_BER_DEBUG_ERRORS)
@@ -175,6 +265,55 @@ static void ber_free_block(VFSS_TYPE* vfss, uint16_t pblock)
         vfss->ber.stat_list[pblock] &= ~(BER_STAT_BLOCK_USED | BER_STAT_BLOCK_STUFFED);
 }
 
+//copy, written after last commit, isn't referenced on flash and can be reused at once
+static bool ber_is_committed(VFSS_TYPE* vfss, uint16_t lblock, uint16_t pblock)
+{
+    unsigned int i;
+    BER_TRANS_ENTRY* trans;
+    BER_LOG_ENTRY* entry = vfss->ber.log_entries;
+    for (i = 0; i < vfss->ber.log_count; ++i)
+    {
+        if ((entry[i].lblock == lblock) && (entry[i].pblock == pblock))
+            return false;
+    }
+    if (vfss->ber.trans_buffer == NULL)
+        return true;
+    for (i = 0; i < array_size(vfss->ber.trans_buffer); ++i)
+    {
+        trans = (BER_TRANS_ENTRY*)array_at(vfss->ber.trans_buffer, i);
+        if (trans->lblock == lblock)
+            return trans->pblock == pblock;
+    }
+    return true;
+}
+
+static void ber_release_block(VFSS_TYPE* vfss, uint16_t lblock, uint16_t pblock)
+{
+    if (pblock == BER_BLOCK_UNUSED)
+        return;
+    ber_free_block(vfss, pblock);
+    //old copy is still referenced by remap on flash
+    if (ber_is_committed(vfss, lblock, pblock))
+        vfss->ber.released[vfss->ber.released_count++] = pblock;
+    else
+        ber_heap_push(vfss, pblock);
+}
+
+static void ber_log_add(VFSS_TYPE* vfss, uint16_t lblock, uint16_t pblock)
+{
+    BER_LOG_ENTRY* entry;
+    if (vfss->ber.log_count >= BER_LOG_ENTRIES_MAX)
+    {
+        //whole superblock will be written on commit
+        vfss->ber.log_overflow = true;
+        return;
+    }
+    entry = (BER_LOG_ENTRY*)vfss->ber.log_entries + vfss->ber.log_count++;
+    entry->lblock = lblock;
+    entry->pblock = pblock;
+    entry->stat = vfss->ber.stat_list[pblock];
+}
+
 static uint32_t ber_superblock_crc(VFSS_TYPE* vfss, IO* io)
 {
     uint16_t len = sizeof(BER_HEADER_TYPE) - 8 + vfss->ber.volume.fs_blocks * sizeof(uint16_t) + vfss->ber.total_blocks * sizeof(uint32_t);
@@ -191,6 +330,16 @@ static uint32_t ber_superblock_crc(VFSS_TYPE* vfss, IO* io)
     return crc;
 }
 
+static uint32_t ber_log_crc(BER_LOG_HEADER* hdr)
+{
+    unsigned int len = (sizeof(BER_LOG_HEADER) - 8 + hdr->count * sizeof(BER_LOG_ENTRY)) / sizeof(uint16_t);
+    uint32_t crc = 0;
+    uint16_t* ptr = (uint16_t*)((uint8_t*)hdr + 8);
+    while (len--)
+        crc += *ptr++;
+    return crc;
+}
+
 static void ber_prepare_superblock(VFSS_TYPE* vfss, uint16_t pblock)
 {
     uint32_t old_stat_superblock, old_stat_pblock;
@@ -213,20 +362,23 @@ static void ber_prepare_superblock(VFSS_TYPE* vfss, uint16_t pblock)
     memcpy((uint8_t*)io_data(vfss->ber.io) + sizeof(BER_HEADER_TYPE) + vfss->ber.volume.fs_blocks * sizeof(uint16_t),
            vfss->ber.stat_list, vfss->ber.total_blocks * sizeof(uint32_t));
     hdr->crc = ber_superblock_crc(vfss, vfss->ber.io);
+    //empty log
+    memset((uint8_t*)io_data(vfss->ber.io) + vfss->ber.log_first * FAT_SECTOR_SIZE, BER_MAGIC_FLASH_UNINITIALIZED,
+           (vfss->ber.volume.block_sectors - vfss->ber.log_first) * FAT_SECTOR_SIZE);
     //update cache later, only after successfull write
     vfss->ber.stat_list[vfss->ber.superblock] = old_stat_superblock;
     vfss->ber.stat_list[pblock] = old_stat_pblock;
 }
 
-static uint16_t ber_write_pblock(VFSS_TYPE* vfss, bool is_super)
+static uint16_t ber_write_pblock(VFSS_TYPE* vfss, IO* io, bool is_super, bool worn)
 {
     unsigned int retry;
     uint16_t pblock;
 
-    vfss->ber.io->data_size = vfss->ber.block_size;
+    io->data_size = vfss->ber.block_size;
     for (;;)
     {
-        pblock = ber_find_best(vfss);
+        pblock = ber_find_best(vfss, worn);
         if (pblock == BER_BLOCK_UNUSED)
             return BER_BLOCK_UNUSED;
         for (retry = 0; retry < 3; ++retry)
@@ -238,7 +390,7 @@ static uint16_t ber_write_pblock(VFSS_TYPE* vfss, bool is_super)
 
             if (is_super)
                 ber_prepare_superblock(vfss, pblock);
-            if (storage_write_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->ber.io, vfss->volume.first_sector +
+            if (storage_write_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, io, vfss->volume.first_sector +
                                       pblock * vfss->ber.volume.block_sectors))
                 return pblock;
             error(ERROR_OK);
@@ -249,6 +401,7 @@ static uint16_t ber_write_pblock(VFSS_TYPE* vfss, bool is_super)
             ++vfss->ber.crc_count;
         }
         vfss->ber.stat_list[pblock] = BER_STAT_BAD_BLOCK;
+        ber_log_add(vfss, BER_BLOCK_UNUSED, pblock);
 #if (VFS_BER_DEBUG_ERRORS)
         printf("BER: marking block %#x as bad\n", pblock);
 #endif //VFS_BER_DEBUG_ERRORS
@@ -257,16 +410,23 @@ static uint16_t ber_write_pblock(VFSS_TYPE* vfss, bool is_super)
 
 static inline bool ber_read_lblock(VFSS_TYPE* vfss, uint16_t lblock)
 {
-    if (vfss->ber.remap_list[lblock] == BER_BLOCK_UNUSED)
+    uint16_t pblock = vfss->ber.remap_list[lblock];
+    if (pblock == BER_BLOCK_UNUSED)
     {
-        memset(io_data(vfss->ber.io), BER_MAGIC_FLASH_UNINITIALIZED, vfss->ber.block_size);
+        memset(io_data(vfss->ber.wio), BER_MAGIC_FLASH_UNINITIALIZED, vfss->ber.block_size);
         return true;
     }
-    return storage_read_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->ber.io, vfss->volume.first_sector +
-                             vfss->ber.remap_list[lblock] * vfss->ber.volume.block_sectors, vfss->ber.block_size);
+    if (!storage_read_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->ber.wio, vfss->volume.first_sector +
+                           pblock * vfss->ber.volume.block_sectors, vfss->ber.block_size))
+        return false;
+    //unstuff
+    if (vfss->ber.stat_list[pblock] & BER_STAT_BLOCK_STUFFED)
+        *((uint32_t*)io_data(vfss->ber.wio)) = BER_MAGIC;
+    return true;
 }
 
-static inline bool ber_write_lblock(VFSS_TYPE* vfss, uint16_t lblock)
+//worn - move to most worn free block instead of least worn
+static inline bool ber_write_lblock(VFSS_TYPE* vfss, uint16_t lblock, bool worn)
 {
     bool stuffed;
     uint16_t pblock;
@@ -281,41 +441,131 @@ static inline bool ber_write_lblock(VFSS_TYPE* vfss, uint16_t lblock)
     }
 
 //extremely rare, but possible. Stuff header
-    stuffed = *((uint32_t*)io_data(vfss->ber.io)) == BER_MAGIC;
+    stuffed = *((uint32_t*)io_data(vfss->ber.wio)) == BER_MAGIC;
     if (stuffed)
-        *((uint32_t*)io_data(vfss->ber.io)) = 0x00000000;
+        *((uint32_t*)io_data(vfss->ber.wio)) = 0x00000000;
 
-    pblock = ber_write_pblock(vfss, false);
+    pblock = ber_write_pblock(vfss, vfss->ber.wio, false, worn);
     if (pblock == BER_BLOCK_UNUSED)
         return false;
 
     //update superblock cache only after successfull write
-    ber_free_block(vfss, vfss->ber.remap_list[lblock]);
+    ber_release_block(vfss, lblock, vfss->ber.remap_list[lblock]);
     ber_use_block(vfss, pblock);
     vfss->ber.remap_list[lblock] = pblock;
     if (stuffed)
         vfss->ber.stat_list[pblock] |= BER_STAT_BLOCK_STUFFED;
+    ber_log_add(vfss, lblock, pblock);
     return true;
 }
 
 static inline bool ber_update_superblock(VFSS_TYPE* vfss)
 {
-    uint16_t pblock = ber_write_pblock(vfss, true);
+    bool old_used;
+    uint16_t pblock = ber_write_pblock(vfss, vfss->ber.io, true, false);
     if (pblock == BER_BLOCK_UNUSED)
         return false;
 
     //update cache only after successfull write
     ++vfss->ber.ber_revision;
+    old_used = (vfss->ber.stat_list[vfss->ber.superblock] & BER_STAT_BLOCK_USED) &&
+               (vfss->ber.stat_list[vfss->ber.superblock] != BER_STAT_BAD_BLOCK);
     ber_free_block(vfss, vfss->ber.superblock);
     ber_use_block(vfss, pblock);
+    //new superblock is already on flash, old one can be reused at once
+    if (old_used)
+        ber_heap_push(vfss, vfss->ber.superblock);
     vfss->ber.superblock = pblock;
+    vfss->ber.log_seq = 0;
     return true;
 }
 
+#if (VFS_BER_REMAP_LOG)
+static bool ber_write_log(VFSS_TYPE* vfss)
+{
+    BER_LOG_HEADER* hdr;
+    unsigned int sector = vfss->ber.log_first + vfss->ber.log_seq;
+    if (vfss->ber.log_overflow || (sector >= vfss->ber.volume.block_sectors))
+        return false;
+    hdr = io_data(vfss->ber.io);
+    hdr->magic = BER_LOG_MAGIC;
+    hdr->revision = vfss->ber.ber_revision;
+    hdr->seq = vfss->ber.log_seq;
+    hdr->count = vfss->ber.log_count;
+    hdr->crc_count = vfss->ber.crc_count;
+    memcpy((uint8_t*)hdr + sizeof(BER_LOG_HEADER), vfss->ber.log_entries, vfss->ber.log_count * sizeof(BER_LOG_ENTRY));
+    hdr->crc = ber_log_crc(hdr);
+    vfss->ber.io->data_size = FAT_SECTOR_SIZE;
+#if (VFS_BER_DEBUG_INFO)
+    printf("BER: append log %d, %d entries\n", vfss->ber.log_seq, vfss->ber.log_count);
+#endif // VFS_BER_DEBUG_INFO
+    if (!storage_write_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->ber.io, vfss->volume.first_sector +
+                            vfss->ber.superblock * vfss->ber.volume.block_sectors + sector))
+    {
+        error(ERROR_OK);
+        return false;
+    }
+    ++vfss->ber.log_seq;
+    return true;
+}
+#endif //VFS_BER_REMAP_LOG
+
+static bool ber_commit(VFSS_TYPE* vfss)
+{
+    unsigned int i;
+    if ((vfss->ber.log_count == 0) && !vfss->ber.log_overflow && (vfss->ber.released_count == 0))
+        return true;
+#if (VFS_BER_REMAP_LOG)
+    //log is full or can't be written - move to new superblock
+    if (!ber_write_log(vfss) && !ber_update_superblock(vfss))
+        return false;
+#else
+    if (!ber_update_superblock(vfss))
+        return false;
+#endif //VFS_BER_REMAP_LOG
+    vfss->ber.log_count = 0;
+    vfss->ber.log_overflow = false;
+    //remap is on flash, old copies can be reused
+    for (i = 0; i < vfss->ber.released_count; ++i)
+        ber_heap_push(vfss, vfss->ber.released[i]);
+    vfss->ber.released_count = 0;
+    return true;
+}
+
+static bool ber_flush_lblock(VFSS_TYPE* vfss)
+{
+    uint16_t lblock = vfss->ber.wlblock;
+    if (lblock == BER_BLOCK_UNUSED)
+        return true;
+    vfss->ber.wlblock = BER_BLOCK_UNUSED;
+    if (!ber_write_lblock(vfss, lblock, false))
+        return false;
+    if (vfss->ber.trans_buffer != NULL)
+        return true;
+    //batch limit, or keep spare block for next write and superblock
+    if ((vfss->ber.log_count >= VFS_BER_COMMIT_WRITES) || (vfss->ber.log_count >= BER_LOG_ENTRIES_MAX) || vfss->ber.log_overflow ||
+        (vfss->ber.heap_size < 2))
+        return ber_commit(vfss);
+    return true;
+}
+
+bool ber_flush(VFSS_TYPE* vfss)
+{
+    if (!vfss->ber.active)
+        return true;
+    if (!ber_flush_lblock(vfss))
+        return false;
+    //transaction remap is committed at once
+    if (vfss->ber.trans_buffer != NULL)
+        return true;
+    return ber_commit(vfss);
+}
+
 bool ber_write_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
 {
     unsigned int i, size_sectors, lblock, lblock_offset, sectors_to_write;
     uint8_t* buf = vfss_get_buf(vfss);
+    vfss->ber.busy = true;
     size_sectors = size / FAT_SECTOR_SIZE;
     for (i = 0; i < size_sectors; i += sectors_to_write)
     {
@@ -329,20 +579,20 @@ bool ber_write_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
         sectors_to_write = vfss->ber.volume.block_sectors - lblock_offset;
         if (sectors_to_write > size_sectors - i)
             sectors_to_write = size_sectors - i;
-        //readback first
-        if (lblock_offset || (sectors_to_write < vfss->ber.volume.block_sectors))
+        //sequential writes to same block are merged in RAM
+        if (lblock != vfss->ber.wlblock)
         {
-            if (!ber_read_lblock(vfss, lblock))
+            if (!ber_flush_lblock(vfss))
                 return false;
+            //readback first
+            if (lblock_offset || (sectors_to_write < vfss->ber.volume.block_sectors))
+            {
+                if (!ber_read_lblock(vfss, lblock))
+                    return false;
+            }
+            vfss->ber.wlblock = lblock;
         }
-        memcpy(io_data(vfss->ber.io) + lblock_offset * FAT_SECTOR_SIZE, buf + i * FAT_SECTOR_SIZE, sectors_to_write * FAT_SECTOR_SIZE);
-        if (!ber_write_lblock(vfss, lblock))
-            return false;
-    }
-    if(vfss->ber.trans_buffer == NULL)
-    {
-        if (!ber_update_superblock(vfss))
-            return false;
+        memcpy((uint8_t*)io_data(vfss->ber.wio) + lblock_offset * FAT_SECTOR_SIZE, buf + i * FAT_SECTOR_SIZE, sectors_to_write * FAT_SECTOR_SIZE);
     }
     return true;
 }
@@ -354,6 +604,14 @@ void ber_init(VFSS_TYPE *vfss)
     vfss->ber.remap_list = NULL;
     vfss->ber.stat_list = NULL;
     vfss->ber.trans_buffer = NULL;
+    vfss->ber.heap = NULL;
+    vfss->ber.released = NULL;
+    vfss->ber.wio = NULL;
+    vfss->ber.log_entries = NULL;
+#if (VFS_BER_GC_MS)
+    vfss->ber.gc_timer = timer_create(VFS_BER_HANDLE, HAL_VFS);
+    vfss->ber.gc_pending = false;
+#endif //VFS_BER_GC_MS
 }
 
 static void ber_close_internal(VFSS_TYPE* vfss)
@@ -362,8 +620,74 @@ static void ber_close_internal(VFSS_TYPE* vfss)
     free(vfss->ber.stat_list);
     vfss->ber.remap_list = NULL;
     vfss->ber.stat_list = NULL;
+    free(vfss->ber.heap);
+    free(vfss->ber.released);
+    free(vfss->ber.log_entries);
+    vfss->ber.heap = NULL;
+    vfss->ber.released = NULL;
+    vfss->ber.log_entries = NULL;
     io_destroy(vfss->ber.io);
+    io_destroy(vfss->ber.wio);
     vfss->ber.io = NULL;
+    vfss->ber.wio = NULL;
+}
+
+static bool ber_alloc(VFSS_TYPE* vfss)
+{
+    vfss->ber.io = io_create(vfss->ber.block_size + sizeof(STORAGE_STACK));
+    vfss->ber.wio = io_create(vfss->ber.block_size + sizeof(STORAGE_STACK));
+    vfss->ber.remap_list = malloc(vfss->ber.volume.fs_blocks * sizeof(uint16_t));
+    vfss->ber.stat_list = malloc(vfss->ber.total_blocks * sizeof(uint32_t));
+    vfss->ber.heap = malloc(vfss->ber.total_blocks * sizeof(uint16_t));
+    vfss->ber.released = malloc(vfss->ber.total_blocks * sizeof(uint16_t));
+    vfss->ber.log_entries = malloc(BER_LOG_ENTRIES_MAX * sizeof(BER_LOG_ENTRY));
+    if (vfss->ber.io == NULL || vfss->ber.wio == NULL || vfss->ber.remap_list == NULL || vfss->ber.stat_list == NULL ||
+        vfss->ber.heap == NULL || vfss->ber.released == NULL || vfss->ber.log_entries == NULL)
+    {
+        ber_close_internal(vfss);
+        return false;
+    }
+    vfss->ber.log_first = (sizeof(BER_HEADER_TYPE) + vfss->ber.volume.fs_blocks * sizeof(uint16_t) + vfss->ber.total_blocks * sizeof(uint32_t) +
+                           FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+    vfss->ber.log_seq = vfss->ber.log_count = vfss->ber.released_count = 0;
+    vfss->ber.log_overflow = false;
+    vfss->ber.wlblock = BER_BLOCK_UNUSED;
+    vfss->ber.moved_count = 0;
+    vfss->ber.busy = false;
+    return true;
+}
+
+//apply remap changes, committed after superblock
+static void ber_replay_log(VFSS_TYPE* vfss)
+{
+    unsigned int i;
+    BER_LOG_HEADER* hdr;
+    BER_LOG_ENTRY* entry;
+    for (; vfss->ber.log_first + vfss->ber.log_seq < vfss->ber.volume.block_sectors; ++vfss->ber.log_seq)
+    {
+        hdr = (BER_LOG_HEADER*)((uint8_t*)vfss_get_buf(vfss) + (vfss->ber.log_first + vfss->ber.log_seq) * FAT_SECTOR_SIZE);
+        if ((hdr->magic != BER_LOG_MAGIC) || (hdr->revision != vfss->ber.ber_revision) || (hdr->seq != vfss->ber.log_seq) ||
+            (hdr->count > BER_LOG_ENTRIES_MAX) || (hdr->crc != ber_log_crc(hdr)))
+            break;
+        entry = (BER_LOG_ENTRY*)((uint8_t*)hdr + sizeof(BER_LOG_HEADER));
+        for (i = 0; i < hdr->count; ++i)
+        {
+            if ((entry[i].pblock >= vfss->ber.total_blocks) ||
+                ((entry[i].lblock != BER_BLOCK_UNUSED) && (entry[i].lblock >= vfss->ber.volume.fs_blocks)))
+                continue;
+            if (entry[i].lblock != BER_BLOCK_UNUSED)
+            {
+                ber_free_block(vfss, vfss->ber.remap_list[entry[i].lblock]);
+                vfss->ber.remap_list[entry[i].lblock] = entry[i].pblock;
+            }
+            vfss->ber.stat_list[entry[i].pblock] = entry[i].stat;
+        }
+        vfss->ber.crc_count = hdr->crc_count;
+    }
+#if (VFS_BER_DEBUG_INFO)
+    if (vfss->ber.log_seq)
+        printf("BER: %d log sectors replayed\n", vfss->ber.log_seq);
+#endif //VFS_BER_DEBUG_INFO
 }
 
 static inline void ber_open(VFSS_TYPE* vfss, unsigned int block_sectors)
@@ -419,23 +743,26 @@ static inline void ber_open(VFSS_TYPE* vfss, unsigned int block_sectors)
     vfss->ber.volume.block_sectors = hdr->block_sectors;
     vfss->ber.volume.fs_blocks = hdr->fs_blocks;
     vfss->ber.total_blocks = hdr->total_blocks;
-    vfss->ber.io = io_create(vfss->ber.block_size + sizeof(STORAGE_STACK));
-    vfss->ber.remap_list = malloc(hdr->fs_blocks * sizeof(uint16_t));
-    vfss->ber.stat_list = malloc(hdr->total_blocks * sizeof(uint32_t));
     vfss->ber.ber_revision = hdr->revision;
     vfss->ber.crc_count = hdr->crc_count;
-    if (vfss->ber.io == NULL || vfss->ber.remap_list == NULL || vfss->ber.stat_list == NULL)
-    {
-        ber_close_internal(vfss);
+    if (!ber_alloc(vfss))
         return;
-    }
     memcpy(vfss->ber.remap_list, (uint8_t*)vfss_get_buf(vfss) + sizeof(BER_HEADER_TYPE), hdr->fs_blocks * sizeof(uint16_t));
     memcpy(vfss->ber.stat_list, (uint8_t*)vfss_get_buf(vfss) + sizeof(BER_HEADER_TYPE) + hdr->fs_blocks * sizeof(uint16_t), hdr->total_blocks * sizeof(uint32_t));
+    ber_replay_log(vfss);
+    ber_heap_build(vfss);
 
 #if (VFS_BER_DEBUG_INFO)
     printf("BER: mounted, FS size: %dKB\n", vfss->ber.volume.fs_blocks * vfss->ber.volume.block_sectors / 2);
 #endif //VFS_BER_DEBUG_INFO
     vfss->ber.active = true;
+#if (VFS_BER_GC_MS)
+    if (!vfss->ber.gc_pending)
+    {
+        timer_start_ms(vfss->ber.gc_timer, VFS_BER_GC_MS);
+        vfss->ber.gc_pending = true;
+    }
+#endif //VFS_BER_GC_MS
 }
 
 static void ber_close(VFSS_TYPE* vfss)
@@ -534,25 +861,20 @@ static inline void ber_format(VFSS_TYPE* vfss, IO* io)
     memset(vfss_get_buf(vfss), 0xff, vfss->ber.block_size);
     vfss->ber.volume.block_sectors = format->block_sectors;
     vfss->ber.volume.fs_blocks = format->fs_blocks;
-    vfss->ber.io = io_create(vfss->ber.block_size + sizeof(STORAGE_STACK));
-    vfss->ber.remap_list = malloc(vfss->ber.volume.fs_blocks * sizeof(uint16_t));
-    vfss->ber.stat_list = malloc(vfss->ber.total_blocks * sizeof(uint32_t));
     vfss->ber.ber_revision = 0;
     vfss->ber.crc_count = 0;
     vfss->ber.superblock = 0;
-    if (vfss->ber.io == NULL || vfss->ber.remap_list == NULL || vfss->ber.stat_list == NULL)
-    {
-        ber_close_internal(vfss);
+    if (!ber_alloc(vfss))
         return;
-    }
 
     //remap list - all empty blocks
     for (i = 0; i < vfss->ber.volume.fs_blocks; ++i)
         vfss->ber.remap_list[i] = BER_BLOCK_UNUSED;
 
     //stat list - unused, no CRC, clear
-    for (i = 1; i < vfss->ber.total_blocks; ++i)
+    for (i = 0; i < vfss->ber.total_blocks; ++i)
         vfss->ber.stat_list[i] = 0;
+    ber_heap_build(vfss);
 
     ber_update_superblock(vfss);
     ber_close_internal(vfss);
@@ -560,17 +882,36 @@ static inline void ber_format(VFSS_TYPE* vfss, IO* io)
 
 static inline void ber_stat(VFSS_TYPE* vfss, IO* io)
 {
-    unsigned int i;
+    unsigned int i, erase_count, good_blocks;
+    unsigned long long erase_total;
     VFS_BER_STAT_TYPE* stat = io_data(io);
     stat->crc_errors_count = vfss->ber.crc_count;
     stat->bad_blocks = stat->crc_blocks = 0;
+    stat->erase_min = 0xffffffff;
+    stat->erase_max = 0;
+    erase_total = 0;
     for (i = 0; i < vfss->ber.total_blocks; ++i)
     {
         if (vfss->ber.stat_list[i] == BER_STAT_BAD_BLOCK)
+        {
             ++stat->bad_blocks;
-        else if (vfss->ber.stat_list[i] & BER_STAT_BLOCK_CRC)
+            continue;
+        }
+        if (vfss->ber.stat_list[i] & BER_STAT_BLOCK_CRC)
             ++stat->crc_blocks;
+        erase_count = BER_STAT_VALUE(vfss->ber.stat_list[i]);
+        if (erase_count < stat->erase_min)
+            stat->erase_min = erase_count;
+        if (erase_count > stat->erase_max)
+            stat->erase_max = erase_count;
+        erase_total += erase_count;
     }
+    good_blocks = vfss->ber.total_blocks - stat->bad_blocks;
+    stat->erase_avg = good_blocks ? erase_total / good_blocks : 0;
+    if (good_blocks == 0)
+        stat->erase_min = 0;
+    stat->free_blocks = vfss->ber.heap_size + vfss->ber.released_count;
+    stat->moved_blocks = vfss->ber.moved_count;
     io->data_size = sizeof(VFS_BER_STAT_TYPE);
 }
 
@@ -581,6 +922,9 @@ static inline void ber_start_trans(VFSS_TYPE* vfss)
         error(ERROR_INVALID_STATE);
         return;
     }
+    //rollback must not discard writes before transaction
+    if (!ber_flush(vfss))
+        return;
     if(array_create(&vfss->ber.trans_buffer, sizeof(BER_TRANS_ENTRY), BER_TRANSACTION_INCREMENT) == NULL)
         error(ERROR_OUT_OF_MEMORY);
 }
@@ -592,11 +936,11 @@ static inline void ber_commit_trans(VFSS_TYPE* vfss)
         error(ERROR_INVALID_STATE);
         return;
     }
-    if(array_size(vfss->ber.trans_buffer))
-    {
-        if(!ber_update_superblock(vfss))
-            error(ERROR_OUT_OF_MEMORY);
-    }
+    //failed write already rolled back
+    if (!ber_flush_lblock(vfss))
+        return;
+    if(!ber_commit(vfss))
+        error(ERROR_OUT_OF_MEMORY);
     ber_trans_clear_buffer(vfss);
 }
 
@@ -608,6 +952,8 @@ static void ber_rollback_trans(VFSS_TYPE* vfss)
         error(ERROR_INVALID_STATE);
         return;
     }
+    //discard coalesced block
+    vfss->ber.wlblock = BER_BLOCK_UNUSED;
     if(array_size(vfss->ber.trans_buffer) == 0)
     {
         ber_trans_clear_buffer(vfss);
@@ -618,6 +964,61 @@ static void ber_rollback_trans(VFSS_TYPE* vfss)
     ber_open(vfss, block_sectors);
 }
 
+#if (VFS_BER_GC_MS)
+//static wear leveling: move coldest data to most worn free block, releasing least worn block for hot data.
+//Compared against move destination, not global max: otherwise every block is rewritten up to most worn one
+static bool ber_move_cold(VFSS_TYPE* vfss)
+{
+    unsigned int i, erase_count, erase_max, cold_erase_count;
+    uint16_t cold;
+    //keep spare block for superblock
+    if (vfss->ber.heap_size < 2)
+        return false;
+    erase_max = BER_HEAP_KEY(vfss, vfss->ber.heap[ber_heap_worn(vfss)]);
+    cold = BER_BLOCK_UNUSED;
+    cold_erase_count = 0xffffffff;
+    for (i = 0; i < vfss->ber.volume.fs_blocks; ++i)
+    {
+        if (vfss->ber.remap_list[i] == BER_BLOCK_UNUSED)
+            continue;
+        erase_count = BER_STAT_VALUE(vfss->ber.stat_list[vfss->ber.remap_list[i]]);
+        if (erase_count < cold_erase_count)
+        {
+            cold = i;
+            cold_erase_count = erase_count;
+        }
+    }
+    if ((cold == BER_BLOCK_UNUSED) || (erase_max <= cold_erase_count + VFS_BER_WEAR_SPREAD))
+        return false;
+    if (!ber_read_lblock(vfss, cold))
+        return false;
+#if (VFS_BER_DEBUG_INFO)
+    printf("BER: move cold lblock %#x, erase count %d, destination %d\n", cold, cold_erase_count, erase_max);
+#endif // VFS_BER_DEBUG_INFO
+    if (!ber_write_lblock(vfss, cold, true))
+        return false;
+    ++vfss->ber.moved_count;
+    return true;
+}
+
+//idle tick: commit delayed remap, so old copies return to free pool, then level wear within work budget
+void ber_timeout(VFSS_TYPE* vfss)
+{
+    unsigned int i;
+    vfss->ber.gc_pending = false;
+    if (!vfss->ber.active)
+        return;
+    if ((vfss->volume.process != INVALID_HANDLE) && !vfss->ber.busy && (vfss->ber.trans_buffer == NULL) && ber_flush(vfss))
+    {
+        for (i = 0; (i < VFS_BER_GC_BLOCKS) && ber_move_cold(vfss); ++i) {}
+        ber_commit(vfss);
+    }
+    vfss->ber.busy = false;
+    timer_start_ms(vfss->ber.gc_timer, VFS_BER_GC_MS);
+    vfss->ber.gc_pending = true;
+}
+#endif //VFS_BER_GC_MS
+
 void ber_request(VFSS_TYPE *vfss, IPC* ipc)
 {
     if((!vfss->ber.active) && (HAL_ITEM(ipc->cmd) != IPC_OPEN) && (HAL_ITEM(ipc->cmd) != VFS_FORMAT) )
@@ -632,6 +1033,8 @@ void ber_request(VFSS_TYPE *vfss, IPC* ipc)
         ber_open(vfss, ipc->param2);
         break;
     case IPC_CLOSE:
+        //uncommitted transaction is discarded
+        ber_flush(vfss);
         ber_close(vfss);
         break;
     case IPC_READ:
@@ -23,6 +23,23 @@ typedef struct {
     uint16_t* remap_list;
     uint32_t* stat_list;
     IO* io;
+    //free blocks, min-heap by erase count
+    uint16_t* heap;
+    unsigned int heap_size;
+    //freed, but not reusable till remap commit
+    uint16_t* released;
+    unsigned int released_count;
+    //coalesced writes of single logical block
+    IO* wio;
+    uint16_t wlblock;
+    //remap log after superblock in same block
+    void* log_entries;
+    unsigned int log_first, log_seq, log_count;
+    bool log_overflow;
+    //idle tick
+    HANDLE gc_timer;
+    unsigned int moved_count;
+    bool gc_pending, busy;
     bool active;
 } BER_TYPE;
 
@@ -30,8 +47,12 @@ unsigned int ber_get_volume_sectors(VFSS_TYPE *vfss);
 
 bool ber_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size);
 bool ber_write_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size);
+//write coalesced block and commit remap. Transaction remap is committed on transaction commit only
+bool ber_flush(VFSS_TYPE* vfss);
 
 void ber_init(VFSS_TYPE *vfss);
 void ber_request(VFSS_TYPE *vfss, IPC* ipc);
+//background commit and static wear leveling on VFS_BER_GC_MS timer
+void ber_timeout(VFSS_TYPE* vfss);
 
 #endif // BER_H
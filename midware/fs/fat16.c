@@ -13,19 +13,31 @@
 #include "../../userspace/disk.h"
 #include "../../userspace/utf.h"
 #include "../../userspace/time.h"
+#include "../../userspace/stdlib.h"
+#include "../../userspace/array.h"
 #include <string.h>
 #include "vfss_private.h"
 
 #define FILE_ENTRIES_IN_SECTOR                              (FAT_SECTOR_SIZE / sizeof(FAT_FILE_ENTRY))
 #define FAT_ENTRIES_IN_SECTOR                               (FAT_SECTOR_SIZE / 2)
+#define FAT32_ENTRIES_IN_SECTOR                             (FAT_SECTOR_SIZE / 4)
+#define FAT_JOURNAL_INTENTS_MAX                             ((FAT_SECTOR_SIZE - sizeof(FAT_JOURNAL_HEADER)) / sizeof(FAT_JOURNAL_INTENT))
 
 typedef struct {
     unsigned int first_cluster, current_cluster, cluster_num, pos;
 } FAT16_FILE_INFO;
 
+//contiguous part of file cluster chain
+typedef struct {
+    unsigned int cluster_num, cluster, count;
+} FAT16_EXTENT;
+
 typedef struct {
     FAT16_FILE_INFO fi, data;
     unsigned int size, mode;
+    //extents of cluster chain, sorted by cluster_num. Mapped lazily on access
+    ARRAY* extents;
+    unsigned int mapped;
 } FAT16_FILE_HANDLE_TYPE;
 
 typedef enum {
@@ -70,8 +82,6 @@ static const uint8_t __FAT16_BOOT[FAT_SECTOR_SIZE] = {
                                                             0x72, 0x74, 0x0D, 0x0A, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0xAC, 0xCB, 0xD8, 0x55, 0xAA};
 
 
-static int fat16_get_free(VFSS_TYPE* vfss);
-
 static void fat16_now(struct tm* ts)
 {
     TIME t;
@@ -108,13 +118,52 @@ static unsigned long fat16_cluster_to_sector(VFSS_TYPE* vfss, unsigned long clus
     return vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * vfss->fat16.fat_count + vfss->fat16.root_sectors + (cluster - 2) * vfss->fat16.cluster_sectors;
 }
 
+static inline unsigned long fat16_fat_entries_in_sector(VFSS_TYPE* vfss)
+{
+    return vfss->fat16.fat32 ? FAT32_ENTRIES_IN_SECTOR : FAT_ENTRIES_IN_SECTOR;
+}
+
+static unsigned long fat16_decode_fat_value(VFSS_TYPE* vfss, void* fat, unsigned long idx)
+{
+    unsigned long value;
+    if (vfss->fat16.fat32)
+        return ((uint32_t*)fat)[idx] & FAT32_CLUSTER_MASK;
+    value = ((uint16_t*)fat)[idx];
+    //same end of chain marks for both
+    if (value >= FAT16_CLUSTER_RESERVED)
+        value |= FAT32_CLUSTER_MASK & ~0xffff;
+    return value;
+}
+
+static void fat16_free_map_update(VFSS_TYPE* vfss, unsigned long cluster, unsigned long old_value, unsigned long value)
+{
+    if (cluster < 2 || cluster >= vfss->fat16.clusters_count || !vfss->fat16.active)
+        return;
+    if (old_value != FAT_CLUSTER_FREE && value == FAT_CLUSTER_FREE)
+    {
+        if (vfss->fat16.free_map)
+            vfss->fat16.free_map[cluster >> 5] |= 1ul << (cluster & 31);
+        ++vfss->fat16.free_count;
+        vfss->fat16.fs_info_dirty = vfss->fat16.fat32;
+    }
+    else if (old_value == FAT_CLUSTER_FREE && value != FAT_CLUSTER_FREE)
+    {
+        if (vfss->fat16.free_map)
+            vfss->fat16.free_map[cluster >> 5] &= ~(1ul << (cluster & 31));
+        --vfss->fat16.free_count;
+        //FSInfo hint
+        vfss->fat16.next_free = cluster + 1 < vfss->fat16.clusters_count ? cluster + 1 : 2;
+        vfss->fat16.fs_info_dirty = vfss->fat16.fat32;
+    }
+}
+
 static unsigned long fat16_get_fat_value(VFSS_TYPE* vfss, unsigned long cluster)
 {
-    uint16_t* fat;
-    fat = vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + (cluster / FAT_ENTRIES_IN_SECTOR), FAT_SECTOR_SIZE);
+    void* fat;
+    fat = vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + (cluster / fat16_fat_entries_in_sector(vfss)), FAT_SECTOR_SIZE);
     if (fat == NULL)
         return FAT_CLUSTER_RESERVED;
-    return fat[cluster % FAT_ENTRIES_IN_SECTOR];
+    return fat16_decode_fat_value(vfss, fat, cluster % fat16_fat_entries_in_sector(vfss));
 }
 
 static unsigned long fat16_get_fat_next(VFSS_TYPE* vfss, unsigned long cluster)
@@ -131,52 +180,223 @@ static unsigned long fat16_get_fat_next(VFSS_TYPE* vfss, unsigned long cluster)
     return next;
 }
 
+//only primary FAT is updated. Mirrors are updated on sync, after primary FAT is on storage
 static bool fat16_set_fat_value(VFSS_TYPE* vfss, unsigned long cluster, unsigned long value)
 {
-    unsigned int i;
-    uint16_t* fat;
-    fat = vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + (cluster / FAT_ENTRIES_IN_SECTOR), FAT_SECTOR_SIZE);
+    unsigned long idx, sector;
+    void* fat;
+    sector = cluster / fat16_fat_entries_in_sector(vfss);
+    fat = vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + sector, FAT_SECTOR_SIZE);
     if (fat == NULL)
         return false;
-    fat[cluster % FAT_ENTRIES_IN_SECTOR] = value;
-    for (i = 0; i < vfss->fat16.fat_count; ++i)
+    idx = cluster % fat16_fat_entries_in_sector(vfss);
+    fat16_free_map_update(vfss, cluster, fat16_decode_fat_value(vfss, fat, idx), value);
+    //upper 4 bits of FAT32 entry are reserved
+    if (vfss->fat16.fat32)
+        ((uint32_t*)fat)[idx] = (((uint32_t*)fat)[idx] & ~FAT32_CLUSTER_MASK) | (value & FAT32_CLUSTER_MASK);
+    else
+        ((uint16_t*)fat)[idx] = value;
+    if (!vfss_write_sectors(vfss, vfss->fat16.reserved_sectors + sector, FAT_SECTOR_SIZE))
+        return false;
+    if (sector < vfss->fat16.fat_dirty_first)
+        vfss->fat16.fat_dirty_first = sector;
+    if (sector > vfss->fat16.fat_dirty_last)
+        vfss->fat16.fat_dirty_last = sector;
+    return true;
+}
+
+//empty range: first > last
+static inline void fat16_fat_dirty_reset(VFSS_TYPE* vfss)
+{
+    vfss->fat16.fat_dirty_first = FAT_CLUSTER_RESERVED;
+    vfss->fat16.fat_dirty_last = 0;
+}
+
+//copy primary FAT sectors to mirrors
+static bool fat16_mirror_fat(VFSS_TYPE* vfss, unsigned long first, unsigned long last)
+{
+    unsigned long sector, sectors_count, i;
+    for (sector = first; sector <= last; sector += sectors_count)
     {
-        if (!vfss_write_sectors(vfss, vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * i + (cluster / FAT_ENTRIES_IN_SECTOR), FAT_SECTOR_SIZE))
+        sectors_count = last - sector + 1;
+        if (sectors_count > vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE)
+            sectors_count = vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE;
+        if (vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + sector, sectors_count * FAT_SECTOR_SIZE) == NULL)
             return false;
+        for (i = 1; i < vfss->fat16.fat_count; ++i)
+        {
+            if (!vfss_write_sectors(vfss, vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * i + sector, sectors_count * FAT_SECTOR_SIZE))
+                return false;
+        }
     }
     return true;
 }
 
+static inline bool fat16_is_free(VFSS_TYPE* vfss, unsigned long cluster)
+{
+    if (vfss->fat16.free_map == NULL)
+        return fat16_get_fat_value(vfss, cluster) == FAT_CLUSTER_FREE;
+    return (vfss->fat16.free_map[cluster >> 5] & (1ul << (cluster & 31))) != 0;
+}
+
+static unsigned long fat16_free_map_search(VFSS_TYPE* vfss, unsigned long from, unsigned long to)
+{
+    unsigned long word, bits;
+    if (vfss->fat16.free_map == NULL)
+    {
+        for (; from < to; ++from)
+            if (fat16_get_fat_value(vfss, from) == FAT_CLUSTER_FREE)
+                return from;
+        return FAT_CLUSTER_RESERVED;
+    }
+    //whole word at once, 32 clusters per iteration
+    while (from < to)
+    {
+        word = from >> 5;
+        bits = vfss->fat16.free_map[word] & (0xffffffff << (from & 31));
+        if (bits)
+        {
+            from = (word << 5) + __builtin_ctz(bits);
+            return from < to ? from : FAT_CLUSTER_RESERVED;
+        }
+        from = (word + 1) << 5;
+    }
+    return FAT_CLUSTER_RESERVED;
+}
+
 static unsigned long fat16_find_free_cluster(VFSS_TYPE* vfss, unsigned long cluster)
 {
     unsigned long next_free;
     //after current till last
-    for (next_free = cluster + 1; next_free < vfss->fat16.clusters_count;  ++next_free)
-        if (fat16_get_fat_value(vfss, next_free) == FAT_CLUSTER_FREE)
-            return next_free;
+    if ((next_free = fat16_free_map_search(vfss, cluster + 1, vfss->fat16.clusters_count)) < FAT_CLUSTER_RESERVED)
+        return next_free;
     //from first till current -1
-    for (next_free = 2; next_free < cluster;  ++next_free)
-        if (fat16_get_fat_value(vfss, next_free) == FAT_CLUSTER_FREE)
-            return next_free;
+    if ((next_free = fat16_free_map_search(vfss, 2, cluster)) < FAT_CLUSTER_RESERVED)
+        return next_free;
 #if (VFS_DEBUG_ERRORS)
     printf("FAT16 warning: No free space\n");
 #endif //VFS_DEBUG_ERRORS
     return FAT_CLUSTER_RESERVED;
 }
 
-static unsigned long fat16_occupy_first_cluster(VFSS_TYPE* vfss)
+//first free run of at least count clusters, or longest one if there is no such
+static unsigned long fat16_find_free_run(VFSS_TYPE* vfss, unsigned long count)
+{
+    unsigned long start, end, best, best_size;
+    //no bitmap, search from FSInfo hint. Run is kept by next cluster preference
+    if (vfss->fat16.free_map == NULL)
+        return fat16_find_free_cluster(vfss, vfss->fat16.next_free - 1);
+    best = FAT_CLUSTER_RESERVED;
+    best_size = 0;
+    for (start = fat16_free_map_search(vfss, 2, vfss->fat16.clusters_count); start < FAT_CLUSTER_RESERVED;
+         start = fat16_free_map_search(vfss, end, vfss->fat16.clusters_count))
+    {
+        for (end = start + 1; end < vfss->fat16.clusters_count && fat16_is_free(vfss, end) && end - start < count; ++end) {}
+        if (end - start > best_size)
+        {
+            best = start;
+            best_size = end - start;
+            if (best_size >= count)
+                break;
+        }
+    }
+#if (VFS_DEBUG_ERRORS)
+    if (best >= FAT_CLUSTER_RESERVED)
+        printf("FAT16 warning: No free space\n");
+#endif //VFS_DEBUG_ERRORS
+    return best;
+}
+
+static uint16_t fat16_journal_checksum(FAT_JOURNAL_HEADER* hdr)
+{
+    unsigned int i;
+    uint16_t sum = 0;
+    uint8_t* data = (uint8_t*)(hdr + 1);
+    for (i = 0; i < hdr->count * sizeof(FAT_JOURNAL_INTENT); ++i)
+        sum = ((sum & 1) ? 0x8000 : 0) + (sum >> 1) + data[i];
+    return sum;
+}
+
+//Logged before FAT is changed. Journal sector is below FAT and directories, ordered write back puts it on storage first
+static bool fat16_journal_add(VFSS_TYPE* vfss, FAT_JOURNAL_OP op, unsigned long folder, unsigned long first_cluster, unsigned long cluster)
 {
-    unsigned long cluster = fat16_find_free_cluster(vfss, 2);
+#if (VFS_FAT_JOURNAL)
+    unsigned int i;
+    FAT_JOURNAL_HEADER* hdr;
+    FAT_JOURNAL_INTENT* intent;
+    if (vfss->fat16.journal_sector == 0)
+        return true;
+    //batch is too large, commit it
+    if (vfss->fat16.journal_count >= FAT_JOURNAL_INTENTS_MAX && !fat16_sync(vfss))
+        return false;
+    hdr = vfss_read_sectors(vfss, vfss->fat16.journal_sector, FAT_SECTOR_SIZE);
+    if (hdr == NULL)
+        return false;
+    intent = (FAT_JOURNAL_INTENT*)(hdr + 1);
+    //rollback point of file is already in batch
+    if (op == FAT_JOURNAL_APPEND)
+    {
+        for (i = 0; i < vfss->fat16.journal_count; ++i)
+            if (intent[i].op == FAT_JOURNAL_APPEND && intent[i].first_cluster == first_cluster)
+                return true;
+    }
+    intent += vfss->fat16.journal_count;
+    memset(intent, 0x00, sizeof(FAT_JOURNAL_INTENT));
+    intent->op = op;
+    intent->folder = folder;
+    intent->first_cluster = first_cluster;
+    intent->cluster = cluster;
+    hdr->magic = FAT_JOURNAL_MAGIC;
+    hdr->count = vfss->fat16.journal_count + 1;
+    hdr->checksum = fat16_journal_checksum(hdr);
+    if (!vfss_write_sectors(vfss, vfss->fat16.journal_sector, FAT_SECTOR_SIZE))
+        return false;
+    ++vfss->fat16.journal_count;
+#endif //VFS_FAT_JOURNAL
+    return true;
+}
+
+//all changes of batch are on storage
+static bool fat16_journal_clear(VFSS_TYPE* vfss)
+{
+#if (VFS_FAT_JOURNAL)
+    FAT_JOURNAL_HEADER* hdr;
+    if (vfss->fat16.journal_count == 0)
+        return true;
+    hdr = vfss_read_sectors(vfss, vfss->fat16.journal_sector, FAT_SECTOR_SIZE);
+    if (hdr == NULL)
+        return false;
+    hdr->magic = FAT_JOURNAL_MAGIC;
+    hdr->count = hdr->checksum = 0;
+    if (!vfss_write_sectors(vfss, vfss->fat16.journal_sector, FAT_SECTOR_SIZE) || !vfss_flush(vfss))
+        return false;
+    vfss->fat16.journal_count = 0;
+#endif //VFS_FAT_JOURNAL
+    return true;
+}
+
+static unsigned long fat16_occupy_first_cluster(VFSS_TYPE* vfss, unsigned long folder)
+{
+    unsigned long cluster = fat16_find_free_run(vfss, 1);
     if (cluster >= FAT_CLUSTER_RESERVED)
         return FAT_CLUSTER_RESERVED;
+    if (!fat16_journal_add(vfss, FAT_JOURNAL_CREATE, folder, cluster, 0))
+        return FAT_CLUSTER_RESERVED;
     if (!fat16_set_fat_value(vfss, cluster, FAT_CLUSTER_LAST))
         return FAT_CLUSTER_RESERVED;
     return cluster;
 }
 
-static unsigned long fat16_occupy_next_cluster(VFSS_TYPE* vfss, unsigned long current_cluster)
+//count is clusters, expected to be appended. Used to keep file contiguous
+static unsigned long fat16_occupy_next_cluster(VFSS_TYPE* vfss, unsigned long current_cluster, unsigned long count)
 {
-    unsigned long cluster = fat16_find_free_cluster(vfss, current_cluster);
+    unsigned long cluster;
+    if (current_cluster + 1 < vfss->fat16.clusters_count && fat16_is_free(vfss, current_cluster + 1))
+        cluster = current_cluster + 1;
+    else if (count > 1)
+        cluster = fat16_find_free_run(vfss, count);
+    else
+        cluster = fat16_find_free_cluster(vfss, current_cluster);
     if (cluster >= FAT_CLUSTER_RESERVED)
         return FAT_CLUSTER_RESERVED;
     if (!fat16_set_fat_value(vfss, current_cluster, cluster))
@@ -186,18 +406,62 @@ static unsigned long fat16_occupy_next_cluster(VFSS_TYPE* vfss, unsigned long cu
     return cluster;
 }
 
-static bool fat16_release_chain(VFSS_TYPE* vfss, unsigned long start_cluster)
+//from chain end. Delayed FAT sectors are written back in sector order, flush on each sector change keeps release order
+static bool fat16_release_extents(VFSS_TYPE* vfss, ARRAY* extents)
 {
-    unsigned long cluster, next_cluster;
-    for (cluster = start_cluster; cluster < FAT_CLUSTER_RESERVED; cluster = next_cluster)
+    FAT16_EXTENT* ext;
+    unsigned long cluster, sector, i;
+    sector = FAT_CLUSTER_RESERVED;
+    for (i = array_size(extents); i > 0; --i)
     {
-        next_cluster = fat16_get_fat_value(vfss, cluster);
-        if (!fat16_set_fat_value(vfss, cluster, FAT_CLUSTER_FREE))
-            return false;
+        ext = array_at(extents, i - 1);
+        for (cluster = ext->cluster + ext->count - 1; cluster >= ext->cluster; --cluster)
+        {
+            if (cluster / fat16_fat_entries_in_sector(vfss) != sector)
+            {
+                if (!vfss_flush(vfss))
+                    return false;
+                sector = cluster / fat16_fat_entries_in_sector(vfss);
+            }
+            if (!fat16_set_fat_value(vfss, cluster, FAT_CLUSTER_FREE))
+                return false;
+        }
     }
     return true;
 }
 
+//rest of chain is always reachable from start cluster, for journal roll forward
+static bool fat16_release_chain(VFSS_TYPE* vfss, unsigned long start_cluster)
+{
+    ARRAY* extents;
+    FAT16_EXTENT* ext;
+    unsigned long cluster, i;
+    bool res = true;
+    if (array_create(&extents, sizeof(FAT16_EXTENT), 1) == NULL)
+        return false;
+    for (cluster = start_cluster, i = 0; cluster >= 2 && cluster < vfss->fat16.clusters_count && i < vfss->fat16.clusters_count;
+         cluster = fat16_get_fat_value(vfss, cluster), ++i)
+    {
+        ext = array_size(extents) ? array_at(extents, array_size(extents) - 1) : NULL;
+        if (ext != NULL && ext->cluster + ext->count == cluster)
+            ++ext->count;
+        else if ((ext = array_append(&extents)) != NULL)
+        {
+            ext->cluster = cluster;
+            ext->count = 1;
+        }
+        else
+        {
+            res = false;
+            break;
+        }
+    }
+    if (res)
+        res = fat16_release_extents(vfss, extents);
+    array_destroy(&extents);
+    return res;
+}
+
 static unsigned int fat16_strspcpy(char* dst, char* src, unsigned int dst_size, unsigned int src_size, bool lowercase)
 {
     unsigned int i, size;
@@ -220,43 +484,126 @@ static unsigned int fat16_strspcpy(char* dst, char* src, unsigned int dst_size,
 void fat16_init(VFSS_TYPE* vfss)
 {
     vfss->fat16.active = false;
+    vfss->fat16.free_map = NULL;
+    vfss->fat16.free_count = 0;
+    vfss->fat16.journal_sector = 0;
+    vfss->fat16.journal_count = 0;
+    fat16_fat_dirty_reset(vfss);
     so_create(&vfss->fat16.finds, sizeof(FAT16_FILE_INFO), 1);
     so_create(&vfss->fat16.file_handles, sizeof(FAT16_FILE_HANDLE_TYPE), 1);
 }
 
-static bool fat16_parse_boot(VFSS_TYPE* vfss)
+static bool fat16_parse_bpb32(VFSS_TYPE* vfss, FAT32_BOOT_SECTOR_BPB_TYPE* bpb)
 {
-    FAT_BOOT_SECTOR_BPB_TYPE* bpb;
-    uint8_t* boot = vfss_read_sectors(vfss, 0, FAT_SECTOR_SIZE);
-    if (boot == NULL)
+    if (bpb->ext_signature != FAT_BPB_EXT_SIGNATURE || bpb->version != 0 || bpb->root_cluster < 2)
         return false;
+    vfss->fat16.fat32 = true;
+    vfss->fat16.sectors_count = bpb->sectors;
+    vfss->fat16.fat_sectors = bpb->fat_sectors32;
+    vfss->fat16.root_cluster = bpb->root_cluster;
+    vfss->fat16.fs_info_sector = bpb->fs_info_sector;
+    return true;
+}
+
+static bool fat16_parse_bpb(VFSS_TYPE* vfss, uint8_t* boot)
+{
+    FAT_BOOT_SECTOR_BPB_TYPE* bpb;
     if (*((uint16_t*)(boot + MBR_MAGIC_OFFSET)) != MBR_MAGIC)
-    {
-#if (VFS_DEBUG_ERRORS)
-        printf("FAT16: Invalid boot sector signature\n");
-#endif //VFS_DEBUG_ERRORS
-        error(ERROR_NOT_SUPPORTED);
         return false;
-    }
     bpb = (void*)(boot + sizeof(FAT_BOOT_SECTOR_HEADER_TYPE));
-    if ((bpb->sector_size != FAT_SECTOR_SIZE) || (bpb->ext_signature != FAT_BPB_EXT_SIGNATURE))
-    {
-        error(ERROR_NOT_SUPPORTED);
-#if (VFS_DEBUG_ERRORS)
-        printf("FAT16: Unsupported BPB\n");
-#endif //VFS_DEBUG_ERRORS
+    if (bpb->sector_size != FAT_SECTOR_SIZE)
         return false;
-    }
     vfss->fat16.cluster_sectors = bpb->cluster_sectors;
+    vfss->fat16.reserved_sectors = bpb->reserved_sectors;
+    vfss->fat16.fat_count = bpb->fat_count;
+    vfss->fat16.root_cluster = VFS_ROOT;
+    //FAT32 has no fixed root and 16 bit FAT size
+    if (bpb->fat_sectors == 0 && bpb->root_count == 0)
+    {
+        vfss->fat16.root_count = vfss->fat16.root_sectors = 0;
+        return fat16_parse_bpb32(vfss, (FAT32_BOOT_SECTOR_BPB_TYPE*)bpb);
+    }
+    if (bpb->ext_signature != FAT_BPB_EXT_SIGNATURE)
+        return false;
+    vfss->fat16.fat32 = false;
     vfss->fat16.sectors_count = bpb->sectors_short;
     vfss->fat16.root_count = bpb->root_count;
     vfss->fat16.root_sectors = (bpb->root_count * sizeof(FAT_FILE_ENTRY) + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
-    vfss->fat16.reserved_sectors = bpb->reserved_sectors;
     vfss->fat16.fat_sectors = bpb->fat_sectors;
-    vfss->fat16.fat_count = bpb->fat_count;
     if (vfss->fat16.sectors_count == 0)
         vfss->fat16.sectors_count = bpb->sectors;
-    if (vfss->fat16.sectors_count > vfss_get_volume_sectors(vfss) || vfss->fat16.sectors_count == 0 || vfss->fat16.cluster_sectors == 0)
+    return true;
+}
+
+static void fat16_read_fs_info(VFSS_TYPE* vfss)
+{
+    FAT32_FS_INFO_TYPE* fs_info;
+    //hints are optional
+    vfss->fat16.free_count = FAT32_FS_INFO_UNKNOWN;
+    vfss->fat16.next_free = 2;
+    vfss->fat16.fs_info_dirty = false;
+    if (vfss->fat16.fs_info_sector == 0 || vfss->fat16.fs_info_sector >= vfss->fat16.reserved_sectors)
+        return;
+    fs_info = vfss_read_sectors(vfss, vfss->fat16.fs_info_sector, FAT_SECTOR_SIZE);
+    if (fs_info == NULL || fs_info->lead_signature != FAT32_FS_INFO_LEAD_SIGNATURE ||
+        fs_info->struct_signature != FAT32_FS_INFO_STRUCT_SIGNATURE || fs_info->trail_signature != FAT32_FS_INFO_TRAIL_SIGNATURE)
+    {
+#if (VFS_DEBUG_ERRORS)
+        printf("FAT32: Invalid FSInfo sector\n");
+#endif //VFS_DEBUG_ERRORS
+        return;
+    }
+    if (fs_info->free_count <= vfss->fat16.clusters_count - 2)
+        vfss->fat16.free_count = fs_info->free_count;
+    if (fs_info->next_free >= 2 && fs_info->next_free < vfss->fat16.clusters_count)
+        vfss->fat16.next_free = fs_info->next_free;
+}
+
+static bool fat16_write_fs_info(VFSS_TYPE* vfss)
+{
+    FAT32_FS_INFO_TYPE* fs_info;
+    if (!vfss->fat16.fs_info_dirty)
+        return true;
+    if (vfss->fat16.fs_info_sector == 0 || vfss->fat16.fs_info_sector >= vfss->fat16.reserved_sectors)
+        return true;
+    fs_info = vfss_read_sectors(vfss, vfss->fat16.fs_info_sector, FAT_SECTOR_SIZE);
+    if (fs_info == NULL)
+        return false;
+    fs_info->lead_signature = FAT32_FS_INFO_LEAD_SIGNATURE;
+    fs_info->struct_signature = FAT32_FS_INFO_STRUCT_SIGNATURE;
+    fs_info->trail_signature = FAT32_FS_INFO_TRAIL_SIGNATURE;
+    fs_info->free_count = vfss->fat16.free_count;
+    fs_info->next_free = vfss->fat16.next_free;
+    if (!vfss_write_sectors(vfss, vfss->fat16.fs_info_sector, FAT_SECTOR_SIZE))
+        return false;
+    vfss->fat16.fs_info_dirty = false;
+    return true;
+}
+
+static bool fat16_parse_boot(VFSS_TYPE* vfss)
+{
+    unsigned long fat_clusters;
+    uint8_t* boot = vfss_read_sectors(vfss, 0, FAT_SECTOR_SIZE);
+    if (boot == NULL)
+        return false;
+    if (!fat16_parse_bpb(vfss, boot))
+    {
+        //FAT32 keeps copy of boot sector
+        boot = vfss_read_sectors(vfss, FAT32_BACKUP_BOOT_SECTOR, FAT_SECTOR_SIZE);
+        if (boot == NULL || !fat16_parse_bpb(vfss, boot) || !vfss->fat16.fat32)
+        {
+            error(ERROR_NOT_SUPPORTED);
+#if (VFS_DEBUG_ERRORS)
+            printf("FAT16: Unsupported boot sector\n");
+#endif //VFS_DEBUG_ERRORS
+            return false;
+        }
+#if (VFS_DEBUG_ERRORS)
+        printf("FAT32: Warning: using backup boot sector\n");
+#endif //VFS_DEBUG_ERRORS
+    }
+    if (vfss->fat16.sectors_count > vfss_get_volume_sectors(vfss) || vfss->fat16.sectors_count == 0 || vfss->fat16.cluster_sectors == 0 ||
+        vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * vfss->fat16.fat_count + vfss->fat16.root_sectors >= vfss->fat16.sectors_count)
     {
         error(ERROR_CORRUPTED);
 #if (VFS_DEBUG_ERRORS)
@@ -265,34 +612,70 @@ static bool fat16_parse_boot(VFSS_TYPE* vfss)
         return false;
     }
     vfss->fat16.clusters_count = (vfss->fat16.sectors_count - (vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * vfss->fat16.fat_count + vfss->fat16.root_sectors)) / vfss->fat16.cluster_sectors + 2;
+    //can't address more than FAT holds
+    fat_clusters = vfss->fat16.fat_sectors * fat16_fat_entries_in_sector(vfss);
+    if (vfss->fat16.clusters_count > fat_clusters)
+        vfss->fat16.clusters_count = fat_clusters;
+    if (vfss->fat16.fat32 && vfss->fat16.root_cluster >= vfss->fat16.clusters_count)
+    {
+        error(ERROR_CORRUPTED);
+#if (VFS_DEBUG_ERRORS)
+        printf("FAT32: Invalid root cluster\n");
+#endif //VFS_DEBUG_ERRORS
+        return false;
+    }
     vfss->fat16.cluster_size = vfss->fat16.cluster_sectors * FAT_SECTOR_SIZE;
     vfss_resize_buf(vfss, vfss->fat16.cluster_size);
+#if (VFS_MAX_CHUNK_SECTORS)
+    vfss_resize_buf(vfss, VFS_MAX_CHUNK_SECTORS * FAT_SECTOR_SIZE);
+#endif //VFS_MAX_CHUNK_SECTORS
+    if (vfss->fat16.fat32)
+        fat16_read_fs_info(vfss);
 
 #if (VFS_DEBUG_INFO)
-    printf("FAT16 info:\n");
+    printf("%s info:\n", vfss->fat16.fat32 ? "FAT32" : "FAT16");
     printf("cluster size: %d\n", vfss->fat16.cluster_sectors * FAT_SECTOR_SIZE);
     printf("total sectors: %d\n", vfss->fat16.sectors_count);
-    printf("serial No: %08X\n", bpb->serial);
 #endif //VFS_DEBUG_INFO
 
     return true;
 }
 
-static void fat16_fi_create(FAT16_FILE_INFO* fi, unsigned int first_cluster)
+//FAT32 root is cluster chain, but still addressed as VFS_ROOT
+static void fat16_fi_reset(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi)
 {
-    fi->first_cluster = fi->current_cluster = first_cluster;
-    fi->cluster_num = fi->pos = 0;
+    fi->current_cluster = fi->first_cluster == VFS_ROOT ? vfss->fat16.root_cluster : fi->first_cluster;
+    fi->cluster_num = 0;
 }
 
-static void fat16_fi_reset(FAT16_FILE_INFO* fi)
+static void fat16_fi_create(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, unsigned int first_cluster)
 {
-    fi->current_cluster = fi->first_cluster;
-    fi->cluster_num = 0;
+    fi->first_cluster = first_cluster;
+    fi->pos = 0;
+    fat16_fi_reset(vfss, fi);
+}
+
+static inline bool fat16_fi_fixed_root(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi)
+{
+    return fi->first_cluster == VFS_ROOT && !vfss->fat16.fat32;
+}
+
+static inline unsigned long fat16_entry_get_cluster(VFSS_TYPE* vfss, FAT_FILE_ENTRY* entry)
+{
+    if (vfss->fat16.fat32)
+        return ((unsigned long)entry->first_cluster_hi << 16) | entry->first_cluster;
+    return entry->first_cluster;
+}
+
+static inline void fat16_entry_set_cluster(FAT_FILE_ENTRY* entry, unsigned long cluster)
+{
+    entry->first_cluster = cluster & 0xffff;
+    entry->first_cluster_hi = cluster >> 16;
 }
 
 static bool fat16_fi_get_cluster_num(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, unsigned int cluster_num)
 {
-    for(fat16_fi_reset(fi); fi->current_cluster < FAT_CLUSTER_RESERVED && fi->cluster_num < cluster_num; ++fi->cluster_num)
+    for(fat16_fi_reset(vfss, fi); fi->current_cluster < FAT_CLUSTER_RESERVED && fi->cluster_num < cluster_num; ++fi->cluster_num)
         fi->current_cluster = fat16_get_fat_next(vfss, fi->current_cluster);
     return fi->current_cluster < FAT_CLUSTER_RESERVED;
 }
@@ -301,7 +684,7 @@ static bool fat16_fi_get_cluster_num(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, unsig
 static unsigned int fat16_entry_get_sector_num(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi)
 {
     unsigned int cluster_num;
-    if (fi->first_cluster == VFS_ROOT)
+    if (fat16_fi_fixed_root(vfss, fi))
     {
         if (fi->pos >= vfss->fat16.root_count)
             return FAT_CLUSTER_RESERVED;
@@ -331,7 +714,7 @@ static unsigned int fat16_entry_get_sector_num(VFSS_TYPE* vfss, FAT16_FILE_INFO*
 
 static unsigned int fat16_entry_get_sector_by_num(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, unsigned int sector_num)
 {
-    if (fi->first_cluster == VFS_ROOT)
+    if (fat16_fi_fixed_root(vfss, fi))
         return vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * vfss->fat16.fat_count + sector_num;
 
     return fat16_cluster_to_sector(vfss, fi->current_cluster) + sector_num;
@@ -344,7 +727,7 @@ static FAT_FILE_ENTRY* fat16_read_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* f
     sector_num = fat16_entry_get_sector_num(vfss, fi);
     if (sector_num >= FAT_CLUSTER_RESERVED)
         return NULL;
-    if (fi->first_cluster == VFS_ROOT)
+    if (fat16_fi_fixed_root(vfss, fi))
         pos_cur = fi->pos - sector_num * FILE_ENTRIES_IN_SECTOR;
     else
         pos_cur = fi->pos - (fi->cluster_num * vfss->fat16.cluster_sectors + sector_num) * FILE_ENTRIES_IN_SECTOR;
@@ -363,8 +746,7 @@ static FAT_FILE_ENTRY* fat16_init_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* f
     memset(entry->name, ' ', 11);
     entry->attr = 0;
     entry->sys_attr = 0;
-    entry->security = 0;
-    entry->first_cluster = 0;
+    fat16_entry_set_cluster(entry, 0);
     entry->size = 0;
     entry->crt_ztime = fat16_ztime_now();
     entry->crt_date = entry->mod_date = entry->acc_date = fat16_fat_date_now();
@@ -386,7 +768,7 @@ static bool fat16_allocate_file_entries(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, un
     unsigned int i;
     unsigned long next_cluster;
     FAT_FILE_ENTRY* entry;
-    fat16_fi_reset(fi);
+    fat16_fi_reset(vfss, fi);
     for(fi->pos = 0, i = 0; i < count; ++fi->pos)
     {
         if ((entry = fat16_read_file_entry(vfss, fi)) == NULL)
@@ -403,7 +785,7 @@ static bool fat16_allocate_file_entries(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, un
     if (i == count)
         return true;
     //no hole? append.
-    if (fi->first_cluster == VFS_ROOT)
+    if (fat16_fi_fixed_root(vfss, fi))
     {
         if (fi->pos + count >= vfss->fat16.root_count)
         {
@@ -420,10 +802,15 @@ static bool fat16_allocate_file_entries(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, un
         //need more cluster?
         if (i <= count)
         {
-            if ((next_cluster = fat16_occupy_next_cluster(vfss, fi->current_cluster)) >= FAT_CLUSTER_RESERVED)
+            if (!fat16_journal_add(vfss, FAT_JOURNAL_EXTEND, fi->first_cluster, 0, fi->current_cluster))
+                return false;
+            if ((next_cluster = fat16_occupy_next_cluster(vfss, fi->current_cluster, 1)) >= FAT_CLUSTER_RESERVED)
                 return false;
             if (!vfss_zero_sectors(vfss, fat16_cluster_to_sector(vfss, next_cluster), vfss->fat16.cluster_sectors))
                 return false;
+            //rare, commit now. Rollback of extension never drops entries, written after it
+            if (!fat16_sync(vfss))
+                return false;
         }
     }
     return true;
@@ -587,7 +974,7 @@ static unsigned int fat16_decode_attr(unsigned int fat_attr)
 static bool fat16_find_by_name(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, const char* name, unsigned int mask, unsigned int ignore_mask)
 {
     char name_cur[VFS_MAX_FILE_PATH + 1];
-    fat16_fi_reset(fi);
+    fat16_fi_reset(vfss, fi);
     for (fi->pos = 0; fat16_get_file_name(vfss, name_cur, fi, mask, ignore_mask); ++fi->pos)
     {
         if (strcmp(name_cur, name) == 0)
@@ -599,7 +986,7 @@ static bool fat16_find_by_name(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, const char*
 static bool fat16_find_by_name83(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, const char* name83)
 {
     FAT_FILE_ENTRY* entry;
-    fat16_fi_reset(fi);
+    fat16_fi_reset(vfss, fi);
     for (fi->pos = 0; (entry = fat16_read_file_entry(vfss, fi)) != NULL; ++fi->pos)
     {
          if ((uint8_t)(entry->name[0]) == FAT_FILE_ENTRY_EMPTY)
@@ -624,7 +1011,7 @@ static bool fat16_get_by_name(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, const char*
         return false;
     }
     entry = fat16_read_file_entry(vfss, fi);
-    fat16_fi_create(fi, entry->first_cluster);
+    fat16_fi_create(vfss, fi, fat16_entry_get_cluster(vfss, entry));
     return true;
 }
 
@@ -645,13 +1032,13 @@ static bool fat16_get_path(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, char* path)
     //root only path
     if (path[0] == '\x0')
     {
-        fat16_fi_create(fi, VFS_ROOT);
+        fat16_fi_create(vfss, fi, VFS_ROOT);
         return true;
     }
     //starting from root
     if (path[0] == VFS_FOLDER_DELIMITER)
     {
-        fat16_fi_create(fi, VFS_ROOT);
+        fat16_fi_create(vfss, fi, VFS_ROOT);
         path++;
     }
     while (path[0] != '\x0')
@@ -738,7 +1125,7 @@ static bool fat16_is_folder_empty(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi)
     entry = fat16_read_file_entry(vfss, fi);
     if (entry == NULL)
         return false;
-    fat16_fi_create(&folder_fi, entry->first_cluster);
+    fat16_fi_create(vfss, &folder_fi, fat16_entry_get_cluster(vfss, entry));
     //can't erase root folder
     if (folder_fi.first_cluster == VFS_ROOT)
         return false;
@@ -820,7 +1207,7 @@ static bool fat16_create_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, char*
         return false;
     }
 
-    if ((fat16_get_free(vfss)/vfss->fat16.cluster_size) < 2)
+    if (vfss->fat16.free_count < 2)
     {
         error(ERROR_FULL);
         return false;
@@ -841,9 +1228,7 @@ static bool fat16_create_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, char*
     }
     else
         ext_case = FAT16_UPPER_CASE;
-    first_cluster = fat16_occupy_first_cluster(vfss);
-    if (first_cluster >= FAT_CLUSTER_RESERVED)
-        return false;
+    first_cluster = FAT_CLUSTER_RESERVED;
     do {
         //need lfn?
         if (name_case == FAT16_MIXED_CASE || ext_case == FAT16_MIXED_CASE)
@@ -889,6 +1274,10 @@ static bool fat16_create_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, char*
             if (!fat16_allocate_file_entries(vfss, fi, 1))
                 break;
         }
+        //occupy after entries allocation, which can commit batch
+        first_cluster = fat16_occupy_first_cluster(vfss, fi->first_cluster);
+        if (first_cluster >= FAT_CLUSTER_RESERVED)
+            break;
         //write short entry
         entry = fat16_init_file_entry(vfss, fi);
         if (entry == NULL)
@@ -899,14 +1288,18 @@ static bool fat16_create_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, char*
             entry->sys_attr |= FAT_FILE_SYS_ATTR_NAME_LOWER_CASE;
         if (ext_case == FAT16_LOWER_CASE)
             entry->sys_attr |= FAT_FILE_SYS_ATTR_EXT_LOWER_CASE;
-        entry->first_cluster = first_cluster;
+        fat16_entry_set_cluster(entry, first_cluster);
         if (!fat16_write_file_entry(vfss, fi))
             break;
         return true;
     } while (false);
 
-    //error occured, free occupied cluster
-    fat16_release_chain(vfss, first_cluster);
+    //error occured, free occupied cluster. Commit, so cluster can't be reused while create intent is logged
+    if (first_cluster < FAT_CLUSTER_RESERVED)
+    {
+        fat16_release_chain(vfss, first_cluster);
+        fat16_sync(vfss);
+    }
     return false;
 }
 
@@ -943,13 +1336,214 @@ static bool fat16_remove_file_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi)
     }
 }
 
+#if (VFS_FAT_JOURNAL)
+//entry of file in folder, by first cluster
+static FAT_FILE_ENTRY* fat16_journal_find_entry(VFSS_TYPE* vfss, FAT16_FILE_INFO* fi, unsigned long folder, unsigned long first_cluster)
+{
+    FAT_FILE_ENTRY* entry;
+    fat16_fi_create(vfss, fi, folder);
+    for (; (entry = fat16_read_file_entry(vfss, fi)) != NULL; ++fi->pos)
+    {
+        if ((uint8_t)(entry->name[0]) == FAT_FILE_ENTRY_EMPTY)
+            return NULL;
+        //skip erased, dot entries, LFN chunks and label
+        if ((uint8_t)(entry->name[0]) == FAT_FILE_ENTRY_MAGIC_ERASED || entry->name[0] == '.' || (entry->attr & FAT_FILE_ATTR_LABEL))
+            continue;
+        if (fat16_entry_get_cluster(vfss, entry) == first_cluster)
+            return entry;
+    }
+    return NULL;
+}
+
+static inline bool fat16_journal_is_cluster(VFSS_TYPE* vfss, unsigned long cluster)
+{
+    return cluster >= 2 && cluster < vfss->fat16.clusters_count;
+}
+
+//stops on already free cluster, chain can be partially released
+static void fat16_journal_release(VFSS_TYPE* vfss, unsigned long cluster)
+{
+    unsigned long next;
+    while (fat16_journal_is_cluster(vfss, cluster))
+    {
+        next = fat16_get_fat_value(vfss, cluster);
+        if (next == FAT_CLUSTER_FREE || !fat16_set_fat_value(vfss, cluster, FAT_CLUSTER_FREE))
+            return;
+        cluster = next;
+    }
+}
+
+//keep count clusters of chain, release rest
+static void fat16_journal_truncate(VFSS_TYPE* vfss, unsigned long cluster, unsigned long count)
+{
+    unsigned long next;
+    for (; count > 1; --count)
+    {
+        cluster = fat16_get_fat_value(vfss, cluster);
+        if (!fat16_journal_is_cluster(vfss, cluster))
+            return;
+    }
+    next = fat16_get_fat_value(vfss, cluster);
+    if (!fat16_journal_is_cluster(vfss, next) || !fat16_set_fat_value(vfss, cluster, FAT_CLUSTER_LAST))
+        return;
+    fat16_journal_release(vfss, next);
+}
+
+static void fat16_journal_undo(VFSS_TYPE* vfss, FAT_JOURNAL_INTENT* intent)
+{
+    FAT16_FILE_INFO fi, folder_fi;
+    FAT_FILE_ENTRY* entry;
+    unsigned long cluster, count, size;
+    switch (intent->op)
+    {
+    case FAT_JOURNAL_CREATE:
+        entry = fat16_journal_find_entry(vfss, &fi, intent->folder, intent->first_cluster);
+        //folder is complete with dot entry only
+        if (entry != NULL && (entry->attr & FAT_FILE_ATTR_SUBFOLDER))
+        {
+            fat16_fi_create(vfss, &folder_fi, intent->first_cluster);
+            entry = fat16_read_file_entry(vfss, &folder_fi);
+            if (entry == NULL || entry->name[0] != '.')
+            {
+                if (!fat16_remove_file_entry(vfss, &fi))
+                    break;
+                entry = NULL;
+            }
+        }
+        if (entry == NULL)
+            fat16_journal_release(vfss, intent->first_cluster);
+        break;
+    case FAT_JOURNAL_APPEND:
+        //not created or removed, other intent will handle
+        entry = fat16_journal_find_entry(vfss, &fi, intent->folder, intent->first_cluster);
+        if (entry == NULL)
+            break;
+        size = entry->size;
+        //clusters before append are committed
+        for (cluster = intent->first_cluster, count = 1; cluster != intent->cluster && count < vfss->fat16.clusters_count; ++count)
+        {
+            cluster = fat16_get_fat_value(vfss, cluster);
+            if (!fat16_journal_is_cluster(vfss, cluster))
+                return;
+        }
+        if (count < (size + vfss->fat16.cluster_size - 1) / vfss->fat16.cluster_size)
+            count = (size + vfss->fat16.cluster_size - 1) / vfss->fat16.cluster_size;
+        fat16_journal_truncate(vfss, intent->first_cluster, count);
+        break;
+    case FAT_JOURNAL_EXTEND:
+        fat16_journal_truncate(vfss, intent->cluster, 1);
+        break;
+    case FAT_JOURNAL_REMOVE:
+        //roll forward
+        if (fat16_journal_find_entry(vfss, &fi, intent->folder, intent->first_cluster) != NULL && !fat16_remove_file_entry(vfss, &fi))
+            break;
+        fat16_journal_release(vfss, intent->first_cluster);
+        break;
+    default:
+        break;
+    }
+}
+#endif //VFS_FAT_JOURNAL
+
+//roll back half-finished operations of last batch before mount
+static bool fat16_journal_open(VFSS_TYPE* vfss)
+{
+#if (VFS_FAT_JOURNAL)
+    FAT_JOURNAL_HEADER* hdr;
+    FAT_JOURNAL_INTENT intent;
+    unsigned int count, i;
+    unsigned long sector = vfss->fat16.fat32 ? FAT32_JOURNAL_SECTOR : FAT16_JOURNAL_SECTOR;
+    vfss->fat16.journal_sector = 0;
+    vfss->fat16.journal_count = 0;
+    //ordered write back still works, but crash in the middle of operation can leave lost clusters
+    if (sector >= vfss->fat16.reserved_sectors || sector == vfss->fat16.fs_info_sector)
+    {
+#if (VFS_DEBUG_ERRORS)
+        printf("FAT16: no free reserved sector, journal disabled\n");
+#endif //VFS_DEBUG_ERRORS
+        return true;
+    }
+    hdr = vfss_read_sectors(vfss, sector, FAT_SECTOR_SIZE);
+    if (hdr == NULL)
+        return false;
+    if (hdr->magic != FAT_JOURNAL_MAGIC)
+    {
+        //don't overwrite foreign data, boot code for example
+        for (i = 0; i < FAT_SECTOR_SIZE && ((uint8_t*)hdr)[i] == 0; ++i) {}
+        if (i == FAT_SECTOR_SIZE)
+            vfss->fat16.journal_sector = sector;
+#if (VFS_DEBUG_ERRORS)
+        else
+            printf("FAT16: reserved sector is used, journal disabled\n");
+#endif //VFS_DEBUG_ERRORS
+        return true;
+    }
+    vfss->fat16.journal_sector = sector;
+    if (hdr->count == 0)
+        return true;
+    count = hdr->count;
+    if (count > FAT_JOURNAL_INTENTS_MAX || hdr->checksum != fat16_journal_checksum(hdr))
+    {
+#if (VFS_DEBUG_ERRORS)
+        printf("FAT16: journal corrupted\n");
+#endif //VFS_DEBUG_ERRORS
+        count = 0;
+    }
+#if (VFS_DEBUG_INFO)
+    printf("FAT16: journal recovery, %d intents\n", count);
+#endif //VFS_DEBUG_INFO
+    //in reverse order. Buffer is reused on each step
+    for (i = count; i > 0; --i)
+    {
+        hdr = vfss_read_sectors(vfss, sector, FAT_SECTOR_SIZE);
+        if (hdr == NULL)
+            return false;
+        memcpy(&intent, (FAT_JOURNAL_INTENT*)(hdr + 1) + i - 1, sizeof(FAT_JOURNAL_INTENT));
+        fat16_journal_undo(vfss, &intent);
+    }
+    //mirrors are stale after power loss, primary FAT is ordered by journal
+    if (!fat16_mirror_fat(vfss, 0, vfss->fat16.fat_sectors - 1))
+        return false;
+    fat16_fat_dirty_reset(vfss);
+    //FSInfo hints are stale too
+    if (vfss->fat16.fat32)
+        vfss->fat16.free_count = FAT32_FS_INFO_UNKNOWN;
+    vfss->fat16.journal_count = 1;
+    return fat16_journal_clear(vfss);
+#else
+    return true;
+#endif //VFS_FAT_JOURNAL
+}
+
+//Sync point. Data is already on storage, then primary FAT, directory entries, FAT mirrors. Journal is cleared last
+bool fat16_sync(VFSS_TYPE* vfss)
+{
+    if (!vfss->fat16.active)
+        return true;
+    if (vfss->fat16.fat32 && !fat16_write_fs_info(vfss))
+        return false;
+    if (!vfss_flush(vfss))
+        return false;
+    if (vfss->fat16.fat_dirty_first <= vfss->fat16.fat_dirty_last)
+    {
+        if (!fat16_mirror_fat(vfss, vfss->fat16.fat_dirty_first, vfss->fat16.fat_dirty_last) || !vfss_flush(vfss))
+            return false;
+        fat16_fat_dirty_reset(vfss);
+    }
+    return fat16_journal_clear(vfss);
+}
+
 static void fat16_close_file(VFSS_TYPE* vfss, HANDLE h)
 {
-#if (VFS_FILE_ATTRIBUTES_UPDATE)
     FAT16_FILE_HANDLE_TYPE* f;
+#if (VFS_FILE_ATTRIBUTES_UPDATE)
     FAT_FILE_ENTRY* entry;
+#endif //VFS_FILE_ATTRIBUTES_UPDATE
     f = so_get(&vfss->fat16.file_handles, h);
-    if (f)
+    if (f == NULL)
+        return;
+    array_destroy(&f->extents);
+#if (VFS_FILE_ATTRIBUTES_UPDATE)
     {
         entry = fat16_read_file_entry(vfss, &f->fi);
         if (entry)
@@ -964,9 +1558,61 @@ static void fat16_close_file(VFSS_TYPE* vfss, HANDLE h)
         }
     }
 #endif //VFS_FILE_ATTRIBUTES_UPDATE
+    //close is sync point
+    fat16_sync(vfss);
     so_free(&vfss->fat16.file_handles, h);
 }
 
+static bool fat16_build_free_map(VFSS_TYPE* vfss)
+{
+    unsigned long cluster, sector, sectors_count, fat_sectors, i;
+    void* fat;
+    if (vfss->fat16.fat32)
+    {
+        //FAT32 bitmap is too large for RAM. Use FSInfo hints, count only if not provided
+        if (vfss->fat16.free_count != FAT32_FS_INFO_UNKNOWN)
+            return true;
+    }
+    else
+    {
+        vfss->fat16.free_map = malloc(((vfss->fat16.clusters_count + 31) >> 5) * sizeof(uint32_t));
+        if (vfss->fat16.free_map == NULL)
+            return false;
+        memset(vfss->fat16.free_map, 0x00, ((vfss->fat16.clusters_count + 31) >> 5) * sizeof(uint32_t));
+    }
+    vfss->fat16.free_count = 0;
+    fat_sectors = (vfss->fat16.clusters_count + fat16_fat_entries_in_sector(vfss) - 1) / fat16_fat_entries_in_sector(vfss);
+    //whole cluster size buffer per read
+    for (sector = 0; sector < fat_sectors; sector += sectors_count)
+    {
+        sectors_count = fat_sectors - sector;
+        if (sectors_count > vfss->fat16.cluster_sectors)
+            sectors_count = vfss->fat16.cluster_sectors;
+        fat = vfss_read_sectors(vfss, vfss->fat16.reserved_sectors + sector, sectors_count * FAT_SECTOR_SIZE);
+        if (fat == NULL)
+        {
+            free(vfss->fat16.free_map);
+            vfss->fat16.free_map = NULL;
+            return false;
+        }
+        cluster = sector * fat16_fat_entries_in_sector(vfss);
+        for (i = 0; i < sectors_count * fat16_fat_entries_in_sector(vfss) && cluster < vfss->fat16.clusters_count; ++i, ++cluster)
+        {
+            if (cluster >= 2 && fat16_decode_fat_value(vfss, fat, i) == FAT_CLUSTER_FREE)
+            {
+                if (vfss->fat16.free_map)
+                    vfss->fat16.free_map[cluster >> 5] |= 1ul << (cluster & 31);
+                ++vfss->fat16.free_count;
+            }
+        }
+    }
+    vfss->fat16.fs_info_dirty = vfss->fat16.fat32;
+#if (VFS_DEBUG_INFO)
+    printf("free clusters: %d\n", vfss->fat16.free_count);
+#endif //VFS_DEBUG_INFO
+    return true;
+}
+
 static inline void fat16_mount(VFSS_TYPE* vfss)
 {
     if (vfss->fat16.active)
@@ -974,7 +1620,8 @@ static inline void fat16_mount(VFSS_TYPE* vfss)
         error(ERROR_ALREADY_CONFIGURED);
         return;
     }
-    if (fat16_parse_boot(vfss))
+    fat16_fat_dirty_reset(vfss);
+    if (fat16_parse_boot(vfss) && fat16_journal_open(vfss) && fat16_build_free_map(vfss))
         vfss->fat16.active = true;
 }
 
@@ -987,6 +1634,9 @@ static void fat16_unmount(VFSS_TYPE* vfss)
     //2. free file_handles
     while((handle = so_first(&vfss->fat16.file_handles)) != INVALID_HANDLE)
         fat16_close_file(vfss, handle);
+    fat16_sync(vfss);
+    free(vfss->fat16.free_map);
+    vfss->fat16.free_map = NULL;
     vfss->fat16.active = false;
 }
 
@@ -999,7 +1649,7 @@ static inline void fat16_find_first(VFSS_TYPE* vfss, unsigned int folder, HANDLE
     if (h == INVALID_HANDLE)
         return;
     fi = so_get(&vfss->fat16.finds, h);
-    fat16_fi_create(fi, folder);
+    fat16_fi_create(vfss, fi, folder);
     ipc_post_inline(process, HAL_CMD(HAL_VFS, VFS_FIND_FIRST), folder, h, 0);
     error(ERROR_SYNC);
 }
@@ -1021,7 +1671,7 @@ static inline void fat16_find_next(VFSS_TYPE* vfss, IPC* ipc)
         return;
     }
     entry = fat16_read_file_entry(vfss, fi);
-    find->item = entry->first_cluster;
+    find->item = fat16_entry_get_cluster(vfss, entry);
     find->size = entry->size;
     find->attr = fat16_decode_attr(entry->attr);
     ++fi->pos;
@@ -1040,7 +1690,7 @@ static inline void fat16_cd_up(VFSS_TYPE* vfss, unsigned int folder, HANDLE proc
 {
     FAT16_FILE_INFO fi;
 
-    fat16_fi_create(&fi, folder);
+    fat16_fi_create(vfss, &fi, folder);
     if (!fat16_get_parent_folder(vfss, &fi))
         return;
     ipc_post_inline(process, HAL_CMD(HAL_VFS, VFS_CD_UP), folder, fi.first_cluster, 0);
@@ -1050,7 +1700,7 @@ static inline void fat16_cd_up(VFSS_TYPE* vfss, unsigned int folder, HANDLE proc
 static inline void fat16_cd_path(VFSS_TYPE* vfss, unsigned int folder, IO* io, HANDLE process)
 {
     FAT16_FILE_INFO fi;
-    fat16_fi_create(&fi, folder);
+    fat16_fi_create(vfss, &fi, folder);
     char* path = io_data(io);
     if (strlen(path) > VFS_MAX_FILE_PATH)
     {
@@ -1072,7 +1722,7 @@ static inline void fat16_read_volume_label(VFSS_TYPE* vfss, IPC* ipc)
     IO* io = (IO*)ipc->param2;
 
     name = io_data(io);
-    fat16_fi_create(&fi, VFS_ROOT);
+    fat16_fi_create(vfss, &fi, VFS_ROOT);
     if (!fat16_get_file_name(vfss, name, &fi, FAT_FILE_ATTR_LABEL, FAT_FILE_ATTR_DOT_OR_DOT_DOT))
     {
         error(ERROR_NOT_FOUND);
@@ -1100,7 +1750,7 @@ static inline void fat16_open_file(VFSS_TYPE* vfss, unsigned int folder, IO* io,
         return;
     }
 #endif //VFS_MAX_HANDLES
-    fat16_fi_create(&fi, folder);
+    fat16_fi_create(vfss, &fi, folder);
     ot = io_data(io);
     if (strlen(ot->name) > VFS_MAX_FILE_PATH || (ot->mode & (VFS_MODE_READ | VFS_MODE_WRITE)) == 0)
     {
@@ -1134,9 +1784,15 @@ static inline void fat16_open_file(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     if (h == INVALID_HANDLE)
         return;
     f = so_get(&vfss->fat16.file_handles, h);
+    if (array_create(&f->extents, sizeof(FAT16_EXTENT), 1) == NULL)
+    {
+        so_free(&vfss->fat16.file_handles, h);
+        return;
+    }
+    f->mapped = 0;
     memcpy(&f->fi, &fi, sizeof(FAT16_FILE_INFO));
     entry = fat16_read_file_entry(vfss, &fi);
-    fat16_fi_create(&f->data, entry->first_cluster);
+    fat16_fi_create(vfss, &f->data, fat16_entry_get_cluster(vfss, entry));
     f->size = entry->size;
     f->mode = ot->mode;
 
@@ -1146,6 +1802,85 @@ static inline void fat16_open_file(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     error(ERROR_SYNC);
 }
 
+static bool fat16_extent_append(FAT16_FILE_HANDLE_TYPE* f, unsigned int cluster)
+{
+    FAT16_EXTENT* ext;
+    if (f->mapped)
+    {
+        ext = array_at(f->extents, array_size(f->extents) - 1);
+        if (ext->cluster + ext->count == cluster)
+        {
+            ++ext->count;
+            ++f->mapped;
+            return true;
+        }
+    }
+    ext = array_append(&f->extents);
+    if (ext == NULL)
+        return false;
+    ext->cluster_num = f->mapped;
+    ext->cluster = cluster;
+    ext->count = 1;
+    ++f->mapped;
+    return true;
+}
+
+static inline unsigned int fat16_extent_last_cluster(FAT16_FILE_HANDLE_TYPE* f)
+{
+    FAT16_EXTENT* ext = array_at(f->extents, array_size(f->extents) - 1);
+    return ext->cluster + ext->count - 1;
+}
+
+//walk FAT chain only for not mapped yet part of file
+static bool fat16_extent_map(VFSS_TYPE* vfss, FAT16_FILE_HANDLE_TYPE* f, unsigned int cluster_num)
+{
+    unsigned long cluster;
+    while (f->mapped <= cluster_num)
+    {
+        if (f->mapped)
+            cluster = fat16_get_fat_value(vfss, fat16_extent_last_cluster(f));
+        else
+            cluster = f->data.first_cluster;
+        if (cluster < 2 || cluster >= FAT_CLUSTER_RESERVED)
+            return false;
+        if (!fat16_extent_append(f, cluster))
+            return false;
+    }
+    return true;
+}
+
+static FAT16_EXTENT* fat16_extent_find(VFSS_TYPE* vfss, FAT16_FILE_HANDLE_TYPE* f, unsigned int cluster_num)
+{
+    unsigned int lo, hi, mid;
+    if (!fat16_extent_map(vfss, f, cluster_num))
+        return NULL;
+    //last extent with cluster_num not above required
+    for (lo = 0, hi = array_size(f->extents) - 1; lo < hi; )
+    {
+        mid = (lo + hi + 1) / 2;
+        if (((FAT16_EXTENT*)array_at(f->extents, mid))->cluster_num <= cluster_num)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+    return array_at(f->extents, lo);
+}
+
+//data sector of current position and count of contiguous sectors, starting from it
+static bool fat16_data_sector(VFSS_TYPE* vfss, FAT16_FILE_HANDLE_TYPE* f, unsigned long* sector, unsigned int* sectors_count)
+{
+    FAT16_EXTENT* ext;
+    unsigned int cluster_num, cluster_sector;
+    cluster_num = f->data.pos / vfss->fat16.cluster_size;
+    ext = fat16_extent_find(vfss, f, cluster_num);
+    if (ext == NULL)
+        return false;
+    cluster_sector = (f->data.pos % vfss->fat16.cluster_size) / FAT_SECTOR_SIZE;
+    *sector = fat16_cluster_to_sector(vfss, ext->cluster + cluster_num - ext->cluster_num) + cluster_sector;
+    *sectors_count = (ext->cluster_num + ext->count - cluster_num) * vfss->fat16.cluster_sectors - cluster_sector;
+    return true;
+}
+
 static inline void fat16_seek_file(VFSS_TYPE* vfss, HANDLE h, unsigned int pos)
 {
     FAT16_FILE_HANDLE_TYPE* f;
@@ -1161,17 +1896,15 @@ static inline void fat16_seek_file(VFSS_TYPE* vfss, HANDLE h, unsigned int pos)
         cluster_num = (f->size - 1) / vfss->fat16.cluster_size;
     else
         cluster_num = f->data.pos / vfss->fat16.cluster_size;
-    if (!fat16_fi_get_cluster_num(vfss, &f->data, cluster_num))
-    {
-        fat16_fi_reset(&f->data);
+    if (fat16_extent_find(vfss, f, cluster_num) == NULL)
         f->data.pos = 0;
-    }
 }
 
 static inline void fat16_read_file(VFSS_TYPE* vfss, HANDLE h, IO* io, unsigned int size, HANDLE process)
 {
     FAT16_FILE_HANDLE_TYPE* f;
-    unsigned int cluster_offset, sector_offset, chunk, sector, sectors_count, next_cluster;
+    unsigned int sector_offset, chunk, sectors_count;
+    unsigned long sector;
     uint8_t* buf;
     f = so_get(&vfss->fat16.file_handles, h);
     if (f == NULL)
@@ -1192,33 +1925,30 @@ static inline void fat16_read_file(VFSS_TYPE* vfss, HANDLE h, IO* io, unsigned i
     buf = vfss_get_buf(vfss);
     while(size)
     {
-        cluster_offset = f->data.pos % vfss->fat16.cluster_size;
-        sector_offset = cluster_offset % FAT_SECTOR_SIZE;
-        sector = cluster_offset / FAT_SECTOR_SIZE;
-        sectors_count = (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
-        if (sectors_count + sector > vfss->fat16.cluster_sectors)
-            sectors_count = vfss->fat16.cluster_sectors - sector;
+        if (!fat16_data_sector(vfss, f, &sector, &sectors_count))
+        {
+#if (VFS_DEBUG_ERRORS)
+            printf("FAT16 warning: FAT corrupted\n");
+#endif //VFS_DEBUG_ERRORS
+            error(ERROR_CORRUPTED);
+            f->data.pos = 0;
+            return;
+        }
+        //contiguous clusters are readed at once
+        sector_offset = f->data.pos % FAT_SECTOR_SIZE;
+        if (sectors_count > (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE)
+            sectors_count = (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+        if (sectors_count > vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE)
+            sectors_count = vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE;
         chunk = sectors_count * FAT_SECTOR_SIZE - sector_offset;
         if (chunk > size)
             chunk = size;
 
-        if (vfss_read_sectors(vfss, fat16_cluster_to_sector(vfss, f->data.current_cluster) + sector, sectors_count * FAT_SECTOR_SIZE) == NULL)
+        if (vfss_read_sectors(vfss, sector, sectors_count * FAT_SECTOR_SIZE) == NULL)
             return;
         io_data_append(io, buf + sector_offset, chunk);
         size -= chunk;
         f->data.pos += chunk;
-        if ((f->data.pos < f->size) && ((f->data.pos % vfss->fat16.cluster_size) == 0))
-        {
-            next_cluster = fat16_get_fat_next(vfss, f->data.current_cluster);
-            if (next_cluster >= FAT_CLUSTER_RESERVED)
-            {
-                fat16_fi_reset(&f->data);
-                f->data.pos = 0;
-                return;
-            }
-            else
-                f->data.current_cluster = next_cluster;
-        }
     }
     io_complete(process, HAL_IO_CMD(HAL_VFS, IPC_READ), h, io);
     error(ERROR_SYNC);
@@ -1238,7 +1968,7 @@ static bool fat16_is_enouth_space(VFSS_TYPE* vfss, uint32_t curr_pos, uint32_t c
     uint32_t need_clusters =fat16_size_to_clusters(vfss, curr_pos + size);
     if(curr_clusters >=need_clusters)
         return true;
-    if((need_clusters - curr_clusters ) > (fat16_get_free(vfss) / vfss->fat16.cluster_size))
+    if((need_clusters - curr_clusters ) > vfss->fat16.free_count)
             return false;
     return true;
 }
@@ -1249,7 +1979,8 @@ static inline void fat16_write_file(VFSS_TYPE* vfss, HANDLE h, IO* io, HANDLE pr
     FAT_FILE_ENTRY* entry;
     uint8_t* data;
     uint8_t* buf;
-    unsigned int cluster_offset, sector_offset, chunk, sector, sectors_count, next_cluster, size;
+    unsigned int sector_offset, chunk, sectors_count, next_cluster, size;
+    unsigned long sector;
     f = so_get(&vfss->fat16.file_handles, h);
     if (f == NULL)
         return;
@@ -1269,29 +2000,42 @@ static inline void fat16_write_file(VFSS_TYPE* vfss, HANDLE h, IO* io, HANDLE pr
     buf = vfss_get_buf(vfss);
     for (size = io->data_size; size; size -= chunk)
     {
-        cluster_offset = f->data.pos % vfss->fat16.cluster_size;
-        sector_offset = cluster_offset % FAT_SECTOR_SIZE;
-        sector = cluster_offset / FAT_SECTOR_SIZE;
-        sectors_count = (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
-        if (sectors_count + sector > vfss->fat16.cluster_sectors)
-            sectors_count = vfss->fat16.cluster_sectors - sector;
-        chunk = sectors_count * FAT_SECTOR_SIZE - sector_offset;
-        if (chunk > size)
-            chunk = size;
-
         //append cluster. Empty file already have one
-        if ((f->data.pos == f->size) && (cluster_offset == 0) && f->size)
+        if ((f->data.pos == f->size) && ((f->data.pos % vfss->fat16.cluster_size) == 0) && f->size &&
+            !fat16_extent_map(vfss, f, f->data.pos / vfss->fat16.cluster_size))
         {
-            next_cluster = fat16_occupy_next_cluster(vfss, f->data.current_cluster);
+            if (f->mapped != f->data.pos / vfss->fat16.cluster_size)
+                break;
+            if (!fat16_journal_add(vfss, FAT_JOURNAL_APPEND, f->fi.first_cluster, f->data.first_cluster, fat16_extent_last_cluster(f)))
+                break;
+            next_cluster = fat16_occupy_next_cluster(vfss, fat16_extent_last_cluster(f), fat16_size_to_clusters(vfss, size));
             if (next_cluster >= FAT_CLUSTER_RESERVED)
                 break;
-            f->data.current_cluster = next_cluster;
+            if (!fat16_extent_append(f, next_cluster))
+                break;
         }
+        if (!fat16_data_sector(vfss, f, &sector, &sectors_count))
+        {
+#if (VFS_DEBUG_ERRORS)
+            printf("FAT16 warning: FAT corrupted\n");
+#endif //VFS_DEBUG_ERRORS
+            error(ERROR_CORRUPTED);
+            f->data.pos = 0;
+            break;
+        }
+        sector_offset = f->data.pos % FAT_SECTOR_SIZE;
+        if (sectors_count > (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE)
+            sectors_count = (size + sector_offset + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+        if (sectors_count > vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE)
+            sectors_count = vfss_get_buf_size(vfss) / FAT_SECTOR_SIZE;
+        chunk = sectors_count * FAT_SECTOR_SIZE - sector_offset;
+        if (chunk > size)
+            chunk = size;
 
         //readout first, no align
         if (sector_offset || (chunk % FAT_SECTOR_SIZE))
         {
-            if (vfss_read_sectors(vfss, fat16_cluster_to_sector(vfss, f->data.current_cluster) + sector, sectors_count * FAT_SECTOR_SIZE) == NULL)
+            if (vfss_read_sectors(vfss, sector, sectors_count * FAT_SECTOR_SIZE) == NULL)
                 break;
         }
 
@@ -1300,26 +2044,13 @@ static inline void fat16_write_file(VFSS_TYPE* vfss, HANDLE h, IO* io, HANDLE pr
         data += chunk;
 
         //writeback
-        if (!vfss_write_sectors(vfss, fat16_cluster_to_sector(vfss, f->data.current_cluster) + sector, sectors_count * FAT_SECTOR_SIZE))
+        if (!vfss_write_sectors(vfss, sector, sectors_count * FAT_SECTOR_SIZE))
             break;
 
         f->data.pos += chunk;
         //append to end of file
         if (f->data.pos > f->size)
             f->size = f->data.pos;
-
-        if ((f->data.pos < f->size) && ((f->data.pos % vfss->fat16.cluster_size) == 0))
-        {
-            next_cluster = fat16_get_fat_next(vfss, f->data.current_cluster);
-            if (next_cluster >= FAT_CLUSTER_RESERVED)
-            {
-                fat16_fi_reset(&f->data);
-                f->data.pos = 0;
-                break;
-            }
-            else
-                f->data.current_cluster = next_cluster;
-        }
     }
     //update file attributes
     entry = fat16_read_file_entry(vfss, &f->fi);
@@ -1343,7 +2074,7 @@ static inline void fat16_remove(VFSS_TYPE* vfss, unsigned int folder, IO* io, HA
     char* file_path;
     unsigned long first_cluster;
 
-    fat16_fi_create(&fi, folder);
+    fat16_fi_create(vfss, &fi, folder);
     file_path = io_data(io);
 
     if (strlen(file_path) > VFS_MAX_FILE_PATH)
@@ -1368,7 +2099,7 @@ static inline void fat16_remove(VFSS_TYPE* vfss, unsigned int folder, IO* io, HA
     entry = fat16_read_file_entry(vfss, &fi);
     if (entry == NULL)
         return;
-    first_cluster = entry->first_cluster;
+    first_cluster = fat16_entry_get_cluster(vfss, entry);
     if (entry->attr & FAT_FILE_ATTR_SUBFOLDER)
     {
         if (!fat16_is_folder_empty(vfss, &fi))
@@ -1377,10 +2108,15 @@ static inline void fat16_remove(VFSS_TYPE* vfss, unsigned int folder, IO* io, HA
             return;
         }
     }
+    if (!fat16_journal_add(vfss, FAT_JOURNAL_REMOVE, fi.first_cluster, first_cluster, 0))
+        return;
     if (!fat16_release_chain(vfss, first_cluster))
         return;
     if (!fat16_remove_file_entry(vfss, &fi))
         return;
+    //sync point, released clusters can be reused by data write, not ordered with metadata
+    if (!fat16_sync(vfss))
+        return;
 
     io->data_size = 0;
     io_complete(process, HAL_IO_CMD(HAL_VFS, VFS_REMOVE), folder, io);
@@ -1397,7 +2133,7 @@ static inline void fat16_mk_folder(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     char* path;
     char* file_path;
 
-    fat16_fi_create(&fi, folder);
+    fat16_fi_create(vfss, &fi, folder);
     file_path = io_data(io);
 
     if (strlen(file_path) > VFS_MAX_FILE_PATH)
@@ -1420,18 +2156,18 @@ static inline void fat16_mk_folder(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     entry = fat16_read_file_entry(vfss, &fi);
     if (entry == NULL)
         return;
-    first_cluster = entry->first_cluster;
+    first_cluster = fat16_entry_get_cluster(vfss, entry);
 
     //zero items cluster
     if (!vfss_zero_sectors(vfss, fat16_cluster_to_sector(vfss, first_cluster), vfss->fat16.cluster_sectors))
         return;
 
     //cd folder
-    fat16_fi_create(&folder_fi, first_cluster);
+    fat16_fi_create(vfss, &folder_fi, first_cluster);
     //mkdir .
     entry = fat16_init_file_entry(vfss, &folder_fi);
     entry->attr = FAT_FILE_ATTR_SUBFOLDER;
-    entry->first_cluster = first_cluster;
+    fat16_entry_set_cluster(entry, first_cluster);
     entry->name[0] = '.';
     if (!fat16_write_file_entry(vfss, &folder_fi))
         return;
@@ -1440,7 +2176,7 @@ static inline void fat16_mk_folder(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     folder_fi.pos = 1;
     entry = fat16_init_file_entry(vfss, &folder_fi);
     entry->attr = FAT_FILE_ATTR_SUBFOLDER;
-    entry->first_cluster = fi.first_cluster;
+    fat16_entry_set_cluster(entry, fi.first_cluster);
     entry->name[0] = entry->name[1] = '.';
     if (!fat16_write_file_entry(vfss, &folder_fi))
         return;
@@ -1450,6 +2186,108 @@ static inline void fat16_mk_folder(VFSS_TYPE* vfss, unsigned int folder, IO* io,
     error(ERROR_SYNC);
 }
 
+static bool fat16_format32(VFSS_TYPE* vfss, VFS_FAT_FORMAT_TYPE* format)
+{
+    unsigned long fat_sectors, clusters_count, volume_sectors, i;
+    FAT32_BOOT_SECTOR_BPB_TYPE* bpb;
+    FAT32_FS_INFO_TYPE* fs_info;
+    uint8_t* boot;
+    uint32_t* fat;
+    FAT16_FILE_INFO fi;
+    FAT_FILE_ENTRY* entry;
+
+    volume_sectors = vfss_get_volume_sectors(vfss);
+    //less clusters will be detected as FAT16 by other hosts
+    if (format->cluster_sectors == 0 || format->fat_count == 0 || volume_sectors / format->cluster_sectors < FAT32_CLUSTERS_MIN)
+    {
+        error(ERROR_INVALID_PARAMS);
+        return false;
+    }
+    clusters_count = (volume_sectors - FAT32_RESERVED_SECTORS + format->cluster_sectors - 1) / format->cluster_sectors;
+    fat_sectors = ((clusters_count + 2) * 4 + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
+    vfss->fat16.reserved_sectors = FAT32_RESERVED_SECTORS;
+#if (VFS_CLUSTER_ALIGN)
+    vfss->fat16.reserved_sectors += (format->cluster_sectors - ((FAT32_RESERVED_SECTORS + fat_sectors * format->fat_count) % format->cluster_sectors)) % format->cluster_sectors;
+#endif //VFS_CLUSTER_ALIGN
+    vfss->fat16.cluster_sectors = format->cluster_sectors;
+    vfss->fat16.cluster_size = format->cluster_sectors * FAT_SECTOR_SIZE;
+    vfss->fat16.fat_sectors = fat_sectors;
+    vfss->fat16.fat_count = format->fat_count;
+    vfss->fat16.root_count = vfss->fat16.root_sectors = 0;
+    vfss->fat16.fat32 = true;
+    vfss->fat16.root_cluster = 2;
+    vfss->fat16.fs_info_sector = FAT32_FS_INFO_SECTOR;
+    clusters_count = (volume_sectors - vfss->fat16.reserved_sectors - fat_sectors * format->fat_count) / format->cluster_sectors;
+
+    //zero reserved area, fat, root cluster
+    if (!vfss_zero_sectors(vfss, 0, vfss->fat16.reserved_sectors + fat_sectors * format->fat_count))
+        return false;
+    if (!vfss_zero_sectors(vfss, fat16_cluster_to_sector(vfss, vfss->fat16.root_cluster), vfss->fat16.cluster_sectors))
+        return false;
+
+    //generate boot sector, no boot code
+    boot = vfss_get_buf(vfss);
+    memset(boot, 0x00, FAT_SECTOR_SIZE);
+    memcpy(boot, __FAT16_BOOT, sizeof(FAT_BOOT_SECTOR_HEADER_TYPE));
+    boot[1] = sizeof(FAT_BOOT_SECTOR_HEADER_TYPE) + sizeof(FAT32_BOOT_SECTOR_BPB_TYPE) - 2;
+    *((uint16_t*)(boot + MBR_MAGIC_OFFSET)) = MBR_MAGIC;
+    bpb = (void*)(boot + sizeof(FAT_BOOT_SECTOR_HEADER_TYPE));
+    bpb->sector_size = FAT_SECTOR_SIZE;
+    bpb->cluster_sectors = format->cluster_sectors;
+    bpb->reserved_sectors = vfss->fat16.reserved_sectors;
+    bpb->fat_count = format->fat_count;
+    bpb->media_type = 0xf8;
+    bpb->sectors_per_track = 0x3f;
+    bpb->heads = 0xff;
+    bpb->hidden = vfss_get_volume_offset(vfss);
+    bpb->sectors = volume_sectors;
+    bpb->fat_sectors32 = fat_sectors;
+    bpb->root_cluster = vfss->fat16.root_cluster;
+    bpb->fs_info_sector = FAT32_FS_INFO_SECTOR;
+    bpb->backup_boot_sector = FAT32_BACKUP_BOOT_SECTOR;
+    bpb->drive_num = 0x80;
+    bpb->ext_signature = FAT_BPB_EXT_SIGNATURE;
+    bpb->serial = format->serial;
+    memset(bpb->label, ' ', 11);
+    for (i = 0; i < 8 && format->label[i]; ++i)
+        bpb->label[i] = fat16_char_upper(format->label[i]);
+    memcpy(bpb->fs_type, "FAT32   ", 8);
+    if (!vfss_write_sectors(vfss, 0, FAT_SECTOR_SIZE) || !vfss_write_sectors(vfss, FAT32_BACKUP_BOOT_SECTOR, FAT_SECTOR_SIZE))
+        return false;
+
+    //FSInfo and it's backup copy. Root cluster is occupied
+    fs_info = vfss_get_buf(vfss);
+    memset(fs_info, 0x00, FAT_SECTOR_SIZE);
+    fs_info->lead_signature = FAT32_FS_INFO_LEAD_SIGNATURE;
+    fs_info->struct_signature = FAT32_FS_INFO_STRUCT_SIGNATURE;
+    fs_info->trail_signature = FAT32_FS_INFO_TRAIL_SIGNATURE;
+    fs_info->free_count = clusters_count - 1;
+    fs_info->next_free = vfss->fat16.root_cluster + 1;
+    if (!vfss_write_sectors(vfss, FAT32_FS_INFO_SECTOR, FAT_SECTOR_SIZE) ||
+        !vfss_write_sectors(vfss, FAT32_BACKUP_BOOT_SECTOR + FAT32_FS_INFO_SECTOR, FAT_SECTOR_SIZE))
+        return false;
+
+    //init fat: media, EOC, root cluster
+    fat = vfss_get_buf(vfss);
+    memset(fat, 0x00, FAT_SECTOR_SIZE);
+    fat[0] = FAT_CLUSTER_RESERVED;
+    fat[1] = FAT_CLUSTER_LAST;
+    fat[2] = FAT_CLUSTER_LAST;
+    for (i = 0; i < vfss->fat16.fat_count; ++i)
+        if (!vfss_write_sectors(vfss, vfss->fat16.reserved_sectors + vfss->fat16.fat_sectors * i, FAT_SECTOR_SIZE))
+            return false;
+
+    //write label in root fs
+    fat16_fi_create(vfss, &fi, VFS_ROOT);
+    entry = fat16_init_file_entry(vfss, &fi);
+    if (entry == NULL)
+        return false;
+    for (i = 0; i < 8 && format->label[i]; ++i)
+        entry->name[i] = fat16_char_upper(format->label[i]);
+    entry->attr = FAT_FILE_ATTR_LABEL;
+    return fat16_write_file_entry(vfss, &fi);
+}
+
 static inline void fat16_format(VFSS_TYPE* vfss, IO* io, HANDLE process)
 {
     unsigned int root_sectors, fat_sectors, clusters_count, i;
@@ -1468,6 +2306,16 @@ static inline void fat16_format(VFSS_TYPE* vfss, IO* io, HANDLE process)
     }
 
     vfss_resize_buf(vfss, format->cluster_sectors * FAT_SECTOR_SIZE);
+    if (format->root_entries == 0)
+    {
+        if (!fat16_format32(vfss, format))
+            return;
+        io_complete(process, HAL_IO_CMD(HAL_VFS, VFS_FORMAT), VFS_FS_HANDLE, io);
+        error(ERROR_SYNC);
+        return;
+    }
+    vfss->fat16.fat32 = false;
+    vfss->fat16.root_cluster = VFS_ROOT;
     root_sectors = (format->root_entries * sizeof(FAT_FILE_ENTRY) + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
     clusters_count = ((vfss_get_volume_sectors(vfss) - 1 - root_sectors) + format->cluster_sectors - 1) / format->cluster_sectors;
     fat_sectors = ((clusters_count + 2) * 2 + FAT_SECTOR_SIZE - 1) / FAT_SECTOR_SIZE;
@@ -1492,20 +2340,20 @@ static inline void fat16_format(VFSS_TYPE* vfss, IO* io, HANDLE process)
     if (!vfss_write_sectors(vfss, 0, FAT_SECTOR_SIZE))
         return;
 
-    //zero fat, root
-    if (!vfss_zero_sectors(vfss, vfss->fat16.reserved_sectors, fat_sectors * format->fat_count + root_sectors))
+    //zero reserved area (journal), fat, root
+    if (!vfss_zero_sectors(vfss, 1, vfss->fat16.reserved_sectors - 1 + fat_sectors * format->fat_count + root_sectors))
         return;
 
     //init fat (sector is now zero)
     fat = vfss_get_buf(vfss);
-    fat[0] = FAT_CLUSTER_RESERVED;
-    fat[1] = FAT_CLUSTER_LAST;
+    fat[0] = FAT16_CLUSTER_RESERVED;
+    fat[1] = FAT16_CLUSTER_LAST;
     for (i = 0; i < vfss->fat16.fat_count; ++i)
         if (!vfss_write_sectors(vfss, vfss->fat16.reserved_sectors+ vfss->fat16.fat_sectors * i, FAT_SECTOR_SIZE))
             return;
 
     //write label in root fs
-    fat16_fi_create(&fi, VFS_ROOT);
+    fat16_fi_create(vfss, &fi, VFS_ROOT);
     entry = fat16_init_file_entry(vfss, &fi);
     if (entry == NULL)
         return;
@@ -1519,19 +2367,22 @@ static inline void fat16_format(VFSS_TYPE* vfss, IO* io, HANDLE process)
     error(ERROR_SYNC);
 }
 
+//FAT32 volume size can exceed int
+static int fat16_clusters_to_size(VFSS_TYPE* vfss, unsigned long clusters)
+{
+    if (clusters > 0x7fffffff / vfss->fat16.cluster_size)
+        return 0x7fffffff;
+    return clusters * vfss->fat16.cluster_size;
+}
+
 static int fat16_get_free(VFSS_TYPE* vfss)
 {
-    unsigned int free_clusters, cluster;
-    free_clusters = 0;
-    for (cluster = 2; cluster < vfss->fat16.clusters_count; ++cluster)
-        if (fat16_get_fat_value(vfss, cluster) == FAT_CLUSTER_FREE)
-            ++free_clusters;
-    return free_clusters * vfss->fat16.cluster_size;
+    return fat16_clusters_to_size(vfss, vfss->fat16.free_count);
 }
 
 static inline int fat16_get_used(VFSS_TYPE* vfss)
 {
-    return (vfss->fat16.clusters_count - 2) * vfss->fat16.cluster_size - fat16_get_free(vfss);
+    return fat16_clusters_to_size(vfss, vfss->fat16.clusters_count - 2 - vfss->fat16.free_count);
 }
 
 void fat16_request(VFSS_TYPE *vfss, IPC* ipc)
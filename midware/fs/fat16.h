@@ -54,10 +54,33 @@
 #define FAT_LFN_SEQ_MASK                                    0x1f
 #define FAT_LFN_CHUNK_SIZE                                  13
 
-#define FAT_CLUSTER_RESERVED                                0xfff8
-#define FAT_CLUSTER_LAST                                    0xffff
+//FAT entries are kept in 28 bit form for both FAT16 and FAT32
+#define FAT_CLUSTER_RESERVED                                0x0ffffff8
+#define FAT_CLUSTER_LAST                                    0x0fffffff
 #define FAT_CLUSTER_FREE                                    0x0000
 
+#define FAT16_CLUSTER_RESERVED                              0xfff8
+#define FAT16_CLUSTER_LAST                                  0xffff
+#define FAT32_CLUSTER_MASK                                  0x0fffffff
+//less is FAT16
+#define FAT32_CLUSTERS_MIN                                  65525
+
+#define FAT32_RESERVED_SECTORS                              32
+#define FAT32_FS_INFO_SECTOR                                1
+#define FAT32_BACKUP_BOOT_SECTOR                            6
+
+//intent journal in unused reserved sector
+#define FAT16_JOURNAL_SECTOR                                1
+#define FAT32_JOURNAL_SECTOR                                2
+#define FAT_JOURNAL_MAGIC                                   0x4c4e524a
+
+typedef enum {
+    FAT_JOURNAL_CREATE = 1,
+    FAT_JOURNAL_APPEND,
+    FAT_JOURNAL_EXTEND,
+    FAT_JOURNAL_REMOVE
+} FAT_JOURNAL_OP;
+
 #pragma pack(push, 1)
 typedef struct {
     char name[8];
@@ -68,7 +91,8 @@ typedef struct {
     uint16_t crt_time;
     uint16_t crt_date;
     uint16_t acc_date;
-    uint16_t security;
+    //FAT32 only
+    uint16_t first_cluster_hi;
     uint16_t mod_time;
     uint16_t mod_date;
     uint16_t first_cluster;
@@ -85,10 +109,34 @@ typedef struct {
     uint16_t first_cluster;
     uint16_t name3[2];
 } FAT_LFN_ENTRY;
+
+typedef struct {
+    uint8_t op;
+    uint8_t reserved[3];
+    //folder of file entry, file first cluster, last cluster before append
+    uint32_t folder, first_cluster, cluster;
+} FAT_JOURNAL_INTENT;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t count;
+    uint16_t checksum;
+} FAT_JOURNAL_HEADER;
 #pragma pack(pop)
 
 typedef struct {
     unsigned long sectors_count, cluster_sectors, root_count, root_sectors, reserved_sectors, fat_sectors, cluster_size, clusters_count, fat_count;
+    //FAT32 only
+    unsigned long root_cluster, fs_info_sector, next_free;
+    //free clusters bitmap, bit set - cluster is free. Built on mount, FAT16 only
+    uint32_t* free_map;
+    unsigned long free_count;
+    bool fat32, fs_info_dirty;
+    //primary FAT sectors changed since last sync, mirrored on sync
+    unsigned long fat_dirty_first, fat_dirty_last;
+    //0 if journal is not used
+    unsigned long journal_sector;
+    unsigned int journal_count;
     SO finds;
     SO file_handles;
     bool active;
@@ -96,5 +144,6 @@ typedef struct {
 
 void fat16_init(VFSS_TYPE* vfss);
 void fat16_request(VFSS_TYPE* vfss, IPC* ipc);
+bool fat16_sync(VFSS_TYPE* vfss);
 
 #endif // FAT16_H
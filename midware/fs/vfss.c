@@ -11,6 +11,7 @@
 #include "../../userspace/stdio.h"
 #include "../../userspace/sys.h"
 #include "../../userspace/ipc.h"
+#include "../../userspace/systime.h"
 #include "sys_config.h"
 #include <string.h>
 
@@ -52,39 +53,293 @@ unsigned int vfss_get_volume_sectors(VFSS_TYPE* vfss)
     return vfss->volume.sectors_count;
 }
 
-void* vfss_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
+static bool vfss_storage_read(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
 {
-    bool res;
-    //cache read
-    if ((sector == vfss->current_sector) && (vfss->io->data_size == size))
-        return io_data(vfss->io);
 #if (VFS_BER)
     if (vfss->volume.sector_mode == SECTOR_MODE_BER)
-        res = ber_read_sectors(vfss, sector, size);
-    else
+        return ber_read_sectors(vfss, sector, size);
+#endif //VFS_BER
+    return storage_read_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->io, sector + vfss->volume.first_sector, size);
+}
+
+static bool vfss_storage_write(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
+{
+#if (VFS_BER)
+    if (vfss->volume.sector_mode == SECTOR_MODE_BER)
+        return ber_write_sectors(vfss, sector, size);
 #endif //VFS_BER
-        res = storage_read_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->io, sector + vfss->volume.first_sector, size);
+    vfss->io->data_size = size;
+    return storage_write_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->io, sector + vfss->volume.first_sector);
+}
+
+#if (VFS_CACHE_SECTORS)
+static inline uint8_t* vfss_cache_data(VFSS_TYPE* vfss, unsigned int idx)
+{
+    return vfss->cache.data + idx * FAT_SECTOR_SIZE;
+}
+
+static unsigned int vfss_cache_find(VFSS_TYPE* vfss, unsigned long sector)
+{
+    unsigned int idx;
+    for (idx = vfss->cache.buckets[sector % VFS_CACHE_SECTORS]; idx != VFSS_CACHE_NONE; idx = vfss->cache.entries[idx].hash_next)
+    {
+        if (vfss->cache.entries[idx].sector == sector)
+            return idx;
+    }
+    return VFSS_CACHE_NONE;
+}
+
+static void vfss_cache_unhash(VFSS_TYPE* vfss, unsigned int idx)
+{
+    uint16_t* cur;
+    for (cur = &vfss->cache.buckets[vfss->cache.entries[idx].sector % VFS_CACHE_SECTORS]; *cur != VFSS_CACHE_NONE; cur = &vfss->cache.entries[*cur].hash_next)
+    {
+        if (*cur == idx)
+        {
+            *cur = vfss->cache.entries[idx].hash_next;
+            break;
+        }
+    }
+    vfss->cache.entries[idx].valid = vfss->cache.entries[idx].dirty = false;
+}
+
+static void vfss_cache_unlink(VFSS_TYPE* vfss, unsigned int idx)
+{
+    VFSS_CACHE_ENTRY* entry = &vfss->cache.entries[idx];
+    if (entry->prev == VFSS_CACHE_NONE)
+        vfss->cache.head = entry->next;
+    else
+        vfss->cache.entries[entry->prev].next = entry->next;
+    if (entry->next == VFSS_CACHE_NONE)
+        vfss->cache.tail = entry->prev;
+    else
+        vfss->cache.entries[entry->next].prev = entry->prev;
+}
+
+//most recently used
+static void vfss_cache_touch(VFSS_TYPE* vfss, unsigned int idx)
+{
+    VFSS_CACHE_ENTRY* entry = &vfss->cache.entries[idx];
+    if (vfss->cache.head == idx)
+        return;
+    vfss_cache_unlink(vfss, idx);
+    entry->prev = VFSS_CACHE_NONE;
+    entry->next = vfss->cache.head;
+    vfss->cache.entries[vfss->cache.head].prev = idx;
+    vfss->cache.head = idx;
+}
+
+//least recently used, first to reuse
+static void vfss_cache_drop(VFSS_TYPE* vfss, unsigned int idx)
+{
+    VFSS_CACHE_ENTRY* entry = &vfss->cache.entries[idx];
+    vfss_cache_unhash(vfss, idx);
+    if (vfss->cache.tail == idx)
+        return;
+    vfss_cache_unlink(vfss, idx);
+    entry->next = VFSS_CACHE_NONE;
+    entry->prev = vfss->cache.tail;
+    vfss->cache.entries[vfss->cache.tail].next = idx;
+    vfss->cache.tail = idx;
+}
+
+static bool vfss_cache_write_back(VFSS_TYPE* vfss, unsigned int idx)
+{
+    IO* io;
+    bool res;
+    //don't touch data in vfss buffer
+    io = vfss->io;
+    vfss->io = vfss->cache.io;
+    memcpy(io_data(vfss->io), vfss_cache_data(vfss, idx), FAT_SECTOR_SIZE);
+    res = vfss_storage_write(vfss, vfss->cache.entries[idx].sector, FAT_SECTOR_SIZE);
+    vfss->io = io;
     if (!res)
+        return false;
+    vfss->cache.entries[idx].dirty = false;
+    ++vfss->cache.write_backs;
+    return true;
+}
+
+static bool vfss_cache_flush(VFSS_TYPE* vfss)
+{
+    unsigned int i, idx;
+    //in ascending order, sequential for storage
+    for (;;)
+    {
+        idx = VFSS_CACHE_NONE;
+        for (i = 0; i < VFS_CACHE_SECTORS; ++i)
+        {
+            if (vfss->cache.entries[i].dirty && ((idx == VFSS_CACHE_NONE) || (vfss->cache.entries[i].sector < vfss->cache.entries[idx].sector)))
+                idx = i;
+        }
+        if (idx == VFSS_CACHE_NONE)
+            return true;
+        if (!vfss_cache_write_back(vfss, idx))
+        {
+#if (VFS_DEBUG_ERRORS)
+            printf("VFS: cache write back failed, sector %d\n", vfss->cache.entries[idx].sector);
+#endif //VFS_DEBUG_ERRORS
+            return false;
+        }
+    }
+}
+
+static unsigned int vfss_cache_allocate(VFSS_TYPE* vfss, unsigned long sector)
+{
+    unsigned int idx = vfss->cache.tail;
+    VFSS_CACHE_ENTRY* entry = &vfss->cache.entries[idx];
+    if (entry->valid)
+    {
+        //write back all. Ascending order keeps metadata ordering: journal, FAT, directories
+        if (entry->dirty && !vfss_cache_flush(vfss))
+            return VFSS_CACHE_NONE;
+        vfss_cache_unhash(vfss, idx);
+    }
+    entry->sector = sector;
+    entry->valid = true;
+    entry->dirty = false;
+    entry->hash_next = vfss->cache.buckets[sector % VFS_CACHE_SECTORS];
+    vfss->cache.buckets[sector % VFS_CACHE_SECTORS] = idx;
+    vfss_cache_touch(vfss, idx);
+    return idx;
+}
+
+//dirty data is lost
+static void vfss_cache_invalidate(VFSS_TYPE* vfss)
+{
+    unsigned int i;
+    for (i = 0; i < VFS_CACHE_SECTORS; ++i)
+    {
+        vfss->cache.entries[i].valid = vfss->cache.entries[i].dirty = false;
+        vfss->cache.entries[i].prev = i ? i - 1 : VFSS_CACHE_NONE;
+        vfss->cache.entries[i].next = (i < VFS_CACHE_SECTORS - 1) ? i + 1 : VFSS_CACHE_NONE;
+        vfss->cache.buckets[i] = VFSS_CACHE_NONE;
+    }
+    vfss->cache.head = 0;
+    vfss->cache.tail = VFS_CACHE_SECTORS - 1;
+}
+
+static inline void vfss_cache_init(VFSS_TYPE* vfss)
+{
+    vfss->cache.data = malloc(VFS_CACHE_SECTORS * FAT_SECTOR_SIZE);
+    vfss->cache.io = io_create(FAT_SECTOR_SIZE + sizeof(STORAGE_STACK));
+    //out of memory - working without cache. No entry is ever valid in this case
+    if ((vfss->cache.data == NULL) || (vfss->cache.io == NULL))
+    {
+#if (VFS_DEBUG_ERRORS)
+        printf("VFS: out of memory, cache disabled\n");
+#endif //VFS_DEBUG_ERRORS
+        free(vfss->cache.data);
+        io_destroy(vfss->cache.io);
+        vfss->cache.data = NULL;
+        vfss->cache.io = NULL;
+    }
+    vfss->cache.hits = vfss->cache.misses = vfss->cache.write_backs = 0;
+    vfss_cache_invalidate(vfss);
+}
+
+static inline void vfss_cache_stat(VFSS_TYPE* vfss, IO* io)
+{
+    unsigned int i;
+    VFS_CACHE_STAT_TYPE* stat = io_data(io);
+    stat->hits = vfss->cache.hits;
+    stat->misses = vfss->cache.misses;
+    stat->write_backs = vfss->cache.write_backs;
+    stat->dirty = 0;
+    for (i = 0; i < VFS_CACHE_SECTORS; ++i)
+    {
+        if (vfss->cache.entries[i].dirty)
+            ++stat->dirty;
+    }
+    io->data_size = sizeof(VFS_CACHE_STAT_TYPE);
+}
+#endif //VFS_CACHE_SECTORS
+
+void* vfss_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
+{
+#if (VFS_CACHE_SECTORS)
+    unsigned int idx;
+    //single sectors are FAT and directory entries, cached
+    if ((size == FAT_SECTOR_SIZE) && (vfss->cache.data != NULL))
+    {
+        if ((idx = vfss_cache_find(vfss, sector)) != VFSS_CACHE_NONE)
+        {
+            ++vfss->cache.hits;
+            vfss_cache_touch(vfss, idx);
+            memcpy(io_data(vfss->io), vfss_cache_data(vfss, idx), FAT_SECTOR_SIZE);
+            vfss->io->data_size = FAT_SECTOR_SIZE;
+            return io_data(vfss->io);
+        }
+        ++vfss->cache.misses;
+        if ((idx = vfss_cache_allocate(vfss, sector)) == VFSS_CACHE_NONE)
+            return NULL;
+        if (!vfss_storage_read(vfss, sector, size))
+        {
+            vfss_cache_drop(vfss, idx);
+            return NULL;
+        }
+        memcpy(vfss_cache_data(vfss, idx), io_data(vfss->io), FAT_SECTOR_SIZE);
+        return io_data(vfss->io);
+    }
+    if (!vfss_storage_read(vfss, sector, size))
+        return NULL;
+    //cached data is more recent
+    for (idx = 0; idx < VFS_CACHE_SECTORS; ++idx)
+    {
+        if (vfss->cache.entries[idx].dirty && (vfss->cache.entries[idx].sector >= sector) &&
+            (vfss->cache.entries[idx].sector < sector + size / FAT_SECTOR_SIZE))
+            memcpy((uint8_t*)io_data(vfss->io) + (vfss->cache.entries[idx].sector - sector) * FAT_SECTOR_SIZE, vfss_cache_data(vfss, idx), FAT_SECTOR_SIZE);
+    }
+    return io_data(vfss->io);
+#else
+    if (!vfss_storage_read(vfss, sector, size))
         return NULL;
-    vfss->current_sector = sector;
     return io_data(vfss->io);
+#endif //VFS_CACHE_SECTORS
 }
 
 bool vfss_write_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size)
 {
-    bool res;
-#if (VFS_BER)
-    if (vfss->volume.sector_mode == SECTOR_MODE_BER)
-        res = ber_write_sectors(vfss, sector, size);
-    else
-#endif //VFS_BER
+#if (VFS_CACHE_SECTORS)
+    unsigned int idx;
+    if ((size == FAT_SECTOR_SIZE) && (vfss->cache.data != NULL))
+    {
+        if ((idx = vfss_cache_find(vfss, sector)) == VFSS_CACHE_NONE)
+        {
+            if ((idx = vfss_cache_allocate(vfss, sector)) == VFSS_CACHE_NONE)
+                return false;
+        }
+        else
+            vfss_cache_touch(vfss, idx);
+        memcpy(vfss_cache_data(vfss, idx), io_data(vfss->io), FAT_SECTOR_SIZE);
+#if (VFS_CACHE_WRITE_BACK)
+        vfss->cache.entries[idx].dirty = true;
+        return true;
+#else
+        if (!vfss_storage_write(vfss, sector, size))
+        {
+            vfss_cache_drop(vfss, idx);
+            return false;
+        }
+        return true;
+#endif //VFS_CACHE_WRITE_BACK
+    }
+    if (!vfss_storage_write(vfss, sector, size))
+        return false;
+    //keep cached copies coherent
+    for (idx = 0; idx < VFS_CACHE_SECTORS; ++idx)
     {
-        vfss->io->data_size = size;
-        res = storage_write_sync(vfss->volume.hal, vfss->volume.process, vfss->volume.user, vfss->io, sector + vfss->volume.first_sector);
+        if (vfss->cache.entries[idx].valid && (vfss->cache.entries[idx].sector >= sector) &&
+            (vfss->cache.entries[idx].sector < sector + size / FAT_SECTOR_SIZE))
+        {
+            memcpy(vfss_cache_data(vfss, idx), (uint8_t*)io_data(vfss->io) + (vfss->cache.entries[idx].sector - sector) * FAT_SECTOR_SIZE, FAT_SECTOR_SIZE);
+            vfss->cache.entries[idx].dirty = false;
+        }
     }
-    if (res)
-        vfss->current_sector = sector;
-    return res;
+    return true;
+#else
+    return vfss_storage_write(vfss, sector, size);
+#endif //VFS_CACHE_SECTORS
 }
 
 bool vfss_zero_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned count)
@@ -103,6 +358,55 @@ bool vfss_zero_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned count)
     return true;
 }
 
+bool vfss_flush(VFSS_TYPE* vfss)
+{
+#if (VFS_CACHE_SECTORS)
+    if (!vfss_cache_flush(vfss))
+        return false;
+#endif //VFS_CACHE_SECTORS
+#if (VFS_BER)
+    //coalesced block and remap log
+    if (vfss->volume.sector_mode == SECTOR_MODE_BER)
+        return ber_flush(vfss);
+#endif //VFS_BER
+    return true;
+}
+
+//fs sync point, then delayed sectors
+static bool vfss_sync(VFSS_TYPE* vfss)
+{
+#if (VFS_SFS)
+    if (!sfs_sync(vfss))
+        return false;
+#else
+    if (!fat16_sync(vfss))
+        return false;
+#endif  // VFS_SFS
+    return vfss_flush(vfss);
+}
+
+#if (VFS_FLUSH_TIMEOUT_MS)
+static inline void vfss_flush_timer_start(VFSS_TYPE* vfss)
+{
+    if (vfss->flush_pending)
+        return;
+    timer_start_ms(vfss->flush_timer, VFS_FLUSH_TIMEOUT_MS);
+    vfss->flush_pending = true;
+}
+
+static inline void vfss_flush_timeout(VFSS_TYPE* vfss)
+{
+    vfss->flush_pending = false;
+    if (vfss->volume.process == INVALID_HANDLE)
+        return;
+    if (!vfss_sync(vfss))
+    {
+#if (VFS_DEBUG_ERRORS)
+        printf("VFS: delayed flush failed\n");
+#endif //VFS_DEBUG_ERRORS
+    }
+}
+#endif //VFS_FLUSH_TIMEOUT_MS
 
 static inline void vfss_open_volume(VFSS_TYPE* vfss, IO* io)
 {
@@ -117,12 +421,17 @@ static inline void vfss_open_volume(VFSS_TYPE* vfss, IO* io)
         return;
     }
     memcpy(&vfss->volume, io_data(io), sizeof(VFS_VOLUME_TYPE));
-    vfss->current_sector = 0xffffffff;
-    vfss->current_size = 0;
+#if (VFS_CACHE_SECTORS)
+    vfss_cache_invalidate(vfss);
+#endif //VFS_CACHE_SECTORS
 }
 
 static inline void vfss_close_volume(VFSS_TYPE* vfss)
 {
+#if (VFS_CACHE_SECTORS)
+    vfss_cache_flush(vfss);
+    vfss_cache_invalidate(vfss);
+#endif //VFS_CACHE_SECTORS
     vfss->volume.process = INVALID_HANDLE;
 }
 
@@ -131,6 +440,13 @@ static inline void vfss_init(VFSS_TYPE* vfss)
     vfss->volume.process = INVALID_HANDLE;
     vfss->io = io_create(FAT_SECTOR_SIZE + sizeof(STORAGE_STACK));
     vfss->io_size = FAT_SECTOR_SIZE;
+#if (VFS_FLUSH_TIMEOUT_MS)
+    vfss->flush_timer = timer_create(0, HAL_VFS);
+    vfss->flush_pending = false;
+#endif //VFS_FLUSH_TIMEOUT_MS
+#if (VFS_CACHE_SECTORS)
+    vfss_cache_init(vfss);
+#endif //VFS_CACHE_SECTORS
 #if (VFS_BER)
     ber_init(vfss);
 #endif //VFS_BER
@@ -143,6 +459,20 @@ static inline void vfss_init(VFSS_TYPE* vfss)
 
 void vfss_request(VFSS_TYPE *vfss, IPC* ipc)
 {
+    if (HAL_ITEM(ipc->cmd) == IPC_TIMEOUT)
+    {
+#if (VFS_BER) && (VFS_BER_GC_MS)
+        if (ipc->param1 == VFS_BER_HANDLE)
+        {
+            ber_timeout(vfss);
+            return;
+        }
+#endif //VFS_BER && VFS_BER_GC_MS
+#if (VFS_FLUSH_TIMEOUT_MS)
+        vfss_flush_timeout(vfss);
+#endif //VFS_FLUSH_TIMEOUT_MS
+        return;
+    }
     if ((HAL_ITEM(ipc->cmd) == IPC_OPEN) && (ipc->param1 == VFS_VOLUME_HANDLE))
     {
         vfss_open_volume(vfss, (IO*)ipc->param2);
@@ -159,10 +489,43 @@ void vfss_request(VFSS_TYPE *vfss, IPC* ipc)
         vfss_close_volume(vfss);
         return;
     }
+    if ((HAL_ITEM(ipc->cmd) == IPC_FLUSH) && (ipc->param1 == VFS_VOLUME_HANDLE))
+    {
+        if (!vfss_sync(vfss))
+            error(ERROR_IO_FAIL);
+        return;
+    }
+#if (VFS_CACHE_SECTORS)
+    if (ipc->param1 == VFS_VOLUME_HANDLE)
+    {
+        switch (HAL_ITEM(ipc->cmd))
+        {
+        case VFS_STAT:
+            vfss_cache_stat(vfss, (IO*)ipc->param2);
+            break;
+        default:
+            error(ERROR_NOT_SUPPORTED);
+        }
+        return;
+    }
+#endif //VFS_CACHE_SECTORS
 #if (VFS_BER)
     if ((vfss->volume.sector_mode == SECTOR_MODE_BER) && (ipc->param1 == VFS_BER_HANDLE))
     {
+#if (VFS_CACHE_SECTORS)
+        //BER works below cache. Transaction must contain all delayed writes, rollback discards them
+        if (HAL_ITEM(ipc->cmd) != VFS_STAT)
+            vfss_cache_flush(vfss);
         ber_request(vfss, ipc);
+        if (HAL_ITEM(ipc->cmd) != VFS_STAT)
+            vfss_cache_invalidate(vfss);
+#else
+        ber_request(vfss, ipc);
+#endif //VFS_CACHE_SECTORS
+#if (VFS_FLUSH_TIMEOUT_MS)
+        if (HAL_ITEM(ipc->cmd) == IPC_WRITE)
+            vfss_flush_timer_start(vfss);
+#endif //VFS_FLUSH_TIMEOUT_MS
         return;
     }
 #endif //VFS_BER
@@ -172,6 +535,26 @@ void vfss_request(VFSS_TYPE *vfss, IPC* ipc)
 #else
     fat16_request(vfss, ipc);
 #endif  // VFS_SFS
+#if (VFS_FLUSH_TIMEOUT_MS)
+    //metadata changes are batched till next sync point
+    switch (HAL_ITEM(ipc->cmd))
+    {
+    case IPC_OPEN:
+    case IPC_WRITE:
+    case VFS_MK_FOLDER:
+        vfss_flush_timer_start(vfss);
+        break;
+    default:
+        break;
+    }
+#endif //VFS_FLUSH_TIMEOUT_MS
+#if (VFS_CACHE_SECTORS)
+    //file close or unmount
+    if ((HAL_ITEM(ipc->cmd) == IPC_CLOSE) && !vfss_cache_flush(vfss))
+        error(ERROR_IO_FAIL);
+    if ((HAL_ITEM(ipc->cmd) == IPC_CLOSE) && (ipc->param1 == VFS_FS_HANDLE))
+        vfss_cache_invalidate(vfss);
+#endif //VFS_CACHE_SECTORS
 }
 
 void vfss()
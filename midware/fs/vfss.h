@@ -20,5 +20,7 @@ unsigned int vfss_get_volume_sectors(VFSS_TYPE* vfss);
 void* vfss_read_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size);
 bool vfss_write_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned size);
 bool vfss_zero_sectors(VFSS_TYPE* vfss, unsigned long sector, unsigned count);
+//write back delayed sectors in ascending order
+bool vfss_flush(VFSS_TYPE* vfss);
 
 #endif // VFSS_H
@@ -20,11 +20,39 @@
 #endif  // VFS_SFS
 
 
+#if (VFS_CACHE_SECTORS)
+#define VFSS_CACHE_NONE                                     0xffff
+
+typedef struct {
+    unsigned long sector;
+    //LRU list, hash chain
+    uint16_t prev, next, hash_next;
+    bool valid, dirty;
+} VFSS_CACHE_ENTRY;
+
+typedef struct {
+    uint8_t* data;
+    //write back of evicted sectors, vfss buffer is in use at this moment
+    IO* io;
+    //most and least recently used
+    uint16_t head, tail;
+    uint16_t buckets[VFS_CACHE_SECTORS];
+    VFSS_CACHE_ENTRY entries[VFS_CACHE_SECTORS];
+    unsigned int hits, misses, write_backs;
+} VFSS_CACHE;
+#endif //VFS_CACHE_SECTORS
+
 typedef struct _VFSS_TYPE {
     IO* io;
     unsigned io_size;
     VFS_VOLUME_TYPE volume;
-    unsigned long current_sector, current_size;
+#if (VFS_FLUSH_TIMEOUT_MS)
+    HANDLE flush_timer;
+    bool flush_pending;
+#endif //VFS_FLUSH_TIMEOUT_MS
+#if (VFS_CACHE_SECTORS)
+    VFSS_CACHE cache;
+#endif //VFS_CACHE_SECTORS
 #if (VFS_BER)
     BER_TYPE ber;
 #endif //VFS_BER
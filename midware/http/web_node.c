@@ -8,43 +8,135 @@
 #include "web_parse.h"
 #include "../../userspace/web.h"
 #include "../../userspace/error.h"
+#include "../../userspace/stdlib.h"
 #include <string.h>
 
+#define WEB_NODE_FNV_OFFSET                     2166136261u
+#define WEB_NODE_FNV_PRIME                      16777619u
+
+static inline char web_node_fold(char c)
+{
+    if (c >= 'A' && c <= 'Z')
+        return c + 0x20;
+    return c;
+}
+
+//FNV-1a of case-folded name, seeded with parent
+static unsigned int web_node_hash(HANDLE parent, const char* name, unsigned int len)
+{
+    unsigned int i;
+    unsigned int hash = WEB_NODE_FNV_OFFSET ^ (unsigned int)parent;
+    for (i = 0; i < len; ++i)
+    {
+        hash ^= (uint8_t)web_node_fold(name[i]);
+        hash *= WEB_NODE_FNV_PRIME;
+    }
+    return hash;
+}
+
+//"*" or "{name}"
+static bool web_node_param_name(const char* name, unsigned int len)
+{
+    if ((len == 1) && (name[0] == WEB_OBJ_WILDCARD[0]))
+        return true;
+    return (len >= 2) && (name[0] == WEB_OBJ_PARAM_OPEN) && (name[len - 1] == WEB_OBJ_PARAM_CLOSE);
+}
+
 void web_node_create(WEB_NODE* web_node)
 {
     so_create(&web_node->items, sizeof(WEB_NODE_ITEM), 1);
     web_node->root = INVALID_HANDLE;
+    web_node->buckets = NULL;
+    web_node->buckets_count = web_node->hashed_count = 0;
 }
 
 void web_node_destroy(WEB_NODE* web_node)
 {
     web_node_free(web_node, web_node->root);
+    free(web_node->buckets);
     so_destroy(&web_node->items);
 }
 
-static WEB_NODE_ITEM* web_node_find_child(WEB_NODE* web_node, WEB_NODE_ITEM* parent, char* name, unsigned int len)
+static WEB_NODE_ITEM* web_node_find_child(WEB_NODE* web_node, HANDLE parent, const char* name, unsigned int len)
 {
     WEB_NODE_ITEM* cur;
-    for(cur = so_get(&web_node->items, parent->child); cur != NULL; cur = so_get(&web_node->items, cur->next))
+    unsigned int i, hash;
+    if (web_node->buckets_count == 0)
+        return NULL;
+    hash = web_node_hash(parent, name, len);
+    for (cur = so_get(&web_node->items, web_node->buckets[hash & (web_node->buckets_count - 1)]); cur != NULL;
+         cur = so_get(&web_node->items, cur->hash_next))
     {
-        if (web_stricmp(WEB_OBJ_WILDCARD, 1, cur->name))
-            return cur;
-
-        if (web_stricmp(name, len, cur->name))
+        if ((cur->hash != hash) || (cur->parent != parent) || (cur->name_len != len))
+            continue;
+        for (i = 0; (i < len) && (web_node_fold(name[i]) == cur->name[i]); ++i) {}
+        if (i == len)
             return cur;
     }
     return NULL;
 }
 
+static void web_node_hash_insert(WEB_NODE* web_node, WEB_NODE_ITEM* item)
+{
+    HANDLE* bucket = &web_node->buckets[item->hash & (web_node->buckets_count - 1)];
+    item->hash_next = *bucket;
+    *bucket = item->self;
+}
+
+static bool web_node_hash_grow(WEB_NODE* web_node)
+{
+    HANDLE* buckets;
+    HANDLE h;
+    WEB_NODE_ITEM* item;
+    unsigned int i, count;
+    //load factor up to 2
+    if (web_node->hashed_count < web_node->buckets_count * 2)
+        return true;
+    count = web_node->buckets_count ? web_node->buckets_count * 2 : WEB_NODE_BUCKETS_MIN;
+    if ((buckets = malloc(count * sizeof(HANDLE))) == NULL)
+        return false;
+    for (i = 0; i < count; ++i)
+        buckets[i] = INVALID_HANDLE;
+    free(web_node->buckets);
+    web_node->buckets = buckets;
+    web_node->buckets_count = count;
+    //rehash
+    for (h = so_first(&web_node->items); h != INVALID_HANDLE; h = so_next(&web_node->items, h))
+    {
+        item = so_get(&web_node->items, h);
+        if ((item->self != web_node->root) && !web_node_param_name(item->name, item->name_len))
+            web_node_hash_insert(web_node, item);
+    }
+    return true;
+}
+
+static void web_node_hash_remove(WEB_NODE* web_node, WEB_NODE_ITEM* item)
+{
+    HANDLE* cur;
+    WEB_NODE_ITEM* prev;
+    for (cur = &web_node->buckets[item->hash & (web_node->buckets_count - 1)]; *cur != INVALID_HANDLE; cur = &prev->hash_next)
+    {
+        if (*cur == item->self)
+        {
+            *cur = item->hash_next;
+            --web_node->hashed_count;
+            return;
+        }
+        prev = so_get(&web_node->items, *cur);
+    }
+}
+
 HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, unsigned int flags)
 {
     WEB_NODE_ITEM* parent;
     WEB_NODE_ITEM* cur;
     WEB_NODE_ITEM* child;
     HANDLE cur_handle;
-    unsigned int len;
+    unsigned int len, i;
+    bool param;
 
     len = strlen(name);
+    param = web_node_param_name(name, len);
     if (parent_handle == WEB_ROOT_NODE)
     {
         if (web_node->root != INVALID_HANDLE)
@@ -58,11 +150,14 @@ HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, u
         parent = so_get(&web_node->items, parent_handle);
         if (parent == NULL)
             return INVALID_HANDLE;
-        if (web_node_find_child(web_node, parent, name, len) != NULL)
+        //only one parameter child per node
+        if ((param && (parent->param != INVALID_HANDLE)) || (!param && (web_node_find_child(web_node, parent_handle, name, len) != NULL)))
         {
             error(ERROR_ALREADY_CONFIGURED);
             return INVALID_HANDLE;
         }
+        if (!param && !web_node_hash_grow(web_node))
+            return INVALID_HANDLE;
     }
 
     if ((cur_handle = so_allocate(&web_node->items)) == INVALID_HANDLE)
@@ -74,10 +169,16 @@ HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, u
         so_free(&web_node->items, cur_handle);
         return INVALID_HANDLE;
     }
-    strcpy(cur->name, name);
+    //keys are folded once, on registration
+    for (i = 0; i <= len; ++i)
+        cur->name[i] = web_node_fold(name[i]);
+    cur->name_len = len;
     cur->self = cur_handle;
-    cur->next = cur->child = INVALID_HANDLE;
+    cur->parent = parent_handle;
+    cur->next = cur->child = cur->hash_next = cur->param = INVALID_HANDLE;
+    cur->hash = web_node_hash(parent_handle, name, len);
     cur->flags = flags;
+    cur->data = NULL;
 
     if (parent_handle == WEB_ROOT_NODE)
         web_node->root = cur_handle;
@@ -85,6 +186,13 @@ HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, u
     {
         //re-fetch after allocate
         parent = so_get(&web_node->items, parent_handle);
+        if (param)
+            parent->param = cur_handle;
+        else
+        {
+            web_node_hash_insert(web_node, cur);
+            ++web_node->hashed_count;
+        }
         //first child
         if (parent->child == INVALID_HANDLE)
             parent->child = cur_handle;
@@ -102,6 +210,8 @@ HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, u
 
 static void web_node_free_internal(WEB_NODE* web_node, WEB_NODE_ITEM* cur)
 {
+    if ((cur->self != web_node->root) && !web_node_param_name(cur->name, cur->name_len))
+        web_node_hash_remove(web_node, cur);
     free(cur->name);
     so_free(&web_node->items, cur->self);
 }
@@ -124,8 +234,7 @@ void web_node_free(WEB_NODE* web_node, HANDLE handle)
 {
     WEB_NODE_ITEM* cur;
     WEB_NODE_ITEM* parent;
-    HANDLE h;
-    bool found;
+    WEB_NODE_ITEM* sibling;
     cur = so_get(&web_node->items, handle);
     if (cur == NULL)
         return;
@@ -137,29 +246,22 @@ void web_node_free(WEB_NODE* web_node, HANDLE handle)
     //remove from parent/older brother
     if (handle != web_node->root)
     {
-        found = false;
-        for (h = so_first(&web_node->items); h != INVALID_HANDLE; h = so_next(&web_node->items, h))
+        parent = so_get(&web_node->items, cur->parent);
+        if (parent->param == handle)
+            parent->param = INVALID_HANDLE;
+        if (parent->child == handle)
+            parent->child = cur->next;
+        else
         {
-            parent = so_get(&web_node->items, h);
-            if (parent->child == handle)
+            for (sibling = so_get(&web_node->items, parent->child); (sibling != NULL) && (sibling->next != handle);
+                 sibling = so_get(&web_node->items, sibling->next)) {}
+            if (sibling == NULL)
             {
-                parent->child = cur->next;
-                found = true;
-                break;
+                error(ERROR_NOT_FOUND);
+                return;
             }
-            if (parent->next == handle)
-            {
-                parent->next = cur->next;
-                found = true;
-                break;
-            }
-        }
-        if (!found)
-        {
-            error(ERROR_NOT_FOUND);
-            return;
+            sibling->next = cur->next;
         }
-
     }
 
     //destroy node itself
@@ -169,10 +271,13 @@ void web_node_free(WEB_NODE* web_node, HANDLE handle)
         web_node->root = INVALID_HANDLE;
 }
 
-HANDLE web_node_find_path(WEB_NODE* web_node, char* url, unsigned int url_size)
+HANDLE web_node_find_path(WEB_NODE* web_node, char* url, unsigned int url_size, WEB_NODE_PARAM* params, unsigned int* params_count)
 {
     WEB_NODE_ITEM* cur;
+    WEB_NODE_ITEM* next;
     unsigned int len;
+    char* start = url;
+    *params_count = 0;
     if (web_node->root == INVALID_HANDLE)
         return INVALID_HANDLE;
     if (!url_size || url[0] != '/')
@@ -186,9 +291,19 @@ HANDLE web_node_find_path(WEB_NODE* web_node, char* url, unsigned int url_size)
     for (;;)
     {
         len = web_get_word(url, url_size, '/');
-        cur = web_node_find_child(web_node, cur, url, len);
-        if (cur == NULL)
-            return INVALID_HANDLE;
+        //exact match has priority over parameter
+        if ((next = web_node_find_child(web_node, cur->self, url, len)) == NULL)
+        {
+            if ((next = so_get(&web_node->items, cur->param)) == NULL)
+                return INVALID_HANDLE;
+            if (*params_count >= WEB_NODE_PARAMS_MAX)
+                return INVALID_HANDLE;
+            params[*params_count].node = next->self;
+            params[*params_count].offset = url - start;
+            params[*params_count].size = len;
+            ++(*params_count);
+        }
+        cur = next;
         if (len == url_size)
             return cur->self;
         //also skip slash
@@ -205,3 +320,36 @@ bool web_node_check_flag(WEB_NODE* web_node, HANDLE handle, unsigned int flag)
         return false;
     return cur->flags & flag ? true : false;
 }
+
+bool web_node_is_param(WEB_NODE* web_node, HANDLE handle, const char* name)
+{
+    WEB_NODE_ITEM* cur;
+    unsigned int len;
+    cur = so_get(&web_node->items, handle);
+    if (cur == NULL)
+        return false;
+    len = strlen(name);
+    //"{name}"
+    if ((cur->name_len == len + 2) && (cur->name[0] == WEB_OBJ_PARAM_OPEN))
+        return web_stricmp(cur->name + 1, len, name);
+    return (cur->name_len == len) && web_stricmp(cur->name, len, name);
+}
+
+bool web_node_set_data(WEB_NODE* web_node, HANDLE handle, const void* data)
+{
+    WEB_NODE_ITEM* cur;
+    cur = so_get(&web_node->items, handle);
+    if (cur == NULL)
+        return false;
+    cur->data = data;
+    return true;
+}
+
+const void* web_node_get_data(WEB_NODE* web_node, HANDLE handle)
+{
+    WEB_NODE_ITEM* cur;
+    cur = so_get(&web_node->items, handle);
+    if (cur == NULL)
+        return NULL;
+    return cur->data;
+}
@@ -10,23 +10,44 @@
 #include "../../userspace/types.h"
 #include "../../userspace/so.h"
 
+//maximum parameter segments in path
+#define WEB_NODE_PARAMS_MAX                     4
+#define WEB_NODE_BUCKETS_MIN                    16
+
 typedef struct {
-    HANDLE child, next;
+    HANDLE child, next, parent;
+    //hash bucket chain, parameter child
+    HANDLE hash_next, param;
     HANDLE self;
+    //case-folded
     char* name;
-    unsigned int flags;
+    unsigned int name_len, hash, flags;
+    //static asset, served without handler
+    const void* data;
 } WEB_NODE_ITEM;
 
 typedef struct {
     HANDLE root;
     SO items;
+    //hashed (parent, name) child index
+    HANDLE* buckets;
+    unsigned int buckets_count, hashed_count;
 } WEB_NODE;
 
+//parameter segment value, offset from url start
+typedef struct {
+    HANDLE node;
+    uint16_t offset, size;
+} WEB_NODE_PARAM;
+
 void web_node_create(WEB_NODE* web_node);
 void web_node_destroy(WEB_NODE* web_node);
 HANDLE web_node_allocate(WEB_NODE* web_node, HANDLE parent_handle, char* name, unsigned int flags);
 void web_node_free(WEB_NODE* web_node, HANDLE handle);
-HANDLE web_node_find_path(WEB_NODE* web_node, char* url, unsigned int url_size);
+HANDLE web_node_find_path(WEB_NODE* web_node, char* url, unsigned int url_size, WEB_NODE_PARAM* params, unsigned int* params_count);
 bool web_node_check_flag(WEB_NODE* web_node, HANDLE handle, unsigned int flag);
+bool web_node_is_param(WEB_NODE* web_node, HANDLE handle, const char* name);
+bool web_node_set_data(WEB_NODE* web_node, HANDLE handle, const void* data);
+const void* web_node_get_data(WEB_NODE* web_node, HANDLE handle);
 
 #endif // WEB_NODE_H
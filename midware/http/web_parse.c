@@ -123,6 +123,58 @@ char* web_trim(char *str, unsigned int* len)
     return str;
 }
 
+//q=0 in token parameters - explicitly refused (RFC 7231 5.3.1)
+static bool web_token_refused(const char* params, unsigned int size)
+{
+    unsigned int len, i;
+    const char* param;
+    while (size)
+    {
+        len = web_get_word(params, size, ';');
+        i = len;
+        param = web_trim((char*)params, &i);
+        if ((i >= 3) && ((param[0] == 'q') || (param[0] == 'Q')) && (param[1] == '=') && (param[2] == '0'))
+        {
+            //0, 0., 0.000
+            for (i -= 3, param += 3; i && ((*param == '0') || (*param == '.')); --i, ++param) {}
+            if (i == 0)
+                return true;
+        }
+        if (len == size)
+            break;
+        params += len + 1;
+        size -= len + 1;
+    }
+    return false;
+}
+
+bool web_has_token(const char* data, unsigned int size, const char* token)
+{
+    unsigned int len, token_len, item_len, params_len;
+    const char* item;
+    token_len = strlen(token);
+    while (size)
+    {
+        len = web_get_word(data, size, ',');
+        item = data;
+        item_len = web_get_word(data, len, ';');
+        params_len = (item_len < len) ? len - item_len - 1 : 0;
+        item = web_trim((char*)item, &item_len);
+        //weak validator
+        if ((item_len > 2) && (item[0] == 'W') && (item[1] == '/'))
+        {
+            item += 2;
+            item_len -= 2;
+        }
+        if ((item_len == token_len) && web_stricmp(item, item_len, token))
+            return !web_token_refused(data + len - params_len, params_len);
+        if (len == size)
+            break;
+        data += len + 1;
+        size -= len + 1;
+    }
+    return false;
+}
 
 char* web_get_str_param(const char* head, unsigned int head_size, const char *param, unsigned int* value_len)
 {
@@ -249,3 +301,103 @@ bool web_get_version(const char* data, unsigned int size, HTTP_VERSION* version)
     return true;
 }
 
+
+void web_parser_init(WEB_PARSER* parser)
+{
+    parser->state = WEB_PARSER_STATE_STATUS_LINE;
+    parser->line = parser->pos = 0;
+    parser->status_line_size = parser->header_size = parser->content_length = parser->fields_count = 0;
+}
+
+static bool web_parser_add_field(WEB_PARSER* parser, const char* data, unsigned int end)
+{
+    const char* delim;
+    char* value;
+    unsigned int value_size, name_size;
+    WEB_HEADER_FIELD* field;
+    //obsolete line folding is not supported
+    if ((data[parser->line] == ' ') || (data[parser->line] == '\t'))
+        return false;
+    if ((delim = memchr(data + parser->line, ':', end - parser->line)) == NULL)
+        return false;
+    if (delim == data + parser->line)
+        return false;
+    name_size = delim - (data + parser->line);
+    value_size = end - (delim - data) - 1;
+    value = web_trim((char*)delim + 1, &value_size);
+    //required for framing, decoded once, even if field is not indexed
+    if ((name_size == 14) && web_stricmp(data + parser->line, name_size, "content-length"))
+    {
+        if (!web_atou(value, value_size, &parser->content_length))
+            return false;
+    }
+    //valid request with too many fields, rest is still in header, but not indexed
+    if (parser->fields_count >= WEB_HEADER_FIELDS_MAX)
+        return true;
+    field = &parser->fields[parser->fields_count++];
+    field->name = parser->line;
+    field->name_size = name_size;
+    field->value = value - data;
+    field->value_size = value_size;
+    return true;
+}
+
+WEB_PARSER_STATE web_parser_feed(WEB_PARSER* parser, const char* data, unsigned int size)
+{
+    const char* cr;
+    unsigned int end;
+    while ((parser->state == WEB_PARSER_STATE_STATUS_LINE) || (parser->state == WEB_PARSER_STATE_HEADER))
+    {
+        if (parser->pos >= size)
+            break;
+        if ((cr = memchr(data + parser->pos, '\r', size - parser->pos)) == NULL)
+        {
+            parser->pos = size;
+            break;
+        }
+        end = cr - data;
+        //wait for LF
+        if (end + 1 >= size)
+        {
+            parser->pos = end;
+            break;
+        }
+        if (data[end + 1] != '\n')
+        {
+            parser->pos = end + 1;
+            continue;
+        }
+        if (parser->state == WEB_PARSER_STATE_STATUS_LINE)
+        {
+            parser->status_line_size = end + 2;
+            parser->state = WEB_PARSER_STATE_HEADER;
+        }
+        //empty line is end of header
+        else if (end == parser->line)
+        {
+            parser->header_size = end + 2;
+            parser->state = WEB_PARSER_STATE_COMPLETE;
+        }
+        else if (!web_parser_add_field(parser, data, end))
+            parser->state = WEB_PARSER_STATE_ERROR;
+        parser->line = parser->pos = end + 2;
+    }
+    return parser->state;
+}
+
+char* web_parser_get_field(WEB_PARSER* parser, const char* data, const char* name, unsigned int* value_size)
+{
+    unsigned int i, len;
+    WEB_HEADER_FIELD* field;
+    len = strlen(name);
+    for (i = 0; i < parser->fields_count; ++i)
+    {
+        field = &parser->fields[i];
+        if ((field->name_size == len) && web_stricmp(data + field->name, len, name))
+        {
+            *value_size = field->value_size;
+            return (char*)data + field->value;
+        }
+    }
+    return NULL;
+}
@@ -8,6 +8,7 @@
 #define WEB_PARSE_H
 
 #include <stdbool.h>
+#include "../../userspace/types.h"
 #include "../../userspace/web.h"
 
 #define HTTP_URL_HEAD_LEN                       7
@@ -27,6 +28,28 @@ typedef enum {
     HTTP_2_0 = 0x20,
 } HTTP_VERSION;
 
+#define WEB_HEADER_FIELDS_MAX                   24
+
+typedef enum {
+    WEB_PARSER_STATE_STATUS_LINE = 0,
+    WEB_PARSER_STATE_HEADER,
+    WEB_PARSER_STATE_COMPLETE,
+    WEB_PARSER_STATE_ERROR
+} WEB_PARSER_STATE;
+
+//offsets from header start
+typedef struct {
+    uint16_t name, name_size, value, value_size;
+} WEB_HEADER_FIELD;
+
+typedef struct {
+    WEB_PARSER_STATE state;
+    //current line start, CR search resume position
+    unsigned int line, pos;
+    unsigned int status_line_size, header_size, content_length, fields_count;
+    WEB_HEADER_FIELD fields[WEB_HEADER_FIELDS_MAX];
+} WEB_PARSER;
+
 unsigned int web_get_header_size(const char* data, unsigned int size);
 int web_get_line_size(const char *data, unsigned int size);
 unsigned int web_get_word(const char *data, unsigned int size, char delim);
@@ -34,6 +57,8 @@ int web_find_keyword(const char* data, unsigned int size, const char* const* key
 bool web_atou(const char* data, unsigned int size, unsigned int* u);
 bool web_stricmp(const char* data, unsigned int size, const char* keyword);
 char* web_trim(char* str, unsigned int* len);
+//comma separated list. Parameters after ';' ignored, except q=0 - token is refused
+bool web_has_token(const char* data, unsigned int size, const char* token);
 char* web_get_str_param(const char* head, unsigned int head_size, const char* param, unsigned int* value_len);
 unsigned int web_get_int_param(const char* head, unsigned int head_size, const char* param);
 void web_set_str_param(char* head, unsigned int* head_size, const char* param, const char* value);
@@ -43,4 +68,9 @@ bool web_url_to_relative(char** url, unsigned int* url_size);
 bool web_get_method(char* data, unsigned int size, WEB_METHOD* method);
 bool web_get_version(const char* data, unsigned int size, HTTP_VERSION* version);
 
+void web_parser_init(WEB_PARSER* parser);
+//data is whole header received so far, may grow between calls. Parsing is resumed from last position
+WEB_PARSER_STATE web_parser_feed(WEB_PARSER* parser, const char* data, unsigned int size);
+char* web_parser_get_field(WEB_PARSER* parser, const char* data, const char* name, unsigned int* value_size);
+
 #endif // WEB_PARSE_H
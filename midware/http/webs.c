@@ -36,10 +36,27 @@ typedef enum {
 
 typedef struct {
     IO* io;
+    //chunk write in progress, completed after transmission
+    IO* user_io;
+    //body read in progress, completed on data arrival
+    IO* user_rx;
+    //response written while body read was in progress, sent after TCP returns io
+    IO* user_tx;
+    //response params, saved while session io is used for body read
+    char* resp_params;
+    //header and bytes received past it: body start, pipelined requests
     char* req;
+    char* resp;
+    //response body sent directly from flash, after resp
+    const char* tx_data;
     char* url;
-    unsigned int req_size, header_size, status_line_size, data_size, url_size, processed;
-    HANDLE conn, node_handle, self;
+    WEB_PARSER parser;
+    WEB_NODE_PARAM params[WEB_NODE_PARAMS_MAX];
+    unsigned int params_count;
+    //body - offset of unread body bytes in req
+    unsigned int req_size, body, data_size, data_processed, resp_size, tx_data_size, url_size, processed;
+    HANDLE conn, node_handle, self, handler;
+    unsigned int user_tx_cmd, resp_params_size;
 #if (WEBS_SESSION_TIMEOUT_S)
     HANDLE timer;
 #endif //WEBS_SESSION_TIMEOUT_S
@@ -49,6 +66,7 @@ typedef struct {
     WEBS_SESSION_STATE state;
     HTTP_VERSION version;
     WEB_METHOD method;
+    bool keep_alive, chunked;
 } WEBS_SESSION;
 
 typedef struct {
@@ -56,14 +74,24 @@ typedef struct {
     char* data;
 } WEBS_ERROR;
 
+typedef struct {
+    HANDLE process, session;
+    //session closed while handler is processing it. Slot is free on next handler call for this session
+    bool closing;
+} WEBS_HANDLER;
+
 typedef struct {
     HANDLE tcpip, process, listener;
-    bool busy;
     WEB_NODE web_node;
 
     ARRAY* errors;
     char* generic_error;
 
+    //handler processes pool. Owner is always first
+    ARRAY* handlers;
+    //sessions waiting for free handler, FIFO
+    ARRAY* pending;
+
     SO sessions;
 } WEBS;
 
@@ -130,9 +158,10 @@ static inline void webs_init(WEBS* webs)
     webs->process = INVALID_HANDLE;
     web_node_create(&webs->web_node);
 
-    webs->busy = false;
     array_create(&webs->errors, sizeof(WEBS_ERROR), 1);
     webs->generic_error = NULL;
+    array_create(&webs->handlers, sizeof(WEBS_HANDLER), 1);
+    array_create(&webs->pending, sizeof(HANDLE), WEBS_MAX_SESSIONS);
 
     so_create(&webs->sessions, sizeof(WEBS_SESSION), 1);
 }
@@ -149,11 +178,131 @@ static const char* webs_get_response_text(WEB_RESPONSE code)
     return __HTTP_REASONS[code / 100 - 1][code % 100];
 }
 
+static WEBS_HANDLER* webs_find_handler(WEBS* webs, HANDLE process)
+{
+    int i;
+    WEBS_HANDLER* handler;
+    for (i = 0; i < array_size(webs->handlers); ++i)
+    {
+        handler = array_at(webs->handlers, i);
+        if (handler->process == process)
+            return handler;
+    }
+    return NULL;
+}
+
+static void webs_dispatch(WEBS* webs, WEBS_SESSION* session, WEBS_HANDLER* handler)
+{
+    handler->session = session->self;
+    handler->closing = false;
+    session->handler = handler->process;
+    session->state = WEBS_SESSION_STATE_REQUEST;
+    //body is streamed by handler reads, content length is known ahead
+    ipc_post_inline(handler->process, HAL_CMD(HAL_WEBS, (WEBS_GET + session->method)), session->self, session->node_handle, session->data_size);
+}
+
+static void webs_schedule(WEBS* webs, WEBS_SESSION* session)
+{
+    HANDLE* pending;
+    WEBS_HANDLER* handler;
+    int i;
+    //any free handler. Pending queue is empty in this case
+    for (i = 0; i < array_size(webs->handlers); ++i)
+    {
+        handler = array_at(webs->handlers, i);
+        if (handler->session == INVALID_HANDLE)
+        {
+            webs_dispatch(webs, session, handler);
+            return;
+        }
+    }
+    if ((pending = array_append(&webs->pending)) == NULL)
+    {
+#if (WEBS_DEBUG_ERRORS)
+        printf("WEBS: Out of memory\n");
+#endif //WEBS_DEBUG_ERRORS
+        return;
+    }
+    *pending = session->self;
+    session->state = WEBS_SESSION_STATE_PENDING;
+}
+
+static void webs_release_handler(WEBS* webs, HANDLE process)
+{
+    WEBS_SESSION* session;
+    WEBS_HANDLER* handler = webs_find_handler(webs, process);
+    if (handler == NULL)
+        return;
+    handler->session = INVALID_HANDLE;
+    handler->closing = false;
+    //switch to next req in arrival order (if any)
+    while (array_size(webs->pending))
+    {
+        session = so_get(&webs->sessions, *((HANDLE*)array_at(webs->pending, 0)));
+        array_remove(&webs->pending, 0);
+        if ((session != NULL) && (session->state == WEBS_SESSION_STATE_PENDING))
+        {
+            webs_dispatch(webs, session, handler);
+            break;
+        }
+    }
+}
+
+//handler may still have request in flight, slot can't be dispatched till handler is done with session
+static void webs_close_handler(WEBS* webs, WEBS_SESSION* session)
+{
+    WEBS_HANDLER* handler = webs_find_handler(webs, session->handler);
+    if ((handler != NULL) && (handler->session == session->self))
+        handler->closing = true;
+}
+
+static void webs_unschedule(WEBS* webs, WEBS_SESSION* session)
+{
+    int i;
+    //user IO in progress, connection lost
+    if (session->user_io != NULL)
+    {
+        io_complete_ex(session->handler, HAL_IO_CMD(HAL_WEBS, WEBS_WRITE_CHUNK), session->self, session->user_io, ERROR_CONNECTION_CLOSED);
+        session->user_io = NULL;
+    }
+    if (session->user_rx != NULL)
+    {
+        io_complete_ex(session->handler, HAL_IO_CMD(HAL_WEBS, IPC_READ), session->self, session->user_rx, ERROR_CONNECTION_CLOSED);
+        session->user_rx = NULL;
+    }
+    if (session->user_tx != NULL)
+    {
+        io_complete_ex(session->handler, HAL_IO_CMD(HAL_WEBS, session->user_tx_cmd), session->self, session->user_tx, ERROR_CONNECTION_CLOSED);
+        session->user_tx = NULL;
+    }
+    switch (session->state)
+    {
+    case WEBS_SESSION_STATE_REQUEST:
+        webs_close_handler(webs, session);
+        break;
+    case WEBS_SESSION_STATE_PENDING:
+        for (i = 0; i < array_size(webs->pending); ++i)
+        {
+            if (*((HANDLE*)array_at(webs->pending, i)) == session->self)
+            {
+                array_remove(&webs->pending, i);
+                break;
+            }
+        }
+        break;
+    default:
+        break;
+    }
+}
+
 static void webs_session_reset(WEBS_SESSION* session)
 {
-    free(session->req);
-    session->req = NULL;
-    session->req_size = session->header_size = session->data_size = 0;
+    free(session->resp);
+    session->resp = NULL;
+    session->tx_data = NULL;
+    session->tx_data_size = session->resp_size = session->body = session->data_size = session->data_processed = 0;
+    session->keep_alive = session->chunked = false;
+    web_parser_init(&session->parser);
     session->state = WEBS_SESSION_STATE_IDLE;
 }
 
@@ -172,9 +321,12 @@ static inline WEBS_SESSION* webs_create_session(WEBS* webs)
     session = so_get(&webs->sessions, h);
     if (session == NULL)
         return NULL;
-    session->state = WEBS_SESSION_STATE_IDLE;
-    session->req = NULL;
-    session->req_size = session->header_size = session->data_size = 0;
+    session->req = session->resp = NULL;
+    session->req_size = 0;
+    webs_session_reset(session);
+    session->handler = INVALID_HANDLE;
+    session->user_io = session->user_rx = session->user_tx = NULL;
+    session->resp_params = NULL;
     session->io = io_create(WEBS_IO_SIZE + sizeof(TCP_STACK));
     session->self = h;
     if (session->io == NULL)
@@ -190,7 +342,10 @@ static inline WEBS_SESSION* webs_create_session(WEBS* webs)
 
 static void webs_destroy_session(WEBS* webs, WEBS_SESSION* session)
 {
+    webs_unschedule(webs, session);
     free(session->req);
+    free(session->resp);
+    free(session->resp_params);
 #if (WEBS_SESSION_TIMEOUT_S)
     timer_stop(session->timer, session->self, HAL_WEBS);
     timer_destroy(session->timer);
@@ -259,16 +414,29 @@ static void webs_out_of_memory(WEBS* webs, WEBS_SESSION* session)
 static void webs_tx(WEBS* webs, WEBS_SESSION* session)
 {
     TCP_STACK* tcp_stack;
+    unsigned int size, total;
+    total = session->resp_size + session->tx_data_size;
     tcp_stack = io_push(session->io, sizeof(TCP_STACK));
     session->io->data_size = WEBS_IO_SIZE;
-    if (session->req_size - session->processed < WEBS_IO_SIZE)
+    if (total - session->processed < WEBS_IO_SIZE)
     {
         tcp_stack->flags = 0;
-        session->io->data_size = session->req_size - session->processed;
+        session->io->data_size = total - session->processed;
     }
     else
         tcp_stack->flags = TCP_PSH;
-    memcpy(io_data(session->io), session->req + session->processed, session->io->data_size);
+    //header part
+    size = 0;
+    if (session->processed < session->resp_size)
+    {
+        size = session->resp_size - session->processed;
+        if (size > session->io->data_size)
+            size = session->io->data_size;
+        memcpy(io_data(session->io), session->resp + session->processed, size);
+    }
+    //static part
+    if (size < session->io->data_size)
+        memcpy((uint8_t*)io_data(session->io) + size, session->tx_data + session->processed + size - session->resp_size, session->io->data_size - size);
     tcp_write(webs->tcpip, session->conn, session->io);
 }
 
@@ -276,38 +444,56 @@ static inline void webs_generate_params(WEBS_SESSION* session, unsigned int resp
 {
     //header
     web_set_str_param(io_data(session->io), &session->io->data_size, "server", "RExOS");
+    web_set_str_param(io_data(session->io), &session->io->data_size, "connection", session->keep_alive ? "keep-alive" : "close");
 
-    if (response_size)
+    //HTTP/1.0 body without size is delimited by connection close
+    if (session->chunked)
     {
-        web_set_int_param(io_data(session->io), &session->io->data_size, "content-length", response_size);
+        if (session->version >= HTTP_1_1)
+            web_set_str_param(io_data(session->io), &session->io->data_size, "transfer-encoding", "chunked");
         web_set_str_param(io_data(session->io), &session->io->data_size, "content-type", "text/html");
     }
+    else
+    {
+        //required for persistent connection even if empty
+        web_set_int_param(io_data(session->io), &session->io->data_size, "content-length", response_size);
+        if (response_size)
+            web_set_str_param(io_data(session->io), &session->io->data_size, "content-type", "text/html");
+    }
 }
 
-static void webs_send_response(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE code, char* data, unsigned int data_size)
+static unsigned int webs_append_header(WEBS_SESSION* session, WEB_RESPONSE code, char* buf)
 {
-    unsigned int header_size, status_line_size;
-
+    unsigned int status_line_size;
     status_line_size = HTTP_STATUS_LINE_SIZE + strlen(webs_get_response_text(code));
-    webs_generate_params(session, data_size);
-    header_size = status_line_size + session->io->data_size + 2;
-    free(session->req);
-    session->req = malloc(header_size + data_size);
+    if (buf != NULL)
+    {
+        //status line
+        sprintf(buf, "HTTP/%d.%d %d %s\r\n", session->version >> 4, session->version & 0xf, code, webs_get_response_text(code));
+        //header, generated in io
+        memcpy(buf + status_line_size, io_data(session->io), session->io->data_size);
+        sprintf(buf + status_line_size + session->io->data_size, "\r\n");
+    }
+    return status_line_size + session->io->data_size + 2;
+}
 
-    if (session->req == NULL)
+static bool webs_prepare_response(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE code, unsigned int content_size, unsigned int data_size)
+{
+    unsigned int header_size;
+
+    webs_generate_params(session, content_size);
+    header_size = webs_append_header(session, code, NULL);
+    free(session->resp);
+    session->resp = malloc(header_size + data_size);
+
+    if (session->resp == NULL)
     {
         webs_out_of_memory(webs, session);
-        return;
+        return false;
     }
 
-    //status line
-    sprintf(session->req, "HTTP/%d.%d %d %s\r\n", session->version >> 4, session->version & 0xf, code, webs_get_response_text(code));
-
-    //header, generated in io
-    memcpy(session->req + status_line_size, io_data(session->io), session->io->data_size);
-    sprintf(session->req + status_line_size + session->io->data_size, "\r\n");
-    memcpy(session->req + header_size, data, data_size);
-    session->req_size = header_size + data_size;
+    webs_append_header(session, code, session->resp);
+    session->resp_size = header_size + data_size;
     session->processed = 0;
     session->state = WEBS_SESSION_STATE_TX;
 
@@ -316,8 +502,32 @@ static void webs_send_response(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE c
 #endif //WEBS_DEBUG_REQUESTS
 #if (WEBS_DEBUG_FLOW)
     printf("WEBS TX:\n");
-    web_print(session->req, session->req_size);
+    web_print(session->resp, header_size);
 #endif //WEBS_DEBUG_FLOW
+    return true;
+}
+
+//data is copied, source can be reused after call
+static void webs_send_response(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE code, char* data, unsigned int data_size)
+{
+    if (!webs_prepare_response(webs, session, code, data_size, data_size))
+        return;
+    memcpy(session->resp + session->resp_size - data_size, data, data_size);
+
+#if (WEBS_SESSION_TIMEOUT_S)
+    timer_start_ms(session->timer, WEBS_SESSION_TIMEOUT_S * 1000);
+#endif //WEBS_SESSION_TIMEOUT_S
+
+    webs_tx(webs, session);
+}
+
+//data located in flash, sent directly. Content size can differ from data size for HEAD/304
+static void webs_send_static(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE code, const void* data, unsigned int content_size, unsigned int data_size)
+{
+    if (!webs_prepare_response(webs, session, code, content_size, 0))
+        return;
+    session->tx_data = data;
+    session->tx_data_size = data_size;
 
 #if (WEBS_SESSION_TIMEOUT_S)
     timer_start_ms(session->timer, WEBS_SESSION_TIMEOUT_S * 1000);
@@ -341,7 +551,11 @@ static char* webs_get_error_html(WEBS* webs, WEB_RESPONSE code)
 
 static void webs_respond_error(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE code)
 {
-    char* html = webs_get_error_html(webs, code);
+    char* html;
+    //request stream can't be trusted anymore
+    if ((code != WEB_RESPONSE_NOT_FOUND) && (code != WEB_RESPONSE_METHOD_NOT_ALLOWED))
+        session->keep_alive = false;
+    html = webs_get_error_html(webs, code);
     if (html == NULL)
         html = webs->generic_error;
     if (html == NULL)
@@ -350,12 +564,12 @@ static void webs_respond_error(WEBS* webs, WEBS_SESSION* session, WEB_RESPONSE c
         webs_destroy_session(webs, session);
         return;
     }
-    webs_session_reset(session);
-    webs_send_response(webs, session, code, html, strlen(html));
+    webs_send_static(webs, session, code, html, strlen(html), strlen(html));
 }
 
 static inline void webs_open(WEBS* webs, uint16_t port, HANDLE tcpip, HANDLE process)
 {
+    WEBS_HANDLER* handler;
     if (webs->process != INVALID_HANDLE)
     {
         error(ERROR_ALREADY_CONFIGURED);
@@ -365,6 +579,15 @@ static inline void webs_open(WEBS* webs, uint16_t port, HANDLE tcpip, HANDLE pro
     webs->listener = tcp_listen(webs->tcpip, port);
     if (webs->listener == INVALID_HANDLE)
         return;
+    //owner is always handler
+    if ((handler = array_insert(&webs->handlers, 0)) == NULL)
+    {
+        tcp_close_listen(webs->tcpip, webs->listener);
+        return;
+    }
+    handler->process = process;
+    handler->session = INVALID_HANDLE;
+    handler->closing = false;
     webs->process = process;
 }
 
@@ -383,50 +606,236 @@ static inline void webs_close(WEBS* webs, HANDLE process)
         return;
     }
 
+    //don't dispatch pending requests while closing
+    array_clear(&webs->pending);
     for (h = so_first(&webs->sessions); h != INVALID_HANDLE; h = so_next(&webs->sessions, h))
     {
         session = so_get(&webs->sessions, h);
         webs_close_session(webs, session);
     }
     tcp_close_listen(webs->tcpip, webs->listener);
+    array_clear(&webs->handlers);
     webs->process = INVALID_HANDLE;
 }
 
+static inline void webs_register_handler(WEBS* webs, HANDLE process)
+{
+    WEBS_HANDLER* handler;
+    if (webs_find_handler(webs, process) != NULL)
+    {
+        error(ERROR_ALREADY_CONFIGURED);
+        return;
+    }
+    if ((handler = array_append(&webs->handlers)) == NULL)
+        return;
+    handler->process = process;
+    handler->session = INVALID_HANDLE;
+    handler->closing = false;
+}
+
+static inline void webs_unregister_handler(WEBS* webs, HANDLE process)
+{
+    int i;
+    WEBS_HANDLER* handler;
+    //owner can't be unregistered, only closed
+    for (i = 1; i < array_size(webs->handlers); ++i)
+    {
+        handler = array_at(webs->handlers, i);
+        if (handler->process == process)
+        {
+            if ((handler->session != INVALID_HANDLE) && !handler->closing)
+            {
+                error(ERROR_IN_PROGRESS);
+                return;
+            }
+            array_remove(&webs->handlers, i);
+            return;
+        }
+    }
+    error(ERROR_NOT_CONFIGURED);
+}
+
+//session io is free for response, params are restored
+static void webs_restore_params(WEBS_SESSION* session)
+{
+    io_reset(session->io);
+    if (session->resp_params == NULL)
+        return;
+    memcpy(io_data(session->io), session->resp_params, session->resp_params_size);
+    session->io->data_size = session->resp_params_size;
+    free(session->resp_params);
+    session->resp_params = NULL;
+}
+
+static void webs_copy_body(WEBS_SESSION* session, IO* io, const char* data, unsigned int size)
+{
+    unsigned int chunk = session->data_size - session->data_processed;
+    if (chunk > size)
+        chunk = size;
+    if (chunk > io_get_free(io))
+        chunk = io_get_free(io);
+    memcpy(io_data(io), data, chunk);
+    io->data_size = chunk;
+    session->data_processed += chunk;
+}
+
 static inline void webs_user_read(WEBS* webs, WEBS_SESSION* session, IO* io)
 {
     io->data_size = 0;
-    if (io_get_free(io) < session->data_size)
+    if (session->user_rx != NULL)
     {
-        error(ERROR_IO_BUFFER_TOO_SMALL);
+        error(ERROR_IN_PROGRESS);
         return;
     }
-    memcpy(io_data(io), session->req + session->header_size, session->data_size);
-    io->data_size = session->data_size;
+    //body already received with header
+    if ((session->data_processed >= session->data_size) || (session->req_size > session->body))
+    {
+        webs_copy_body(session, io, session->req + session->body, session->req_size - session->body);
+        session->body += io->data_size;
+        io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, IPC_READ), session->self, io);
+    }
+    else
+    {
+        //response params are kept in session io, saved till body read is complete
+        if (session->io->data_size)
+        {
+            if ((session->resp_params = malloc(session->io->data_size)) == NULL)
+            {
+                error(ERROR_OUT_OF_MEMORY);
+                return;
+            }
+            memcpy(session->resp_params, io_data(session->io), session->io->data_size);
+            session->resp_params_size = session->io->data_size;
+        }
+        //read directly to user, no accumulation
+        session->user_rx = io;
+#if (WEBS_SESSION_TIMEOUT_S)
+        timer_start_ms(session->timer, WEBS_SESSION_TIMEOUT_S * 1000);
+#endif //WEBS_SESSION_TIMEOUT_S
+        tcp_read(webs->tcpip, session->conn, session->io, WEBS_IO_SIZE);
+    }
+    error(ERROR_SYNC);
+}
+
+//response while body read is pending. Read is completed with error, session io is flushed from TCP.
+//Response is sent, when io is returned
+static bool webs_cancel_user_rx(WEBS* webs, WEBS_SESSION* session, IO* io, unsigned int cmd)
+{
+    if (session->user_rx == NULL)
+        return false;
+#if (WEBS_SESSION_TIMEOUT_S)
+    timer_stop(session->timer, session->self, HAL_WEBS);
+#endif //WEBS_SESSION_TIMEOUT_S
+    io_complete_ex(session->handler, HAL_IO_CMD(HAL_WEBS, IPC_READ), session->self, session->user_rx, ERROR_INVALID_STATE);
+    session->user_rx = NULL;
+    session->user_tx = io;
+    session->user_tx_cmd = cmd;
+    tcp_flush(webs->tcpip, session->conn);
+    error(ERROR_SYNC);
+    return true;
 }
 
 static inline void webs_user_write(WEBS* webs, WEBS_SESSION* session, IO* io)
 {
-    WEBS_SESSION* cur_session;
-    HANDLE h;
-    WEB_RESPONSE code = *((WEB_RESPONSE*)io_stack(io));
+    WEB_RESPONSE code;
+    if (webs_cancel_user_rx(webs, session, io, IPC_WRITE))
+        return;
+    code = *((WEB_RESPONSE*)io_stack(io));
     io_pop(io, sizeof(WEB_RESPONSE));
 
-    webs->busy = false;
-    //switch to next req (if any)
-    for (h = so_first(&webs->sessions); h != INVALID_HANDLE; h = so_next(&webs->sessions, h))
+    webs_release_handler(webs, session->handler);
+    session->handler = INVALID_HANDLE;
+
+    webs_send_response(webs, session, code, io_data(io), io->data_size);
+}
+
+static inline void webs_user_write_chunk(WEBS* webs, WEBS_SESSION* session, IO* io)
+{
+    unsigned int header_size, size;
+    char* buf;
+    WEB_RESPONSE code;
+
+    if (session->user_io != NULL)
     {
-        cur_session = so_get(&webs->sessions, h);
-        if (cur_session->state == WEBS_SESSION_STATE_PENDING)
-        {
-            webs->busy = true;
-            cur_session->state = WEBS_SESSION_STATE_REQUEST;
-            ipc_post_inline(webs->process, HAL_CMD(HAL_WEBS, (WEBS_GET + cur_session->method)), cur_session->self,
-                            cur_session->node_handle, cur_session->req_size);
-            break;
-        }
+        error(ERROR_IN_PROGRESS);
+        return;
     }
+    if (webs_cancel_user_rx(webs, session, io, WEBS_WRITE_CHUNK))
+        return;
+    code = *((WEB_RESPONSE*)io_stack(io));
+    io_pop(io, sizeof(WEB_RESPONSE));
 
-    webs_send_response(webs, session, code, io_data(io), io->data_size);
+    header_size = 0;
+    //first chunk, append header
+    if (!session->chunked)
+    {
+        session->chunked = true;
+        //HTTP/1.0 client doesn't support chunked encoding, close connection after body
+        if (session->version < HTTP_1_1)
+            session->keep_alive = false;
+        webs_generate_params(session, 0);
+        header_size = webs_append_header(session, code, NULL);
+    }
+    //size in hex, CRLF, data, CRLF. Final - zero size chunk with empty trailer
+    size = header_size + io->data_size;
+    if (session->version >= HTTP_1_1)
+        size += 8 + 2 + 2 + 2;
+
+    if ((buf = malloc(size)) == NULL)
+    {
+        webs_out_of_memory(webs, session);
+        return;
+    }
+    free(session->resp);
+    session->resp = buf;
+
+    if (header_size)
+        webs_append_header(session, code, buf);
+    size = header_size;
+    if (session->version >= HTTP_1_1)
+    {
+        sprintf(buf + size, "%x\r\n", io->data_size);
+        size += strlen(buf + size);
+    }
+    memcpy(buf + size, io_data(io), io->data_size);
+    size += io->data_size;
+    if ((session->version >= HTTP_1_1) && io->data_size)
+    {
+        memcpy(buf + size, "\r\n", 2);
+        size += 2;
+    }
+    //zero size chunk, empty trailer
+    if ((session->version >= HTTP_1_1) && (io->data_size == 0))
+    {
+        memcpy(buf + size, "\r\n", 2);
+        size += 2;
+    }
+    session->resp_size = size;
+    session->processed = 0;
+
+#if (WEBS_SESSION_TIMEOUT_S)
+    //timeout is restarted on each chunk
+    timer_stop(session->timer, session->self, HAL_WEBS);
+    timer_start_ms(session->timer, WEBS_SESSION_TIMEOUT_S * 1000);
+#endif //WEBS_SESSION_TIMEOUT_S
+
+    if (io->data_size == 0)
+    {
+        //last chunk, response is complete from user side
+        webs_release_handler(webs, session->handler);
+        session->handler = INVALID_HANDLE;
+        session->state = WEBS_SESSION_STATE_TX;
+#if (WEBS_DEBUG_REQUESTS)
+        printf("WEBS: %d %s (chunked)\n", code, webs_get_response_text(code));
+#endif //WEBS_DEBUG_REQUESTS
+    }
+    else
+    {
+        //hold user until chunk is transmitted - flow control
+        session->user_io = io;
+        error(ERROR_SYNC);
+    }
+    webs_tx(webs, session);
 }
 
 static inline void webs_create_node(WEBS* webs, HANDLE process, HANDLE parent, IO* io, unsigned int flags)
@@ -443,6 +852,27 @@ static inline void webs_destroy_node(WEBS* webs, HANDLE handle)
     web_node_free(&webs->web_node, handle);
 }
 
+static inline void webs_register_asset(WEBS* webs, HANDLE node, const WEB_ASSET* asset)
+{
+    if (web_node_get_data(&webs->web_node, node) != NULL)
+    {
+        error(ERROR_ALREADY_CONFIGURED);
+        return;
+    }
+    if (!web_node_set_data(&webs->web_node, node, asset))
+        error(ERROR_NOT_FOUND);
+}
+
+static inline void webs_unregister_asset(WEBS* webs, HANDLE node)
+{
+    if (web_node_get_data(&webs->web_node, node) == NULL)
+    {
+        error(ERROR_NOT_CONFIGURED);
+        return;
+    }
+    web_node_set_data(&webs->web_node, node, NULL);
+}
+
 static inline void webs_register_error(WEBS* webs, int code, char* html)
 {
     WEBS_ERROR* err;
@@ -498,7 +928,7 @@ static inline void webs_get_param(WEBS* webs, WEBS_SESSION* session, IO* io)
     unsigned int size;
     char* param;
 
-    param = web_get_str_param(session->req, session->header_size, io_data(io), &size);
+    param = web_parser_get_field(&session->parser, session->req, io_data(io), &size);
     io->data_size = 0;
     if (param == NULL)
     {
@@ -513,7 +943,7 @@ static inline void webs_get_param(WEBS* webs, WEBS_SESSION* session, IO* io)
     memcpy(io_data(io), param, size);
     ((uint8_t*)io_data(io))[size] = 0;
     io->data_size = size + 1;
-    io_complete(webs->process, HAL_IO_CMD(HAL_WEBS, WEBS_GET_PARAM), session->self, io);
+    io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, WEBS_GET_PARAM), session->self, io);
     error(ERROR_SYNC);
 }
 
@@ -522,6 +952,12 @@ static inline void webs_set_param(WEBS* webs, WEBS_SESSION* session, IO* io)
     char* param;
     char* value;
 
+    //session io is used by body read
+    if ((session->user_rx != NULL) || (session->user_tx != NULL))
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
     param = io_data(io);
     value = param + strlen(param) + 1;
     web_set_str_param(io_data(session->io), &session->io->data_size, param, value);
@@ -538,14 +974,51 @@ static inline void webs_get_url(WEBS* webs, WEBS_SESSION* session, IO* io)
     memcpy(io_data(io), session->url, session->url_size);
     ((uint8_t*)io_data(io))[session->url_size] = 0;
     io->data_size = session->url_size + 1;
-    io_complete(webs->process, HAL_IO_CMD(HAL_WEBS, WEBS_GET_URL), session->self, io);
+    io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, WEBS_GET_URL), session->self, io);
     error(ERROR_SYNC);
 }
 
-static inline void webs_session_request(WEBS* webs, IPC* ipc)
+static inline void webs_get_path_param(WEBS* webs, WEBS_SESSION* session, IO* io)
 {
-    WEBS_SESSION* session = so_get(&webs->sessions, ipc->param1);
+    unsigned int i;
+    WEB_NODE_PARAM* param;
+
+    for (i = 0; i < session->params_count; ++i)
+    {
+        param = &session->params[i];
+        if (web_node_is_param(&webs->web_node, param->node, io_data(io)))
+            break;
+    }
+    io->data_size = 0;
+    if (i >= session->params_count)
+    {
+        error(ERROR_NOT_FOUND);
+        return;
+    }
+    if (io_get_free(io) < param->size + 1)
+    {
+        error(ERROR_IO_BUFFER_TOO_SMALL);
+        return;
+    }
+    memcpy(io_data(io), session->url + param->offset, param->size);
+    ((uint8_t*)io_data(io))[param->size] = 0;
+    io->data_size = param->size + 1;
+    io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, WEBS_GET_PATH_PARAM), session->self, io);
+    error(ERROR_SYNC);
+}
 
+static inline void webs_session_request(WEBS* webs, IPC* ipc)
+{
+    WEBS_SESSION* session;
+    WEBS_HANDLER* handler = webs_find_handler(webs, ipc->process);
+    //handler is done with closed session. Checked first: session handle can be already reused
+    if ((handler != NULL) && handler->closing && (handler->session == (HANDLE)ipc->param1))
+    {
+        webs_release_handler(webs, ipc->process);
+        error(ERROR_CONNECTION_CLOSED);
+        return;
+    }
+    session = so_get(&webs->sessions, ipc->param1);
     if (session == NULL)
     {
         error(ERROR_CONNECTION_CLOSED);
@@ -561,11 +1034,22 @@ static inline void webs_session_request(WEBS* webs, IPC* ipc)
     }
     else
 #endif //WEBS_SESSION_TIMEOUT_S
-        if (session->state != WEBS_SESSION_STATE_REQUEST)
+        if ((session->state != WEBS_SESSION_STATE_REQUEST) || ((session->chunked) && (HAL_ITEM(ipc->cmd) != WEBS_WRITE_CHUNK)))
         {
             error(ERROR_INVALID_STATE);
             return;
         }
+        else if (session->handler != ipc->process)
+        {
+            error(ERROR_ACCESS_DENIED);
+            return;
+        }
+        //response is waiting for session io
+        else if (session->user_tx != NULL)
+        {
+            error(ERROR_IN_PROGRESS);
+            return;
+        }
 
     switch (HAL_ITEM(ipc->cmd))
     {
@@ -575,6 +1059,9 @@ static inline void webs_session_request(WEBS* webs, IPC* ipc)
     case IPC_WRITE:
         webs_user_write(webs, session, (IO*)ipc->param2);
         break;
+    case WEBS_WRITE_CHUNK:
+        webs_user_write_chunk(webs, session, (IO*)ipc->param2);
+        break;
     case WEBS_GET_PARAM:
         webs_get_param(webs, session, (IO*)ipc->param2);
         break;
@@ -584,6 +1071,9 @@ static inline void webs_session_request(WEBS* webs, IPC* ipc)
     case WEBS_GET_URL:
         webs_get_url(webs, session, (IO*)ipc->param2);
         break;
+    case WEBS_GET_PATH_PARAM:
+        webs_get_path_param(webs, session, (IO*)ipc->param2);
+        break;
     default:
         error(ERROR_NOT_SUPPORTED);
     }
@@ -611,21 +1101,130 @@ static inline void webs_request(WEBS* webs, IPC* ipc)
     case WEBS_UNREGISTER_RESPONSE:
         webs_unregister_error(webs, (int)ipc->param1);
         break;
+    case WEBS_REGISTER_ASSET:
+        webs_register_asset(webs, (HANDLE)ipc->param1, (const WEB_ASSET*)ipc->param2);
+        break;
+    case WEBS_UNREGISTER_ASSET:
+        webs_unregister_asset(webs, (HANDLE)ipc->param1);
+        break;
+    case WEBS_REGISTER_HANDLER:
+        webs_register_handler(webs, ipc->process);
+        break;
+    case WEBS_UNREGISTER_HANDLER:
+        webs_unregister_handler(webs, ipc->process);
+        break;
     default:
         webs_session_request(webs, ipc);
     }
 }
 
+static inline bool webs_get_keep_alive(WEBS_SESSION* session)
+{
+#if (WEBS_SESSION_TIMEOUT_S)
+    char* value;
+    unsigned int value_len;
+    value = web_parser_get_field(&session->parser, session->req, "connection", &value_len);
+    //HTTP/1.1 is persistent by default, HTTP/1.0 only on explicit request. Connection is comma-separated token list
+    if (session->version >= HTTP_1_1)
+        return (value == NULL) || !web_has_token(value, value_len, "close");
+    return (value != NULL) && web_has_token(value, value_len, "keep-alive");
+#else
+    return false;
+#endif //WEBS_SESSION_TIMEOUT_S
+}
+
+static inline bool webs_asset_not_modified(WEBS_SESSION* session, const WEB_ASSET* asset, const char* etag)
+{
+    char* value;
+    unsigned int value_len;
+    //If-None-Match has priority
+    if ((value = web_parser_get_field(&session->parser, session->req, "if-none-match", &value_len)) != NULL)
+        return web_has_token(value, value_len, etag) || web_has_token(value, value_len, "*");
+    if ((asset->last_modified != NULL) &&
+        ((value = web_parser_get_field(&session->parser, session->req, "if-modified-since", &value_len)) != NULL))
+        return (value_len == strlen(asset->last_modified)) && (strncmp(value, asset->last_modified, value_len) == 0);
+    return false;
+}
+
+static inline void webs_send_asset(WEBS* webs, WEBS_SESSION* session, const WEB_ASSET* asset)
+{
+    char buf[HTTP_LINE_SIZE];
+    char etag[16];
+    char* value;
+    unsigned int value_len;
+    const void* data = asset->data;
+    unsigned int size = asset->data_size;
+    bool gzip = false;
+
+    //precompressed variant
+    if (asset->gzip != NULL)
+    {
+        web_set_str_param(io_data(session->io), &session->io->data_size, "vary", "Accept-Encoding");
+        value = web_parser_get_field(&session->parser, session->req, "accept-encoding", &value_len);
+        gzip = (value != NULL) && web_has_token(value, value_len, "gzip");
+    }
+    if (gzip)
+    {
+        data = asset->gzip;
+        size = asset->gzip_size;
+        web_set_str_param(io_data(session->io), &session->io->data_size, "content-encoding", "gzip");
+        sprintf(etag, "\"%08x-gz\"", (unsigned int)asset->etag);
+    }
+    else
+        sprintf(etag, "\"%08x\"", (unsigned int)asset->etag);
+    web_set_str_param(io_data(session->io), &session->io->data_size, "etag", etag);
+    if (asset->last_modified != NULL)
+        web_set_str_param(io_data(session->io), &session->io->data_size, "last-modified", asset->last_modified);
+    if (asset->max_age)
+    {
+        sprintf(buf, "max-age=%u", asset->max_age);
+        web_set_str_param(io_data(session->io), &session->io->data_size, "cache-control", buf);
+    }
+    else
+        web_set_str_param(io_data(session->io), &session->io->data_size, "cache-control", "no-cache");
+
+    if (webs_asset_not_modified(session, asset, etag))
+    {
+        //representation size, no body
+        web_set_int_param(io_data(session->io), &session->io->data_size, "content-length", size);
+        webs_send_static(webs, session, WEB_RESPONSE_NOT_MODIFIED, NULL, 0, 0);
+        return;
+    }
+    if (asset->content_type != NULL)
+        web_set_str_param(io_data(session->io), &session->io->data_size, "content-type", asset->content_type);
+    webs_send_static(webs, session, WEB_RESPONSE_OK, data, size, session->method == WEB_METHOD_HEAD ? 0 : size);
+}
+
+//methods of node for 405 response
+static inline void webs_set_allow(WEBS* webs, WEBS_SESSION* session)
+{
+    char allow[HTTP_LINE_SIZE];
+    unsigned int i;
+    allow[0] = 0;
+    for (i = 0; i < HTTP_METHODS_COUNT; ++i)
+    {
+        if (web_node_check_flag(&webs->web_node, session->node_handle, WEB_FLAG(i)))
+        {
+            if (allow[0])
+                strcat(allow, ", ");
+            strcat(allow, __HTTP_METHODS[i]);
+        }
+    }
+    web_set_str_param(io_data(session->io), &session->io->data_size, "allow", allow);
+}
+
 static inline void webs_req_received(WEBS* webs, WEBS_SESSION* session)
 {
+    const WEB_ASSET* asset;
     char* str;
     unsigned int pos, size;
+    session->keep_alive = false;
     do {
         io_reset(session->io);
         //parse status line
         //<METHOD> <URL> HTTP/<VERSION>
         str = session->req;
-        size = web_get_line_size(session->req, session->header_size) - 2;
+        size = session->parser.status_line_size - 2;
 
         //method
         if ((pos = web_get_word(str, size, ' ')) == 0)
@@ -654,6 +1253,13 @@ static inline void webs_req_received(WEBS* webs, WEBS_SESSION* session)
             webs_respond_error(webs, session, WEB_RESPONSE_HTTP_VERSION_NOT_SUPPORTED);
             return;
         }
+        session->keep_alive = webs_get_keep_alive(session);
+        //chunked request body is not supported, can't find next request boundary
+        if (web_parser_get_field(&session->parser, session->req, "transfer-encoding", &pos) != NULL)
+        {
+            webs_respond_error(webs, session, WEB_RESPONSE_NOT_IMPLEMENTED);
+            return;
+        }
 
 #if (WEBS_DEBUG_REQUESTS)
         printf("WEBS: %s ", __HTTP_METHODS[session->method]);
@@ -662,7 +1268,7 @@ static inline void webs_req_received(WEBS* webs, WEBS_SESSION* session)
 #endif //WEBS_DEBUG_REQUESTS
 
         //check url path and method
-        session->node_handle = web_node_find_path(&webs->web_node, session->url, session->url_size);
+        session->node_handle = web_node_find_path(&webs->web_node, session->url, session->url_size, session->params, &session->params_count);
         if (session->node_handle == INVALID_HANDLE)
         {
             webs_respond_error(webs, session, WEB_RESPONSE_NOT_FOUND);
@@ -670,103 +1276,211 @@ static inline void webs_req_received(WEBS* webs, WEBS_SESSION* session)
         }
         if (!web_node_check_flag(&webs->web_node, session->node_handle, 1 << session->method))
         {
+            webs_set_allow(webs, session);
             webs_respond_error(webs, session, WEB_RESPONSE_METHOD_NOT_ALLOWED);
             return;
         }
 
-        if (webs->busy)
-            session->state = WEBS_SESSION_STATE_PENDING;
-        else
+        //static asset, handler is not involved
+        if (((session->method == WEB_METHOD_GET) || (session->method == WEB_METHOD_HEAD)) &&
+            ((asset = web_node_get_data(&webs->web_node, session->node_handle)) != NULL))
         {
-            webs->busy = true;
-            session->state = WEBS_SESSION_STATE_REQUEST;
-            ipc_post_inline(webs->process, HAL_CMD(HAL_WEBS, (WEBS_GET + session->method)), session->self, session->node_handle, session->req_size);
+            webs_send_asset(webs, session, asset);
+            return;
         }
+
+        webs_schedule(webs, session);
         return;
     } while (false);
     webs_respond_error(webs, session, WEB_RESPONSE_BAD_REQUEST);
 }
 
-static inline void webs_session_rx(WEBS* webs, WEBS_SESSION* session, int size)
+static void webs_session_parse(WEBS* webs, WEBS_SESSION* session)
 {
-    if (size < 0)
+    switch (web_parser_feed(&session->parser, session->req, session->req_size))
     {
-        //any error will cause connection termination
-        webs_close_session(webs, session);
+    case WEB_PARSER_STATE_COMPLETE:
+        break;
+    case WEB_PARSER_STATE_ERROR:
+        webs_respond_error(webs, session, WEB_RESPONSE_BAD_REQUEST);
+        return;
+    default:
+        //still no header received
+        tcp_read(webs->tcpip, session->conn, session->io, WEBS_IO_SIZE);
         return;
     }
+    session->body = session->parser.header_size;
+    session->data_size = session->parser.content_length;
+    session->data_processed = 0;
 
-    //we don't need TCP flags analyse
-    io_pop(session->io, sizeof(TCP_STACK));
+#if (WEBS_DEBUG_FLOW)
+    printf("WEBS RX:\n");
+    web_print(session->req, session->parser.header_size);
+#endif //WEBS_DEBUG_FLOW
 
+#if (WEBS_SESSION_TIMEOUT_S)
+    timer_stop(session->timer, session->self, HAL_WEBS);
+#endif //WEBS_SESSION_TIMEOUT_S
+
+    webs_req_received(webs, session);
+}
+
+static inline void webs_session_rx_header(WEBS* webs, WEBS_SESSION* session)
+{
+    char* req;
     if (session->req_size + session->io->data_size > WEBS_MAX_PAYLOAD)
     {
         webs_respond_error(webs, session, WEB_RESPONSE_PAYLOAD_TOO_LARGE);
         return;
     }
+    if ((req = realloc(session->req, session->req_size + session->io->data_size)) == NULL)
+    {
+        webs_out_of_memory(webs, session);
+        return;
+    }
+    session->req = req;
+    memcpy(session->req + session->req_size, io_data(session->io), session->io->data_size);
+    session->req_size += session->io->data_size;
+    session->state = WEBS_SESSION_STATE_RX;
+
+    webs_session_parse(webs, session);
+}
+
+static inline void webs_session_rx_body(WEBS* webs, WEBS_SESSION* session)
+{
+    char* req;
+    IO* io = session->user_rx;
+    unsigned int rest;
+    if (io == NULL)
+    {
+#if (WEBS_DEBUG_ERRORS)
+        printf("WEBS: Unexpected body RX\n");
+#endif //WEBS_DEBUG_ERRORS
+        webs_close_session(webs, session);
+        return;
+    }
+#if (WEBS_SESSION_TIMEOUT_S)
+    timer_stop(session->timer, session->self, HAL_WEBS);
+#endif //WEBS_SESSION_TIMEOUT_S
+    session->user_rx = NULL;
+    webs_copy_body(session, io, io_data(session->io), session->io->data_size);
+
+    //user buffer is smaller than segment or pipelined request. Save for later
+    rest = session->io->data_size - io->data_size;
+    if (rest)
+    {
+        //all buffered data is processed at this point
+        if ((req = realloc(session->req, session->req_size + rest)) == NULL)
+        {
+            io_complete_ex(session->handler, HAL_IO_CMD(HAL_WEBS, IPC_READ), session->self, io, ERROR_OUT_OF_MEMORY);
+            webs_out_of_memory(webs, session);
+            return;
+        }
+        //url is still used by handler
+        session->url = req + (session->url - session->req);
+        session->req = req;
+        memcpy(session->req + session->req_size, (uint8_t*)io_data(session->io) + io->data_size, rest);
+        session->req_size += rest;
+    }
+    webs_restore_params(session);
+    io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, IPC_READ), session->self, io);
+}
+
+//io is returned after body read was cancelled, send response written by user
+static inline void webs_session_rx_cancelled(WEBS* webs, WEBS_SESSION* session)
+{
+    IO* io = session->user_tx;
+    HANDLE handler = session->handler;
+    HANDLE self = session->self;
+    unsigned int cmd = session->user_tx_cmd;
+    session->user_tx = NULL;
+    //unread body is still on the wire, request boundary is lost
+    session->keep_alive = false;
+    webs_restore_params(session);
+    if (cmd == WEBS_WRITE_CHUNK)
+        webs_user_write_chunk(webs, session, io);
+    else
+        webs_user_write(webs, session, io);
+    //session is closed and freed on out of memory
+    if ((session = so_get(&webs->sessions, self)) == NULL)
+    {
+        io_complete_ex(handler, HAL_IO_CMD(HAL_WEBS, cmd), self, io, ERROR_CONNECTION_CLOSED);
+        return;
+    }
+    //hold user until chunk is transmitted
+    if (session->user_io == io)
+        return;
+    io_complete(handler, HAL_IO_CMD(HAL_WEBS, cmd), self, io);
+}
+
+static inline void webs_session_rx(WEBS* webs, WEBS_SESSION* session, int size)
+{
+    //flushed read returns with data or with error
+    if (session->user_tx != NULL)
+    {
+        webs_session_rx_cancelled(webs, session);
+        return;
+    }
+    if (size < 0)
+    {
+        //any error will cause connection termination
+        webs_close_session(webs, session);
+        return;
+    }
+
+    //we don't need TCP flags analyse
+    io_pop(session->io, sizeof(TCP_STACK));
 
     switch (session->state)
     {
     case WEBS_SESSION_STATE_IDLE:
-        session->req = malloc(size);
-        session->state = WEBS_SESSION_STATE_RX;
-        break;
     case WEBS_SESSION_STATE_RX:
-        session->req = realloc(session->req, session->req_size + size);
+        webs_session_rx_header(webs, session);
+        break;
+    case WEBS_SESSION_STATE_REQUEST:
+        webs_session_rx_body(webs, session);
         break;
     default:
 #if (WEBS_DEBUG_ERRORS)
         printf("WEBS: Invalid session state on RX: %d\n", session->state);
 #endif //WEBS_DEBUG_ERRORS
         webs_close_session(webs, session);
-        return;
     }
+}
 
-    if (session->req == NULL)
+static inline void webs_session_next(WEBS* webs, WEBS_SESSION* session)
+{
+    unsigned int rest;
+    //unread body still on the wire, can't find next request
+    if (session->data_size - session->data_processed > session->req_size - session->body)
+        session->keep_alive = false;
+    if (!session->keep_alive)
     {
-        webs_out_of_memory(webs, session);
+        webs_close_session(webs, session);
         return;
     }
-
-    memcpy(session->req + session->req_size, io_data(session->io), session->io->data_size);
-    session->req_size += session->io->data_size;
-
-    //Header ends with double CRLF
-    if (session->header_size == 0)
+    //skip unread body, pipelined request moved to buffer start
+    rest = session->req_size - session->body - (session->data_size - session->data_processed);
+    webs_session_reset(session);
+    if (rest)
     {
-        session->header_size = web_get_header_size(session->req, session->req_size);
-        //still no header received
-        if (session->header_size == 0)
-        {
-            tcp_read(webs->tcpip, session->conn, session->io, WEBS_IO_SIZE);
-            return;
-        }
+        memmove(session->req, session->req + session->req_size - rest, rest);
+        session->req_size = rest;
+        session->state = WEBS_SESSION_STATE_RX;
+        webs_session_parse(webs, session);
     }
-
-    session->status_line_size = web_get_line_size(session->req, session->header_size);
-    //Make sure all data received
-    if (session->data_size == 0)
-        session->data_size = web_get_int_param(session->req + session->status_line_size, session->header_size, "content-length");
-    if (session->data_size + session->header_size < session->req_size)
+    else
     {
+        free(session->req);
+        session->req = NULL;
+        session->req_size = 0;
         tcp_read(webs->tcpip, session->conn, session->io, WEBS_IO_SIZE);
-        return;
     }
-
-#if (WEBS_DEBUG_FLOW)
-    printf("WEBS RX:\n");
-    web_print(session->req, session->req_size);
-#endif //WEBS_DEBUG_FLOW
-
-#if (WEBS_SESSION_TIMEOUT_S)
-    timer_stop(session->timer, session->self, HAL_WEBS);
-#endif //WEBS_SESSION_TIMEOUT_S
-
-    webs_req_received(webs, session);
 }
 
 static inline void webs_session_tx_complete(WEBS* webs, WEBS_SESSION* session, int size)
 {
+    IO* user_io;
     if (size < 0)
     {
         //any error will cause connection termination
@@ -774,14 +1488,18 @@ static inline void webs_session_tx_complete(WEBS* webs, WEBS_SESSION* session, i
         return;
     }
     session->processed += size;
-    if (session->processed >= session->req_size)
+    if (session->processed >= session->resp_size + session->tx_data_size)
     {
-#if (WEBS_SESSION_TIMEOUT_S)
-        webs_session_reset(session);
-        tcp_read(webs->tcpip, session->conn, session->io, WEBS_IO_SIZE);
-#else
-        webs_close_session(webs, session);
-#endif //WEBS_SESSION_TIMEOUT_S
+        //chunk transmitted, user can send next
+        if (session->user_io != NULL)
+        {
+            user_io = session->user_io;
+            session->user_io = NULL;
+            io_complete(session->handler, HAL_IO_CMD(HAL_WEBS, WEBS_WRITE_CHUNK), session->self, user_io);
+            return;
+        }
+        if (session->state == WEBS_SESSION_STATE_TX)
+            webs_session_next(webs, session);
     }
     else
         webs_tx(webs, session);
@@ -809,6 +1527,7 @@ static inline void webs_tcp_request(WEBS* webs, IPC* ipc)
             break;
         case IPC_WRITE:
             webs_session_tx_complete(webs, session, (int)ipc->param3);
+            break;
         default:
             error(ERROR_NOT_SUPPORTED);
             break;
@@ -37,6 +37,7 @@ static void scsis_media_removed(SCSIS* scsis)
 
 SCSIS* scsis_create(SCSIS_CB cb_host, void* param, unsigned int id, SCSI_STORAGE_DESCRIPTOR *storage_descriptor)
 {
+    int i;
     SCSIS* scsis = malloc(sizeof(SCSIS));
     if (scsis == NULL)
         return NULL;
@@ -47,11 +48,24 @@ SCSIS* scsis_create(SCSIS_CB cb_host, void* param, unsigned int id, SCSI_STORAGE
     scsis->io = NULL;
     scsis->media = NULL;
     scsis->state = SCSIS_STATE_IDLE;
+    for (i = 0; i < SCSI_IO_BUFFERS; ++i)
+        scsis->ios[i] = NULL;
+#if (SCSI_WRITE_CACHE)
+    scsis->write_cached = false;
+#endif //SCSI_WRITE_CACHE
+#if (SCSI_TASK_DEPTH)
+    scsis->task_count = 0;
+    scsis->tag = SCSIS_NO_TAG;
+#endif //SCSI_TASK_DEPTH
     return scsis;
 }
 
 void scsis_destroy(SCSIS* scsis)
 {
+    int i;
+    //first is host IO
+    for (i = 1; i < SCSI_IO_BUFFERS; ++i)
+        io_destroy(scsis->ios[i]);
     if (scsis->storage_descriptor->flags & SCSI_STORAGE_DESCRIPTOR_REMOVABLE)
         storage_cancel_notify_state_change(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user);
     scsis_media_removed(scsis);
@@ -75,6 +89,13 @@ void scsis_reset(SCSIS* scsis)
     scsis->need_media = false;
     scsis->io = NULL;
     scsis->state = SCSIS_STATE_IDLE;
+#if (SCSI_WRITE_CACHE)
+    scsis->write_cached = false;
+#endif //SCSI_WRITE_CACHE
+#if (SCSI_TASK_DEPTH)
+    scsis->task_count = 0;
+    scsis->tag = SCSIS_NO_TAG;
+#endif //SCSI_TASK_DEPTH
 }
 
 void scsis_request_cmd(SCSIS* scsis, IO* io, uint8_t* req)
@@ -221,12 +242,126 @@ void scsis_host_io_complete(SCSIS* scsis, int resp_size)
         scsis_bc_host_io_complete(scsis, resp_size);
 }
 
+#if (SCSI_TASK_DEPTH)
+static unsigned int scsis_task_next(SCSIS* scsis)
+{
+    unsigned int i, j, lba, count, wlba, wcount;
+    bool write;
+    for (i = 0; i < scsis->task_count; ++i)
+    {
+        if (scsis->tasks[i].attr == SCSIS_TASK_HEAD_OF_QUEUE)
+            return i;
+    }
+    //simple read can pass simple writes queued before, if not overlapped
+    for (i = 0; i < scsis->task_count; ++i)
+    {
+        if ((scsis->tasks[i].attr != SCSIS_TASK_SIMPLE) || !scsis_bc_get_range(scsis->tasks[i].req, &lba, &count, &write))
+            break;
+        if (write)
+            continue;
+        for (j = 0; j < i; ++j)
+        {
+            scsis_bc_get_range(scsis->tasks[j].req, &wlba, &wcount, &write);
+            if (write && (lba < wlba + wcount) && (wlba < lba + count))
+                break;
+        }
+        if (j == i)
+            return i;
+    }
+    return 0;
+}
+
+static void scsis_task_remove(SCSIS* scsis, unsigned int i)
+{
+    --scsis->task_count;
+    memmove(scsis->tasks + i, scsis->tasks + i + 1, (scsis->task_count - i) * sizeof(SCSIS_TASK));
+}
+
+static void scsis_task_start(SCSIS* scsis)
+{
+    unsigned int i = scsis_task_next(scsis);
+    memcpy(scsis->req, scsis->tasks[i].req, SCSI_CDB_SIZE);
+    scsis->tag = scsis->tasks[i].tag;
+    scsis_task_remove(scsis, i);
+#if (SCSI_DEBUG_REQUESTS)
+    printf("SCSI task tag: %d, queued: %d\n", scsis->tag, scsis->task_count);
+#endif //SCSI_DEBUG_REQUESTS
+    scsis_request_cmd(scsis, scsis->io, scsis->req);
+}
+
+static int scsis_task_find(SCSIS* scsis, unsigned int tag)
+{
+    unsigned int i;
+    for (i = 0; i < scsis->task_count; ++i)
+    {
+        if (scsis->tasks[i].tag == tag)
+            return i;
+    }
+    return -1;
+}
+
+bool scsis_queue_cmd(SCSIS* scsis, unsigned int tag, SCSIS_TASK_ATTR attr, uint8_t* req)
+{
+    SCSIS_TASK* task;
+    if (scsis->task_count >= SCSI_TASK_DEPTH)
+    {
+#if (SCSI_DEBUG_ERRORS)
+        printf("SCSI: task set full\n");
+#endif //SCSI_DEBUG_ERRORS
+        return false;
+    }
+    task = &scsis->tasks[scsis->task_count++];
+    memcpy(task->req, req, SCSI_CDB_SIZE);
+    task->tag = tag;
+    task->attr = attr;
+    scsis_task_need_io(scsis);
+    return true;
+}
+
+unsigned int scsis_get_tag(SCSIS* scsis)
+{
+    return scsis->tag;
+}
+
+bool scsis_query_task(SCSIS* scsis, unsigned int tag)
+{
+    return (scsis->tag == tag) || (scsis_task_find(scsis, tag) >= 0);
+}
+
+bool scsis_abort_task(SCSIS* scsis, unsigned int tag)
+{
+    int i = scsis_task_find(scsis, tag);
+    if (i < 0)
+        return false;
+    scsis_task_remove(scsis, i);
+    return true;
+}
+
+void scsis_abort_task_set(SCSIS* scsis)
+{
+    scsis->task_count = 0;
+}
+#endif //SCSI_TASK_DEPTH
+
 void scsis_host_give_io(SCSIS* scsis, IO* io)
 {
     scsis->io = io;
+#if (SCSI_TASK_DEPTH)
+    if (!scsis->need_media && scsis->task_count)
+    {
+        scsis_task_start(scsis);
+        return;
+    }
+#endif //SCSI_TASK_DEPTH
     scsis_request_media(scsis);
 }
 
+unsigned int scsis_get_sense(SCSIS* scsis, uint8_t* data)
+{
+    scsis_error_get_fixed(scsis, data);
+    return SCSI_SENSE_FIXED_SIZE;
+}
+
 static inline void scsis_get_media_descriptor(SCSIS* scsis, int size)
 {
     scsis->need_media = false;
@@ -250,6 +385,9 @@ static inline void scsis_get_media_descriptor(SCSIS* scsis, int size)
     //media descriptor responded, inform host on ready state
     scsis->io = NULL;
     scsis_cb_host(scsis, SCSIS_RESPONSE_RELEASE_IO, 0);
+#if (SCSI_TASK_DEPTH)
+    scsis_task_need_io(scsis);
+#endif //SCSI_TASK_DEPTH
 }
 
 void scsis_request(SCSIS* scsis, IPC* ipc)
@@ -8,6 +8,7 @@
 #define SCSIS_H
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "../../userspace/io.h"
 #include "../../userspace/scsi.h"
 
@@ -24,7 +25,18 @@ typedef enum {
     SCSIS_RESPONSE_RELEASE_IO
 } SCSIS_RESPONSE;
 
-typedef void (*SCSIS_CB)(void*, unsigned int, SCSIS_RESPONSE, unsigned int);
+//io is data buffer for READ/WRITE responses. Up to SCSI_IO_BUFFERS can be used in single transfer, host io complete is in order
+//task attribute, same encoding as SAM-4 and UAS
+typedef enum {
+    SCSIS_TASK_SIMPLE = 0,
+    SCSIS_TASK_HEAD_OF_QUEUE,
+    SCSIS_TASK_ORDERED,
+    SCSIS_TASK_ACA = 4
+} SCSIS_TASK_ATTR;
+
+#define SCSIS_NO_TAG                                0xffffffff
+
+typedef void (*SCSIS_CB)(void*, unsigned int, SCSIS_RESPONSE, IO*, unsigned int);
 
 SCSIS* scsis_create(SCSIS_CB cb_host, void* param, unsigned int id, SCSI_STORAGE_DESCRIPTOR* storage_descriptor);
 void scsis_destroy(SCSIS* scsis);
@@ -36,5 +48,18 @@ void scsis_request_cmd(SCSIS* scsis, IO* io, uint8_t* req);
 void scsis_host_io_complete(SCSIS* scsis, int resp_size);
 void scsis_host_give_io(SCSIS* scsis, IO* io);
 void scsis_request(SCSIS* scsis, IPC* ipc);
+//fixed format sense of last failed command
+unsigned int scsis_get_sense(SCSIS* scsis, uint8_t* data);
+
+//tagged command queueing, SCSI_TASK_DEPTH required. IO is requested with NEED_IO, when task is ready to run
+//false if task set is full
+bool scsis_queue_cmd(SCSIS* scsis, unsigned int tag, SCSIS_TASK_ATTR attr, uint8_t* req);
+//tag of running command or SCSIS_NO_TAG. Valid on host callbacks
+unsigned int scsis_get_tag(SCSIS* scsis);
+//true if tag is queued or running
+bool scsis_query_task(SCSIS* scsis, unsigned int tag);
+//only queued task can be aborted
+bool scsis_abort_task(SCSIS* scsis, unsigned int tag);
+void scsis_abort_task_set(SCSIS* scsis);
 
 #endif // SCSIS_H
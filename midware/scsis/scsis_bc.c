@@ -92,137 +92,254 @@ void scsis_bc_start_stop_unit(SCSIS* scsis, uint8_t* req)
     scsis_pass(scsis);
 }
 
-static void scsis_io(SCSIS* scsis)
+static void scsis_bc_lba_advance(SCSIS* scsis, unsigned int count)
 {
-    scsis->io->data_size = 0;
 #if (SCSI_LONG_LBA)
     uint32_t lba_old = scsis->lba;
 #endif //SCSI_LONG_LBA
-    if (!scsis_get_media(scsis))
-        return;
-    //request completed
-    if (scsis->count == 0)
-    {
-        scsis_pass(scsis);
-        return;
-    }
-    scsis->lba += scsis->count_cur;
+    scsis->lba += count;
 #if (SCSI_LONG_LBA)
     if (scsis->lba < lba_old)
         ++scsis->lba_hi;
 #endif //SCSI_LONG_LBA
+}
 
-    scsis->count_cur = (io_get_free(scsis->io) - sizeof(STORAGE_STACK)) / scsis->media->sector_size;
-    if (scsis->count < scsis->count_cur)
-        scsis->count_cur = scsis->count;
-
-    scsis->count -= scsis->count_cur;
-
-    switch (scsis->state)
+static void scsis_bc_io_abort(SCSIS* scsis, uint8_t key_sense, uint16_t ascq)
+{
+    //only first error is reported, following are consequences
+    if (scsis->io_error.key_sense == SENSE_KEY_NO_SENSE)
     {
-    case SCSIS_STATE_READ:
-        storage_read(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user,
-                     scsis->io, scsis->lba, scsis->count_cur * scsis->media->sector_size);
-        break;
-    case SCSIS_STATE_WRITE:
-#if (SCSI_VERIFY_SUPPORTED)
-    case SCSIS_STATE_VERIFY:
-    case SCSIS_STATE_WRITE_VERIFY:
-#endif //SCSI_VERIFY_SUPPORTED
-        scsis_cb_host(scsis, SCSIS_RESPONSE_READ, scsis->count_cur * scsis->media->sector_size);
-        break;
-    default:
-        break;
+        scsis->io_error.key_sense = key_sense;
+        scsis->io_error.ascq = ascq;
     }
+    scsis->count = 0;
 }
 
-static bool scsis_bc_io_response_check(SCSIS* scsis, int size)
+static bool scsis_bc_io_response_check(SCSIS* scsis, int size, unsigned int expected)
 {
-    if (!scsis_get_media(scsis))
-        return false;
     if (size < 0)
     {
         switch (size)
         {
         case ERROR_CRC:
-            scsis_fail(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_CRC_ERROR);
+            scsis_bc_io_abort(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_CRC_ERROR);
             break;
         case ERROR_IN_PROGRESS:
-            scsis_fail(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_UNIT_NOT_READY_OPERATION_IN_PROGRESS);
+            scsis_bc_io_abort(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_UNIT_NOT_READY_OPERATION_IN_PROGRESS);
             break;
         case ERROR_ACCESS_DENIED:
-            scsis_fail(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_WRITE_PROTECTED);
+            scsis_bc_io_abort(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_WRITE_PROTECTED);
             break;
         case ERROR_INVALID_PARAMS:
-            scsis_fail(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
+            scsis_bc_io_abort(scsis, SENSE_KEY_MEDIUM_ERROR, ASCQ_LOGICAL_BLOCK_ADDRESS_OUT_OF_RANGE);
             break;
         default:
-            scsis_fail(scsis, SENSE_KEY_HARDWARE_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_FAILURE);
+            scsis_bc_io_abort(scsis, SENSE_KEY_HARDWARE_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_FAILURE);
             break;
         }
         return false;
     }
-    else if (size != scsis->count_cur * scsis->media->sector_size)
+    else if (size != expected)
     {
-        scsis_fail(scsis, SENSE_KEY_HARDWARE_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_FAILURE);
+        scsis_bc_io_abort(scsis, SENSE_KEY_HARDWARE_ERROR, ASCQ_LOGICAL_UNIT_COMMUNICATION_FAILURE);
         return false;
     }
     return true;
 }
 
-void scsis_bc_host_io_complete(SCSIS* scsis, int resp_size)
+/*
+    Producer fills ring buffers in order, consumer drains them. Storage is producer on read and consumer on write/verify,
+    host is opposite. Only one request is pending on each side, so storage and host IO are overlapped.
+ */
+static void scsis_bc_io_produce(SCSIS* scsis)
 {
-    if (!scsis_bc_io_response_check(scsis, resp_size))
-        return;
+    IO* io = scsis->ios[scsis->io_head];
+    unsigned int count;
+    io->data_size = 0;
+    count = (io_get_free(io) - sizeof(STORAGE_STACK)) / scsis->media->sector_size;
+    if (scsis->count < count)
+        count = scsis->count;
+    scsis->count -= count;
+    scsis->io_size[scsis->io_head] = count * scsis->media->sector_size;
+    ++scsis->io_fill;
+    scsis->producing = true;
+
+    if (scsis->state == SCSIS_STATE_READ)
+    {
+        storage_read(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user,
+                     io, scsis->lba, scsis->io_size[scsis->io_head]);
+        scsis_bc_lba_advance(scsis, count);
+    }
+    else
+        scsis_cb_host_io(scsis, io, SCSIS_RESPONSE_READ, scsis->io_size[scsis->io_head]);
+}
+
+static void scsis_bc_io_consume(SCSIS* scsis)
+{
+    IO* io = scsis->ios[scsis->io_tail];
+    scsis->consuming = true;
     switch (scsis->state)
     {
     case SCSIS_STATE_READ:
-        scsis_io(scsis);
-        break;
+        scsis_cb_host_io(scsis, io, SCSIS_RESPONSE_WRITE, io->data_size);
+        return;
     case SCSIS_STATE_WRITE:
-#if (SCSI_WRITE_CACHE)
-        if (scsis->count == 0)
-            scsis_cb_host(scsis, SCSIS_RESPONSE_PASS, 0);
-#endif //SCSI_WRITE_CACHE
         storage_write(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user,
-                      scsis->io, scsis->lba);
+                      io, scsis->lba);
         break;
 #if (SCSI_VERIFY_SUPPORTED)
     case SCSIS_STATE_VERIFY:
         storage_verify(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user,
-                      scsis->io, scsis->lba);
+                      io, scsis->lba);
         break;
     case SCSIS_STATE_WRITE_VERIFY:
         storage_write_verify(scsis->storage_descriptor->hal, scsis->storage_descriptor->storage, scsis->storage_descriptor->user,
-                      scsis->io, scsis->lba);
+                      io, scsis->lba);
         break;
 #endif //SCSI_VERIFY_SUPPORTED
     default:
         break;
     }
+    scsis_bc_lba_advance(scsis, scsis->io_size[scsis->io_tail] / scsis->media->sector_size);
 }
 
-void scsis_bc_storage_io_complete(SCSIS* scsis, int resp_size)
+static void scsis_bc_io_pump(SCSIS* scsis)
 {
-    if (!scsis_bc_io_response_check(scsis, resp_size))
+    if (scsis->media == NULL)
+        scsis_bc_io_abort(scsis, SENSE_KEY_NOT_READY, ASCQ_MEDIUM_NOT_PRESENT);
+    if (scsis->io_error.key_sense != SENSE_KEY_NO_SENSE)
+    {
+        //IO can't be released while used by storage or host
+        if (!scsis->producing && !scsis->consuming)
+            scsis_fail(scsis, scsis->io_error.key_sense, scsis->io_error.ascq);
         return;
+    }
+    if (!scsis->consuming && scsis->io_ready)
+        scsis_bc_io_consume(scsis);
+    if (!scsis->producing && scsis->count && (scsis->io_fill < scsis->io_count))
+        scsis_bc_io_produce(scsis);
+    //request completed
+    if (!scsis->producing && !scsis->consuming && (scsis->io_fill == 0))
+        scsis_pass(scsis);
+}
 
+static void scsis_bc_io_produced(SCSIS* scsis, int size)
+{
+    scsis->producing = false;
+    if (scsis_bc_io_response_check(scsis, size, scsis->io_size[scsis->io_head]))
+    {
+        scsis->io_head = (scsis->io_head + 1) % scsis->io_count;
+        ++scsis->io_ready;
+#if (SCSI_WRITE_CACHE)
+        if ((scsis->state == SCSIS_STATE_WRITE) && (scsis->count == 0) && (scsis->io_error.key_sense == SENSE_KEY_NO_SENSE))
+        {
+            scsis->write_cached = true;
+            scsis_cb_host(scsis, SCSIS_RESPONSE_PASS, 0);
+#if (SCSI_TASK_DEPTH)
+            //tag can be reused by host
+            scsis->tag = SCSIS_NO_TAG;
+#endif //SCSI_TASK_DEPTH
+        }
+#endif //SCSI_WRITE_CACHE
+    }
+    scsis_bc_io_pump(scsis);
+}
+
+static void scsis_bc_io_consumed(SCSIS* scsis, int size)
+{
+    scsis->consuming = false;
+    if (scsis_bc_io_response_check(scsis, size, scsis->io_size[scsis->io_tail]))
+    {
+        scsis->io_tail = (scsis->io_tail + 1) % scsis->io_count;
+        --scsis->io_ready;
+        --scsis->io_fill;
+    }
+    scsis_bc_io_pump(scsis);
+}
+
+static void scsis_bc_io_start(SCSIS* scsis, SCSIS_STATE state)
+{
+    scsis->state = state;
+    if (!scsis_get_media(scsis))
+        return;
+    scsis->ios[0] = scsis->io;
+    //work with less buffers on out of memory
+    for (scsis->io_count = 1; scsis->io_count < SCSI_IO_BUFFERS; ++scsis->io_count)
+    {
+        if ((scsis->ios[scsis->io_count] == NULL) && ((scsis->ios[scsis->io_count] = io_create(scsis->io->size - sizeof(IO))) == NULL))
+            break;
+    }
+    scsis->io_head = scsis->io_tail = scsis->io_fill = scsis->io_ready = 0;
+    scsis->producing = scsis->consuming = false;
+    scsis->io_error.key_sense = SENSE_KEY_NO_SENSE;
+    scsis->io_error.ascq = ASCQ_NO_ADDITIONAL_SENSE_INFORMATION;
+    scsis_bc_io_pump(scsis);
+}
+
+void scsis_bc_host_io_complete(SCSIS* scsis, int resp_size)
+{
+    switch (scsis->state)
+    {
+    case SCSIS_STATE_READ:
+        scsis_bc_io_consumed(scsis, resp_size);
+        break;
+    case SCSIS_STATE_WRITE:
+#if (SCSI_VERIFY_SUPPORTED)
+    case SCSIS_STATE_VERIFY:
+    case SCSIS_STATE_WRITE_VERIFY:
+#endif //SCSI_VERIFY_SUPPORTED
+        scsis_bc_io_produced(scsis, resp_size);
+        break;
+    default:
+        break;
+    }
+}
+
+void scsis_bc_storage_io_complete(SCSIS* scsis, int resp_size)
+{
     switch (scsis->state)
     {
     case SCSIS_STATE_READ:
-        scsis_cb_host(scsis, SCSIS_RESPONSE_WRITE, scsis->io->data_size);
+        scsis_bc_io_produced(scsis, resp_size);
         break;
     case SCSIS_STATE_WRITE:
 #if (SCSI_VERIFY_SUPPORTED)
     case SCSIS_STATE_VERIFY:
     case SCSIS_STATE_WRITE_VERIFY:
 #endif //SCSI_VERIFY_SUPPORTED
-        scsis_io(scsis);
+        scsis_bc_io_consumed(scsis, resp_size);
         break;
     default:
         break;
     }
 }
+
+bool scsis_bc_get_range(uint8_t* req, unsigned int* lba, unsigned int* count, bool* write)
+{
+    switch (req[0])
+    {
+    case SCSI_SBC_CMD_READ6:
+    case SCSI_SBC_CMD_WRITE6:
+        *lba = ((req[1] & 0x1f) << 16) | be2short(req + 2);
+        *count = req[4] ? req[4] : 256;
+        break;
+    case SCSI_SBC_CMD_READ10:
+    case SCSI_SBC_CMD_WRITE10:
+        *lba = be2int(req + 2);
+        *count = be2short(req + 7);
+        break;
+    case SCSI_SBC_CMD_READ12:
+    case SCSI_SBC_CMD_WRITE12:
+        *lba = be2int(req + 2);
+        *count = be2int(req + 6);
+        break;
+    default:
+        return false;
+    }
+    *write = (req[0] == SCSI_SBC_CMD_WRITE6) || (req[0] == SCSI_SBC_CMD_WRITE10) || (req[0] == SCSI_SBC_CMD_WRITE12);
+    return true;
+}
+
 void scsis_bc_read6(SCSIS* scsis, uint8_t* req)
 {
     scsis->lba = ((req[1] & 0x1f) << 16) | be2short(req + 2);
@@ -235,9 +352,7 @@ void scsis_bc_read6(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI read(6) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_READ;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_READ);
 }
 
 void scsis_bc_read10(SCSIS* scsis, uint8_t* req)
@@ -250,9 +365,7 @@ void scsis_bc_read10(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI read(10) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_READ;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_READ);
 }
 
 void scsis_bc_read12(SCSIS* scsis, uint8_t* req)
@@ -265,9 +378,7 @@ void scsis_bc_read12(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI read(12) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_READ;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_READ);
 }
 
 void scsis_bc_write6(SCSIS* scsis, uint8_t* req)
@@ -282,9 +393,7 @@ void scsis_bc_write6(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write(6) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE);
 }
 
 void scsis_bc_write10(SCSIS* scsis, uint8_t* req)
@@ -297,9 +406,7 @@ void scsis_bc_write10(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write(10) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE);
 }
 
 void scsis_bc_write12(SCSIS* scsis, uint8_t* req)
@@ -312,9 +419,7 @@ void scsis_bc_write12(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write(12) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE);
 }
 
 #if (SCSI_VERIFY_SUPPORTED)
@@ -328,9 +433,7 @@ void scsis_bc_verify10(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI verify(10) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_VERIFY);
 }
 
 void scsis_bc_verify12(SCSIS* scsis, uint8_t* req)
@@ -343,9 +446,7 @@ void scsis_bc_verify12(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI verify(12) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_VERIFY);
 }
 
 void scsis_bc_write_verify10(SCSIS* scsis, uint8_t* req)
@@ -358,9 +459,7 @@ void scsis_bc_write_verify10(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write and verify(10) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE_VERIFY);
 }
 
 void scsis_bc_write_verify12(SCSIS* scsis, uint8_t* req)
@@ -373,9 +472,7 @@ void scsis_bc_write_verify12(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write and verify(12) lba: %#08X, len: %#X\n", scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE_VERIFY);
 }
 #endif //SCSI_VERIFY_SUPPORTED
 
@@ -388,9 +485,7 @@ void scsis_bc_read16(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI read(16) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_READ;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_READ);
 }
 
 void scsis_bc_read32(SCSIS* scsis, uint8_t* req)
@@ -401,9 +496,7 @@ void scsis_bc_read32(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI read(32) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_READ;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_READ);
 }
 
 void scsis_bc_write16(SCSIS* scsis, uint8_t* req)
@@ -414,9 +507,7 @@ void scsis_bc_write16(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write(16) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE);
 }
 
 void scsis_bc_write32(SCSIS* scsis, uint8_t* req)
@@ -427,9 +518,7 @@ void scsis_bc_write32(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write(32) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE);
 }
 
 #if (SCSI_VERIFY_SUPPORTED)
@@ -441,9 +530,7 @@ void scsis_bc_verify16(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI verify(16) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_VERIFY);
 }
 
 void scsis_bc_verify32(SCSIS* scsis, uint8_t* req)
@@ -454,9 +541,7 @@ void scsis_bc_verify32(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI verify(32) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_VERIFY);
 }
 
 void scsis_bc_write_verify16(SCSIS* scsis, uint8_t* req)
@@ -467,9 +552,7 @@ void scsis_bc_write_verify16(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write and verify(16) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE_VERIFY);
 }
 
 void scsis_bc_write_verify32(SCSIS* scsis, uint8_t* req)
@@ -480,9 +563,7 @@ void scsis_bc_write_verify32(SCSIS* scsis, uint8_t* req)
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI write and verify(32) lba: %#08X%08X, len: %#X\n", scsis->lba_hi, scsis->lba, scsis->count);
 #endif //SCSI_DEBUG_REQUESTS
-    scsis->state = SCSIS_STATE_WRITE_VERIFY;
-    scsis->count_cur = 0;
-    scsis_io(scsis);
+    scsis_bc_io_start(scsis, SCSIS_STATE_WRITE_VERIFY);
 }
 #endif //SCSI_VERIFY_SUPPORTED
 #endif //SCSI_LONG_LBA
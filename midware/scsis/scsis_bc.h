@@ -39,6 +39,9 @@ void scsis_bc_verify32(SCSIS* scsis, uint8_t* req);
 void scsis_bc_write_verify16(SCSIS* scsis, uint8_t* req);
 void scsis_bc_write_verify32(SCSIS* scsis, uint8_t* req);
 
+//for task set reordering. Only 6, 10, 12 read/write is decoded
+bool scsis_bc_get_range(uint8_t* req, unsigned int* lba, unsigned int* count, bool* write);
+
 //for scsis_pc
 void scsis_bc_mode_sense_fill_header(SCSIS* scsis, bool dbd);
 void scsis_bc_mode_sense_fill_header_long(SCSIS* scsis, bool dbd, bool long_lba);
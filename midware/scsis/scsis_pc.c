@@ -238,7 +238,6 @@ void scsis_pc_mode_select10(SCSIS* scsis, uint8_t* req)
 
 void scsis_pc_request_sense(SCSIS* scsis, uint8_t* req)
 {
-    SCSIS_ERROR err;
 #if (SCSI_DEBUG_REQUESTS)
     printf("SCSI request sense\n");
 #endif //SCSI_DEBUG_REQUESTS
@@ -247,15 +246,8 @@ void scsis_pc_request_sense(SCSIS* scsis, uint8_t* req)
         scsis_fail(scsis, SENSE_KEY_ILLEGAL_REQUEST, ASCQ_INVALID_FIELD_IN_CDB);
         return;
     }
-    scsis->io->data_size = 18;
-    memset(io_data(scsis->io), 0, scsis->io->data_size);
-    uint8_t* page = io_data(scsis->io);
-    scsis_error_get(scsis, &err);
-    page[0] = SCSI_SENSE_CURRENT_FIXED;
-    page[2] = err.key_sense & 0xf;
-    page[7] = scsis->io->data_size - 8;
-    page[12] = (err.ascq >> 8) & 0xff;
-    page[13] = (err.ascq >> 0) & 0xff;
+    scsis_error_get_fixed(scsis, io_data(scsis->io));
+    scsis->io->data_size = SCSI_SENSE_FIXED_SIZE;
 
     scsis->state = SCSIS_STATE_COMPLETE;
     scsis_cb_host(scsis, SCSIS_RESPONSE_WRITE, scsis->io->data_size);
@@ -44,17 +44,34 @@ void scsis_error_get(SCSIS* scsis, SCSIS_ERROR *err)
     }
 }
 
+void scsis_error_get_fixed(SCSIS* scsis, uint8_t* page)
+{
+    SCSIS_ERROR err;
+    memset(page, 0, SCSI_SENSE_FIXED_SIZE);
+    scsis_error_get(scsis, &err);
+    page[0] = SCSI_SENSE_CURRENT_FIXED;
+    page[2] = err.key_sense & 0xf;
+    page[7] = SCSI_SENSE_FIXED_SIZE - 8;
+    page[12] = (err.ascq >> 8) & 0xff;
+    page[13] = (err.ascq >> 0) & 0xff;
+}
+
 void scsis_cb_host(SCSIS* scsis, SCSIS_RESPONSE response, unsigned int size)
 {
-    scsis->cb_host(scsis->param, scsis->id, response, size);
+    scsis->cb_host(scsis->param, scsis->id, response, scsis->io, size);
+}
+
+void scsis_cb_host_io(SCSIS* scsis, IO* io, SCSIS_RESPONSE response, unsigned int size)
+{
+    scsis->cb_host(scsis->param, scsis->id, response, io, size);
 }
 
 static void scsis_done(SCSIS* scsis, SCSIS_RESPONSE resp)
 {
     bool was_ready = false;
 #if (SCSI_WRITE_CACHE)
-    if (scsis->state == SCSIS_STATE_WRITE && (scsis->count == 0))
-        was_ready = true;
+    was_ready = scsis->write_cached;
+    scsis->write_cached = false;
 #endif //SCSI_WRITE_CACHE
     scsis->state = SCSIS_STATE_IDLE;
     if (scsis->need_media)
@@ -67,6 +84,10 @@ static void scsis_done(SCSIS* scsis, SCSIS_RESPONSE resp)
     //pass already sent on write
     if (!was_ready)
         scsis_cb_host(scsis, resp, 0);
+#if (SCSI_TASK_DEPTH)
+    scsis->tag = SCSIS_NO_TAG;
+    scsis_task_need_io(scsis);
+#endif //SCSI_TASK_DEPTH
 }
 
 void scsis_fail(SCSIS* scsis, uint8_t key_sense, uint16_t ascq)
@@ -80,6 +101,14 @@ void scsis_pass(SCSIS* scsis)
     scsis_done(scsis, SCSIS_RESPONSE_PASS);
 }
 
+#if (SCSI_TASK_DEPTH)
+void scsis_task_need_io(SCSIS* scsis)
+{
+    if (scsis->task_count && (scsis->state == SCSIS_STATE_IDLE) && (scsis->io == NULL))
+        scsis_cb_host(scsis, SCSIS_RESPONSE_NEED_IO, 0);
+}
+#endif //SCSI_TASK_DEPTH
+
 bool scsis_get_media(SCSIS* scsis)
 {
     if (scsis->media == NULL)
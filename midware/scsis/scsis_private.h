@@ -191,6 +191,8 @@
 
 #define SCSI_REQUEST_SENSE_DESC                                         (1 << 0)
 
+#define SCSI_SENSE_FIXED_SIZE                                           18
+
 //----------------------------- sense key for error recovery -----------------------------------------------
 #define SENSE_KEY_NO_SENSE                                              0x00
 #define SENSE_RECOVERED_ERROR                                           0x01
@@ -252,6 +254,14 @@ typedef struct {
     uint16_t ascq;
 } SCSIS_ERROR;
 
+#define SCSI_CDB_SIZE                                                   16
+
+typedef struct {
+    uint8_t req[SCSI_CDB_SIZE];
+    unsigned int tag;
+    SCSIS_TASK_ATTR attr;
+} SCSIS_TASK;
+
 typedef struct _SCSIS {
     SCSI_STORAGE_DESCRIPTOR* storage_descriptor;
     STORAGE_MEDIA_DESCRIPTOR* media;
@@ -261,22 +271,45 @@ typedef struct _SCSIS {
     IO* io;
     SCSIS_CB cb_host;
     void* param;
-    unsigned int lba, count, count_cur, id;
+    unsigned int lba, count, id;
+    //IO ring for pipelined transfer. First is host IO, others are allocated on first use
+    IO* ios[SCSI_IO_BUFFERS];
+    unsigned int io_size[SCSI_IO_BUFFERS];
+    unsigned int io_count, io_head, io_tail, io_fill, io_ready;
+    //first error during transfer, reported after all pending IO completed
+    SCSIS_ERROR io_error;
+    bool producing, consuming;
+#if (SCSI_WRITE_CACHE)
+    //PASS already sent to host
+    bool write_cached;
+#endif //SCSI_WRITE_CACHE
 #if (SCSI_LONG_LBA)
     unsigned int lba_hi;
 #endif //SCSI_LONG_LBA
 #if (SCSI_MMC)
     bool media_status_changed;
 #endif //SCSI_MMC
+#if (SCSI_TASK_DEPTH)
+    //task set in order of arrival
+    SCSIS_TASK tasks[SCSI_TASK_DEPTH];
+    unsigned int task_count, tag;
+    uint8_t req[SCSI_CDB_SIZE];
+#endif //SCSI_TASK_DEPTH
     bool need_media;
 } SCSIS;
 
 void scsis_error_init(SCSIS* scsis);
 void scsis_error_put(SCSIS* scsis, uint8_t key_sense, uint16_t ascq);
 void scsis_error_get(SCSIS* scsis, SCSIS_ERROR* err);
+void scsis_error_get_fixed(SCSIS* scsis, uint8_t* page);
 void scsis_cb_host(SCSIS* scsis, SCSIS_RESPONSE response, unsigned int size);
+void scsis_cb_host_io(SCSIS* scsis, IO* io, SCSIS_RESPONSE response, unsigned int size);
 void scsis_fail(SCSIS* scsis, uint8_t key_sense, uint16_t ascq);
 void scsis_pass(SCSIS* scsis);
+#if (SCSI_TASK_DEPTH)
+//request IO for next queued task
+void scsis_task_need_io(SCSIS* scsis);
+#endif //SCSI_TASK_DEPTH
 
 
 //failure if no media inserted
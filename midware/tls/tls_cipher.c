@@ -28,6 +28,9 @@ static const uint8_t __KEY_BLOCK_LABEL[KEY_BLOCK_LABEL_LEN ] =  "key expansion";
 #define FINISHED_LABEL_LEN                                      15
 static const uint8_t __CLIENT_LABEL[FINISHED_LABEL_LEN ] =      "client finished";
 static const uint8_t __SERVER_LABEL[FINISHED_LABEL_LEN ] =      "server finished";
+//decrypt and MAC record by small chunks, multiple of AES block
+#define TLS_DECRYPT_CHUNK_SIZE                                  (AES_BLOCK_SIZE * 4)
+
 #define IV_LABEL_LEN                                            14
 static const uint8_t __IV_LABEL[IV_LABEL_LEN ] =                "iv block round";
 
@@ -1176,6 +1179,11 @@ bool tls_cipher_create(TLS_CIPHER* tls_cipher, uint16_t cipher_suite)
         //RSA is based on client-side software
         break;
 #endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    case TLS_KEY_EXCHANGE_ECDHE_RSA:
+        //X25519 is computed here, only params signature is based on client-side software
+        break;
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     default:
 #if (TLS_DEBUG_ERRORS)
         printf("Key exchange not supported: %d\n", key_exchange);
@@ -1185,11 +1193,11 @@ bool tls_cipher_create(TLS_CIPHER* tls_cipher, uint16_t cipher_suite)
 
     switch (cipher)
     {
-#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
+#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE) || (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
     case TLS_CIPHER_AES_128_CBC:
         tls_cipher->key_size = tls_cipher->block_size = AES_BLOCK_SIZE;
         break;
-#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
+#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE) || (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
     default:
 #if (TLS_DEBUG_ERRORS)
         printf("Cipher not supported: %d\n", cipher);
@@ -1199,13 +1207,13 @@ bool tls_cipher_create(TLS_CIPHER* tls_cipher, uint16_t cipher_suite)
 
     switch (hash)
     {
-#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
     case TLS_HASH_SHA:
         tls_cipher->hash_size = SHA1_BLOCK_SIZE;
         tls_cipher->hash_ctx_size = sizeof(SHA1_CTX);
         tls_cipher->hash_struct = &__HMAC_SHA1;
         break;
-#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE) || (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
 #if (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
     case TLS_HASH_SHA256:
         tls_cipher->hash_size = SHA256_BLOCK_SIZE;
@@ -1225,6 +1233,7 @@ bool tls_cipher_create(TLS_CIPHER* tls_cipher, uint16_t cipher_suite)
     if (!res)
         return false;
 
+    tls_cipher->key_exchange = key_exchange;
     sha256_init(&tls_cipher->handshake_hash);
     tls_cipher->rx_sequence_hi = tls_cipher->tx_sequence_hi = tls_cipher->rx_sequence_lo = tls_cipher->tx_sequence_lo = 0;
     tls_cipher->rx_hash_ctx = malloc(tls_cipher->hash_ctx_size);
@@ -1279,67 +1288,114 @@ bool tls_cipher_compare_finished(TLS_CIPHER* tls_cipher, TLS_FINISHED_MODE mode,
     return memcmp(dig, data, TLS_FINISHED_DIGEST_SIZE) == 0;
 }
 
-bool tls_cipher_decode_key_block(const void* premaster, TLS_CIPHER *tls_cipher)
+static bool tls_cipher_generate_key_block(TLS_CIPHER *tls_cipher, unsigned int premaster_size)
 {
     uint8_t* raw;
-    bool res;
     unsigned int raw_size = (tls_cipher->hash_size + tls_cipher->key_size) << 1;
     raw = malloc(raw_size);
     if (raw == NULL)
         return false;
 
-    res = false;
-    //decode pkcs padding
-    do {
-        if (eme_pkcs1_v1_15_decode(premaster, TLS_RAW_PREMASTER_SIZE, tls_cipher->master, TLS_PREMASTER_SIZE) < sizeof(TLS_PREMASTER_SIZE))
-            break;
-        //decode master from premaster
-        p_hash(tls_cipher->master, TLS_PREMASTER_SIZE, __MASTER_LABEL, MASTER_LABEL_LEN,
-                                   tls_cipher->client_random, TLS_RANDOM_SIZE,
-                                   tls_cipher->server_random, TLS_RANDOM_SIZE,
-                                   tls_cipher->master, TLS_MASTER_SIZE);
+    //decode master from premaster
+    p_hash(tls_cipher->master, premaster_size, __MASTER_LABEL, MASTER_LABEL_LEN,
+                               tls_cipher->client_random, TLS_RANDOM_SIZE,
+                               tls_cipher->server_random, TLS_RANDOM_SIZE,
+                               tls_cipher->master, TLS_MASTER_SIZE);
 
-        //genarate raw key block. Server here goes first
-        p_hash(tls_cipher->master, TLS_MASTER_SIZE, __KEY_BLOCK_LABEL, KEY_BLOCK_LABEL_LEN,
-                                    tls_cipher->server_random, TLS_RANDOM_SIZE,
-                                    tls_cipher->client_random, TLS_RANDOM_SIZE,
-                                    raw, raw_size);
+    //genarate raw key block. Server here goes first
+    p_hash(tls_cipher->master, TLS_MASTER_SIZE, __KEY_BLOCK_LABEL, KEY_BLOCK_LABEL_LEN,
+                                tls_cipher->server_random, TLS_RANDOM_SIZE,
+                                tls_cipher->client_random, TLS_RANDOM_SIZE,
+                                raw, raw_size);
 
-        hmac_setup(&tls_cipher->rx_hmac_ctx, tls_cipher->hash_struct, tls_cipher->rx_hash_ctx, raw, tls_cipher->hash_size);
-        hmac_setup(&tls_cipher->tx_hmac_ctx, tls_cipher->hash_struct, tls_cipher->tx_hash_ctx, raw + tls_cipher->hash_size, tls_cipher->hash_size);
-        AES_set_decrypt_key(raw + (tls_cipher->hash_size << 1), 128, &tls_cipher->rx_key);
-        AES_set_encrypt_key(raw + (tls_cipher->hash_size << 1) + tls_cipher->key_size, 128, &tls_cipher->tx_key);
-        //MAC, IV, padding (same as IV), extra padding byte
-        tls_cipher->max_data_size -= tls_cipher->hash_size + 2 * tls_cipher->block_size + 1;
-        res = true;
-    } while(false);
+    hmac_setup(&tls_cipher->rx_hmac_ctx, tls_cipher->hash_struct, tls_cipher->rx_hash_ctx, raw, tls_cipher->hash_size);
+    hmac_setup(&tls_cipher->tx_hmac_ctx, tls_cipher->hash_struct, tls_cipher->tx_hash_ctx, raw + tls_cipher->hash_size, tls_cipher->hash_size);
+    AES_set_decrypt_key(raw + (tls_cipher->hash_size << 1), 128, &tls_cipher->rx_key);
+    AES_set_encrypt_key(raw + (tls_cipher->hash_size << 1) + tls_cipher->key_size, 128, &tls_cipher->tx_key);
+    //MAC, IV, padding (same as IV), extra padding byte
+    tls_cipher->max_data_size -= tls_cipher->hash_size + 2 * tls_cipher->block_size + 1;
 
+    memset(raw, 0x00, raw_size);
     free (raw);
-    return res;
+    return true;
+}
+
+bool tls_cipher_decode_key_block(const void* premaster, TLS_CIPHER *tls_cipher)
+{
+    //decode pkcs padding
+    if (eme_pkcs1_v1_15_decode(premaster, TLS_RAW_PREMASTER_SIZE, tls_cipher->master, TLS_PREMASTER_SIZE) < sizeof(TLS_PREMASTER_SIZE))
+        return false;
+    return tls_cipher_generate_key_block(tls_cipher, TLS_PREMASTER_SIZE);
+}
+
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+void tls_cipher_ecdhe_generate(TLS_CIPHER* tls_cipher, const void* random)
+{
+    memcpy(tls_cipher->ecdhe_private, random, X25519_KEY_SIZE);
+    x25519_public_key(tls_cipher->ecdhe_public, tls_cipher->ecdhe_private);
 }
 
+unsigned int tls_cipher_ecdhe_params(TLS_CIPHER* tls_cipher, void* out)
+{
+    uint8_t* params = out;
+    params[0] = TLS_EC_CURVE_TYPE_NAMED_CURVE;
+    short2be(params + 1, TLS_NAMED_GROUP_X25519);
+    params[3] = X25519_KEY_SIZE;
+    memcpy(params + 4, tls_cipher->ecdhe_public, X25519_KEY_SIZE);
+    return TLS_ECDHE_PARAMS_SIZE;
+}
+
+bool tls_cipher_ecdhe_sign_encode(TLS_CIPHER* tls_cipher, void* em)
+{
+    SHA256_CTX ctx;
+    uint8_t params[TLS_ECDHE_PARAMS_SIZE];
+    uint8_t hash[SHA256_BLOCK_SIZE];
+
+    //signed: client_random + server_random + ServerECDHParams
+    tls_cipher_ecdhe_params(tls_cipher, params);
+    sha256_init(&ctx);
+    sha256_update(&ctx, tls_cipher->client_random, TLS_RANDOM_SIZE);
+    sha256_update(&ctx, tls_cipher->server_random, TLS_RANDOM_SIZE);
+    sha256_update(&ctx, params, TLS_ECDHE_PARAMS_SIZE);
+    sha256_final(&ctx, hash);
+    return emsa_pkcs1_v1_15_encode_sha256(hash, em, TLS_RAW_SIGNATURE_SIZE);
+}
+
+bool tls_cipher_ecdhe_key_block(const void* client_public, TLS_CIPHER *tls_cipher)
+{
+    bool res;
+    //premaster is shared secret itself
+    res = x25519_shared_secret(tls_cipher->master, tls_cipher->ecdhe_private, client_public);
+    //ephemeral key is not required anymore
+    memset(tls_cipher->ecdhe_private, 0x00, X25519_KEY_SIZE);
+    if (!res)
+        return false;
+    return tls_cipher_generate_key_block(tls_cipher, X25519_KEY_SIZE);
+}
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+
 int tls_cipher_decrypt(TLS_CIPHER* tls_cipher, TLS_CONTENT_TYPE content_type, void* in, unsigned int len)
 {
-    int raw_len, m_len;
+    int raw_len, m_len, i, chunk, mac_len;
+    uint8_t pad_len;
     TLS_HMAC_HEADER hdr;
     uint8_t mac[tls_cipher->hash_size];
-    void* data = (uint8_t*)in + tls_cipher->block_size;
+    uint8_t last[AES_BLOCK_SIZE];
+    uint8_t* data = (uint8_t*)in + tls_cipher->block_size;
     raw_len = len - tls_cipher->block_size;
     if ((len <= tls_cipher->block_size) || (len % tls_cipher->block_size))
         return TLS_DECRYPT_FAILED;
-    AES_cbc_encrypt(data, data, raw_len, &tls_cipher->rx_key, in, AES_DECRYPT);
-    m_len = pkcs7_decode(data, raw_len);
-    if (m_len <= 0)
-        return TLS_DECRYPT_FAILED;
-    //padding byte itself
-    if (((uint8_t*)data)[m_len - 1] != raw_len - m_len)
-        return TLS_DECRYPT_FAILED;
-    --m_len;
-    if (m_len < tls_cipher->hash_size)
+
+    //1. Decrypt last block first to get padding and so MAC data len
+    AES_decrypt(data + raw_len - AES_BLOCK_SIZE, last, &tls_cipher->rx_key);
+    for (i = 0; i < AES_BLOCK_SIZE; ++i)
+        last[i] ^= *(data + raw_len - (AES_BLOCK_SIZE << 1) + i);
+    pad_len = last[AES_BLOCK_SIZE - 1];
+    //padding, padding byte itself
+    m_len = raw_len - pad_len - 1 - tls_cipher->hash_size;
+    if (m_len < 0)
         return TLS_DECRYPT_FAILED;
-    m_len -= tls_cipher->hash_size;
 
-    //check MAC
     int2be(hdr.seq_hi_be, tls_cipher->rx_sequence_hi);
     int2be(hdr.seq_lo_be, tls_cipher->rx_sequence_lo++);
     if (tls_cipher->rx_sequence_lo == 0)
@@ -1350,9 +1406,31 @@ int tls_cipher_decrypt(TLS_CIPHER* tls_cipher, TLS_CONTENT_TYPE content_type, vo
     short2be(hdr.record.record_length_be, m_len);
     hmac_init(&tls_cipher->rx_hmac_ctx);
     hmac_update(&tls_cipher->rx_hmac_ctx, &hdr, sizeof(TLS_HMAC_HEADER));
-    hmac_update(&tls_cipher->rx_hmac_ctx, data, m_len);
+
+    //2. Decrypt in place and MAC plain data in same pass, while it's hot
+    for (i = 0; i < raw_len; i += chunk)
+    {
+        chunk = raw_len - i;
+        if (chunk > TLS_DECRYPT_CHUNK_SIZE)
+            chunk = TLS_DECRYPT_CHUNK_SIZE;
+        AES_cbc_decrypt(data + i, data + i, chunk, &tls_cipher->rx_key, in);
+        if (i < m_len)
+        {
+            mac_len = m_len - i;
+            if (mac_len > chunk)
+                mac_len = chunk;
+            hmac_update(&tls_cipher->rx_hmac_ctx, data + i, mac_len);
+        }
+    }
     hmac_final(&tls_cipher->rx_hmac_ctx, mac);
-    if (memcmp((uint8_t*)data + m_len, mac, tls_cipher->hash_size))
+
+    //3. Check padding, all bytes including padding byte are same
+    for (i = m_len + tls_cipher->hash_size; i < raw_len; ++i)
+        if (data[i] != pad_len)
+            return TLS_DECRYPT_FAILED;
+
+    //4. check MAC
+    if (memcmp(data + m_len, mac, tls_cipher->hash_size))
         return TLS_MAC_FAILED;
     return m_len;
 }
@@ -13,11 +13,16 @@
 #include "../crypto/sha1.h"
 #include "../crypto/sha256.h"
 #include "../crypto/hmac.h"
+#include "../crypto/x25519.h"
 #include "tls_private.h"
+#include "sys_config.h"
 
 #define TLS_MAC_FAILED                                  -21
 #define TLS_DECRYPT_FAILED                              -20
 
+//curve_type, named_curve, point length, point
+#define TLS_ECDHE_PARAMS_SIZE                           (4 + X25519_KEY_SIZE)
+
 typedef struct {
     uint8_t client_random[TLS_RANDOM_SIZE];
     uint8_t server_random[TLS_RANDOM_SIZE];
@@ -36,6 +41,12 @@ typedef struct {
     void *rx_hash_ctx, *tx_hash_ctx;
     const HMAC_HASH_STRUCT* hash_struct;
     unsigned short hash_size, hash_ctx_size;
+
+    TLS_KEY_EXCHANGE_TYPE key_exchange;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    uint8_t ecdhe_private[X25519_KEY_SIZE];
+    uint8_t ecdhe_public[X25519_KEY_SIZE];
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
 } TLS_CIPHER;
 
 typedef enum {
@@ -52,6 +63,12 @@ void tls_cipher_generate_finished(TLS_CIPHER* tls_cipher, TLS_FINISHED_MODE mode
 bool tls_cipher_compare_finished(TLS_CIPHER* tls_cipher, TLS_FINISHED_MODE mode, const void* data);
 
 bool tls_cipher_decode_key_block(const void* premaster, TLS_CIPHER *tls_cipher);
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+void tls_cipher_ecdhe_generate(TLS_CIPHER* tls_cipher, const void* random);
+unsigned int tls_cipher_ecdhe_params(TLS_CIPHER* tls_cipher, void* out);
+bool tls_cipher_ecdhe_sign_encode(TLS_CIPHER* tls_cipher, void* em);
+bool tls_cipher_ecdhe_key_block(const void* client_public, TLS_CIPHER *tls_cipher);
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
 
 int tls_cipher_decrypt(TLS_CIPHER* tls_cipher, TLS_CONTENT_TYPE content_type, void* in, unsigned int len);
 unsigned int tls_cipher_encrypt(TLS_CIPHER* tls_cipher, TLS_CONTENT_TYPE content_type, void* in, unsigned int len);
@@ -361,6 +361,13 @@
 #define TLS_EXTENSION_SESSION_TICKET_TLS                            35
 #define TLS_EXTENSION_RENEGOTIATION_INFO                            65281
 
+#define TLS_EC_CURVE_TYPE_NAMED_CURVE                               3
+#define TLS_NAMED_GROUP_X25519                                      29
+#define TLS_EC_POINT_FORMAT_UNCOMPRESSED                            0
+
+#define TLS_HASH_ALGORITHM_SHA256                                   4
+#define TLS_SIGNATURE_ALGORITHM_RSA                                 1
+
 typedef enum {
     TLS_KEY_EXCHANGE_NULL,
     TLS_KEY_EXCHANGE_RSA,
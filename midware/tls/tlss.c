@@ -24,6 +24,8 @@ typedef enum {
     TLSS_STATE_CLIENT_HELLO = 0,
     TLSS_STATE_GENERATE_SERVER_RANDOM,
     TLSS_STATE_GENERATE_SESSION_ID,
+    TLSS_STATE_GENERATE_ECDHE_KEY,
+    TLSS_STATE_SIGN_SERVER_KEY_EXCHANGE,
     TLSS_STATE_SERVER_HELLO,
     TLSS_STATE_CLIENT_KEY_EXCHANGE,
     TLSS_STATE_DECRYPT_PREMASTER,
@@ -51,6 +53,9 @@ typedef struct {
     TLSS_STATE state;
     uint16_t cipher_suite;
     bool server_secure, client_secure;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    uint8_t signature[TLS_RAW_SIGNATURE_SIZE];
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
 } TLSS_TCB;
 
 typedef struct {
@@ -82,6 +87,8 @@ const REX __TLSS = {
 static const char* const __TLSS_STATES[TLSS_STATE_MAX] =           {"CLIENT_HELLO",
                                                                     "GENERATE_SERVER_RANDOM",
                                                                     "GENERATE_SESSION_ID",
+                                                                    "GENERATE_ECDHE_KEY",
+                                                                    "SIGN_SERVER_KEY_EXCHANGE",
                                                                     "SERVER_HELLO",
                                                                     "CLIENT_KEY_EXCHANGE",
                                                                     "DECRYPT_PREMASTER",
@@ -421,6 +428,7 @@ static unsigned int tlss_append_server_hello(TLSS* tlss, TLSS_TCB* tcb, void* da
     TLS_HANDSHAKE* handshake;
     TLS_HELLO* hello;
     TLS_EXTENSION* ext;
+    uint8_t* ext_len;
     unsigned int len;
 
     handshake = data;
@@ -449,7 +457,7 @@ static unsigned int tlss_append_server_hello(TLSS* tlss, TLSS_TCB* tcb, void* da
     ++len;
 
     //5. Append renegotiation_info extension to make openSSL happy
-    short2be((uint8_t*)data + len, sizeof(TLS_EXTENSION) + 1);
+    ext_len = (uint8_t*)data + len;
     len += 2;
 
     ext = (TLS_EXTENSION*)((uint8_t*)data + len);
@@ -459,6 +467,21 @@ static unsigned int tlss_append_server_hello(TLSS* tlss, TLSS_TCB* tcb, void* da
     *((uint8_t*)data + len) = 0x00;
     ++len;
 
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    //RFC 8422: only uncompressed point format is supported
+    if (tcb->tls_cipher.key_exchange == TLS_KEY_EXCHANGE_ECDHE_RSA)
+    {
+        ext = (TLS_EXTENSION*)((uint8_t*)data + len);
+        len += sizeof(TLS_EXTENSION);
+        short2be(ext->code_be, TLS_EXTENSION_EC_POINT_FORMATS);
+        short2be(ext->len_be, 2);
+        *((uint8_t*)data + len) = 1;
+        *((uint8_t*)data + len + 1) = TLS_EC_POINT_FORMAT_UNCOMPRESSED;
+        len += 2;
+    }
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+    short2be(ext_len, (uint8_t*)data + len - ext_len - 2);
+
     //6. Update len at end
     tlss_set_size(&handshake->message_length_be, len - sizeof(TLS_HANDSHAKE));
     tls_cipher_hash_handshake(&tcb->tls_cipher, data, len);
@@ -473,10 +496,14 @@ static unsigned int tlss_append_server_hello(TLSS* tlss, TLSS_TCB* tcb, void* da
     printf("Session ID:\n");
     tlss_dump(tcb->session_id, TLS_SESSION_ID_SIZE);
     printf("cipher suite: ");
-    tlss_print_cipher_suite(TLS_RSA_WITH_AES_128_CBC_SHA);
+    tlss_print_cipher_suite(tcb->cipher_suite);
     printf("Compression method: NULL\n");
     printf("Extensions:\n");
     printf("Ext 65281: 00\n");
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    if (tcb->tls_cipher.key_exchange == TLS_KEY_EXCHANGE_ECDHE_RSA)
+        printf("Ext 11: 01 00\n");
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
 #endif //TLS_DEBUG_REQUESTS
     return len;
 }
@@ -510,6 +537,40 @@ static unsigned int tlss_append_certificate(TLSS* tlss, TLSS_TCB* tcb, void* dat
     return len;
 }
 
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+static unsigned int tlss_append_server_key_exchange(TLSS* tlss, TLSS_TCB* tcb, void* data)
+{
+    TLS_HANDSHAKE* handshake;
+    unsigned int len;
+    //1. Handshake record
+    handshake = data;
+    handshake->message_type = TLS_HANDSHAKE_SERVER_KEY_EXCHANGE;
+    tlss_set_size(&handshake->message_length_be, 0);
+    len = sizeof(TLS_HANDSHAKE);
+
+    //2. ServerECDHParams
+    len += tls_cipher_ecdhe_params(&tcb->tls_cipher, (uint8_t*)data + len);
+
+    //3. Signature algorithm
+    *((uint8_t*)data + len) = TLS_HASH_ALGORITHM_SHA256;
+    *((uint8_t*)data + len + 1) = TLS_SIGNATURE_ALGORITHM_RSA;
+    len += 2;
+
+    //4. Signature, precomputed by owner
+    short2be((uint8_t*)data + len, TLS_RAW_SIGNATURE_SIZE);
+    len += 2;
+    memcpy((uint8_t*)data + len, tcb->signature, TLS_RAW_SIGNATURE_SIZE);
+    len += TLS_RAW_SIGNATURE_SIZE;
+
+    tlss_set_size(&handshake->message_length_be, len - sizeof(TLS_HANDSHAKE));
+    tls_cipher_hash_handshake(&tcb->tls_cipher, data, len);
+#if (TLS_DEBUG_REQUESTS)
+    printf("TLS: serverKeyExchange\n");
+#endif //TLS_DEBUG_REQUESTS
+    return len;
+}
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+
 static unsigned int tlss_append_server_hello_done(TLSS* tlss, TLSS_TCB* tcb, void* data)
 {
     TLS_HANDSHAKE* handshake;
@@ -530,6 +591,10 @@ static inline void tlss_tx_server_hello(TLSS* tlss, TLSS_TCB* tcb)
     data = tlss_allocate_record(tlss, tcb, TLS_CONTENT_HANDSHAKE);
     len += tlss_append_server_hello(tlss, tcb, (uint8_t*)data + len);
     len += tlss_append_certificate(tlss, tcb, (uint8_t*)data + len);
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    if (tcb->tls_cipher.key_exchange == TLS_KEY_EXCHANGE_ECDHE_RSA)
+        len += tlss_append_server_key_exchange(tlss, tcb, (uint8_t*)data + len);
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     len += tlss_append_server_hello_done(tlss, tcb, (uint8_t*)data + len);
     tlss_send_record(tlss, tcb, len);
     tlss_set_state(tcb, TLSS_STATE_CLIENT_KEY_EXCHANGE);
@@ -652,6 +717,24 @@ static inline void tlss_rx_alert(TLSS* tlss, TLSS_TCB* tcb, void* data, unsigned
     }
 }
 
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+static bool tlss_x25519_supported(uint8_t* data, unsigned int len)
+{
+    unsigned int i, list_len;
+    if (len < 2)
+        return false;
+    list_len = be2short(data);
+    if (list_len > len - 2)
+        return false;
+    for (i = 0; i + 1 < list_len; i += 2)
+    {
+        if (be2short(data + 2 + i) == TLS_NAMED_GROUP_X25519)
+            return true;
+    }
+    return false;
+}
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+
 static inline void tlss_rx_client_hello(TLSS* tlss, TLSS_TCB* tcb, void* data, unsigned int len)
 {
     int i;
@@ -664,6 +747,9 @@ static inline void tlss_rx_client_hello(TLSS* tlss, TLSS_TCB* tcb, void* data, u
     uint16_t extensions_len;
     TLS_HELLO* hello;
     TLS_EXTENSION* ext;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    bool x25519_supported = false;
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     hello = data;
     //1. Check state and clientHello header size
     if ((tcb->state != TLSS_STATE_CLIENT_HELLO) || (len < sizeof(TLS_HELLO)))
@@ -717,30 +803,6 @@ static inline void tlss_rx_client_hello(TLSS* tlss, TLSS_TCB* tcb, void* data, u
     cipher_suites = data;
     data += cipher_suites_len;
     len -= cipher_suites_len;
-    for (i = 0; (i < cipher_suites_len) && (tcb->cipher_suite == TLS_NULL_WITH_NULL_NULL); i += 2)
-    {
-        tmp = be2short(cipher_suites + i);
-        switch (tmp)
-        {
-#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
-        case TLS_RSA_WITH_AES_128_CBC_SHA:
-#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
-#if (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
-        case TLS_RSA_WITH_AES_128_CBC_SHA256:
-#endif //(TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
-            tcb->cipher_suite = tmp;
-        default:
-            break;
-        }
-    }
-    if (tcb->cipher_suite == TLS_NULL_WITH_NULL_NULL)
-    {
-#if (TLS_DEBUG_ERRORS)
-        printf("TLS: Supported cipher suite not found\n");
-#endif //TLS_DEBUG_ERRORS
-        tlss_fatal(tlss, tcb, TLS_ALERT_HANDSHAKE_FAILURE);
-        return;
-    }
     //6. Decode and check compression
     compression_len = *((uint8_t*)data);
     ++data;
@@ -800,6 +862,42 @@ static inline void tlss_rx_client_hello(TLSS* tlss, TLSS_TCB* tcb, void* data, u
             return;
         }
         len -= tmp;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+        if (be2short(ext->code_be) == TLS_EXTENSION_SUPPORTED_GROUPS)
+            x25519_supported = tlss_x25519_supported((uint8_t*)ext + sizeof(TLS_EXTENSION), tmp);
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+    }
+
+    //8. Select cipher suite. ECDHE requires named group from extensions
+    for (i = 0; (i < cipher_suites_len) && (tcb->cipher_suite == TLS_NULL_WITH_NULL_NULL); i += 2)
+    {
+        tmp = be2short(cipher_suites + i);
+        switch (tmp)
+        {
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+        case TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA:
+            if (x25519_supported)
+                tcb->cipher_suite = tmp;
+            break;
+#endif //(TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+#if (TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+        case TLS_RSA_WITH_AES_128_CBC_SHA:
+#endif //(TLS_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+#if (TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
+        case TLS_RSA_WITH_AES_128_CBC_SHA256:
+#endif //(TLS_RSA_WITH_AES_128_CBC_SHA256_CIPHER_SUITE)
+            tcb->cipher_suite = tmp;
+        default:
+            break;
+        }
+    }
+    if (tcb->cipher_suite == TLS_NULL_WITH_NULL_NULL)
+    {
+#if (TLS_DEBUG_ERRORS)
+        printf("TLS: Supported cipher suite not found\n");
+#endif //TLS_DEBUG_ERRORS
+        tlss_fatal(tlss, tcb, TLS_ALERT_HANDSHAKE_FAILURE);
+        return;
     }
 
     if (!tls_cipher_create(&tcb->tls_cipher, tcb->cipher_suite))
@@ -848,6 +946,34 @@ static inline void tlss_rx_client_hello(TLSS* tlss, TLSS_TCB* tcb, void* data, u
 
 static inline void tlss_rx_client_key_exchange(TLSS* tlss, TLSS_TCB* tcb, void* data, unsigned int len)
 {
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    if (tcb->tls_cipher.key_exchange == TLS_KEY_EXCHANGE_ECDHE_RSA)
+    {
+        //ClientECDiffieHellmanPublic
+        if ((tcb->state != TLSS_STATE_CLIENT_KEY_EXCHANGE) || (len != X25519_KEY_SIZE + 1) || (*((uint8_t*)data) != X25519_KEY_SIZE))
+        {
+            tlss_fatal(tlss, tcb, TLS_ALERT_UNEXPECTED_MESSAGE);
+            return;
+        }
+        if (!tls_cipher_ecdhe_key_block((uint8_t*)data + 1, &tcb->tls_cipher))
+        {
+#if (TLS_DEBUG_ERRORS)
+            printf("TLS: ECDHE key exchange failed\n");
+#endif //TLS_DEBUG_ERRORS
+            tlss_fatal(tlss, tcb, TLS_ALERT_ILLEGAL_PARAMETER);
+            return;
+        }
+#if (TLS_DEBUG_SECRETS)
+        printf("TLS: master secret:\n");
+        tlss_dump(tcb->tls_cipher.master, TLS_MASTER_SIZE);
+#endif //TLS_DEBUG_SECRETS
+        tlss_set_state(tcb, TLSS_STATE_CLIENT_CHANGE_CIPHER_SPEC);
+#if (TLS_DEBUG_REQUESTS)
+        printf("TLS: clientKeyExchange\n");
+#endif //TLS_DEBUG_REQUESTS
+        return;
+    }
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     if ((tcb->state != TLSS_STATE_CLIENT_KEY_EXCHANGE) || (len < TLS_RAW_PREMASTER_SIZE + 2) || (be2short(data) != TLS_RAW_PREMASTER_SIZE))
     {
         tlss_fatal(tlss, tcb, TLS_ALERT_UNEXPECTED_MESSAGE);
@@ -1082,6 +1208,16 @@ static void tlss_fsm(TLSS* tlss)
         case TLSS_STATE_GENERATE_IV_SEED:
             io_read(tlss->owner, HAL_IO_REQ(HAL_TLS, TLS_GENERATE_RANDOM), tlss->tcb_handle, tlss->tx, TLS_IV_SEED_SIZE);
             return;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+        case TLSS_STATE_GENERATE_ECDHE_KEY:
+            io_read(tlss->owner, HAL_IO_REQ(HAL_TLS, TLS_GENERATE_RANDOM), tlss->tcb_handle, tlss->tx, X25519_KEY_SIZE);
+            return;
+        case TLSS_STATE_SIGN_SERVER_KEY_EXCHANGE:
+            tls_cipher_ecdhe_sign_encode(&tcb->tls_cipher, io_data(tlss->tx));
+            tlss->tx->data_size = TLS_RAW_SIGNATURE_SIZE;
+            io_write(tlss->owner, HAL_IO_REQ(HAL_TLS, TLS_SIGN), tlss->tcb_handle, tlss->tx);
+            return;
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
         case TLSS_STATE_SERVER_HELLO:
             tlss_tx_server_hello(tlss, tcb);
             break;
@@ -1164,9 +1300,25 @@ static inline void tlss_generate_server_random(TLSS* tlss, TLSS_TCB* tcb, void*
 static inline void tlss_generate_session_id(TLSS* tlss, TLSS_TCB* tcb, void* random)
 {
     memcpy(tcb->session_id, io_data(tlss->tx), TLS_SESSION_ID_SIZE);
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    if (tcb->tls_cipher.key_exchange == TLS_KEY_EXCHANGE_ECDHE_RSA)
+    {
+        tlss_set_state(tcb, TLSS_STATE_GENERATE_ECDHE_KEY);
+        return;
+    }
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     tlss_set_state(tcb, TLSS_STATE_SERVER_HELLO);
 }
 
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+static inline void tlss_generate_ecdhe_key(TLSS* tlss, TLSS_TCB* tcb, void* random)
+{
+    tls_cipher_ecdhe_generate(&tcb->tls_cipher, random);
+    memset(random, 0x00, X25519_KEY_SIZE);
+    tlss_set_state(tcb, TLSS_STATE_SIGN_SERVER_KEY_EXCHANGE);
+}
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+
 static inline void tlss_generate_iv_seed(TLSS* tlss, TLSS_TCB* tcb, void* random)
 {
     memcpy(tcb->tls_cipher.iv_seed, io_data(tlss->tx), TLS_IV_SEED_SIZE);
@@ -1194,6 +1346,11 @@ static inline void tlss_generate_random(TLSS* tlss, HANDLE tcb_handle)
         case TLSS_STATE_GENERATE_IV_SEED:
             tlss_generate_iv_seed(tlss, tcb, io_data(tlss->tx));
             break;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+        case TLSS_STATE_GENERATE_ECDHE_KEY:
+            tlss_generate_ecdhe_key(tlss, tcb, io_data(tlss->tx));
+            break;
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
         default:
             break;
         }
@@ -1248,6 +1405,32 @@ static inline void tlss_premaster_decrypt(TLSS* tlss, HANDLE tcb_handle)
     tlss_fsm(tlss);
 }
 
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+static inline void tlss_sign(TLSS* tlss, HANDLE tcb_handle)
+{
+    TLSS_TCB* tcb;
+    do {
+        //closed already
+        if (tlss->tcb_handle != tcb_handle)
+            break;
+        tcb = so_get(&tlss->tcbs, tlss->tcb_handle);
+        if ((tcb->state != TLSS_STATE_SIGN_SERVER_KEY_EXCHANGE) || (tlss->tx->data_size < TLS_RAW_SIGNATURE_SIZE))
+        {
+            tlss_fatal(tlss, tcb, TLS_ALERT_INTERNAL_ERROR);
+#if (TLS_DEBUG_ERRORS)
+            printf("TLS: serverKeyExchange sign failed\n");
+#endif //TLS_DEBUG_ERRORS
+            break;
+        }
+        memcpy(tcb->signature, io_data(tlss->tx), TLS_RAW_SIGNATURE_SIZE);
+        tlss_set_state(tcb, TLSS_STATE_SERVER_HELLO);
+    } while (false);
+    io_reset(tlss->tx);
+    tlss->tx_busy = false;
+    tlss_fsm(tlss);
+}
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
+
 static inline void tlss_request(TLSS* tlss, IPC* ipc)
 {
     switch (HAL_ITEM(ipc->cmd))
@@ -1267,6 +1450,11 @@ static inline void tlss_request(TLSS* tlss, IPC* ipc)
     case TLS_PREMASTER_DECRYPT:
         tlss_premaster_decrypt(tlss, (HANDLE)ipc->param1);
         break;
+#if (TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE)
+    case TLS_SIGN:
+        tlss_sign(tlss, (HANDLE)ipc->param1);
+        break;
+#endif //TLS_ECDHE_RSA_WITH_AES_128_CBC_SHA_CIPHER_SUITE
     default:
         error(ERROR_NOT_SUPPORTED);
     }
@@ -13,11 +13,16 @@
 #include "../../userspace/stdlib.h"
 #include "../../userspace/cdc_acm.h"
 #include "../../userspace/usb.h"
+#include <string.h>
 #include "sys_config.h"
 
 #define CDC_BLOCK_SIZE                                                          64
 #define CDC_NOTIFY_SIZE                                                         64
 
+#if (USBD_CDC_ACM_BULK_QUEUE) && (USBD_CDC_ACM_TX_STREAM_SIZE || USBD_CDC_ACM_RX_STREAM_SIZE)
+#error CDC ACM bulk mode is not using streams
+#endif //USBD_CDC_ACM_BULK_QUEUE
+
 #define LC_BAUD_STOP_BITS_SIZE                                                  3
 static const int LC_BAUD_STOP_BITS[LC_BAUD_STOP_BITS_SIZE] =                    {1, 15, 2};
 
@@ -36,16 +41,24 @@ typedef struct {
     HANDLE tx_stream_handle, rx_stream_handle;
     unsigned int notify_state;
     uint8_t data_ep, control_ep;
-    uint16_t data_ep_size, rx_free, tx_size;
+    uint16_t data_ep_size, rx_free, tx_size, tx_block;
     uint16_t control_ep_size;
     uint8_t tx_idle, data_iface, control_iface;
-    bool suspended, notify_busy, notify_pending;
+    bool suspended, notify_busy, notify_pending, tx_zlp;
     uint8_t DTR, RTS;
     BAUD baud;
 #if (USBD_CDC_ACM_FLOW_CONTROL)
     uint32_t break_count;
     bool flow_sending, flow_changed;
 #endif //USBD_CDC_ACM_FLOW_CONTROL
+#if (USBD_CDC_ACM_BULK_QUEUE)
+    //user IO, head is on the air
+    IO* tx_queue[USBD_CDC_ACM_BULK_QUEUE];
+    IO* rx_queue[USBD_CDC_ACM_BULK_QUEUE];
+    unsigned int rx_size[USBD_CDC_ACM_BULK_QUEUE];
+    uint8_t tx_count, rx_count;
+    bool tx_active, rx_active;
+#endif //USBD_CDC_ACM_BULK_QUEUE
 } CDC_ACMD;
 
 void cdc_acmd_notify_serial_state(USBD* usbd, CDC_ACMD* cdc_acmd, unsigned int state)
@@ -85,6 +98,129 @@ void cdc_acmd_destroy(CDC_ACMD* cdc_acmd)
     free(cdc_acmd);
 }
 
+#if (USBD_CDC_ACM_BULK_QUEUE)
+static IO* cdc_acmd_bulk_pop(IO** queue, uint8_t* count)
+{
+    IO* io = queue[0];
+    if (--(*count))
+        memmove(queue, queue + 1, (*count) * sizeof(IO*));
+    return io;
+}
+
+static void cdc_acmd_bulk_tx_flush(USBD* usbd, CDC_ACMD* cdc_acmd)
+{
+    IO* io;
+    if (cdc_acmd->tx_active || cdc_acmd->tx_zlp)
+        usbd_usb_ep_flush(usbd, USB_EP_IN | cdc_acmd->data_ep);
+    cdc_acmd->tx_active = cdc_acmd->tx_zlp = false;
+    while (cdc_acmd->tx_count)
+    {
+        io = cdc_acmd_bulk_pop(cdc_acmd->tx_queue, &cdc_acmd->tx_count);
+        usbd_io_user(usbd, cdc_acmd->data_iface, 0, HAL_IO_CMD(HAL_USBD_IFACE, IPC_WRITE), io, ERROR_IO_CANCELLED);
+    }
+}
+
+static void cdc_acmd_bulk_rx_flush(USBD* usbd, CDC_ACMD* cdc_acmd)
+{
+    IO* io;
+    if (cdc_acmd->rx_active)
+        usbd_usb_ep_flush(usbd, cdc_acmd->data_ep);
+    cdc_acmd->rx_active = false;
+    while (cdc_acmd->rx_count)
+    {
+        io = cdc_acmd_bulk_pop(cdc_acmd->rx_queue, &cdc_acmd->rx_count);
+        memmove(cdc_acmd->rx_size, cdc_acmd->rx_size + 1, cdc_acmd->rx_count * sizeof(unsigned int));
+        usbd_io_user(usbd, cdc_acmd->data_iface, 0, HAL_IO_CMD(HAL_USBD_IFACE, IPC_READ), io, ERROR_IO_CANCELLED);
+    }
+}
+
+//user IO is passed to USB driver as is. Host is NAKed, till user is not ready
+static void cdc_acmd_bulk_write(USBD* usbd, CDC_ACMD* cdc_acmd)
+{
+    if (!cdc_acmd->DTR || cdc_acmd->suspended || cdc_acmd->tx_active || cdc_acmd->tx_zlp || (cdc_acmd->tx_count == 0))
+        return;
+    cdc_acmd->tx_active = true;
+    usbd_usb_ep_write(usbd, cdc_acmd->data_ep, cdc_acmd->tx_queue[0]);
+}
+
+static void cdc_acmd_bulk_read(USBD* usbd, CDC_ACMD* cdc_acmd)
+{
+    if (cdc_acmd->suspended || cdc_acmd->rx_active || (cdc_acmd->rx_count == 0))
+        return;
+    cdc_acmd->rx_active = true;
+    usbd_usb_ep_read(usbd, cdc_acmd->data_ep, cdc_acmd->rx_queue[0], cdc_acmd->rx_size[0]);
+}
+
+static inline void cdc_acmd_bulk_write_complete(USBD* usbd, CDC_ACMD* cdc_acmd, unsigned int size)
+{
+    IO* io;
+    if (cdc_acmd->tx_zlp)
+        cdc_acmd->tx_zlp = false;
+    else if (cdc_acmd->tx_active)
+    {
+        cdc_acmd->tx_active = false;
+        io = cdc_acmd_bulk_pop(cdc_acmd->tx_queue, &cdc_acmd->tx_count);
+        //transfer is terminated by short packet
+        if (size && ((size % cdc_acmd->data_ep_size) == 0))
+        {
+            cdc_acmd->tx_zlp = true;
+            io_reset(cdc_acmd->tx);
+            usbd_usb_ep_write(usbd, cdc_acmd->data_ep, cdc_acmd->tx);
+        }
+        usbd_io_user(usbd, cdc_acmd->data_iface, 0, HAL_IO_CMD(HAL_USBD_IFACE, IPC_WRITE), io, size);
+    }
+    cdc_acmd_bulk_write(usbd, cdc_acmd);
+}
+
+static inline void cdc_acmd_bulk_read_complete(USBD* usbd, CDC_ACMD* cdc_acmd)
+{
+    IO* io;
+    //flushed
+    if (!cdc_acmd->rx_active)
+        return;
+    cdc_acmd->rx_active = false;
+    io = cdc_acmd_bulk_pop(cdc_acmd->rx_queue, &cdc_acmd->rx_count);
+    memmove(cdc_acmd->rx_size, cdc_acmd->rx_size + 1, cdc_acmd->rx_count * sizeof(unsigned int));
+    //next read is queued before user is notified
+    cdc_acmd_bulk_read(usbd, cdc_acmd);
+    usbd_io_user(usbd, cdc_acmd->data_iface, 0, HAL_IO_CMD(HAL_USBD_IFACE, IPC_READ), io, io->data_size);
+}
+
+static inline void cdc_acmd_bulk_io_write(USBD* usbd, CDC_ACMD* cdc_acmd, IO* io)
+{
+    if (cdc_acmd->tx_count >= USBD_CDC_ACM_BULK_QUEUE)
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
+    cdc_acmd->tx_queue[cdc_acmd->tx_count++] = io;
+    cdc_acmd_bulk_write(usbd, cdc_acmd);
+    error(ERROR_SYNC);
+}
+
+static inline void cdc_acmd_bulk_io_read(USBD* usbd, CDC_ACMD* cdc_acmd, IO* io, unsigned int size)
+{
+    //whole packets only, or data will be lost
+    if (size > io_get_free(io))
+        size = 0;
+    size = (size / cdc_acmd->data_ep_size) * cdc_acmd->data_ep_size;
+    if (size == 0)
+    {
+        error(ERROR_INVALID_PARAMS);
+        return;
+    }
+    if (cdc_acmd->rx_count >= USBD_CDC_ACM_BULK_QUEUE)
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
+    cdc_acmd->rx_size[cdc_acmd->rx_count] = size;
+    cdc_acmd->rx_queue[cdc_acmd->rx_count++] = io;
+    cdc_acmd_bulk_read(usbd, cdc_acmd);
+    error(ERROR_SYNC);
+}
+#endif //USBD_CDC_ACM_BULK_QUEUE
+
 void cdc_acmd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
 {
     USB_INTERFACE_DESCRIPTOR* iface;
@@ -167,7 +303,7 @@ void cdc_acmd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
         cdc_acmd->data_ep_size = data_ep_size;
         cdc_acmd->tx = cdc_acmd->rx = NULL;
         cdc_acmd->tx_stream = cdc_acmd->rx_stream = cdc_acmd->tx_stream_handle = cdc_acmd->rx_stream_handle = INVALID_HANDLE;
-        cdc_acmd->suspended = false;
+        cdc_acmd->suspended = cdc_acmd->tx_zlp = false;
 
         cdc_acmd->control_iface = control_iface;
         cdc_acmd->control_ep = control_ep;
@@ -181,8 +317,12 @@ void cdc_acmd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
 #endif //USBD_CDC_ACM_FLOW_CONTROL
 
 #if (USBD_CDC_ACM_TX_STREAM_SIZE)
-        cdc_acmd->tx = io_create(cdc_acmd->data_ep_size);
-        cdc_acmd->tx_stream = stream_create(USBD_CDC_ACM_RX_STREAM_SIZE);
+        //few packets per transfer, if stream is large enough
+        cdc_acmd->tx_block = (USBD_CDC_ACM_TX_STREAM_SIZE / cdc_acmd->data_ep_size) * cdc_acmd->data_ep_size;
+        if (cdc_acmd->tx_block == 0)
+            cdc_acmd->tx_block = cdc_acmd->data_ep_size;
+        cdc_acmd->tx = io_create(cdc_acmd->tx_block);
+        cdc_acmd->tx_stream = stream_create(USBD_CDC_ACM_TX_STREAM_SIZE);
         cdc_acmd->tx_stream_handle = stream_open(cdc_acmd->tx_stream);
         if (cdc_acmd->tx == NULL || cdc_acmd->tx_stream_handle == INVALID_HANDLE)
         {
@@ -214,6 +354,19 @@ void cdc_acmd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
         usbd_usb_ep_open(usbd, cdc_acmd->data_ep, USB_EP_BULK, cdc_acmd->data_ep_size);
         usbd_usb_ep_read(usbd, cdc_acmd->data_ep, cdc_acmd->rx, cdc_acmd->data_ep_size);
 #endif //USBD_CDC_ACM_RX_STREAM_SIZE
+#if (USBD_CDC_ACM_BULK_QUEUE)
+        //ZLP only
+        cdc_acmd->tx = io_create(0);
+        if (cdc_acmd->tx == NULL)
+        {
+            cdc_acmd_destroy(cdc_acmd);
+            return;
+        }
+        cdc_acmd->tx_count = cdc_acmd->rx_count = 0;
+        cdc_acmd->tx_active = cdc_acmd->rx_active = false;
+        usbd_usb_ep_open(usbd, USB_EP_IN | cdc_acmd->data_ep, USB_EP_BULK, cdc_acmd->data_ep_size);
+        usbd_usb_ep_open(usbd, cdc_acmd->data_ep, USB_EP_BULK, cdc_acmd->data_ep_size);
+#endif //USBD_CDC_ACM_BULK_QUEUE
 
         usbd_register_interface(usbd, cdc_acmd->data_iface, &__CDC_ACMD_CLASS, cdc_acmd);
         usbd_register_endpoint(usbd, cdc_acmd->data_iface, cdc_acmd->data_ep);
@@ -260,6 +413,12 @@ void cdc_acmd_class_reset(USBD* usbd, void* param)
     stream_flush(cdc_acmd->rx_stream);
     usbd_usb_ep_close(usbd, cdc_acmd->data_ep);
 #endif //USBD_CDC_ACM_RX_STREAM_SIZE
+#if (USBD_CDC_ACM_BULK_QUEUE)
+    cdc_acmd_bulk_tx_flush(usbd, cdc_acmd);
+    cdc_acmd_bulk_rx_flush(usbd, cdc_acmd);
+    usbd_usb_ep_close(usbd, USB_EP_IN | cdc_acmd->data_ep);
+    usbd_usb_ep_close(usbd, cdc_acmd->data_ep);
+#endif //USBD_CDC_ACM_BULK_QUEUE
 
     usbd_unregister_endpoint(usbd, cdc_acmd->data_iface, cdc_acmd->data_ep);
     usbd_unregister_interface(usbd, cdc_acmd->data_iface, &__CDC_ACMD_CLASS);
@@ -281,12 +440,17 @@ void cdc_acmd_class_suspend(USBD* usbd, void* param)
     usbd_usb_ep_flush(usbd, USB_EP_IN | cdc_acmd->data_ep);
     cdc_acmd->tx_idle = true;
     cdc_acmd->tx_size = 0;
+    cdc_acmd->tx_zlp = false;
 #endif //USBD_CDC_ACM_TX_STREAM_SIZE
 #if (USBD_CDC_ACM_RX_STREAM_SIZE)
     stream_flush(cdc_acmd->rx_stream);
     usbd_usb_ep_flush(usbd, cdc_acmd->data_ep);
     cdc_acmd->rx_free = 0;
 #endif //USBD_CDC_ACM_RX_STREAM_SIZE
+#if (USBD_CDC_ACM_BULK_QUEUE)
+    cdc_acmd_bulk_tx_flush(usbd, cdc_acmd);
+    cdc_acmd_bulk_rx_flush(usbd, cdc_acmd);
+#endif //USBD_CDC_ACM_BULK_QUEUE
 
     if (cdc_acmd->control_ep)
     {
@@ -344,14 +508,15 @@ void cdc_acmd_write(USBD* usbd, CDC_ACMD* cdc_acmd)
         cdc_acmd->tx_size = stream_get_size(cdc_acmd->tx_stream);
 
     to_write = cdc_acmd->tx_size;
-    if (to_write > cdc_acmd->data_ep_size)
-        to_write = cdc_acmd->data_ep_size;
+    if (to_write > cdc_acmd->tx_block)
+        to_write = cdc_acmd->tx_block;
     if (to_write)
     {
         cdc_acmd->tx_size -= to_write;
         if (stream_read(cdc_acmd->tx_stream_handle, io_data(cdc_acmd->tx), to_write))
         {
             cdc_acmd->tx_idle = false;
+            cdc_acmd->tx_zlp = (to_write % cdc_acmd->data_ep_size) == 0;
             cdc_acmd->tx->data_size = to_write;
             usbd_usb_ep_write(usbd, cdc_acmd->data_ep, cdc_acmd->tx);
         }
@@ -359,6 +524,14 @@ void cdc_acmd_write(USBD* usbd, CDC_ACMD* cdc_acmd)
         else
             stream_listen(cdc_acmd->tx_stream, USBD_IFACE(cdc_acmd->data_iface, 0), HAL_USBD_IFACE);
     }
+    //stream is empty, terminate transfer with short packet
+    else if (cdc_acmd->tx_zlp)
+    {
+        cdc_acmd->tx_idle = false;
+        cdc_acmd->tx_zlp = false;
+        cdc_acmd->tx->data_size = 0;
+        usbd_usb_ep_write(usbd, cdc_acmd->data_ep, cdc_acmd->tx);
+    }
     else
         stream_listen(cdc_acmd->tx_stream, USBD_IFACE(cdc_acmd->data_iface, 0), HAL_USBD_IFACE);
 }
@@ -441,6 +614,13 @@ static inline int set_control_line_state(USBD* usbd, CDC_ACMD* cdc_acmd, SETUP*
     printf("USB CDC ACM: DTR %s, RTS %s\n", ON_OFF[1 * cdc_acmd->DTR], ON_OFF[1 * cdc_acmd->RTS]);
 #endif
 
+#if (USBD_CDC_ACM_BULK_QUEUE)
+    if (cdc_acmd->DTR)
+        cdc_acmd_bulk_write(usbd, cdc_acmd);
+    //pending user IO is cancelled
+    else
+        cdc_acmd_bulk_tx_flush(usbd, cdc_acmd);
+#else
     //resume write if DTR is set
     if (cdc_acmd->DTR)
         cdc_acmd_write(usbd, cdc_acmd);
@@ -449,7 +629,9 @@ static inline int set_control_line_state(USBD* usbd, CDC_ACMD* cdc_acmd, SETUP*
     {
         usbd_usb_ep_flush(usbd, USB_EP_IN | cdc_acmd->data_ep);
         cdc_acmd->tx_idle = true;
+        cdc_acmd->tx_zlp = false;
     }
+#endif //USBD_CDC_ACM_BULK_QUEUE
     return 0;
 }
 
@@ -510,13 +692,21 @@ static inline void cdc_acmd_driver_event(USBD* usbd, CDC_ACMD* cdc_acmd, IPC* ip
     switch (HAL_ITEM(ipc->cmd))
     {
     case IPC_READ:
+#if (USBD_CDC_ACM_BULK_QUEUE)
+        cdc_acmd_bulk_read_complete(usbd, cdc_acmd);
+#else
         cdc_acmd_read_complete(usbd, cdc_acmd);
+#endif //USBD_CDC_ACM_BULK_QUEUE
         break;
     case IPC_WRITE:
         if (ipc->param1 == (cdc_acmd->data_ep | USB_EP_IN))
         {
+#if (USBD_CDC_ACM_BULK_QUEUE)
+            cdc_acmd_bulk_write_complete(usbd, cdc_acmd, ipc->param3);
+#else
             cdc_acmd->tx_idle = true;
             cdc_acmd_write(usbd, cdc_acmd);
+#endif //USBD_CDC_ACM_BULK_QUEUE
         }
         else
         {
@@ -551,6 +741,14 @@ void cdc_acmd_class_request(USBD* usbd, void* param, IPC* ipc)
         case IPC_GET_RX_STREAM:
             ipc->param2 = cdc_acmd->rx_stream;
             break;
+#if (USBD_CDC_ACM_BULK_QUEUE)
+        case IPC_WRITE:
+            cdc_acmd_bulk_io_write(usbd, cdc_acmd, (IO*)ipc->param2);
+            break;
+        case IPC_READ:
+            cdc_acmd_bulk_io_read(usbd, cdc_acmd, (IO*)ipc->param2, ipc->param3);
+            break;
+#endif //USBD_CDC_ACM_BULK_QUEUE
 #if (USBD_CDC_ACM_FLOW_CONTROL)
         case USB_CDC_ACM_SET_BAUDRATE:
             uart_decode_baudrate(ipc, &cdc_acmd->baud);
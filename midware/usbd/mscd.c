@@ -154,7 +154,7 @@ static void mscd_release_io(MSCD* mscd)
         mscd_cbw_process(mscd->usbd, mscd);
 }
 
-void mscd_host_cb(void* param, unsigned int id, SCSIS_RESPONSE response, unsigned int size)
+void mscd_host_cb(void* param, unsigned int id, SCSIS_RESPONSE response, IO* io, unsigned int size)
 {
     MSCD* mscd = param;
 
@@ -165,13 +165,13 @@ void mscd_host_cb(void* param, unsigned int id, SCSIS_RESPONSE response, unsigne
             size = mscd->residue;
         mscd->residue -= size;
         //some hardware required to be multiple of MPS
-        usbd_usb_ep_read(mscd->usbd, mscd->ep_num, mscd->data, (size + mscd->ep_size - 1) & ~(mscd->ep_size - 1));
+        usbd_usb_ep_read(mscd->usbd, mscd->ep_num, io, (size + mscd->ep_size - 1) & ~(mscd->ep_size - 1));
         break;
     case SCSIS_RESPONSE_WRITE:
-        if (mscd->data->data_size > mscd->residue)
-            mscd->data->data_size = mscd->residue;
-        mscd->residue -= mscd->data->data_size;
-        usbd_usb_ep_write(mscd->usbd, mscd->ep_num, mscd->data);
+        if (io->data_size > mscd->residue)
+            io->data_size = mscd->residue;
+        mscd->residue -= io->data_size;
+        usbd_usb_ep_write(mscd->usbd, mscd->ep_num, io);
         break;
     case SCSIS_RESPONSE_PASS:
         mscd->csw_status = MSC_CSW_COMMAND_PASSED;
@@ -211,7 +211,7 @@ void mscd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
     for (iface = usb_get_first_interface(cfg); iface != NULL; iface = usb_get_next_interface(cfg, iface))
     {
         ep = (USB_ENDPOINT_DESCRIPTOR*)usb_interface_get_first_descriptor(cfg, iface, USB_ENDPOINT_DESCRIPTOR_TYPE);
-        if (ep != NULL && iface->bInterfaceClass == MSC_INTERFACE_CLASS)
+        if (ep != NULL && iface->bInterfaceClass == MSC_INTERFACE_CLASS && iface->bInterfaceProtocol != MSC_PROTOCOL_UAS)
         {
             ep_num = USB_EP_NUM(ep->bEndpointAddress);
             ep_size = ep->wMaxPacketSize;
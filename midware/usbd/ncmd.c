@@ -0,0 +1,887 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#include "ncmd.h"
+#include "usbd.h"
+#include "../../userspace/sys.h"
+#include "../../userspace/mac.h"
+#include "../../userspace/eth.h"
+#include "../../userspace/stdio.h"
+#include "../../userspace/io.h"
+#include "../../userspace/stdlib.h"
+#include "../../userspace/cdc_acm.h"
+#include "../../userspace/usb.h"
+#include <string.h>
+#include "sys_config.h"
+
+#if (ETH_DOUBLE_BUFFERING)
+#define NCMD_IO_WAIT                                                            2
+#else
+#define NCMD_IO_WAIT                                                            1
+#endif //ETH_DOUBLE_BUFFERING
+
+#define NCMD_NOTIFY_SIZE                                                        (sizeof(SETUP) + sizeof(CDC_CONNECTION_SPEED))
+#define NCMD_ALIGN(size)                                                        (((size) + 3) & ~3)
+
+typedef struct {
+    IO* notify;
+    //NTB (frame for ECM): one on the air, other is filling
+    IO* tx[2];
+    IO* rx;
+    //tcpip frames, waiting for NTB space/received data
+    IO* tx_wait[NCMD_IO_WAIT];
+    IO* rx_wait[NCMD_IO_WAIT];
+    HANDLE tcpip;
+#if (USBD_NCM_TX_FLUSH_MS)
+    HANDLE tx_timer;
+#endif //USBD_NCM_TX_FLUSH_MS
+    MAC mac;
+    unsigned int ntb_input_size, tx_ok, rx_ok;
+    //datagram table of filling NTB
+    NCM_DPE16 tx_dpe[USBD_NCM_MAX_DATAGRAMS];
+    //received NTB position: NDP offset and datagram entry in it
+    uint16_t rx_ndp, rx_dpe, rx_block;
+    uint16_t tx_seq, packet_filter, data_ep_size;
+    uint8_t control_iface, data_iface, data_alt, control_ep, data_ep_in, data_ep_out;
+    uint8_t tx_fill, tx_count, tx_wait_count, rx_wait_count;
+    bool ncm, active, tx_busy, rx_busy, rx_pending, tx_timer_active;
+    bool notify_busy, notify_speed, notify_pending;
+} NCMD;
+
+static void ncmd_destroy(NCMD* ncmd)
+{
+#if (USBD_NCM_TX_FLUSH_MS)
+    timer_destroy(ncmd->tx_timer);
+#endif //USBD_NCM_TX_FLUSH_MS
+    io_destroy(ncmd->notify);
+    io_destroy(ncmd->tx[0]);
+    io_destroy(ncmd->tx[1]);
+    io_destroy(ncmd->rx);
+    free(ncmd);
+}
+
+static inline bool ncmd_link_ready(NCMD* ncmd)
+{
+    return (ncmd->tcpip != INVALID_HANDLE) && ncmd->active;
+}
+
+static void ncmd_tx_timer_stop(NCMD* ncmd)
+{
+#if (USBD_NCM_TX_FLUSH_MS)
+    if (ncmd->tx_timer_active)
+    {
+        timer_stop(ncmd->tx_timer, USBD_IFACE(ncmd->control_iface, 0), HAL_USBD_IFACE);
+        ncmd->tx_timer_active = false;
+    }
+#endif //USBD_NCM_TX_FLUSH_MS
+}
+
+static void ncmd_flush(USBD* usbd, NCMD* ncmd)
+{
+    unsigned int i;
+    usbd_usb_ep_flush(usbd, USB_EP_IN | ncmd->data_ep_in);
+    usbd_usb_ep_flush(usbd, ncmd->data_ep_out);
+    for (i = 0; i < ncmd->rx_wait_count; ++i)
+        io_complete_ex(ncmd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(ncmd->control_iface, 0), ncmd->rx_wait[i], ERROR_IO_CANCELLED);
+    for (i = 0; i < ncmd->tx_wait_count; ++i)
+        io_complete_ex(ncmd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(ncmd->control_iface, 0), ncmd->tx_wait[i], ERROR_IO_CANCELLED);
+    ncmd->rx_wait_count = ncmd->tx_wait_count = 0;
+    ncmd_tx_timer_stop(ncmd);
+    io_reset(ncmd->tx[0]);
+    io_reset(ncmd->tx[1]);
+    io_reset(ncmd->rx);
+    ncmd->tx_count = 0;
+    ncmd->tx_busy = ncmd->rx_busy = ncmd->rx_pending = false;
+}
+
+static void ncmd_notify_send(USBD* usbd, NCMD* ncmd)
+{
+    SETUP* setup = io_data(ncmd->notify);
+    CDC_CONNECTION_SPEED* speed;
+    setup->bmRequestType = BM_REQUEST_DIRECTION_DEVICE_TO_HOST | BM_REQUEST_TYPE_CLASS | BM_REQUEST_RECIPIENT_INTERFACE;
+    setup->wIndex = ncmd->control_iface;
+    //speed first, connection is following
+    if (ncmd->notify_speed)
+    {
+        setup->bRequest = CDC_CONNECTION_SPEED_CHANGE;
+        setup->wValue = 0;
+        setup->wLength = sizeof(CDC_CONNECTION_SPEED);
+        speed = (CDC_CONNECTION_SPEED*)((uint8_t*)io_data(ncmd->notify) + sizeof(SETUP));
+        //bulk endpoint size is the only hint of bus speed
+        speed->DLBitRate = speed->ULBitRate = ncmd->data_ep_size > 64 ? 480000000 : 12000000;
+        ncmd->notify->data_size = sizeof(SETUP) + sizeof(CDC_CONNECTION_SPEED);
+    }
+    else
+    {
+        setup->bRequest = CDC_NETWORK_CONNECTION;
+        setup->wValue = ncmd_link_ready(ncmd) ? 1 : 0;
+        setup->wLength = 0;
+        ncmd->notify->data_size = sizeof(SETUP);
+    }
+    ncmd->notify_busy = true;
+    usbd_usb_ep_write(usbd, ncmd->control_ep, ncmd->notify);
+}
+
+static void ncmd_notify_link(USBD* usbd, NCMD* ncmd)
+{
+    if (ncmd->notify_busy)
+    {
+        ncmd->notify_pending = true;
+        return;
+    }
+    ncmd->notify_speed = ncmd_link_ready(ncmd);
+    ncmd_notify_send(usbd, ncmd);
+}
+
+static inline void ncmd_notify_complete(USBD* usbd, NCMD* ncmd)
+{
+    ncmd->notify_busy = false;
+    if (ncmd->notify_speed)
+    {
+        ncmd->notify_speed = false;
+        ncmd_notify_send(usbd, ncmd);
+        return;
+    }
+    if (ncmd->notify_pending)
+    {
+        ncmd->notify_pending = false;
+        ncmd_notify_link(usbd, ncmd);
+    }
+}
+
+static void ncmd_link_changed(USBD* usbd, NCMD* ncmd)
+{
+    if (ncmd_link_ready(ncmd))
+        ipc_post_inline(ncmd->tcpip, HAL_CMD(HAL_ETH, ETH_NOTIFY_LINK_CHANGED), USBD_IFACE(ncmd->control_iface, 0), ETH_100_FULL, 0);
+    else
+    {
+        ncmd_flush(usbd, ncmd);
+        if (ncmd->tcpip != INVALID_HANDLE)
+            ipc_post_inline(ncmd->tcpip, HAL_CMD(HAL_ETH, ETH_NOTIFY_LINK_CHANGED), USBD_IFACE(ncmd->control_iface, 0), ETH_NO_LINK, 0);
+    }
+    if (ncmd->active)
+        ncmd_notify_link(usbd, ncmd);
+}
+
+static void ncmd_set_active(USBD* usbd, NCMD* ncmd, bool active)
+{
+    bool was_ready = ncmd_link_ready(ncmd);
+    if (active)
+    {
+        //alternate setting selection resets data toggle and NTB parameters
+        usbd_usb_ep_open(usbd, USB_EP_IN | ncmd->data_ep_in, USB_EP_BULK, ncmd->data_ep_size);
+        usbd_usb_ep_open(usbd, ncmd->data_ep_out, USB_EP_BULK, ncmd->data_ep_size);
+        ncmd->ntb_input_size = USBD_NCM_MAX_NTB_SIZE;
+        ncmd->tx_seq = 0;
+    }
+    else if (ncmd->active)
+    {
+        usbd_usb_ep_close(usbd, USB_EP_IN | ncmd->data_ep_in);
+        usbd_usb_ep_close(usbd, ncmd->data_ep_out);
+    }
+    ncmd->active = active;
+    if (was_ready != ncmd_link_ready(ncmd))
+        ncmd_link_changed(usbd, ncmd);
+    else if (active)
+        ncmd_notify_link(usbd, ncmd);
+}
+
+static USB_INTERFACE_DESCRIPTOR* ncmd_find_data_alt(USB_CONFIGURATION_DESCRIPTOR* cfg, uint8_t num)
+{
+    USB_INTERFACE_DESCRIPTOR* iface;
+    for (iface = usb_get_first_interface(cfg); iface != NULL; iface = usb_get_next_interface(cfg, iface))
+    {
+        if ((iface->bInterfaceNumber == num) && (iface->bNumEndpoints >= 2))
+            return iface;
+    }
+    return NULL;
+}
+
+void ncmd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
+{
+    USB_INTERFACE_DESCRIPTOR* iface;
+    USB_INTERFACE_DESCRIPTOR* diface;
+    CDC_UNION_DESCRIPTOR* u;
+    USB_ENDPOINT_DESCRIPTOR* ep;
+    uint8_t control_ep, data_ep_in, data_ep_out, data_iface;
+    uint16_t control_ep_size, data_ep_size;
+    NCMD* ncmd;
+
+    for (iface = usb_get_first_interface(cfg); iface != NULL; iface = usb_get_next_interface(cfg, iface))
+    {
+        if ((iface->bInterfaceClass != CDC_COMM_INTERFACE_CLASS) ||
+            ((iface->bInterfaceSubClass != CDC_NETWORK_CONTROL) && (iface->bInterfaceSubClass != CDC_ETHERNET)))
+            continue;
+#if (USBD_NCM_DEBUG)
+        printf("Found USB %s device interface: %d\n", iface->bInterfaceSubClass == CDC_NETWORK_CONTROL ? "NCM" : "ECM", iface->bInterfaceNumber);
+#endif //USBD_NCM_DEBUG
+
+        ep = (USB_ENDPOINT_DESCRIPTOR*)usb_interface_get_first_descriptor(cfg, iface, USB_ENDPOINT_DESCRIPTOR_TYPE);
+        if (ep == NULL)
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Warning no control EP, skipping interface\n");
+#endif //USBD_NCM_DEBUG
+            continue;
+        }
+        control_ep = USB_EP_NUM(ep->bEndpointAddress);
+        control_ep_size = ep->wMaxPacketSize;
+
+        //find union descriptor
+        for (u = usb_interface_get_first_descriptor(cfg, iface, CS_INTERFACE); u != NULL; u = usb_interface_get_next_descriptor(cfg, u, CS_INTERFACE))
+        {
+            if ((u->bDescriptorSybType == CDC_DESCRIPTOR_UNION) && (u->bControlInterface == iface->bInterfaceNumber) &&
+                (u->bFunctionLength > sizeof(CDC_UNION_DESCRIPTOR)))
+                break;
+        }
+        if (u == NULL)
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Warning - no UNION descriptor, skipping interface\n");
+#endif //USBD_NCM_DEBUG
+            continue;
+        }
+        data_iface = ((uint8_t*)u)[sizeof(CDC_UNION_DESCRIPTOR)];
+        diface = ncmd_find_data_alt(cfg, data_iface);
+        if (diface == NULL)
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Warning no data interface\n");
+#endif //USBD_NCM_DEBUG
+            continue;
+        }
+
+        data_ep_in = data_ep_out = 0;
+        data_ep_size = 0;
+        for (ep = usb_interface_get_first_descriptor(cfg, diface, USB_ENDPOINT_DESCRIPTOR_TYPE); ep != NULL;
+             ep = usb_interface_get_next_descriptor(cfg, ep, USB_ENDPOINT_DESCRIPTOR_TYPE))
+        {
+            if (ep->bEndpointAddress & USB_EP_IN)
+                data_ep_in = USB_EP_NUM(ep->bEndpointAddress);
+            else
+                data_ep_out = USB_EP_NUM(ep->bEndpointAddress);
+            data_ep_size = ep->wMaxPacketSize;
+        }
+        if ((data_ep_in == 0) || (data_ep_out == 0))
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Warning no data EP, skipping interface\n");
+#endif //USBD_NCM_DEBUG
+            continue;
+        }
+
+        //configuration is ok, applying
+        ncmd = (NCMD*)malloc(sizeof(NCMD));
+        if (ncmd == NULL)
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Out of memory\n");
+#endif //USBD_NCM_DEBUG
+            return;
+        }
+        ncmd->control_iface = iface->bInterfaceNumber;
+        ncmd->control_ep = control_ep;
+        ncmd->data_iface = data_iface;
+        ncmd->data_alt = diface->bAlternateSetting;
+        ncmd->data_ep_in = data_ep_in;
+        ncmd->data_ep_out = data_ep_out;
+        ncmd->data_ep_size = data_ep_size;
+        ncmd->ncm = (iface->bInterfaceSubClass == CDC_NETWORK_CONTROL);
+#if (USBD_NCM_TX_FLUSH_MS)
+        ncmd->tx_timer = timer_create(USBD_IFACE(ncmd->control_iface, 0), HAL_USBD_IFACE);
+        if (ncmd->tx_timer == INVALID_HANDLE)
+        {
+            free(ncmd);
+            return;
+        }
+#endif //USBD_NCM_TX_FLUSH_MS
+        ncmd->notify = io_create(NCMD_NOTIFY_SIZE);
+        ncmd->tx[0] = io_create(USBD_NCM_MAX_NTB_SIZE);
+        ncmd->tx[1] = io_create(USBD_NCM_MAX_NTB_SIZE);
+        ncmd->rx = io_create(USBD_NCM_MAX_NTB_SIZE);
+        if ((ncmd->notify == NULL) || (ncmd->tx[0] == NULL) || (ncmd->tx[1] == NULL) || (ncmd->rx == NULL))
+        {
+#if (USBD_NCM_DEBUG)
+            printf("NCM device: Out of memory\n");
+#endif //USBD_NCM_DEBUG
+            ncmd_destroy(ncmd);
+            return;
+        }
+
+        ncmd->tcpip = INVALID_HANDLE;
+        ncmd->mac.u32.hi = ncmd->mac.u32.lo = 0;
+        ncmd->ntb_input_size = USBD_NCM_MAX_NTB_SIZE;
+        ncmd->tx_ok = ncmd->rx_ok = 0;
+        ncmd->tx_seq = 0;
+        ncmd->packet_filter = 0;
+        ncmd->tx_fill = ncmd->tx_count = ncmd->tx_wait_count = ncmd->rx_wait_count = 0;
+        ncmd->active = ncmd->tx_busy = ncmd->rx_busy = ncmd->rx_pending = ncmd->tx_timer_active = false;
+        ncmd->notify_busy = ncmd->notify_speed = ncmd->notify_pending = false;
+
+        usbd_usb_ep_open(usbd, USB_EP_IN | ncmd->control_ep, USB_EP_INTERRUPT, control_ep_size);
+        usbd_register_interface(usbd, ncmd->control_iface, &__NCMD_CLASS, ncmd);
+        usbd_register_interface(usbd, ncmd->data_iface, &__NCMD_CLASS, ncmd);
+        usbd_register_endpoint(usbd, ncmd->control_iface, ncmd->control_ep);
+        usbd_register_endpoint(usbd, ncmd->data_iface, ncmd->data_ep_in);
+        if (ncmd->data_ep_out != ncmd->data_ep_in)
+            usbd_register_endpoint(usbd, ncmd->data_iface, ncmd->data_ep_out);
+        //no data-less alternate setting
+        if (ncmd->data_alt == 0)
+            ncmd_set_active(usbd, ncmd, true);
+    }
+}
+
+void ncmd_class_reset(USBD* usbd, void* param)
+{
+    NCMD* ncmd = (NCMD*)param;
+
+    ncmd_set_active(usbd, ncmd, false);
+    if (ncmd->tcpip != INVALID_HANDLE)
+        ipc_post_inline(ncmd->tcpip, HAL_CMD(HAL_ETH, IPC_CLOSE), USBD_IFACE(ncmd->control_iface, 0), 0, 0);
+
+    usbd_usb_ep_close(usbd, USB_EP_IN | ncmd->control_ep);
+    usbd_unregister_endpoint(usbd, ncmd->control_iface, ncmd->control_ep);
+    usbd_unregister_endpoint(usbd, ncmd->data_iface, ncmd->data_ep_in);
+    if (ncmd->data_ep_out != ncmd->data_ep_in)
+        usbd_unregister_endpoint(usbd, ncmd->data_iface, ncmd->data_ep_out);
+    usbd_unregister_interface(usbd, ncmd->data_iface, &__NCMD_CLASS);
+    usbd_unregister_interface(usbd, ncmd->control_iface, &__NCMD_CLASS);
+    ncmd_destroy(ncmd);
+}
+
+void ncmd_class_suspend(USBD* usbd, void* param)
+{
+    NCMD* ncmd = (NCMD*)param;
+    if (ncmd_link_ready(ncmd))
+        ipc_post_inline(ncmd->tcpip, HAL_CMD(HAL_ETH, ETH_NOTIFY_LINK_CHANGED), USBD_IFACE(ncmd->control_iface, 0), ETH_NO_LINK, 0);
+    usbd_usb_ep_flush(usbd, USB_EP_IN | ncmd->control_ep);
+    ncmd->notify_busy = ncmd->notify_speed = ncmd->notify_pending = false;
+    ncmd_flush(usbd, ncmd);
+}
+
+void ncmd_class_resume(USBD* usbd, void* param)
+{
+    NCMD* ncmd = (NCMD*)param;
+    if (ncmd_link_ready(ncmd))
+        ipc_post_inline(ncmd->tcpip, HAL_CMD(HAL_ETH, ETH_NOTIFY_LINK_CHANGED), USBD_IFACE(ncmd->control_iface, 0), ETH_100_FULL, 0);
+}
+
+static void ncmd_rx_start(USBD* usbd, NCMD* ncmd)
+{
+    ncmd->rx_busy = true;
+    usbd_usb_ep_read(usbd, ncmd->data_ep_out, ncmd->rx, USBD_NCM_MAX_NTB_SIZE);
+}
+
+static IO* ncmd_wait_pop(IO** wait, uint8_t* count)
+{
+    IO* io = wait[0];
+    if (--(*count))
+        memmove(wait, wait + 1, (*count) * sizeof(IO*));
+    return io;
+}
+
+static void ncmd_rx_deliver(NCMD* ncmd, uint8_t* data, unsigned int size)
+{
+    IO* io;
+    //frame is not fitting, drop
+    if (size > io_get_free(ncmd->rx_wait[0]))
+        return;
+    io = ncmd_wait_pop(ncmd->rx_wait, &ncmd->rx_wait_count);
+    memcpy(io_data(io), data, size);
+    io->data_size = size;
+    ++ncmd->rx_ok;
+#if (USBD_NCM_DEBUG_FLOW)
+    printf("NCM device: RX %d\n", io->data_size);
+#endif //USBD_NCM_DEBUG_FLOW
+    io_complete(ncmd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(ncmd->control_iface, 0), io);
+}
+
+static bool ncmd_rx_ntb_check(NCMD* ncmd)
+{
+    NCM_NTH16* nth = io_data(ncmd->rx);
+    if ((ncmd->rx->data_size < sizeof(NCM_NTH16)) || (nth->dwSignature != NCM_NTH16_SIGNATURE) || (nth->wHeaderLength != sizeof(NCM_NTH16)) ||
+        (nth->wBlockLength > ncmd->rx->data_size))
+        return false;
+    ncmd->rx_block = nth->wBlockLength ? nth->wBlockLength : ncmd->rx->data_size;
+    ncmd->rx_ndp = nth->wNdpIndex;
+    ncmd->rx_dpe = 0;
+    return true;
+}
+
+//walk NDP chain, each datagram is copied to own tcpip frame
+static void ncmd_rx_ntb(NCMD* ncmd)
+{
+    NCM_NDP16* ndp;
+    NCM_DPE16* dpe;
+    uint8_t* ntb = io_data(ncmd->rx);
+    unsigned int offset;
+    while (ncmd->rx_pending && ncmd->rx_wait_count)
+    {
+        ndp = (NCM_NDP16*)(ntb + ncmd->rx_ndp);
+        //NDP must be aligned, signature read faults on Cortex-M0 otherwise
+        if ((ncmd->rx_ndp < sizeof(NCM_NTH16)) || (ncmd->rx_ndp & 3) || (ncmd->rx_ndp + sizeof(NCM_NDP16) > ncmd->rx_block) || (ndp->dwSignature != NCM_NDP16_SIGNATURE) ||
+            (ndp->wLength < sizeof(NCM_NDP16) + 2 * sizeof(NCM_DPE16)) || (ncmd->rx_ndp + ndp->wLength > ncmd->rx_block))
+        {
+            ncmd->rx_pending = false;
+            break;
+        }
+        offset = sizeof(NCM_NDP16) + ncmd->rx_dpe * sizeof(NCM_DPE16);
+        dpe = (NCM_DPE16*)(ntb + ncmd->rx_ndp + offset);
+        //end of datagram list, go to next NDP
+        if ((offset + sizeof(NCM_DPE16) > ndp->wLength) || (dpe->wDatagramIndex == 0) || (dpe->wDatagramLength == 0))
+        {
+            //chain is only walked forward, loop from host will hang driver or repeat frames. Drop rest of NTB
+            if (ndp->wNextNdpIndex <= ncmd->rx_ndp)
+                ncmd->rx_pending = false;
+            ncmd->rx_ndp = ndp->wNextNdpIndex;
+            ncmd->rx_dpe = 0;
+            continue;
+        }
+        ++ncmd->rx_dpe;
+        if (dpe->wDatagramIndex + dpe->wDatagramLength > ncmd->rx_block)
+            continue;
+        ncmd_rx_deliver(ncmd, ntb + dpe->wDatagramIndex, dpe->wDatagramLength);
+    }
+}
+
+static void ncmd_rx_process(USBD* usbd, NCMD* ncmd)
+{
+    if (ncmd->rx_pending && ncmd->rx_wait_count)
+    {
+        if (ncmd->ncm)
+            ncmd_rx_ntb(ncmd);
+        else
+        {
+            ncmd_rx_deliver(ncmd, io_data(ncmd->rx), ncmd->rx->data_size);
+            ncmd->rx_pending = false;
+        }
+    }
+    //transfer is processed, receive next if someone is waiting
+    if (!ncmd->rx_busy && !ncmd->rx_pending && ncmd->rx_wait_count)
+        ncmd_rx_start(usbd, ncmd);
+}
+
+static inline void ncmd_read_complete(USBD* usbd, NCMD* ncmd, int size)
+{
+    IO* io;
+    //cancelled by flush
+    if (!ncmd->rx_busy)
+        return;
+    ncmd->rx_busy = false;
+    if (size < 0)
+    {
+        if (ncmd->rx_wait_count)
+        {
+            io = ncmd_wait_pop(ncmd->rx_wait, &ncmd->rx_wait_count);
+            io_complete_ex(ncmd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(ncmd->control_iface, 0), io, size);
+        }
+    }
+    else if (ncmd->ncm)
+        ncmd->rx_pending = ncmd_rx_ntb_check(ncmd);
+    else
+        ncmd->rx_pending = (ncmd->rx->data_size != 0);
+    ncmd_rx_process(usbd, ncmd);
+}
+
+static bool ncmd_tx_append(NCMD* ncmd, IO* io)
+{
+    IO* tx = ncmd->tx[ncmd->tx_fill];
+    unsigned int offset;
+    if (!ncmd->ncm)
+    {
+        if (ncmd->tx_count)
+            return false;
+        memcpy(io_data(tx), io_data(io), io->data_size);
+        tx->data_size = io->data_size;
+    }
+    else
+    {
+        offset = ncmd->tx_count ? NCMD_ALIGN(tx->data_size) : sizeof(NCM_NTH16);
+        //NDP with terminating entry and possible short packet padding must fit too
+        if ((ncmd->tx_count >= USBD_NCM_MAX_DATAGRAMS) ||
+            (NCMD_ALIGN(offset + io->data_size) + sizeof(NCM_NDP16) + (ncmd->tx_count + 2) * sizeof(NCM_DPE16) + 1 > ncmd->ntb_input_size))
+            return false;
+        memcpy((uint8_t*)io_data(tx) + offset, io_data(io), io->data_size);
+        ncmd->tx_dpe[ncmd->tx_count].wDatagramIndex = offset;
+        ncmd->tx_dpe[ncmd->tx_count].wDatagramLength = io->data_size;
+        tx->data_size = offset + io->data_size;
+    }
+    ++ncmd->tx_count;
+#if (USBD_NCM_DEBUG_FLOW)
+    printf("NCM device: TX %d\n", io->data_size);
+#endif //USBD_NCM_DEBUG_FLOW
+    return true;
+}
+
+//NDP is placed after datagrams, when all of them are known
+static void ncmd_tx_ntb_close(NCMD* ncmd, IO* tx)
+{
+    NCM_NTH16* nth = io_data(tx);
+    NCM_NDP16* ndp;
+    NCM_DPE16* dpe;
+    unsigned int offset = NCMD_ALIGN(tx->data_size);
+    memset((uint8_t*)io_data(tx) + tx->data_size, 0, offset - tx->data_size);
+    ndp = (NCM_NDP16*)((uint8_t*)io_data(tx) + offset);
+    ndp->dwSignature = NCM_NDP16_SIGNATURE;
+    ndp->wLength = sizeof(NCM_NDP16) + (ncmd->tx_count + 1) * sizeof(NCM_DPE16);
+    ndp->wNextNdpIndex = 0;
+    dpe = (NCM_DPE16*)((uint8_t*)ndp + sizeof(NCM_NDP16));
+    memcpy(dpe, ncmd->tx_dpe, ncmd->tx_count * sizeof(NCM_DPE16));
+    dpe[ncmd->tx_count].wDatagramIndex = dpe[ncmd->tx_count].wDatagramLength = 0;
+    tx->data_size = offset + ndp->wLength;
+    //pad instead of ZLP
+    if (((tx->data_size % ncmd->data_ep_size) == 0) && (tx->data_size < ncmd->ntb_input_size))
+        ((uint8_t*)io_data(tx))[tx->data_size++] = 0;
+    nth->dwSignature = NCM_NTH16_SIGNATURE;
+    nth->wHeaderLength = sizeof(NCM_NTH16);
+    nth->wSequence = ncmd->tx_seq++;
+    nth->wBlockLength = tx->data_size;
+    nth->wNdpIndex = offset;
+}
+
+static void ncmd_tx_pump(NCMD* ncmd)
+{
+    IO* io;
+    while (ncmd->tx_wait_count && ncmd_tx_append(ncmd, ncmd->tx_wait[0]))
+    {
+        io = ncmd_wait_pop(ncmd->tx_wait, &ncmd->tx_wait_count);
+        ++ncmd->tx_ok;
+        io_complete(ncmd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(ncmd->control_iface, 0), io);
+    }
+}
+
+static void ncmd_tx_send(USBD* usbd, NCMD* ncmd)
+{
+    IO* io = ncmd->tx[ncmd->tx_fill];
+    ncmd_tx_timer_stop(ncmd);
+    if (ncmd->ncm)
+        ncmd_tx_ntb_close(ncmd, io);
+    ncmd->tx_busy = true;
+    ncmd->tx_fill ^= 1;
+    ncmd->tx_count = 0;
+    io_reset(ncmd->tx[ncmd->tx_fill]);
+    usbd_usb_ep_write(usbd, ncmd->data_ep_in, io);
+}
+
+//flush - send now, don't wait for NTB to fill
+static void ncmd_tx_process(USBD* usbd, NCMD* ncmd, bool flush)
+{
+    ncmd_tx_pump(ncmd);
+    if (ncmd->tx_busy || (ncmd->tx_count == 0))
+        return;
+#if (USBD_NCM_TX_FLUSH_MS)
+    if (ncmd->ncm && !flush && !ncmd->tx_wait_count && (ncmd->tx_count < USBD_NCM_MAX_DATAGRAMS))
+    {
+        if (!ncmd->tx_timer_active)
+        {
+            timer_start_ms(ncmd->tx_timer, USBD_NCM_TX_FLUSH_MS);
+            ncmd->tx_timer_active = true;
+        }
+        return;
+    }
+#endif //USBD_NCM_TX_FLUSH_MS
+    ncmd_tx_send(usbd, ncmd);
+    ncmd_tx_pump(ncmd);
+}
+
+static inline void ncmd_write_complete(USBD* usbd, NCMD* ncmd, int size)
+{
+    IO* io;
+    //cancelled by flush
+    if (!ncmd->tx_busy)
+        return;
+    //ECM frame is terminated by ZLP. NTB is padded instead
+    if ((size > 0) && ((size % ncmd->data_ep_size) == 0))
+    {
+        io = ncmd->tx[ncmd->tx_fill ^ 1];
+        io_reset(io);
+        usbd_usb_ep_write(usbd, ncmd->data_ep_in, io);
+        return;
+    }
+    ncmd->tx_busy = false;
+    //frames queued during transfer already waited enough
+    if (ncmd_link_ready(ncmd))
+        ncmd_tx_process(usbd, ncmd, true);
+}
+
+static inline int ncmd_get_ntb_parameters(IO* io)
+{
+    NCM_NTB_PARAMETERS* params = io_data(io);
+    params->wLength = sizeof(NCM_NTB_PARAMETERS);
+    params->bmNtbFormatsSupported = NCM_NTB_FORMAT_16;
+    params->dwNtbInMaxSize = params->dwNtbOutMaxSize = USBD_NCM_MAX_NTB_SIZE;
+    params->wNdpInDivisor = params->wNdpOutDivisor = 4;
+    params->wNdpInPayloadRemainder = params->wNdpOutPayloadRemainder = 0;
+    params->wNdpInAlignment = params->wNdpOutAlignment = 4;
+    params->wReserved = 0;
+    //any count, limited by NTB size only
+    params->wNtbOutMaxDatagrams = 0;
+    return sizeof(NCM_NTB_PARAMETERS);
+}
+
+static inline int ncmd_set_ntb_input_size(NCMD* ncmd, IO* io)
+{
+    uint32_t size;
+    if (io->data_size < sizeof(uint32_t))
+        return -1;
+    size = *((uint32_t*)io_data(io));
+    if ((size < NCM_NTB_MIN_INPUT_SIZE) || (size > USBD_NCM_MAX_NTB_SIZE))
+        return -1;
+    ncmd->ntb_input_size = size;
+#if (USBD_NCM_DEBUG_REQUESTS)
+    printf("NCM device: SET NTB input size %d\n", ncmd->ntb_input_size);
+#endif //USBD_NCM_DEBUG_REQUESTS
+    return 0;
+}
+
+static inline int ncmd_class_request_setup(NCMD* ncmd, SETUP* setup, IO* io)
+{
+    int res = -1;
+    switch (setup->bRequest)
+    {
+    case SET_ETHERNET_PACKET_FILTER:
+        ncmd->packet_filter = setup->wValue;
+#if (USBD_NCM_DEBUG_REQUESTS)
+        printf("NCM device: SET packet filter: %#04X\n", ncmd->packet_filter);
+#endif //USBD_NCM_DEBUG_REQUESTS
+        res = 0;
+        break;
+    case SET_ETHERNET_MULTICAST_FILTERS:
+        //no hardware filtering, everything is passed to tcpip
+        res = 0;
+        break;
+    default:
+        break;
+    }
+    if (!ncmd->ncm || (res >= 0))
+        return res;
+
+    switch (setup->bRequest)
+    {
+    case GET_NTB_PARAMETERS:
+        res = ncmd_get_ntb_parameters(io);
+        break;
+    case GET_NTB_FORMAT:
+        *((uint16_t*)io_data(io)) = 0;
+        res = sizeof(uint16_t);
+        break;
+    case SET_NTB_FORMAT:
+        //NTB16 only
+        if (setup->wValue == 0)
+            res = 0;
+        break;
+    case GET_NTB_INPUT_SIZE:
+        *((uint32_t*)io_data(io)) = ncmd->ntb_input_size;
+        res = sizeof(uint32_t);
+        break;
+    case SET_NTB_INPUT_SIZE:
+        res = ncmd_set_ntb_input_size(ncmd, io);
+        break;
+    default:
+#if (USBD_NCM_DEBUG_REQUESTS)
+        printf("NCM device: unsupported request %#X\n", setup->bRequest);
+#endif //USBD_NCM_DEBUG_REQUESTS
+        break;
+    }
+    return res;
+}
+
+int ncmd_class_setup(USBD* usbd, void* param, SETUP* setup, IO* io)
+{
+    NCMD* ncmd = (NCMD*)param;
+    int res = -1;
+    if ((setup->bmRequestType & BM_REQUEST_TYPE) == BM_REQUEST_TYPE_CLASS)
+        return ncmd_class_request_setup(ncmd, setup, io);
+    if ((setup->wIndex & 0xff) != ncmd->data_iface)
+        return -1;
+    switch (setup->bRequest)
+    {
+    case USB_REQUEST_GET_INTERFACE:
+        *((uint8_t*)io_data(io)) = ncmd->active ? ncmd->data_alt : 0;
+        res = sizeof(uint8_t);
+        break;
+    case USB_REQUEST_SET_INTERFACE:
+        if ((setup->wValue == 0) || (setup->wValue == ncmd->data_alt))
+        {
+#if (USBD_NCM_DEBUG_REQUESTS)
+            printf("NCM device: data alt %d\n", setup->wValue);
+#endif //USBD_NCM_DEBUG_REQUESTS
+            //reselection of active setting resets data too
+            if (ncmd->active)
+                ncmd_set_active(usbd, ncmd, false);
+            if (setup->wValue == ncmd->data_alt)
+                ncmd_set_active(usbd, ncmd, true);
+            res = 0;
+        }
+        break;
+    default:
+        break;
+    }
+    return res;
+}
+
+static inline void ncmd_driver_event(USBD* usbd, NCMD* ncmd, IPC* ipc)
+{
+    switch (HAL_ITEM(ipc->cmd))
+    {
+    case IPC_READ:
+        if (USB_EP_NUM(ipc->param1) == ncmd->data_ep_out)
+            ncmd_read_complete(usbd, ncmd, (int)ipc->param3);
+        break;
+    case IPC_WRITE:
+        if (USB_EP_NUM(ipc->param1) == ncmd->data_ep_in)
+            ncmd_write_complete(usbd, ncmd, (int)ipc->param3);
+        else if (ncmd->notify_busy)
+            ncmd_notify_complete(usbd, ncmd);
+        break;
+    default:
+        error(ERROR_NOT_SUPPORTED);
+    }
+}
+
+static inline void ncmd_eth_open(USBD* usbd, NCMD* ncmd, HANDLE tcpip)
+{
+    bool was_ready = ncmd_link_ready(ncmd);
+    if (ncmd->tcpip != INVALID_HANDLE)
+    {
+        error(ERROR_ALREADY_CONFIGURED);
+        return;
+    }
+    ncmd->tcpip = tcpip;
+    if (was_ready != ncmd_link_ready(ncmd))
+        ncmd_link_changed(usbd, ncmd);
+}
+
+static inline void ncmd_eth_close(USBD* usbd, NCMD* ncmd, HANDLE tcpip)
+{
+    if (ncmd->tcpip == INVALID_HANDLE)
+    {
+        error(ERROR_NOT_CONFIGURED);
+        return;
+    }
+    if (ncmd->tcpip != tcpip)
+    {
+        error(ERROR_ACCESS_DENIED);
+        return;
+    }
+    ncmd_flush(usbd, ncmd);
+    ncmd->tcpip = INVALID_HANDLE;
+    if (ncmd->active)
+        ncmd_notify_link(usbd, ncmd);
+}
+
+static inline void ncmd_eth_read(USBD* usbd, NCMD* ncmd, IO* io)
+{
+    if (!ncmd_link_ready(ncmd))
+    {
+        error(ERROR_NOT_ACTIVE);
+        return;
+    }
+    if (ncmd->rx_wait_count >= NCMD_IO_WAIT)
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
+    ncmd->rx_wait[ncmd->rx_wait_count++] = io;
+    ncmd_rx_process(usbd, ncmd);
+    error(ERROR_SYNC);
+}
+
+static inline void ncmd_eth_write(USBD* usbd, NCMD* ncmd, IO* io)
+{
+    if (!ncmd_link_ready(ncmd))
+    {
+        error(ERROR_NOT_ACTIVE);
+        return;
+    }
+    if (sizeof(NCM_NTH16) + sizeof(NCM_NDP16) + 2 * sizeof(NCM_DPE16) + io->data_size + 4 > ncmd->ntb_input_size)
+    {
+        error(ERROR_INVALID_FRAME);
+        return;
+    }
+    if (ncmd->tx_wait_count >= NCMD_IO_WAIT)
+    {
+        error(ERROR_IN_PROGRESS);
+        return;
+    }
+    ncmd->tx_wait[ncmd->tx_wait_count++] = io;
+    ncmd_tx_process(usbd, ncmd, false);
+    error(ERROR_SYNC);
+}
+
+static inline void ncmd_eth_event(USBD* usbd, NCMD* ncmd, IPC* ipc)
+{
+    switch (HAL_ITEM(ipc->cmd))
+    {
+    case ETH_SET_MAC:
+        ncmd->mac.u32.hi = ipc->param2;
+        ncmd->mac.u32.lo = (uint16_t)ipc->param3;
+        break;
+    case ETH_GET_MAC:
+        ipc->param2 = ncmd->mac.u32.hi;
+        ipc->param3 = ncmd->mac.u32.lo;
+        break;
+    case ETH_GET_HEADER_SIZE:
+        //frames are copied to NTB, no headroom required
+        ipc->param2 = 0;
+        ipc->param3 = ERROR_OK;
+        break;
+    case IPC_OPEN:
+        ncmd_eth_open(usbd, ncmd, ipc->process);
+        break;
+    case IPC_CLOSE:
+        ncmd_eth_close(usbd, ncmd, ipc->process);
+        break;
+    case IPC_READ:
+        ncmd_eth_read(usbd, ncmd, (IO*)ipc->param2);
+        break;
+    case IPC_WRITE:
+        ncmd_eth_write(usbd, ncmd, (IO*)ipc->param2);
+        break;
+    case IPC_FLUSH:
+        ncmd_flush(usbd, ncmd);
+        break;
+    default:
+        error(ERROR_NOT_SUPPORTED);
+    }
+}
+
+void ncmd_class_request(USBD* usbd, void* param, IPC* ipc)
+{
+    NCMD* ncmd = (NCMD*)param;
+    switch (HAL_GROUP(ipc->cmd))
+    {
+    case HAL_USB:
+        ncmd_driver_event(usbd, ncmd, ipc);
+        break;
+    case HAL_ETH:
+        ncmd_eth_event(usbd, ncmd, ipc);
+        break;
+#if (USBD_NCM_TX_FLUSH_MS)
+    case HAL_USBD_IFACE:
+        if (HAL_ITEM(ipc->cmd) == IPC_TIMEOUT)
+        {
+            ncmd->tx_timer_active = false;
+            if (ncmd_link_ready(ncmd))
+                ncmd_tx_process(usbd, ncmd, true);
+            break;
+        }
+        error(ERROR_NOT_SUPPORTED);
+        break;
+#endif //USBD_NCM_TX_FLUSH_MS
+    default:
+        error(ERROR_NOT_SUPPORTED);
+    }
+}
+
+const USBD_CLASS __NCMD_CLASS = {
+    ncmd_class_configured,
+    ncmd_class_reset,
+    ncmd_class_suspend,
+    ncmd_class_resume,
+    ncmd_class_setup,
+    ncmd_class_request,
+};
@@ -0,0 +1,70 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#ifndef NCMD_H
+#define NCMD_H
+
+/*
+        CDC NCM 1.0 network device, NTB16 only. CDC ECM is served by same driver
+ */
+
+#include "usbd.h"
+#include <stdint.h>
+
+#define NCM_NTH16_SIGNATURE                                                     0x484d434e
+#define NCM_NDP16_SIGNATURE                                                     0x304d434e
+
+#define NCM_NTB_FORMAT_16                                                       (1 << 0)
+#define NCM_NTB_MIN_INPUT_SIZE                                                  2048
+
+#pragma pack(push, 1)
+
+typedef struct {
+    uint32_t dwSignature;
+    uint16_t wHeaderLength;
+    uint16_t wSequence;
+    //0 - block is terminated by short packet
+    uint16_t wBlockLength;
+    uint16_t wNdpIndex;
+} NCM_NTH16;
+
+typedef struct {
+    uint16_t wDatagramIndex;
+    uint16_t wDatagramLength;
+} NCM_DPE16;
+
+typedef struct {
+    uint32_t dwSignature;
+    uint16_t wLength;
+    uint16_t wNextNdpIndex;
+    //NCM_DPE16 list, terminated by zero entry, is following
+} NCM_NDP16;
+
+typedef struct {
+    uint16_t wLength;
+    uint16_t bmNtbFormatsSupported;
+    uint32_t dwNtbInMaxSize;
+    uint16_t wNdpInDivisor;
+    uint16_t wNdpInPayloadRemainder;
+    uint16_t wNdpInAlignment;
+    uint16_t wReserved;
+    uint32_t dwNtbOutMaxSize;
+    uint16_t wNdpOutDivisor;
+    uint16_t wNdpOutPayloadRemainder;
+    uint16_t wNdpOutAlignment;
+    uint16_t wNtbOutMaxDatagrams;
+} NCM_NTB_PARAMETERS;
+
+typedef struct {
+    uint32_t DLBitRate;
+    uint32_t ULBitRate;
+} CDC_CONNECTION_SPEED;
+
+#pragma pack(pop)
+
+extern const USBD_CLASS __NCMD_CLASS;
+
+#endif // NCMD_H
@@ -59,62 +59,79 @@ static const uint32_t __RNDIS_GEN_SUPPORTED_LIST[RNDIS_GEN_SUPPORTED_LIST_COUNT]
                                                                                    };
 #pragma pack(pop)
 
-typedef struct {
-    IO* usb_notify;
-    IO* tx_cur;
-    IO* rx_cur;
 #if (ETH_DOUBLE_BUFFERING)
-    IO* tx;
-    IO* rx;
+#define RNDISD_IO_WAIT                                                          2
 #else
+#define RNDISD_IO_WAIT                                                          1
+#endif //ETH_DOUBLE_BUFFERING
+
+typedef struct {
+    IO* usb_notify;
+    //aggregated transfers: one on the air, other is filling
+    IO* tx[2];
     IO* rx;
-#endif
-    unsigned int transfer_size, tx_ok, rx_ok, rx_size;
+    //tcpip frames, waiting for transfer space/received data
+    IO* tx_wait[RNDISD_IO_WAIT];
+    IO* rx_wait[RNDISD_IO_WAIT];
+    unsigned int transfer_size, tx_ok, rx_ok, rx_pos;
     uint32_t packet_filter, vendor_id;
     char* vendor;
     ETH_CONN_TYPE conn;
     MAC eth, host;
     HANDLE tcpip;
+#if (USBD_RNDIS_TX_FLUSH_MS)
+    HANDLE tx_timer;
+#endif //USBD_RNDIS_TX_FLUSH_MS
     uint8_t response[RNDIS_RESPONSE_SIZE];
     uint8_t response_size;
     uint8_t data_ep, control_ep;
     uint16_t data_ep_size;
     uint8_t data_iface, control_iface;
-    bool notify_busy, link_status_queued, connected, zlp, initialized;
+    uint8_t tx_fill, tx_count, tx_wait_count, rx_wait_count;
+    bool notify_busy, link_status_queued, connected, initialized;
+    bool tx_busy, rx_busy, tx_timer_active;
 } RNDISD;
 
 static void rndisd_destroy(RNDISD* rndisd)
 {
+#if (USBD_RNDIS_TX_FLUSH_MS)
+    timer_destroy(rndisd->tx_timer);
+#endif //USBD_RNDIS_TX_FLUSH_MS
+    io_destroy(rndisd->tx[0]);
+    io_destroy(rndisd->tx[1]);
+    io_destroy(rndisd->rx);
     free(rndisd);
 }
 
+static void rndisd_tx_timer_stop(RNDISD* rndisd)
+{
+#if (USBD_RNDIS_TX_FLUSH_MS)
+    if (rndisd->tx_timer_active)
+    {
+        timer_stop(rndisd->tx_timer, USBD_IFACE(rndisd->control_iface, 0), HAL_USBD_IFACE);
+        rndisd->tx_timer_active = false;
+    }
+#endif //USBD_RNDIS_TX_FLUSH_MS
+}
+
 static void rndisd_flush(USBD* usbd, RNDISD* rndisd)
 {
+    unsigned int i;
     usbd_usb_ep_flush(usbd, USB_EP_IN | rndisd->control_ep);
     usbd_usb_ep_flush(usbd, USB_EP_IN | rndisd->data_ep);
     usbd_usb_ep_flush(usbd, rndisd->data_ep);
-#if (ETH_DOUBLE_BUFFERING)
-    if (rndisd->tx != NULL)
-    {
-        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), rndisd->tx, ERROR_IO_CANCELLED);
-        rndisd->tx = NULL;
-    }
-    if (rndisd->rx != NULL)
-    {
-        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rndisd->rx, ERROR_IO_CANCELLED);
-        rndisd->rx = NULL;
-    }
-#endif //ETH_DOUBLE_BUFFERING
-    if (rndisd->rx_cur != NULL)
-    {
-        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rndisd->rx_cur, ERROR_IO_CANCELLED);
-        rndisd->rx_cur = NULL;
-    }
-    if (rndisd->tx_cur != NULL)
-    {
-        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), rndisd->tx_cur, ERROR_IO_CANCELLED);
-        rndisd->tx_cur = NULL;
-    }
+    for (i = 0; i < rndisd->rx_wait_count; ++i)
+        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rndisd->rx_wait[i], ERROR_IO_CANCELLED);
+    for (i = 0; i < rndisd->tx_wait_count; ++i)
+        io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), rndisd->tx_wait[i], ERROR_IO_CANCELLED);
+    rndisd->rx_wait_count = rndisd->tx_wait_count = 0;
+    rndisd_tx_timer_stop(rndisd);
+    io_reset(rndisd->tx[0]);
+    io_reset(rndisd->tx[1]);
+    io_reset(rndisd->rx);
+    rndisd->tx_count = 0;
+    rndisd->rx_pos = 0;
+    rndisd->tx_busy = rndisd->rx_busy = false;
     rndisd->link_status_queued = rndisd->notify_busy = false;
 }
 
@@ -265,9 +282,25 @@ void rndisd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
         rndisd->data_iface = data_iface;
         rndisd->data_ep = data_ep;
         rndisd->data_ep_size = data_ep_size;
-#if (ETH_DOUBLE_BUFFERING)
-        rndisd->tx = rndisd->rx = NULL;
-#endif //ETH_DOUBLE_BUFFERING
+#if (USBD_RNDIS_TX_FLUSH_MS)
+        rndisd->tx_timer = timer_create(USBD_IFACE(rndisd->control_iface, 0), HAL_USBD_IFACE);
+        if (rndisd->tx_timer == INVALID_HANDLE)
+        {
+            free(rndisd);
+            return;
+        }
+#endif //USBD_RNDIS_TX_FLUSH_MS
+        rndisd->tx[0] = io_create(USBD_RNDIS_MAX_PACKET_SIZE);
+        rndisd->tx[1] = io_create(USBD_RNDIS_MAX_PACKET_SIZE);
+        rndisd->rx = io_create(USBD_RNDIS_MAX_PACKET_SIZE);
+        if ((rndisd->tx[0] == NULL) || (rndisd->tx[1] == NULL) || (rndisd->rx == NULL))
+        {
+#if (USBD_RNDIS_DEBUG)
+            printf("RNDIS device: Out of memory\n");
+#endif //USBD_RNDIS_DEBUG
+            rndisd_destroy(rndisd);
+            return;
+        }
         rndisd->usb_notify = io_create(control_ep_size);
 
         usbd_usb_ep_open(usbd, USB_EP_IN | rndisd->data_ep, USB_EP_BULK, rndisd->data_ep_size);
@@ -287,8 +320,9 @@ void rndisd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
         rndisd->vendor = NULL;
         rndisd->notify_busy = false;
         rndisd->connected = false;
-        rndisd->tx_cur = rndisd->rx_cur = NULL;
-        rndisd->zlp = false;
+        rndisd->tx_fill = rndisd->tx_count = rndisd->tx_wait_count = rndisd->rx_wait_count = 0;
+        rndisd->rx_pos = 0;
+        rndisd->tx_busy = rndisd->rx_busy = rndisd->tx_timer_active = false;
         rndisd->initialized = false;
         rndisd_reset(usbd, rndisd);
     }
@@ -331,112 +365,163 @@ void rndisd_class_resume(USBD* usbd, void* param)
         ipc_post_inline(rndisd->tcpip, HAL_CMD(HAL_ETH, ETH_NOTIFY_LINK_CHANGED), USBD_IFACE(rndisd->control_iface, 0), rndisd->conn, 0);
 }
 
-static inline void rndisd_read_complete(USBD* usbd, RNDISD* rndisd, int size)
+static void rndisd_rx_start(USBD* usbd, RNDISD* rndisd)
 {
-    IO* rx_cur;
-    RNDIS_PACKET_MSG* msg;
+    rndisd->rx_pos = 0;
+    rndisd->rx_busy = true;
+    usbd_usb_ep_read(usbd, rndisd->data_ep, rndisd->rx, USBD_RNDIS_MAX_PACKET_SIZE);
+}
 
-    rx_cur = rndisd->rx_cur;
-    rndisd->rx_cur = NULL;
-#if (ETH_DOUBLE_BUFFERING)
-    if (rndisd->rx != NULL)
-    {
-        rndisd->rx_cur = rndisd->rx;
-        rndisd->rx = NULL;
-        usbd_usb_ep_read(usbd, rndisd->data_ep, rndisd->rx_cur, rndisd->rx_size);
-    }
-#endif //ETH_DOUBLE_BUFFERING
-    if (rx_cur != NULL)
+static IO* rndisd_wait_pop(IO** wait, uint8_t* count)
+{
+    IO* io = wait[0];
+    if (--(*count))
+        memmove(wait, wait + 1, (*count) * sizeof(IO*));
+    return io;
+}
+
+//transfer may contain few concatenated packets. Each is copied to own tcpip frame
+static void rndisd_rx_process(USBD* usbd, RNDISD* rndisd)
+{
+    RNDIS_PACKET_MSG* msg;
+    IO* io;
+    unsigned int size;
+    while (!rndisd->rx_busy && rndisd->rx_wait_count && (rndisd->rx_pos < rndisd->rx->data_size))
     {
-        do {
-            if (size < 0)
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rx_cur, size);
-                break;
-            }
-            if (!rndisd_link_ready(rndisd))
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rx_cur, ERROR_NOT_ACTIVE);
-                break;
-            }
-            if (rx_cur->data_size < sizeof(RNDIS_PACKET_MSG))
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rx_cur, ERROR_INVALID_FRAME);
-                break;
-            }
-            msg = io_data(rx_cur);
-            if ((msg->message_type != REMOTE_NDIS_PACKET_MSG) || (msg->message_length > rndisd->transfer_size) ||
-                (msg->message_length > rx_cur->data_size) ||
-                (msg->data_offset + msg->data_length + offsetof(RNDIS_PACKET_MSG, data_offset) > msg->message_length) || (msg->data_length == 0))
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rx_cur, ERROR_INVALID_FRAME);
-                break;
-            }
-            rx_cur->data_offset += msg->data_offset + offsetof(RNDIS_PACKET_MSG, data_offset);
-            rx_cur->data_size = msg->data_length;
-            ++rndisd->rx_ok;
+        size = rndisd->rx->data_size - rndisd->rx_pos;
+        msg = (RNDIS_PACKET_MSG*)((uint8_t*)io_data(rndisd->rx) + rndisd->rx_pos);
+        //short packet padding or broken stream, rest of transfer is dropped
+        if ((size < sizeof(RNDIS_PACKET_MSG)) || (msg->message_type != REMOTE_NDIS_PACKET_MSG) || (msg->message_length < sizeof(RNDIS_PACKET_MSG)) ||
+            (msg->message_length > size) || (msg->data_offset + msg->data_length + offsetof(RNDIS_PACKET_MSG, data_offset) > msg->message_length) ||
+            (msg->data_length == 0))
+        {
+            rndisd->rx_pos = rndisd->rx->data_size;
+            break;
+        }
+        rndisd->rx_pos += msg->message_length;
+        //frame is not fitting, drop
+        if (msg->data_length > io_get_free(rndisd->rx_wait[0]))
+            continue;
+        io = rndisd_wait_pop(rndisd->rx_wait, &rndisd->rx_wait_count);
+        memcpy(io_data(io), (uint8_t*)msg + msg->data_offset + offsetof(RNDIS_PACKET_MSG, data_offset), msg->data_length);
+        io->data_size = msg->data_length;
+        ++rndisd->rx_ok;
 #if (USBD_RNDIS_DEBUG_FLOW)
-            printf("RNDIS device: RX %d\n", rx_cur->data_size);
+        printf("RNDIS device: RX %d\n", io->data_size);
 #endif //USBD_RNDIS_DEBUG_FLOW
-            io_complete(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), rx_cur);
-        } while(false);
+        io_complete(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), io);
     }
+    //transfer is processed, receive next if someone is waiting
+    if (!rndisd->rx_busy && rndisd->rx_wait_count && (rndisd->rx_pos >= rndisd->rx->data_size))
+        rndisd_rx_start(usbd, rndisd);
 }
 
-static void rndisd_write_packet(USBD* usbd, RNDISD* rndisd)
+static inline void rndisd_read_complete(USBD* usbd, RNDISD* rndisd, int size)
+{
+    IO* io;
+    //cancelled by flush
+    if (!rndisd->rx_busy)
+        return;
+    rndisd->rx_busy = false;
+    if (size < 0)
+    {
+        rndisd->rx->data_size = 0;
+        if (rndisd->rx_wait_count)
+        {
+            io = rndisd_wait_pop(rndisd->rx_wait, &rndisd->rx_wait_count);
+            io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_READ), USBD_IFACE(rndisd->control_iface, 0), io, size);
+        }
+    }
+    rndisd_rx_process(usbd, rndisd);
+}
+
+static bool rndisd_tx_append(RNDISD* rndisd, IO* io)
 {
     RNDIS_PACKET_MSG* msg;
-    io_unhide(rndisd->tx_cur, sizeof(RNDIS_PACKET_MSG));
-    msg = io_data(rndisd->tx_cur);
+    unsigned int size;
+    IO* tx = rndisd->tx[rndisd->tx_fill];
+    //aligned to packet_alignment_factor
+    size = (sizeof(RNDIS_PACKET_MSG) + io->data_size + 3) & ~3;
+    if ((rndisd->tx_count >= USBD_RNDIS_MAX_PACKETS_PER_TRANSFER) || (tx->data_size + size > rndisd->transfer_size))
+        return false;
+    msg = (RNDIS_PACKET_MSG*)((uint8_t*)io_data(tx) + tx->data_size);
     msg->message_type = REMOTE_NDIS_PACKET_MSG;
-    msg->message_length = rndisd->tx_cur->data_size;
+    msg->message_length = size;
     msg->data_offset = sizeof(RNDIS_PACKET_MSG) - offsetof(RNDIS_PACKET_MSG, data_offset);
-    msg->data_length = msg->message_length - sizeof(RNDIS_PACKET_MSG);
+    msg->data_length = io->data_size;
     memset(&msg->out_of_band_data_offset, 0, sizeof(RNDIS_PACKET_MSG) - offsetof(RNDIS_PACKET_MSG, out_of_band_data_offset));
-    usbd_usb_ep_write(usbd, USB_EP_IN | rndisd->data_ep, rndisd->tx_cur);
+    memcpy((uint8_t*)msg + sizeof(RNDIS_PACKET_MSG), io_data(io), io->data_size);
+    memset((uint8_t*)msg + sizeof(RNDIS_PACKET_MSG) + io->data_size, 0, size - sizeof(RNDIS_PACKET_MSG) - io->data_size);
+    tx->data_size += size;
+    ++rndisd->tx_count;
 #if (USBD_RNDIS_DEBUG_FLOW)
-    printf("RNDIS device: TX %d\n", rndisd->tx_cur->data_size - sizeof(RNDIS_PACKET_MSG));
+    printf("RNDIS device: TX %d\n", io->data_size);
 #endif //USBD_RNDIS_DEBUG_FLOW
+    return true;
 }
 
-void rndisd_write_complete(USBD* usbd, RNDISD* rndisd, int size)
+//copy waiting tcpip frames to filling transfer
+static void rndisd_tx_pump(RNDISD* rndisd)
 {
-    IO* tx_cur;
-    //tx ZLP
-    if ((size > 0) && ((size % rndisd->data_ep_size) == 0) && rndisd->tx_cur)
+    IO* io;
+    while (rndisd->tx_wait_count && rndisd_tx_append(rndisd, rndisd->tx_wait[0]))
     {
-        io_reset(rndisd->tx_cur);
-        usbd_usb_ep_write(usbd, USB_EP_IN | rndisd->data_ep, rndisd->tx_cur);
-        return;
+        io = rndisd_wait_pop(rndisd->tx_wait, &rndisd->tx_wait_count);
+        ++rndisd->tx_ok;
+        io_complete(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), io);
     }
-    tx_cur = rndisd->tx_cur;
-    rndisd->tx_cur = NULL;
-#if (ETH_DOUBLE_BUFFERING)
-    if (rndisd->tx != NULL)
+}
+
+static void rndisd_tx_send(USBD* usbd, RNDISD* rndisd)
+{
+    IO* io = rndisd->tx[rndisd->tx_fill];
+    rndisd_tx_timer_stop(rndisd);
+    rndisd->tx_busy = true;
+    rndisd->tx_fill ^= 1;
+    rndisd->tx_count = 0;
+    io_reset(rndisd->tx[rndisd->tx_fill]);
+    usbd_usb_ep_write(usbd, USB_EP_IN | rndisd->data_ep, io);
+}
+
+//flush - send now, don't wait for transfer to fill
+static void rndisd_tx_process(USBD* usbd, RNDISD* rndisd, bool flush)
+{
+    rndisd_tx_pump(rndisd);
+    if (rndisd->tx_busy || (rndisd->tx_count == 0))
+        return;
+#if (USBD_RNDIS_TX_FLUSH_MS)
+    if (!flush && !rndisd->tx_wait_count && (rndisd->tx_count < USBD_RNDIS_MAX_PACKETS_PER_TRANSFER))
     {
-        rndisd->tx_cur = rndisd->tx;
-        rndisd->tx = NULL;
-        rndisd_write_packet(usbd, rndisd);
+        if (!rndisd->tx_timer_active)
+        {
+            timer_start_ms(rndisd->tx_timer, USBD_RNDIS_TX_FLUSH_MS);
+            rndisd->tx_timer_active = true;
+        }
+        return;
     }
-#endif //ETH_DOUBLE_BUFFERING
-    if (tx_cur != NULL)
-    {
-        do {
-            if (size < 0)
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), tx_cur, size);
-                break;
-            }
-            if (!rndisd_link_ready(rndisd))
-            {
-                io_complete_ex(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), tx_cur, ERROR_NOT_ACTIVE);
-                break;
-            }
+#endif //USBD_RNDIS_TX_FLUSH_MS
+    rndisd_tx_send(usbd, rndisd);
+    rndisd_tx_pump(rndisd);
+}
 
-            io_complete(rndisd->tcpip, HAL_IO_CMD(HAL_ETH, IPC_WRITE), USBD_IFACE(rndisd->control_iface, 0), tx_cur);
-            ++rndisd->tx_ok;
-        } while (false);
+void rndisd_write_complete(USBD* usbd, RNDISD* rndisd, int size)
+{
+    IO* io;
+    //cancelled by flush
+    if (!rndisd->tx_busy)
+        return;
+    //tx ZLP
+    if ((size > 0) && ((size % rndisd->data_ep_size) == 0))
+    {
+        io = rndisd->tx[rndisd->tx_fill ^ 1];
+        io_reset(io);
+        usbd_usb_ep_write(usbd, USB_EP_IN | rndisd->data_ep, io);
+        return;
     }
+    rndisd->tx_busy = false;
+    //frames queued during transfer already waited enough
+    if (rndisd_link_ready(rndisd))
+        rndisd_tx_process(usbd, rndisd, true);
 }
 
 static inline void rndisd_initialize_msg(USBD* usbd, RNDISD* rndisd, IO* io)
@@ -462,8 +547,8 @@ static inline void rndisd_initialize_msg(USBD* usbd, RNDISD* rndisd, IO* io)
     cmplt->minor_version = RNDIS_VERSION_MINOR;
     cmplt->device_flags = RNDIS_DF_CONNECTIONLESS;
     cmplt->medium = RNDIS_MEDIUM_802_3;
-    cmplt->max_packets_per_transfer = 1;
-    cmplt->max_transfer_size = rndisd->transfer_size;
+    cmplt->max_packets_per_transfer = USBD_RNDIS_MAX_PACKETS_PER_TRANSFER;
+    cmplt->max_transfer_size = USBD_RNDIS_MAX_PACKET_SIZE;
     //The value is specified as an exponent of 2
     cmplt->packet_alignment_factor = 2;
     //Reserved for future use and MUST be set to zero. It SHOULD be treated as an error otherwise
@@ -1062,7 +1147,8 @@ static inline void rndisd_eth_get_mac(RNDISD* rndisd, IPC* ipc)
 
 static inline unsigned int rndisd_eth_get_header_size()
 {
-    return sizeof(RNDIS_PACKET_MSG);
+    //frames are copied to aggregated transfer, no headroom required
+    return 0;
 }
 
 static inline void rndisd_eth_open(USBD* usbd, RNDISD* rndisd, HANDLE tcpip)
@@ -1094,29 +1180,21 @@ static inline void rndisd_eth_close(USBD* usbd, RNDISD* rndisd, HANDLE tcpip)
     rndisd->tcpip = INVALID_HANDLE;
 }
 
-static inline void rndisd_eth_read(USBD* usbd, RNDISD* rndisd, IO* io, unsigned int size)
+static inline void rndisd_eth_read(USBD* usbd, RNDISD* rndisd, IO* io)
 {
     if (!rndisd_link_ready(rndisd))
     {
         error(ERROR_NOT_ACTIVE);
         return;
     }
-    if (rndisd->rx_cur == NULL)
+    if (rndisd->rx_wait_count >= RNDISD_IO_WAIT)
     {
-        rndisd->rx_cur = io;
-        usbd_usb_ep_read(usbd, rndisd->data_ep, rndisd->rx_cur, size);
-        error(ERROR_SYNC);
-    }
-#if (ETH_DOUBLE_BUFFERING)
-    else if (rndisd->rx == NULL)
-    {
-        rndisd->rx = io;
-        rndisd->rx_size = size;
-        error(ERROR_SYNC);
-    }
-#endif //ETH_DOUBLE_BUFFERING
-    else
         error(ERROR_IN_PROGRESS);
+        return;
+    }
+    rndisd->rx_wait[rndisd->rx_wait_count++] = io;
+    rndisd_rx_process(usbd, rndisd);
+    error(ERROR_SYNC);
 }
 
 static inline void rndisd_eth_write(USBD* usbd, RNDISD* rndisd, IO* io)
@@ -1126,21 +1204,19 @@ static inline void rndisd_eth_write(USBD* usbd, RNDISD* rndisd, IO* io)
         error(ERROR_NOT_ACTIVE);
         return;
     }
-    if (rndisd->tx_cur == NULL)
+    if (sizeof(RNDIS_PACKET_MSG) + io->data_size > rndisd->transfer_size)
     {
-        rndisd->tx_cur = io;
-        rndisd_write_packet(usbd, rndisd);
-        error(ERROR_SYNC);
+        error(ERROR_INVALID_FRAME);
+        return;
     }
-#if (ETH_DOUBLE_BUFFERING)
-    else if (rndisd->tx == NULL)
+    if (rndisd->tx_wait_count >= RNDISD_IO_WAIT)
     {
-        rndisd->tx = io;
-        error(ERROR_SYNC);
-    }
-#endif //ETH_DOUBLE_BUFFERING
-    else
         error(ERROR_IN_PROGRESS);
+        return;
+    }
+    rndisd->tx_wait[rndisd->tx_wait_count++] = io;
+    rndisd_tx_process(usbd, rndisd, false);
+    error(ERROR_SYNC);
 }
 
 static inline void rndisd_eth_event(USBD* usbd, RNDISD* rndisd, IPC* ipc)
@@ -1164,7 +1240,7 @@ static inline void rndisd_eth_event(USBD* usbd, RNDISD* rndisd, IPC* ipc)
         rndisd_eth_close(usbd, rndisd, ipc->process);
         break;
     case IPC_READ:
-        rndisd_eth_read(usbd, rndisd, (IO*)ipc->param2, ipc->param3);
+        rndisd_eth_read(usbd, rndisd, (IO*)ipc->param2);
         break;
     case IPC_WRITE:
         rndisd_eth_write(usbd, rndisd, (IO*)ipc->param2);
@@ -1226,10 +1302,24 @@ static inline void rndisd_get_host_mac(RNDISD* rndisd, IPC* ipc)
 }
 
 
+#if (USBD_RNDIS_TX_FLUSH_MS)
+static inline void rndisd_tx_timeout(USBD* usbd, RNDISD* rndisd)
+{
+    rndisd->tx_timer_active = false;
+    if (rndisd_link_ready(rndisd))
+        rndisd_tx_process(usbd, rndisd, true);
+}
+#endif //USBD_RNDIS_TX_FLUSH_MS
+
 static inline void rndisd_iface_event(USBD* usbd, RNDISD* rndisd, IPC* ipc)
 {
     switch (HAL_ITEM(ipc->cmd))
     {
+#if (USBD_RNDIS_TX_FLUSH_MS)
+    case IPC_TIMEOUT:
+        rndisd_tx_timeout(usbd, rndisd);
+        break;
+#endif //USBD_RNDIS_TX_FLUSH_MS
     case RNDIS_SET_LINK:
         rndisd_set_link(usbd, rndisd, (ETH_CONN_TYPE)ipc->param2);
         break;
@@ -0,0 +1,545 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#include "uasd.h"
+#include "../../userspace/sys.h"
+#include "../../userspace/stdio.h"
+#include "../../userspace/io.h"
+#include "../../userspace/stdlib.h"
+#include "../../userspace/endian.h"
+#include "../../userspace/msc.h"
+#include "../../userspace/scsi.h"
+#include "../../userspace/storage.h"
+#include "../../userspace/rb.h"
+#include "../scsis/scsis.h"
+#include <stdint.h>
+#include <string.h>
+#include "usb.h"
+#include "sys_config.h"
+
+#if (SCSI_TASK_DEPTH == 0)
+#error UAS requires SCSI_TASK_DEPTH
+#endif //SCSI_TASK_DEPTH
+
+//sense IU with fixed format sense data
+#define UASD_IU_SIZE_MAX                            (sizeof(UAS_SENSE_IU) + 18)
+#define UASD_STATUS_DEPTH                           8
+//ready + sense for running task, sense of previous task and response for received IU
+#define UASD_STATUS_RESERVE                         4
+
+typedef struct {
+    uint8_t data[UASD_IU_SIZE_MAX];
+    unsigned int size;
+} UASD_IU;
+
+typedef struct {
+    IO* command;
+    IO* status;
+    IO* data;
+    USBD* usbd;
+    uint8_t iface_num, command_ep, status_ep, data_in_ep, data_out_ep;
+    uint16_t command_ep_size, data_out_ep_size;
+    unsigned int lun_count;
+    uint32_t io_busy_mask;
+    int io_owner;
+    //status pipe queue
+    UASD_IU ius[UASD_STATUS_DEPTH];
+    RB rb_status;
+    bool status_busy, command_busy, ready_sent;
+    //SCSIS* for each lun is following
+} UASD;
+
+#define UASD_SCSI(uasd)                            ((SCSIS**)((uint8_t*)(uasd) + sizeof(UASD)))
+
+static void uasd_destroy(UASD* uasd)
+{
+    int i;
+    for (i = 0; i < uasd->lun_count; ++i)
+    {
+        if (UASD_SCSI(uasd)[i] != NULL)
+            scsis_destroy(UASD_SCSI(uasd)[i]);
+    }
+    io_destroy(uasd->data);
+    io_destroy(uasd->status);
+    io_destroy(uasd->command);
+    free(uasd);
+}
+
+static void uasd_command_rx(USBD* usbd, UASD* uasd)
+{
+    //throttle host, till status pipe is drained
+    if (uasd->command_busy || (rb_free(&uasd->rb_status) < UASD_STATUS_RESERVE))
+        return;
+    uasd->command_busy = true;
+    usbd_usb_ep_read(usbd, uasd->command_ep, uasd->command, uasd->command_ep_size);
+}
+
+static void uasd_status_tx(USBD* usbd, UASD* uasd)
+{
+    unsigned int idx;
+    if (uasd->status_busy || rb_is_empty(&uasd->rb_status))
+        return;
+    idx = rb_get(&uasd->rb_status);
+    io_data_write(uasd->status, uasd->ius[idx].data, uasd->ius[idx].size);
+    uasd->status_busy = true;
+    usbd_usb_ep_write(usbd, USB_EP_IN | uasd->status_ep, uasd->status);
+}
+
+static void* uasd_status_put(UASD* uasd, uint8_t iu_id, unsigned int tag, unsigned int size)
+{
+    UASD_IU* iu;
+    UAS_IU_HEADER* header;
+    if (rb_is_full(&uasd->rb_status))
+    {
+#if (USBD_UAS_DEBUG_ERRORS)
+        printf("UASD: status overflow\n");
+#endif //USBD_UAS_DEBUG_ERRORS
+        return NULL;
+    }
+    iu = &uasd->ius[rb_put(&uasd->rb_status)];
+    memset(iu->data, 0, size);
+    iu->size = size;
+    header = (UAS_IU_HEADER*)iu->data;
+    header->iu_id = iu_id;
+    short2be(header->tag, tag);
+    return iu->data;
+}
+
+static void uasd_ready(UASD* uasd, uint8_t iu_id, unsigned int tag)
+{
+    if (uasd->ready_sent)
+        return;
+    uasd->ready_sent = true;
+    uasd_status_put(uasd, iu_id, tag, sizeof(UAS_IU_HEADER));
+    uasd_status_tx(uasd->usbd, uasd);
+}
+
+static void uasd_response(UASD* uasd, unsigned int tag, uint8_t response_code)
+{
+    UAS_RESPONSE_IU* response = uasd_status_put(uasd, UAS_IU_RESPONSE, tag, sizeof(UAS_RESPONSE_IU));
+#if (USBD_UAS_DEBUG_REQUESTS)
+    printf("UASD: response tag: %d, code: %02xh\n", tag, response_code);
+#endif //USBD_UAS_DEBUG_REQUESTS
+    if (response != NULL)
+        response->response_code = response_code;
+    uasd_status_tx(uasd->usbd, uasd);
+}
+
+static void uasd_sense(UASD* uasd, SCSIS* scsis, unsigned int tag, uint8_t status)
+{
+    UAS_SENSE_IU* sense;
+    unsigned int len = 0;
+    uint8_t sense_data[UASD_IU_SIZE_MAX - sizeof(UAS_SENSE_IU)];
+    if (status == SCSI_STATUS_CHECK_CONDITION)
+        len = scsis_get_sense(scsis, sense_data);
+    sense = uasd_status_put(uasd, UAS_IU_SENSE, tag, sizeof(UAS_SENSE_IU) + len);
+    if (sense != NULL)
+    {
+        sense->status = status;
+        short2be(sense->length, len);
+        memcpy((uint8_t*)sense + sizeof(UAS_SENSE_IU), sense_data, len);
+    }
+    uasd_status_tx(uasd->usbd, uasd);
+}
+
+static void uasd_flush(USBD* usbd, UASD* uasd)
+{
+    int i;
+    usbd_usb_ep_flush(usbd, uasd->command_ep);
+    usbd_usb_ep_flush(usbd, USB_EP_IN | uasd->status_ep);
+    usbd_usb_ep_flush(usbd, USB_EP_IN | uasd->data_in_ep);
+    usbd_usb_ep_flush(usbd, uasd->data_out_ep);
+    for (i = 0; i < uasd->lun_count; ++i)
+        scsis_reset(UASD_SCSI(uasd)[i]);
+    rb_clear(&uasd->rb_status);
+    uasd->io_busy_mask = 0;
+    uasd->io_owner = -1;
+    uasd->status_busy = uasd->command_busy = uasd->ready_sent = false;
+}
+
+static void uasd_release_io(UASD* uasd)
+{
+    int i;
+    uasd->io_owner = -1;
+    uasd->ready_sent = false;
+    if (uasd->io_busy_mask)
+    {
+        for (i = 0; i < uasd->lun_count; ++i)
+        {
+            if (uasd->io_busy_mask & (1 << i))
+            {
+                uasd->io_owner = i;
+                uasd->io_busy_mask &= ~(1 << i);
+                scsis_host_give_io(UASD_SCSI(uasd)[i], uasd->data);
+                return;
+            }
+        }
+    }
+}
+
+void uasd_host_cb(void* param, unsigned int id, SCSIS_RESPONSE response, IO* io, unsigned int size)
+{
+    UASD* uasd = param;
+    SCSIS* scsis = UASD_SCSI(uasd)[id];
+
+    switch (response)
+    {
+    case SCSIS_RESPONSE_READ:
+        uasd_ready(uasd, UAS_IU_WRITE_READY, scsis_get_tag(scsis));
+        //some hardware required to be multiple of MPS
+        usbd_usb_ep_read(uasd->usbd, uasd->data_out_ep, io, (size + uasd->data_out_ep_size - 1) & ~(uasd->data_out_ep_size - 1));
+        break;
+    case SCSIS_RESPONSE_WRITE:
+        uasd_ready(uasd, UAS_IU_READ_READY, scsis_get_tag(scsis));
+        usbd_usb_ep_write(uasd->usbd, USB_EP_IN | uasd->data_in_ep, io);
+        break;
+    case SCSIS_RESPONSE_PASS:
+        uasd_sense(uasd, scsis, scsis_get_tag(scsis), SCSI_STATUS_GOOD);
+        break;
+    case SCSIS_RESPONSE_FAIL:
+        uasd_sense(uasd, scsis, scsis_get_tag(scsis), SCSI_STATUS_CHECK_CONDITION);
+        break;
+    case SCSIS_RESPONSE_NEED_IO:
+        if (uasd->io_owner < 0)
+        {
+            uasd->io_owner = id;
+            scsis_host_give_io(scsis, uasd->data);
+        }
+        else if (uasd->io_owner != id)
+            uasd->io_busy_mask |= 1 << id;
+        break;
+    case SCSIS_RESPONSE_RELEASE_IO:
+        uasd_release_io(uasd);
+        break;
+    default:
+        break;
+    }
+}
+
+void uasd_class_configured(USBD* usbd, USB_CONFIGURATION_DESCRIPTOR* cfg)
+{
+    USB_INTERFACE_DESCRIPTOR* iface;
+    USB_ENDPOINT_DESCRIPTOR* ep;
+    UAS_PIPE_USAGE_DESCRIPTOR* pipe;
+    void* config;
+    int i;
+    unsigned int command_ep, status_ep, data_in_ep, data_out_ep, command_ep_size, status_ep_size, data_in_ep_size, data_out_ep_size;
+    unsigned int iface_num, lun_count;
+    command_ep = status_ep = data_in_ep = data_out_ep = 0;
+    command_ep_size = status_ep_size = data_in_ep_size = data_out_ep_size = 0;
+
+    for (iface = usb_get_first_interface(cfg); iface != NULL; iface = usb_get_next_interface(cfg, iface))
+    {
+        if ((iface->bInterfaceClass != MSC_INTERFACE_CLASS) || (iface->bInterfaceProtocol != MSC_PROTOCOL_UAS))
+            continue;
+        //pipe usage descriptor is following each endpoint
+        for (ep = (USB_ENDPOINT_DESCRIPTOR*)usb_interface_get_first_descriptor(cfg, iface, USB_ENDPOINT_DESCRIPTOR_TYPE); ep != NULL;
+             ep = (USB_ENDPOINT_DESCRIPTOR*)usb_interface_get_next_descriptor(cfg, (USB_GENERIC_DESCRIPTOR*)ep, USB_ENDPOINT_DESCRIPTOR_TYPE))
+        {
+            pipe = (UAS_PIPE_USAGE_DESCRIPTOR*)usb_interface_get_next_descriptor(cfg, (USB_GENERIC_DESCRIPTOR*)ep, 0);
+            if ((pipe == NULL) || (pipe->bDescriptorType != UAS_PIPE_USAGE_DESCRIPTOR_TYPE))
+                continue;
+            switch (pipe->bPipeID)
+            {
+            case UAS_PIPE_ID_COMMAND:
+                command_ep = USB_EP_NUM(ep->bEndpointAddress);
+                command_ep_size = ep->wMaxPacketSize;
+                break;
+            case UAS_PIPE_ID_STATUS:
+                status_ep = USB_EP_NUM(ep->bEndpointAddress);
+                status_ep_size = ep->wMaxPacketSize;
+                break;
+            case UAS_PIPE_ID_DATA_IN:
+                data_in_ep = USB_EP_NUM(ep->bEndpointAddress);
+                data_in_ep_size = ep->wMaxPacketSize;
+                break;
+            case UAS_PIPE_ID_DATA_OUT:
+                data_out_ep = USB_EP_NUM(ep->bEndpointAddress);
+                data_out_ep_size = ep->wMaxPacketSize;
+                break;
+            default:
+                break;
+            }
+        }
+        iface_num = iface->bInterfaceNumber;
+        break;
+    }
+
+    //No UAS interface
+    if ((command_ep == 0) || (status_ep == 0) || (data_in_ep == 0) || (data_out_ep == 0))
+        return;
+    i = usbd_get_cfg(usbd, iface_num);
+    config = usbd_get_cfg_data(usbd, i);
+    lun_count = 0;
+    if (usbd_get_cfg_data_size(usbd, i) > (int)sizeof(uint32_t))
+        lun_count = MSC_LUN_COUNT(config);
+    if ((config == NULL) || (usbd_get_cfg_data_size(usbd, i) < (int)((sizeof(SCSI_STORAGE_DESCRIPTOR)) * lun_count + sizeof(uint32_t))) || (lun_count == 0))
+    {
+#if (USBD_UAS_DEBUG_ERRORS)
+        printf("UASD: Failed to read user configuration\n");
+#endif //USBD_UAS_DEBUG_ERRORS
+        return;
+    }
+    UASD* uasd = (UASD*)malloc(sizeof(UASD) + sizeof(void*) * lun_count);
+    if (uasd == NULL)
+        return;
+
+    uasd->iface_num = iface_num;
+    uasd->command_ep = command_ep;
+    uasd->status_ep = status_ep;
+    uasd->data_in_ep = data_in_ep;
+    uasd->data_out_ep = data_out_ep;
+    uasd->command_ep_size = command_ep_size;
+    uasd->data_out_ep_size = data_out_ep_size;
+    uasd->usbd = usbd;
+
+    uasd->command = io_create(command_ep_size);
+    uasd->status = io_create(UASD_IU_SIZE_MAX);
+    uasd->data = io_create(USBD_UAS_IO_SIZE + sizeof(STORAGE_STACK));
+    uasd->lun_count = lun_count;
+    uasd->io_busy_mask = 0x00000000;
+    uasd->io_owner = -1;
+    uasd->status_busy = uasd->command_busy = uasd->ready_sent = false;
+    rb_init(&uasd->rb_status, UASD_STATUS_DEPTH);
+    for (i = 0; i < uasd->lun_count; ++i)
+        UASD_SCSI(uasd)[i] = scsis_create(uasd_host_cb, uasd, i, MSC_LUN_CONFIGURATION(config, i));
+    if (uasd->command == NULL || uasd->status == NULL || uasd->data == NULL || UASD_SCSI(uasd)[uasd->lun_count - 1] == NULL)
+    {
+#if (USBD_UAS_DEBUG_ERRORS)
+        printf("UASD: Out of memory\n");
+#endif //USBD_UAS_DEBUG_ERRORS
+        uasd_destroy(uasd);
+        return;
+    }
+
+    for (i = 0; i < uasd->lun_count; ++i)
+        scsis_init(UASD_SCSI(uasd)[i]);
+
+#if (USBD_UAS_DEBUG_REQUESTS)
+    printf("Found USB UASD class, command EP%d, status EP%d, data in EP%d, data out EP%d, iface: %d\n",
+           command_ep, status_ep, data_in_ep, data_out_ep, iface_num);
+#endif //USBD_UAS_DEBUG_REQUESTS
+
+    usbd_register_interface(usbd, iface_num, &__UASD_CLASS, uasd);
+    usbd_register_endpoint(usbd, iface_num, command_ep);
+    if (status_ep != command_ep)
+        usbd_register_endpoint(usbd, iface_num, status_ep);
+    if ((data_in_ep != command_ep) && (data_in_ep != status_ep))
+        usbd_register_endpoint(usbd, iface_num, data_in_ep);
+    if ((data_out_ep != command_ep) && (data_out_ep != status_ep) && (data_out_ep != data_in_ep))
+        usbd_register_endpoint(usbd, iface_num, data_out_ep);
+
+    usbd_usb_ep_open(usbd, command_ep, USB_EP_BULK, command_ep_size);
+    usbd_usb_ep_open(usbd, USB_EP_IN | status_ep, USB_EP_BULK, status_ep_size);
+    usbd_usb_ep_open(usbd, USB_EP_IN | data_in_ep, USB_EP_BULK, data_in_ep_size);
+    usbd_usb_ep_open(usbd, data_out_ep, USB_EP_BULK, data_out_ep_size);
+
+    uasd_command_rx(usbd, uasd);
+}
+
+void uasd_class_reset(USBD* usbd, void* param)
+{
+    UASD* uasd = (UASD*)param;
+
+    uasd_flush(usbd, uasd);
+    usbd_unregister_endpoint(usbd, uasd->iface_num, uasd->command_ep);
+    usbd_unregister_endpoint(usbd, uasd->iface_num, uasd->status_ep);
+    usbd_unregister_endpoint(usbd, uasd->iface_num, uasd->data_in_ep);
+    usbd_unregister_endpoint(usbd, uasd->iface_num, uasd->data_out_ep);
+    usbd_unregister_interface(usbd, uasd->iface_num, &__UASD_CLASS);
+    usbd_usb_ep_close(usbd, uasd->command_ep);
+    usbd_usb_ep_close(usbd, USB_EP_IN | uasd->status_ep);
+    usbd_usb_ep_close(usbd, USB_EP_IN | uasd->data_in_ep);
+    usbd_usb_ep_close(usbd, uasd->data_out_ep);
+    uasd_destroy(uasd);
+}
+
+void uasd_class_suspend(USBD* usbd, void* param)
+{
+    UASD* uasd = (UASD*)param;
+    uasd_flush(usbd, uasd);
+}
+
+void uasd_class_resume(USBD* usbd, void* param)
+{
+    UASD* uasd = (UASD*)param;
+    uasd_command_rx(usbd, uasd);
+}
+
+int uasd_class_setup(USBD* usbd, void* param, SETUP* setup, IO* io)
+{
+    int res = -1;
+    if ((setup->bmRequestType & BM_REQUEST_TYPE) != BM_REQUEST_TYPE_STANDART)
+        return res;
+    //UAS is only alternate setting
+    switch (setup->bRequest)
+    {
+    case USB_REQUEST_GET_INTERFACE:
+        *((uint8_t*)io_data(io)) = 0;
+        res = sizeof(uint8_t);
+        break;
+    case USB_REQUEST_SET_INTERFACE:
+        if (setup->wValue == 0)
+            res = 0;
+        break;
+    }
+    return res;
+}
+
+static inline void uasd_command_iu(USBD* usbd, UASD* uasd)
+{
+    UAS_COMMAND_IU* cmd = io_data(uasd->command);
+    unsigned int tag = be2short(cmd->header.tag);
+    unsigned int lun = UAS_LUN(cmd->lun);
+    int i;
+#if (USBD_UAS_DEBUG_IO)
+    printf("UASD: command tag: %d, lun: %d, opcode: %02xh\n", tag, lun, cmd->cdb[0]);
+#endif //USBD_UAS_DEBUG_IO
+    if (uasd->command->data_size < sizeof(UAS_COMMAND_IU))
+    {
+        uasd_response(uasd, tag, UAS_RC_INVALID_IU);
+        return;
+    }
+    if (lun >= uasd->lun_count)
+    {
+        uasd_response(uasd, tag, UAS_RC_INCORRECT_LUN);
+        return;
+    }
+    //tag is unique for all LUNs
+    for (i = 0; i < uasd->lun_count; ++i)
+    {
+        if (scsis_query_task(UASD_SCSI(uasd)[i], tag))
+        {
+            uasd_response(uasd, tag, UAS_RC_OVERLAPPED_TAG);
+            return;
+        }
+    }
+    if (!scsis_queue_cmd(UASD_SCSI(uasd)[lun], tag, cmd->attr & UAS_COMMAND_ATTR_MASK, cmd->cdb))
+        uasd_sense(uasd, UASD_SCSI(uasd)[lun], tag, SCSI_STATUS_TASK_SET_FULL);
+}
+
+static inline void uasd_task_management_iu(USBD* usbd, UASD* uasd)
+{
+    UAS_TASK_MANAGEMENT_IU* tmf = io_data(uasd->command);
+    unsigned int tag = be2short(tmf->header.tag);
+    unsigned int lun = UAS_LUN(tmf->lun);
+    SCSIS* scsis;
+    uint8_t rc;
+#if (USBD_UAS_DEBUG_REQUESTS)
+    printf("UASD: task management tag: %d, function: %02xh\n", tag, tmf->function);
+#endif //USBD_UAS_DEBUG_REQUESTS
+    if (uasd->command->data_size < sizeof(UAS_TASK_MANAGEMENT_IU))
+    {
+        uasd_response(uasd, tag, UAS_RC_INVALID_IU);
+        return;
+    }
+    if (lun >= uasd->lun_count)
+    {
+        uasd_response(uasd, tag, UAS_RC_INCORRECT_LUN);
+        return;
+    }
+    scsis = UASD_SCSI(uasd)[lun];
+    switch (tmf->function)
+    {
+    case UAS_TMF_ABORT_TASK:
+        rc = UAS_RC_TMF_COMPLETE;
+        //running task can't be aborted
+        if (!scsis_abort_task(scsis, be2short(tmf->task_tag)) && (scsis_get_tag(scsis) == be2short(tmf->task_tag)))
+            rc = UAS_RC_TMF_FAILED;
+        break;
+    case UAS_TMF_ABORT_TASK_SET:
+    case UAS_TMF_CLEAR_TASK_SET:
+    case UAS_TMF_LOGICAL_UNIT_RESET:
+        scsis_abort_task_set(scsis);
+        rc = UAS_RC_TMF_COMPLETE;
+        break;
+    case UAS_TMF_QUERY_TASK:
+        rc = scsis_query_task(scsis, be2short(tmf->task_tag)) ? UAS_RC_TMF_SUCCEEDED : UAS_RC_TMF_COMPLETE;
+        break;
+    default:
+        rc = UAS_RC_TMF_NOT_SUPPORTED;
+        break;
+    }
+    uasd_response(uasd, tag, rc);
+}
+
+static inline void uasd_command_complete(USBD* usbd, UASD* uasd)
+{
+    UAS_IU_HEADER* header = io_data(uasd->command);
+    uasd->command_busy = false;
+    if (uasd->command->data_size < sizeof(UAS_IU_HEADER))
+    {
+#if (USBD_UAS_DEBUG_ERRORS)
+        printf("UASD: invalid IU\n");
+#endif //USBD_UAS_DEBUG_ERRORS
+        uasd_command_rx(usbd, uasd);
+        return;
+    }
+    switch (header->iu_id)
+    {
+    case UAS_IU_COMMAND:
+        uasd_command_iu(usbd, uasd);
+        break;
+    case UAS_IU_TASK_MANAGEMENT:
+        uasd_task_management_iu(usbd, uasd);
+        break;
+    default:
+        uasd_response(uasd, be2short(header->tag), UAS_RC_INVALID_IU);
+        break;
+    }
+    uasd_command_rx(usbd, uasd);
+}
+
+static inline void uasd_driver_event(USBD* usbd, UASD* uasd, IPC* ipc)
+{
+    unsigned int num = USB_NUM(ipc->param1);
+    switch (HAL_ITEM(ipc->cmd))
+    {
+    case IPC_READ:
+        if (num == uasd->command_ep)
+            uasd_command_complete(usbd, uasd);
+        else if ((num == uasd->data_out_ep) && (uasd->io_owner >= 0))
+            scsis_host_io_complete(UASD_SCSI(uasd)[uasd->io_owner], (int)ipc->param3);
+        break;
+    case IPC_WRITE:
+        if (num == (USB_EP_IN | uasd->status_ep))
+        {
+            uasd->status_busy = false;
+            uasd_status_tx(usbd, uasd);
+            uasd_command_rx(usbd, uasd);
+        }
+        else if ((num == (USB_EP_IN | uasd->data_in_ep)) && (uasd->io_owner >= 0))
+            scsis_host_io_complete(UASD_SCSI(uasd)[uasd->io_owner], (int)ipc->param3);
+        break;
+    default:
+        error(ERROR_NOT_SUPPORTED);
+    }
+}
+
+void uasd_class_request(USBD* usbd, void* param, IPC* ipc)
+{
+    UASD* uasd = (UASD*)param;
+    switch (HAL_GROUP(ipc->cmd))
+    {
+    case HAL_USB:
+        uasd_driver_event(usbd, uasd, ipc);
+        break;
+    default:
+        if (USBD_IFACE_ITEM(ipc->param1) == uasd->io_owner)
+            scsis_request(UASD_SCSI(uasd)[uasd->io_owner], ipc);
+        else
+            error(ERROR_NOT_SUPPORTED);
+    }
+}
+
+const USBD_CLASS __UASD_CLASS = {
+    uasd_class_configured,
+    uasd_class_reset,
+    uasd_class_suspend,
+    uasd_class_resume,
+    uasd_class_setup,
+    uasd_class_request,
+};
@@ -0,0 +1,106 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#ifndef UASD_H
+#define UASD_H
+
+/*
+        USB Attached SCSI, revision 1.0. USB 2.0 mode, without streams
+ */
+
+#include "usbd.h"
+
+#define UAS_PIPE_USAGE_DESCRIPTOR_TYPE                                                  0x24
+
+#define UAS_PIPE_ID_COMMAND                                                             0x01
+#define UAS_PIPE_ID_STATUS                                                              0x02
+#define UAS_PIPE_ID_DATA_IN                                                             0x03
+#define UAS_PIPE_ID_DATA_OUT                                                            0x04
+
+#define UAS_IU_COMMAND                                                                  0x01
+#define UAS_IU_SENSE                                                                    0x03
+#define UAS_IU_RESPONSE                                                                 0x04
+#define UAS_IU_TASK_MANAGEMENT                                                          0x05
+#define UAS_IU_READ_READY                                                               0x06
+#define UAS_IU_WRITE_READY                                                              0x07
+
+#define UAS_TMF_ABORT_TASK                                                              0x01
+#define UAS_TMF_ABORT_TASK_SET                                                          0x02
+#define UAS_TMF_CLEAR_TASK_SET                                                          0x04
+#define UAS_TMF_LOGICAL_UNIT_RESET                                                      0x08
+#define UAS_TMF_I_T_NEXUS_RESET                                                         0x10
+#define UAS_TMF_CLEAR_ACA                                                               0x40
+#define UAS_TMF_QUERY_TASK                                                              0x80
+#define UAS_TMF_QUERY_TASK_SET                                                          0x81
+#define UAS_TMF_QUERY_ASYNC_EVENT                                                       0x82
+
+#define UAS_RC_TMF_COMPLETE                                                             0x00
+#define UAS_RC_INVALID_IU                                                               0x02
+#define UAS_RC_TMF_NOT_SUPPORTED                                                        0x04
+#define UAS_RC_TMF_FAILED                                                               0x05
+#define UAS_RC_TMF_SUCCEEDED                                                            0x08
+#define UAS_RC_INCORRECT_LUN                                                            0x09
+#define UAS_RC_OVERLAPPED_TAG                                                           0x0a
+
+#define UAS_COMMAND_ATTR_MASK                                                           (7 << 0)
+
+#pragma pack(push, 1)
+
+typedef struct {
+    uint8_t bLength;
+    uint8_t bDescriptorType;
+    uint8_t bPipeID;
+    uint8_t Reserved;
+} UAS_PIPE_USAGE_DESCRIPTOR;
+
+//all multibyte fields are big-endian
+typedef struct {
+    uint8_t iu_id;
+    uint8_t reserved;
+    uint8_t tag[2];
+} UAS_IU_HEADER;
+
+typedef struct {
+    UAS_IU_HEADER header;
+    uint8_t attr;
+    uint8_t reserved1;
+    uint8_t add_cdb_len;
+    uint8_t reserved2;
+    uint8_t lun[8];
+    uint8_t cdb[16];
+} UAS_COMMAND_IU;
+
+typedef struct {
+    UAS_IU_HEADER header;
+    uint8_t function;
+    uint8_t reserved1;
+    uint8_t task_tag[2];
+    uint8_t lun[8];
+} UAS_TASK_MANAGEMENT_IU;
+
+typedef struct {
+    UAS_IU_HEADER header;
+    uint8_t status_qualifier[2];
+    uint8_t status;
+    uint8_t reserved1[7];
+    uint8_t length[2];
+    //sense data is following
+} UAS_SENSE_IU;
+
+typedef struct {
+    UAS_IU_HEADER header;
+    uint8_t response_info[3];
+    uint8_t response_code;
+} UAS_RESPONSE_IU;
+
+#pragma pack(pop)
+
+//single level LUN addressing
+#define UAS_LUN(lun)                                                                    ((lun)[1])
+
+extern const USBD_CLASS __UASD_CLASS;
+
+#endif // UASD_H
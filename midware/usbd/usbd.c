@@ -13,8 +13,10 @@
 #include "../../userspace/array.h"
 #include "cdc_acmd.h"
 #include "rndisd.h"
+#include "ncmd.h"
 #include "hidd_kbd.h"
 #include "mscd.h"
+#include "uasd.h"
 #include "ccidd.h"
 
 typedef enum {
@@ -39,6 +41,18 @@ typedef enum {
     USBD_STATE_CONFIGURED
 } USBD_STATE;
 
+#if (USBD_EP_QUEUE)
+typedef struct {
+    //head is on the air
+    IO* io[USBD_EP_QUEUE];
+    unsigned int size[USBD_EP_QUEUE];
+    IO* zlp;
+    uint16_t mps;
+    uint8_t count;
+    bool armed, zlp_active, zlp_policy;
+} USBD_EP_QUEUE_TYPE;
+#endif //USBD_EP_QUEUE
+
 typedef struct _USBD {
     HANDLE user;
 #ifndef EXODRIVERS
@@ -63,6 +77,10 @@ typedef struct _USBD {
     ARRAY* cfgs;
     uint8_t ep_iface[USB_EP_COUNT_MAX];
     uint8_t ifacecnt;
+#if (USBD_EP_QUEUE)
+    //OUT, IN
+    USBD_EP_QUEUE_TYPE* ep_queue[USB_EP_COUNT_MAX][2];
+#endif //USBD_EP_QUEUE
 } USBD;
 
 typedef struct {
@@ -102,12 +120,18 @@ static const USBD_CLASS* __USBD_CLASSES[] =         {
 #if (USBD_RNDIS_CLASS)
                                                         &__RNDISD_CLASS,
 #endif //USBD_RNDIS_CLASS
+#if (USBD_NCM_CLASS)
+                                                        &__NCMD_CLASS,
+#endif //USBD_NCM_CLASS
 #if (USBD_HID_KBD_CLASS)
                                                         &__HIDD_KBD_CLASS,
 #endif //USBD_HID_KBD_CLASS
 #if (USBD_MSC_CLASS)
                                                         &__MSCD_CLASS,
 #endif //USBD_MSC_CLASS
+#if (USBD_UAS_CLASS)
+                                                        &__UASD_CLASS,
+#endif //USBD_UAS_CLASS
 #if (USBD_CCID_CLASS)
                                                         &__CCIDD_CLASS,
 #endif //USBD_CCID_CLASS
@@ -262,6 +286,143 @@ static void usbd_usb_sync(USBD* usbd)
 }
 #endif //EXODRIVERS
 
+#if (USBD_EP_QUEUE)
+#define EP_QUEUE(usbd, num)                         ((usbd)->ep_queue[USB_EP_NUM(num)][((num) & USB_EP_IN) ? 1 : 0])
+
+static void usbd_ep_queue_arm(USBD* usbd, unsigned int num, USBD_EP_QUEUE_TYPE* q)
+{
+    if (q->armed || q->zlp_active || (q->count == 0))
+        return;
+    q->armed = true;
+    if (num & USB_EP_IN)
+        usbd_usb_ep_write(usbd, USB_EP_NUM(num), q->io[0]);
+    else
+        usbd_usb_ep_read(usbd, num, q->io[0], q->size[0]);
+}
+
+static void usbd_ep_queue_pop(USBD_EP_QUEUE_TYPE* q)
+{
+    if (--q->count)
+    {
+        memmove(q->io, q->io + 1, q->count * sizeof(IO*));
+        memmove(q->size, q->size + 1, q->count * sizeof(unsigned int));
+    }
+}
+
+static bool usbd_ep_queue_push(USBD* usbd, unsigned int num, IO* io, unsigned int size)
+{
+    USBD_EP_QUEUE_TYPE* q;
+    if (USB_EP_NUM(num) >= USB_EP_COUNT_MAX)
+        return false;
+    q = EP_QUEUE(usbd, num);
+    if ((q == NULL) || (q->count >= USBD_EP_QUEUE))
+        return false;
+    q->io[q->count] = io;
+    q->size[q->count++] = size;
+    usbd_ep_queue_arm(usbd, num, q);
+    return true;
+}
+
+bool usbd_ep_queue_open(USBD* usbd, unsigned int num, USB_EP_TYPE type, unsigned int size, bool zlp)
+{
+    USBD_EP_QUEUE_TYPE* q;
+    if ((USB_EP_NUM(num) >= USB_EP_COUNT_MAX) || (EP_QUEUE(usbd, num) != NULL))
+        return false;
+    q = malloc(sizeof(USBD_EP_QUEUE_TYPE));
+    if (q == NULL)
+        return false;
+    q->zlp = NULL;
+    if ((num & USB_EP_IN) && zlp)
+    {
+        q->zlp = io_create(0);
+        if (q->zlp == NULL)
+        {
+            free(q);
+            return false;
+        }
+    }
+    q->mps = size;
+    q->count = 0;
+    q->armed = q->zlp_active = false;
+    q->zlp_policy = zlp;
+    EP_QUEUE(usbd, num) = q;
+    usbd_usb_ep_open(usbd, num, type, size);
+    return true;
+}
+
+void usbd_ep_queue_close(USBD* usbd, unsigned int num)
+{
+    USBD_EP_QUEUE_TYPE* q;
+    if (USB_EP_NUM(num) >= USB_EP_COUNT_MAX)
+        return;
+    q = EP_QUEUE(usbd, num);
+    if (q == NULL)
+        return;
+    usbd_usb_ep_close(usbd, num);
+    io_destroy(q->zlp);
+    free(q);
+    EP_QUEUE(usbd, num) = NULL;
+}
+
+bool usbd_ep_queue_write(USBD* usbd, unsigned int ep_num, IO* io)
+{
+    return usbd_ep_queue_push(usbd, USB_EP_IN | ep_num, io, io->data_size);
+}
+
+bool usbd_ep_queue_read(USBD* usbd, unsigned int ep_num, IO* io, unsigned int size)
+{
+    return usbd_ep_queue_push(usbd, ep_num, io, size);
+}
+
+IO* usbd_ep_queue_cancel(USBD* usbd, unsigned int num)
+{
+    USBD_EP_QUEUE_TYPE* q;
+    IO* io;
+    if (USB_EP_NUM(num) >= USB_EP_COUNT_MAX)
+        return NULL;
+    q = EP_QUEUE(usbd, num);
+    if (q == NULL)
+        return NULL;
+    //late completion of flushed IO is ignored, because it is not queue head anymore
+    if (q->armed || q->zlp_active)
+        usbd_usb_ep_flush(usbd, num);
+    q->armed = q->zlp_active = false;
+    if (q->count == 0)
+        return NULL;
+    io = q->io[0];
+    usbd_ep_queue_pop(q);
+    return io;
+}
+
+//next IO is armed before class is notified. false - completion is internal
+static bool usbd_ep_queue_complete(USBD* usbd, IPC* ipc)
+{
+    unsigned int num = USB_NUM(ipc->param1);
+    USBD_EP_QUEUE_TYPE* q = EP_QUEUE(usbd, num);
+    if (q == NULL)
+        return true;
+    if (q->zlp_active && ((IO*)ipc->param2 == q->zlp))
+    {
+        q->zlp_active = false;
+        usbd_ep_queue_arm(usbd, num, q);
+        return false;
+    }
+    if (!q->armed || ((IO*)ipc->param2 != q->io[0]))
+        return false;
+    q->armed = false;
+    usbd_ep_queue_pop(q);
+    if (q->zlp_policy && (num & USB_EP_IN) && ipc->param3 && ((ipc->param3 % q->mps) == 0))
+    {
+        q->zlp_active = true;
+        io_reset(q->zlp);
+        usbd_usb_ep_write(usbd, USB_EP_NUM(num), q->zlp);
+    }
+    else
+        usbd_ep_queue_arm(usbd, num, q);
+    return true;
+}
+#endif //USBD_EP_QUEUE
+
 static int usbd_get_descriptor_index(USBD* usbd, unsigned int type, unsigned int index, unsigned int lang)
 {
     int i;
@@ -691,11 +852,7 @@ static int send_descriptor(USBD* usbd, unsigned int type, unsigned int index, un
         error(ERROR_NOT_CONFIGURED);
         return -1;
     }
-    if (type == USB_CONFIGURATION_DESCRIPTOR_TYPE || type == USB_OTHER_SPEED_CONFIGURATION_DESCRIPTOR_TYPE)
-        size = ((USB_CONFIGURATION_DESCRIPTOR*)d)->wTotalLength;
-    else
-        size = d->bLength;
-
+    size = usb_descriptor_size(d);
     size = io_data_write(usbd->io, d, size);
     ((USB_GENERIC_DESCRIPTOR*)io_data(usbd->io))->bDescriptorType = send_type;
     return size;
@@ -752,6 +909,13 @@ static inline int usbd_get_descriptor(USBD* usbd)
 #if (USBD_DEBUG_REQUESTS)
         printf("USB get other speed CONFIGURATION %d descriptor\n", index);
 #endif
+        break;
+    case USB_BOS_DESCRIPTOR_TYPE:
+        res = send_descriptor(usbd, USB_BOS_DESCRIPTOR_TYPE, 0, 0, USB_BOS_DESCRIPTOR_TYPE);
+#if (USBD_DEBUG_REQUESTS)
+        printf("USB get BOS descriptor\n");
+#endif
+        break;
     }
 
 #if (USBD_DEBUG_ERRORS)
@@ -990,6 +1154,32 @@ static void usbd_setup_response(USBD* usbd, int res)
     }
 }
 
+static const uint8_t __MS_OS_20_UUID[16] =         {0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c, 0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f};
+
+//MS OS 2.0 descriptor set is requested with vendor code from BOS platform capability
+static bool usbd_ms_os_20_request(USBD* usbd)
+{
+    USB_BOS_DESCRIPTOR* bos;
+    USB_MS_OS_20_PLATFORM_DESCRIPTOR* cap;
+    unsigned int offset;
+    if ((usbd->setup.bmRequestType != (BM_REQUEST_DIRECTION_DEVICE_TO_HOST | BM_REQUEST_TYPE_VENDOR | BM_REQUEST_RECIPIENT_DEVICE)) ||
+        (usbd->setup.wIndex != USB_MS_OS_20_DESCRIPTOR_INDEX))
+        return false;
+    bos = (USB_BOS_DESCRIPTOR*)usbd_descriptor(usbd, USB_BOS_DESCRIPTOR_TYPE, 0, 0);
+    if (bos == NULL)
+        return false;
+    for (offset = bos->bLength; offset + sizeof(USB_MS_OS_20_PLATFORM_DESCRIPTOR) <= bos->wTotalLength; offset += cap->bLength)
+    {
+        cap = (USB_MS_OS_20_PLATFORM_DESCRIPTOR*)((uint8_t*)bos + offset);
+        if (cap->bLength == 0)
+            break;
+        if ((cap->bDescriptorType == USB_DEVICE_CAPABILITY_DESCRIPTOR_TYPE) && (cap->bDevCapabilityType == USB_DEVICE_CAPABILITY_PLATFORM) &&
+            (memcmp(cap->PlatformCapabilityUUID, __MS_OS_20_UUID, 16) == 0))
+            return cap->bMS_VendorCode == usbd->setup.bRequest;
+    }
+    return false;
+}
+
 #if (USBD_VSR)
 static inline bool usbd_vendor_request(USBD* usbd)
 {
@@ -1017,6 +1207,13 @@ static void usbd_setup_process(USBD* usbd)
     case BM_REQUEST_RECIPIENT_DEVICE:
         if ((usbd->setup.bmRequestType & BM_REQUEST_TYPE) == BM_REQUEST_TYPE_STANDART)
             res = usbd_standart_device_request(usbd);
+        else if (usbd_ms_os_20_request(usbd))
+        {
+            res = send_descriptor(usbd, USB_MS_OS_20_SET_TYPE, 0, 0, USB_MS_OS_20_SET_TYPE);
+#if (USBD_DEBUG_REQUESTS)
+            printf("USB get MS OS 2.0 descriptor set\n");
+#endif
+        }
 #if (USBD_VSR)
         else
         {
@@ -1154,7 +1351,12 @@ static inline void usbd_init(USBD* usbd)
 
     usbd->ifacecnt = 0;
     for (i = 0; i < USB_EP_COUNT_MAX; ++i)
+    {
         usbd->ep_iface[i] = USBD_INVALID_INTERFACE;
+#if (USBD_EP_QUEUE)
+        usbd->ep_queue[i][0] = usbd->ep_queue[i][1] = NULL;
+#endif //USBD_EP_QUEUE
+    }
 }
 
 static inline void usbd_register_user(USBD* usbd, HANDLE process)
@@ -1325,6 +1527,10 @@ static inline void usbd_class_endpoint_request(USBD *usbd, IPC* ipc, unsigned in
         error(ERROR_SYNC);
         return;
     }
+#if (USBD_EP_QUEUE)
+    if (!usbd_ep_queue_complete(usbd, ipc))
+        return;
+#endif //USBD_EP_QUEUE
     IFACE(usbd, usbd->ep_iface[num])->usbd_class->usbd_class_request(usbd, IFACE(usbd, usbd->ep_iface[num])->param, ipc);
 }
 
@@ -39,6 +39,16 @@ void usbd_usb_ep_set_stall(USBD* usbd, unsigned int num);
 void usbd_usb_ep_clear_stall(USBD* usbd, unsigned int num);
 void usbd_usb_ep_write(USBD* usbd, unsigned int ep_num, IO* io);
 void usbd_usb_ep_read(USBD* usbd, unsigned int ep_num, IO* io, unsigned int size);
+#if (USBD_EP_QUEUE)
+//Endpoint transfer queue. Next IO is armed by usbd on completion, before class is notified. Completion is
+//delivered to class with IO in param2. zlp - terminate IN transfer of EP size multiple with ZLP
+bool usbd_ep_queue_open(USBD* usbd, unsigned int num, USB_EP_TYPE type, unsigned int size, bool zlp);
+void usbd_ep_queue_close(USBD* usbd, unsigned int num);
+bool usbd_ep_queue_write(USBD* usbd, unsigned int ep_num, IO* io);
+bool usbd_ep_queue_read(USBD* usbd, unsigned int ep_num, IO* io, unsigned int size);
+//remove queued IO. Endpoint is flushed on first call. NULL if queue is empty
+IO* usbd_ep_queue_cancel(USBD* usbd, unsigned int num);
+#endif //USBD_EP_QUEUE
 int usbd_get_cfg(USBD* usbd, uint8_t iface);
 void* usbd_get_cfg_data(USBD* usbd, int i);
 int usbd_get_cfg_data_size(USBD* usbd, int i);
@@ -73,6 +73,41 @@ void canopen_sdo_init_req(HANDLE co, CO_SDO_REQ* req)
     ipc_post(&ipc);
 }
 
+int canopen_sdo_download(HANDLE co, uint8_t id, uint32_t idx, IO* io, bool block)
+{
+    return io_write_sync(co, HAL_IO_REQ(HAL_CANOPEN, block ? IPC_CO_SDO_BLOCK_DOWNLOAD : IPC_CO_SDO_DOWNLOAD), (id << 24) | idx, io);
+}
+
+int canopen_sdo_upload(HANDLE co, uint8_t id, uint32_t idx, IO* io, unsigned int size, bool block)
+{
+    return io_read_sync(co, HAL_IO_REQ(HAL_CANOPEN, block ? IPC_CO_SDO_BLOCK_UPLOAD : IPC_CO_SDO_UPLOAD), (id << 24) | idx, io, size);
+}
+
+int canopen_domain_read(HANDLE co, uint32_t idx, IO* io)
+{
+    return io_read_sync(co, HAL_IO_REQ(HAL_CANOPEN, IPC_CO_DOMAIN_READ), idx, io, io_get_free(io));
+}
+
+int canopen_domain_write(HANDLE co, uint32_t idx, IO* io)
+{
+    return io_write_sync(co, HAL_IO_REQ(HAL_CANOPEN, IPC_CO_DOMAIN_WRITE), idx, io);
+}
+
+void canopen_time_get(HANDLE co, TIME* time)
+{
+    IPC ipc;
+    ipc.process = co;
+    ipc.cmd = HAL_REQ(HAL_CANOPEN, IPC_CO_GET_TIME);
+    call(&ipc);
+    time->day = ipc.param1;
+    time->ms = ipc.param2;
+}
+
+void canopen_time_set(HANDLE co, TIME* time)
+{
+    ack(co, HAL_REQ(HAL_CANOPEN, IPC_CO_SET_TIME), (unsigned int)time->day, time->ms, 0);
+}
+
 //------------------- Object Dictionary --------------------
 bool co_od_write(CO_OD_ENTRY* od, uint16_t index, uint8_t subindex, uint32_t value)
 {
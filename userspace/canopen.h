@@ -11,6 +11,7 @@
 #include "object.h"
 #include "ipc.h"
 #include "io.h"
+#include "time.h"
 
 #define LSS_CHECK_ALL_BITS            31
 #define CO_OD_MAX_ENTRY               100
@@ -61,7 +62,16 @@ typedef enum {
     IPC_CO_LSS_FOUND,
     IPC_CO_LSS_SET_ID,
     IPC_CO_SDO_REQUEST,
-    IPC_CO_SDO_RESULT
+    IPC_CO_SDO_RESULT,
+    IPC_CO_SDO_DOWNLOAD,
+    IPC_CO_SDO_UPLOAD,
+    IPC_CO_SDO_BLOCK_DOWNLOAD,
+    IPC_CO_SDO_BLOCK_UPLOAD,
+    IPC_CO_DOMAIN_READ,
+    IPC_CO_DOMAIN_WRITE,
+    IPC_CO_TIME,
+    IPC_CO_GET_TIME,
+    IPC_CO_SET_TIME
 
 } CANOPEN_IPCS;
 
@@ -102,6 +112,8 @@ typedef struct {
 #define OD_RO                               (0UL << 31)
 #define OD_RW                               (1UL << 31)
 #define CO_OD_IS_RW(od)                     (od->len & OD_RW)
+//domain object. Transferred only by segmented or block SDO, data is max size
+#define OD_DOMAIN                           (1UL << 30)
 
 #define CO_OD_SUBINDEX_Pos                  16
 #define CO_OD_IDX(index, subindex)          ( (index) | ((subindex) << CO_OD_SUBINDEX_Pos) )
@@ -109,6 +121,7 @@ typedef struct {
 #define CO_OD_SUBINDEX(idx)                 ( (idx) >> CO_OD_SUBINDEX_Pos)
 #define CO_OD_ADD_FLOAT(index, subindex, rw_mode, len, d)   { {{(index), (subindex)}}, (len) | (rw_mode), {.f = (d)}}
 #define CO_OD_ADD(index, subindex, rw_mode, len, d)   { {{(index), (subindex)}}, (len) | (rw_mode), {.data= (d)}}
+#define CO_OD_ADD_DOMAIN(index, subindex, rw_mode, size)  CO_OD_ADD((index), (subindex), (rw_mode) | OD_DOMAIN, 0, (size))
 #define CO_OD_END                                        { {{0, 0}}, 0, {.data = 0}}
 #define CO_OD_FIRST_USER_INDEX               0x2000
 #define CO_OD_MAX_INDEX                      0xC000
@@ -116,6 +129,14 @@ typedef struct {
 #define CO_OD_ENTRY_HEARTBEAT_TIME          CO_OD_IDX(0x1017, 0)
 #define CO_OD_INDEX_SAVE_OD                 0x1010
 #define CO_OD_INDEX_RESTORE_OD              0x1011
+#define CO_OD_INDEX_ERROR_HISTORY           0x1003
+#define CO_OD_INDEX_SYNC_COB_ID             0x1005
+#define CO_OD_INDEX_SYNC_PERIOD             0x1006
+#define CO_OD_INDEX_SYNC_WINDOW             0x1007
+#define CO_OD_INDEX_TIME_COB_ID             0x1012
+#define CO_OD_INDEX_EMCY_COB_ID             0x1014
+#define CO_OD_INDEX_EMCY_INHIBIT            0x1015
+#define CO_OD_INDEX_SYNC_OVERFLOW           0x1019
 
 
 typedef struct {
@@ -155,17 +176,28 @@ typedef struct {
     uint32_t data;
 } CO_SDO_REQ;
 //--------------------------------
+//EMCY error code in low 16 bits, additional info in high. 0 - error reset
 void canopen_fault(HANDLE co, uint32_t err_code);
 HANDLE canopen_create(uint32_t process_size, uint32_t priority);
 void canopen_open(HANDLE co, IO* od, uint32_t baudrate, uint8_t id);
 void canopen_close(HANDLE co);
 void canopen_send_pdo(HANDLE co, uint8_t pdo_num, uint8_t pdo_len, uint32_t hi, uint32_t lo);
 void canopen_od_change(HANDLE co, uint32_t idx, uint32_t data);
+//return size or error
+int canopen_domain_read(HANDLE co, uint32_t idx, IO* io);
+int canopen_domain_write(HANDLE co, uint32_t idx, IO* io);
+//network time, running by systime between TIME messages
+void canopen_time_get(HANDLE co, TIME* time);
+//producer also sends TIME
+void canopen_time_set(HANDLE co, TIME* time);
 
 //--- only master -----
 void canopen_lss_find(HANDLE co, LSS_FIND* lss);
 void canopen_lss_set_id(HANDLE co, uint32_t id);
 void canopen_sdo_init_req(HANDLE co, CO_SDO_REQ* req);
+//segmented or block transfer. Return transferred size or error
+int canopen_sdo_download(HANDLE co, uint8_t id, uint32_t idx, IO* io, bool block);
+int canopen_sdo_upload(HANDLE co, uint8_t id, uint32_t idx, IO* io, unsigned int size, bool block);
 
 //--- object dictionary  ------
 uint32_t co_od_get_u32(CO_OD_ENTRY* od, uint16_t index, uint8_t subindex);
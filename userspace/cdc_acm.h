@@ -255,6 +255,7 @@ typedef struct {
 #define CDC_SERIAL_STATE                                                                0x20
 #define CDC_CALL_STATE_CHANGE                                                           0x28
 #define CDC_LINE_STATE_CHANGE                                                           0x23
+#define CDC_CONNECTION_SPEED_CHANGE                                                     0x2a
 
 //serial state notify
 #define CDC_SERIAL_STATE_DCD                                                            (1 << 0)
@@ -16,6 +16,11 @@
 #define MBR_PARTITION_OFFSET                                0x1be
 #define MBR_PARTITIONS_COUNT                                4
 
+#define FAT32_FS_INFO_LEAD_SIGNATURE                        0x41615252
+#define FAT32_FS_INFO_STRUCT_SIGNATURE                      0x61417272
+#define FAT32_FS_INFO_TRAIL_SIGNATURE                       0xaa550000
+#define FAT32_FS_INFO_UNKNOWN                               0xffffffff
+
 #pragma pack(push, 1)
 typedef struct {
     uint8_t active;
@@ -58,6 +63,47 @@ typedef struct {
     char label[11];
     char fs_type[8];
 } FAT_BOOT_SECTOR_BPB_TYPE;
+
+typedef struct {
+    //DOS 2.0 BPB
+    uint16_t sector_size;
+    uint8_t cluster_sectors;
+    uint16_t reserved_sectors;
+    uint8_t fat_count;
+    uint16_t root_count;
+    uint16_t sectors_short;
+    uint8_t media_type;
+    uint16_t fat_sectors;
+    //DOS 3.31 BPB
+    uint16_t sectors_per_track;
+    uint16_t heads;
+    uint32_t hidden;
+    uint32_t sectors;
+    //FAT32 EBPB
+    uint32_t fat_sectors32;
+    uint16_t ext_flags;
+    uint16_t version;
+    uint32_t root_cluster;
+    uint16_t fs_info_sector;
+    uint16_t backup_boot_sector;
+    uint8_t reserved32[12];
+    uint8_t drive_num;
+    uint8_t reserved;
+    uint8_t ext_signature;
+    uint32_t serial;
+    char label[11];
+    char fs_type[8];
+} FAT32_BOOT_SECTOR_BPB_TYPE;
+
+typedef struct {
+    uint32_t lead_signature;
+    uint8_t reserved1[480];
+    uint32_t struct_signature;
+    uint32_t free_count;
+    uint32_t next_free;
+    uint8_t reserved2[12];
+    uint32_t trail_signature;
+} FAT32_FS_INFO_TYPE;
 #pragma pack(pop)
 
 #endif // DISK_H
@@ -22,6 +22,7 @@
 #define MSC_PROTOCOL_CBI_INTERRUPT                                                      0x00
 #define MSC_PROTOCOL_CBI_NO_INTERRUPT                                                   0x01
 #define MSC_PROTOCOL_BULK_ONLY                                                          0x50
+#define MSC_PROTOCOL_UAS                                                                0x62
 
 #define MSC_LUN_COUNT(ptr)                                                              (*(uint32_t*)(ptr))
 #define MSC_LUN_CONFIGURATION(ptr, idx)                                                 ((SCSI_STORAGE_DESCRIPTOR*)((uint8_t*)(ptr) + \
@@ -50,4 +50,9 @@ typedef struct {
 
 #define SCSI_STORAGE_DESCRIPTOR_REMOVABLE                               (1 << 0)
 
+#define SCSI_STATUS_GOOD                                                0x00
+#define SCSI_STATUS_CHECK_CONDITION                                     0x02
+#define SCSI_STATUS_BUSY                                                0x08
+#define SCSI_STATUS_TASK_SET_FULL                                       0x28
+
 #endif // SCSI_H
@@ -17,11 +17,15 @@
 #define TLS_MASTER_SIZE                                                 48
 #define TLS_SESSION_ID_SIZE                                             32
 #define TLS_IV_SEED_SIZE                                                32
+//RSA signature has same modulus size as encrypted premaster
+#define TLS_RAW_SIGNATURE_SIZE                                          TLS_RAW_PREMASTER_SIZE
 
 typedef enum {
     TLS_REGISTER_CERTIFICATE = IPC_USER,
     TLS_GENERATE_RANDOM,
-    TLS_PREMASTER_DECRYPT
+    TLS_PREMASTER_DECRYPT,
+    //raw RSA private key operation over EMSA-PKCS1-v1_5 encoded block, same as TLS_PREMASTER_DECRYPT
+    TLS_SIGN
 } TLS_IPCS;
 
 HANDLE tls_create();
@@ -68,6 +68,22 @@ void* usb_interface_get_next_descriptor(const USB_CONFIGURATION_DESCRIPTOR* cfg,
     return NULL;
 }
 
+unsigned int usb_descriptor_size(const void* d)
+{
+    switch (((const USB_GENERIC_DESCRIPTOR*)d)->bDescriptorType)
+    {
+    case USB_CONFIGURATION_DESCRIPTOR_TYPE:
+    case USB_OTHER_SPEED_CONFIGURATION_DESCRIPTOR_TYPE:
+        return ((const USB_CONFIGURATION_DESCRIPTOR*)d)->wTotalLength;
+    case USB_BOS_DESCRIPTOR_TYPE:
+        return ((const USB_BOS_DESCRIPTOR*)d)->wTotalLength;
+    case USB_MS_OS_20_SET_TYPE:
+        return ((const USB_MS_OS_20_SET_HEADER*)d)->wTotalLength;
+    default:
+        return ((const USB_GENERIC_DESCRIPTOR*)d)->bLength;
+    }
+}
+
 static bool usbd_register_descriptor_internal(HANDLE usbd, IO* io, unsigned int index, unsigned int lang)
 {
     USBD_DESCRIPTOR_REGISTER_STRUCT* udrs = io_push(io, sizeof(USBD_DESCRIPTOR_REGISTER_STRUCT));
@@ -82,12 +98,7 @@ static bool usbd_register_descriptor_internal(HANDLE usbd, IO* io, unsigned int
 
 bool usbd_register_descriptor(HANDLE usbd, const void* d, unsigned int index, unsigned int lang)
 {
-    unsigned int size;
-    const USB_GENERIC_DESCRIPTOR* descriptor = (USB_GENERIC_DESCRIPTOR*)d;
-    if (descriptor->bDescriptorType == USB_CONFIGURATION_DESCRIPTOR_TYPE || descriptor->bDescriptorType == USB_OTHER_SPEED_CONFIGURATION_DESCRIPTOR_TYPE)
-        size = ((const USB_CONFIGURATION_DESCRIPTOR*)d)->wTotalLength;
-    else
-        size = descriptor->bLength;
+    unsigned int size = usb_descriptor_size(d);
 
     IO* io = io_create(size + sizeof(USBD_DESCRIPTOR_REGISTER_STRUCT) + sizeof(void*));
     if (io == NULL)
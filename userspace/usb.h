@@ -113,6 +113,24 @@ typedef enum {
 } USB_DESCRIPTOR_TYPE;
 
 #define USB_FUNCTIONAL_DESCRIPTOR                               0x21
+//USB 2.1. bcdUSB in device descriptor must be at least 0x0210
+#define USB_BOS_DESCRIPTOR_TYPE                                 0x0f
+#define USB_DEVICE_CAPABILITY_DESCRIPTOR_TYPE                   0x10
+#define USB_DEVICE_CAPABILITY_PLATFORM                          0x05
+
+//Microsoft OS 2.0. Descriptor set is registered as descriptor of USB_MS_OS_20_SET_TYPE
+#define USB_MS_OS_20_SET_TYPE                                   0x00
+#define USB_MS_OS_20_DESCRIPTOR_INDEX                           0x07
+#define USB_MS_OS_20_WINDOWS_8_1                                0x06030000
+
+#define USB_MS_OS_20_SET_HEADER_DESCRIPTOR                      0x00
+#define USB_MS_OS_20_SUBSET_HEADER_CONFIGURATION                0x01
+#define USB_MS_OS_20_SUBSET_HEADER_FUNCTION                     0x02
+#define USB_MS_OS_20_FEATURE_COMPATIBLE_ID                      0x03
+#define USB_MS_OS_20_FEATURE_REG_PROPERTY                       0x04
+
+#define USB_MS_OS_20_REG_SZ                                     0x01
+#define USB_MS_OS_20_REG_MULTI_SZ                               0x07
 
 //used for composite USB with IAD
 #define USB_MISCELLANEOUS_DEVICE_CLASS                          0xef
@@ -231,11 +249,44 @@ typedef struct {
     uint8_t iFunction;                                          /*Index of string descriptor describing this function*/
 } USB_INTERFACE_ASSOCIATION_DESCRIPTOR;
 
+typedef struct {
+    uint8_t  bLength;                                           //Size of this descriptor in bytes
+    uint8_t  bDescriptorType;                                   //BOS Descriptor Type
+    uint16_t wTotalLength;                                      //Length of this descriptor and all of its sub descriptors
+    uint8_t  bNumDeviceCaps;                                    //The number of separate device capability descriptors in the BOS
+} USB_BOS_DESCRIPTOR;
+
+typedef struct {
+    uint8_t  bLength;                                           //Size of this descriptor in bytes
+    uint8_t  bDescriptorType;                                   //DEVICE CAPABILITY Descriptor type
+    uint8_t  bDevCapabilityType;                                //PLATFORM
+    uint8_t  bReserved;
+    uint8_t  PlatformCapabilityUUID[16];                        //MS OS 2.0: D8DD60DF-4589-4CC7-9CD2-659D9E648A9F
+    uint32_t dwWindowsVersion;                                  //Minimum Windows version
+    uint16_t wMSOSDescriptorSetTotalLength;                     //Size of MS OS 2.0 descriptor set
+    uint8_t  bMS_VendorCode;                                    //Vendor request code to retrieve descriptor set
+    uint8_t  bAltEnumCode;                                      //0 - alternate enumeration is not supported
+} USB_MS_OS_20_PLATFORM_DESCRIPTOR;
+
+typedef struct {
+    uint16_t wLength;
+    uint16_t wDescriptorType;
+} USB_MS_OS_20_HEADER;
+
+typedef struct {
+    uint16_t wLength;
+    uint16_t wDescriptorType;                                   //USB_MS_OS_20_SET_HEADER_DESCRIPTOR
+    uint32_t dwWindowsVersion;
+    uint16_t wTotalLength;                                      //Size of entire descriptor set
+} USB_MS_OS_20_SET_HEADER;
+
 USB_INTERFACE_DESCRIPTOR* usb_get_first_interface(const USB_CONFIGURATION_DESCRIPTOR* cfg);
 USB_INTERFACE_DESCRIPTOR* usb_get_next_interface(const USB_CONFIGURATION_DESCRIPTOR* cfg, const USB_INTERFACE_DESCRIPTOR* start);
 USB_INTERFACE_DESCRIPTOR* usb_find_interface(const USB_CONFIGURATION_DESCRIPTOR* cfg, uint8_t num);
 void* usb_interface_get_first_descriptor(const USB_CONFIGURATION_DESCRIPTOR* cfg, const USB_INTERFACE_DESCRIPTOR* start, unsigned int type);
 void* usb_interface_get_next_descriptor(const USB_CONFIGURATION_DESCRIPTOR* cfg, const void *start, unsigned int type);
+//full size, including sub descriptors
+unsigned int usb_descriptor_size(const void* d);
 
 //--------------------------------------------------- USB device ---------------------------------------------------------------
 
@@ -0,0 +1,396 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#include "usbd_desc.h"
+#include "cdc_acm.h"
+#include "msc.h"
+#include <string.h>
+
+#define USBD_DESC_CDC_NOTIFY_SIZE                           16
+#define USBD_DESC_CDC_NOTIFY_INTERVAL                       5
+#define USBD_DESC_ETHERNET_SEGMENT_SIZE                     1514
+
+static const uint8_t __MS_OS_20_UUID[16] =                  {0xdf, 0x60, 0xdd, 0xd8, 0x89, 0x45, 0xc7, 0x4c,
+                                                             0x9c, 0xd2, 0x65, 0x9d, 0x9e, 0x64, 0x8a, 0x9f};
+
+static const char __MS_OS_20_GUIDS_PROPERTY[] =            "DeviceInterfaceGUIDs";
+
+#define USBD_DESC_PTR(desc, offset)                         ((void*)(((uint8_t*)io_data((desc)->io)) + (offset)))
+
+static void* usbd_desc_alloc(USBD_DESC* desc, unsigned int size)
+{
+    void* d;
+    if (desc->overflow || (io_get_free(desc->io) < size))
+    {
+        desc->overflow = true;
+        return NULL;
+    }
+    d = USBD_DESC_PTR(desc, desc->io->data_size);
+    memset(d, 0x00, size);
+    desc->io->data_size += size;
+    return d;
+}
+
+bool usbd_desc_open(USBD_DESC* desc, unsigned int size, uint8_t attributes, uint8_t max_power, unsigned int ep_count, unsigned int fifo_size)
+{
+    USB_CONFIGURATION_DESCRIPTOR* cfg;
+    memset(desc, 0x00, sizeof(USBD_DESC));
+    if (ep_count > 16)
+        ep_count = 16;
+    desc->ep_count = ep_count;
+    desc->fifo_free = fifo_size;
+    desc->io = io_create(size);
+    if (desc->io == NULL)
+        return false;
+    cfg = usbd_desc_alloc(desc, sizeof(USB_CONFIGURATION_DESCRIPTOR));
+    if (cfg == NULL)
+        return false;
+    cfg->bLength = sizeof(USB_CONFIGURATION_DESCRIPTOR);
+    cfg->bDescriptorType = USB_CONFIGURATION_DESCRIPTOR_TYPE;
+    cfg->bConfigurationValue = 1;
+    cfg->bmAttributes = attributes;
+    cfg->bMaxPower = max_power;
+    return true;
+}
+
+void usbd_desc_close(USBD_DESC* desc)
+{
+    io_destroy(desc->io);
+    desc->io = NULL;
+}
+
+bool usbd_desc_append(USBD_DESC* desc, const void* d, unsigned int size)
+{
+    void* ptr = usbd_desc_alloc(desc, size);
+    if (ptr == NULL)
+        return false;
+    memcpy(ptr, d, size);
+    return true;
+}
+
+bool usbd_desc_iad(USBD_DESC* desc, uint8_t count, uint8_t function_class, uint8_t subclass, uint8_t protocol, uint8_t function_str)
+{
+    USB_INTERFACE_ASSOCIATION_DESCRIPTOR* iad = usbd_desc_alloc(desc, sizeof(USB_INTERFACE_ASSOCIATION_DESCRIPTOR));
+    if (iad == NULL)
+        return false;
+    iad->bLength = sizeof(USB_INTERFACE_ASSOCIATION_DESCRIPTOR);
+    iad->bDescriptorType = USB_INTERFACE_ASSOCIATION_DESCRIPTOR_TYPE;
+    iad->bFirstInterface = desc->ifaces;
+    iad->bInterfaceCount = count;
+    iad->bFunctionClass = function_class;
+    iad->bFunctionSubClass = subclass;
+    iad->bFunctionProtocol = protocol;
+    iad->iFunction = function_str;
+    return true;
+}
+
+int usbd_desc_interface(USBD_DESC* desc, uint8_t alt, uint8_t iface_class, uint8_t subclass, uint8_t protocol, uint8_t iface_str)
+{
+    USB_INTERFACE_DESCRIPTOR* iface;
+    uint8_t num;
+    //alternate setting without main interface
+    if (alt && (desc->iface_offset == 0))
+        return -1;
+    num = alt ? desc->ifaces - 1 : desc->ifaces;
+    iface = usbd_desc_alloc(desc, sizeof(USB_INTERFACE_DESCRIPTOR));
+    if (iface == NULL)
+        return -1;
+    iface->bLength = sizeof(USB_INTERFACE_DESCRIPTOR);
+    iface->bDescriptorType = USB_INTERFACE_DESCRIPTOR_TYPE;
+    iface->bInterfaceNumber = num;
+    iface->bAlternateSetting = alt;
+    iface->bInterfaceClass = iface_class;
+    iface->bInterfaceSubClass = subclass;
+    iface->bInterfaceProtocol = protocol;
+    iface->iInterface = iface_str;
+    desc->iface_offset = desc->io->data_size - sizeof(USB_INTERFACE_DESCRIPTOR);
+    if (!alt)
+    {
+        ++desc->ifaces;
+        desc->ep_iface = 0;
+    }
+    return num;
+}
+
+int usbd_desc_endpoint(USBD_DESC* desc, bool in, USB_EP_TYPE type, unsigned int size, uint8_t interval)
+{
+    USB_ENDPOINT_DESCRIPTOR* ep;
+    uint16_t* used;
+    unsigned int num;
+    if (desc->iface_offset == 0)
+        return -1;
+    used = in ? &desc->ep_in : &desc->ep_out;
+    //pair with other direction of same interface. usbd maps endpoints to interface by number
+    for (num = 1; (num < desc->ep_count) && (((desc->ep_iface & (1 << num)) == 0) || ((*used) & (1 << num))); ++num) {}
+    //number free in both directions
+    if (num >= desc->ep_count)
+        for (num = 1; (num < desc->ep_count) && ((desc->ep_in | desc->ep_out) & (1 << num)); ++num) {}
+    if (num >= desc->ep_count)
+        return -1;
+    if (desc->fifo_free)
+    {
+        if (size > desc->fifo_free)
+            return -1;
+        desc->fifo_free -= size;
+    }
+    ep = usbd_desc_alloc(desc, sizeof(USB_ENDPOINT_DESCRIPTOR));
+    if (ep == NULL)
+        return -1;
+    (*used) |= 1 << num;
+    desc->ep_iface |= 1 << num;
+    ep->bLength = sizeof(USB_ENDPOINT_DESCRIPTOR);
+    ep->bDescriptorType = USB_ENDPOINT_DESCRIPTOR_TYPE;
+    ep->bEndpointAddress = in ? (USB_EP_IN | num) : num;
+    ep->bmAttributes = (uint8_t)type;
+    ep->wMaxPacketSize = size;
+    ep->bInterval = interval;
+    ++((USB_INTERFACE_DESCRIPTOR*)USBD_DESC_PTR(desc, desc->iface_offset))->bNumEndpoints;
+    return ep->bEndpointAddress;
+}
+
+USB_CONFIGURATION_DESCRIPTOR* usbd_desc_get(USBD_DESC* desc)
+{
+    USB_CONFIGURATION_DESCRIPTOR* cfg;
+    if (desc->io == NULL || desc->overflow)
+        return NULL;
+    cfg = io_data(desc->io);
+    cfg->wTotalLength = desc->io->data_size;
+    cfg->bNumInterfaces = desc->ifaces;
+    return cfg;
+}
+
+bool usbd_desc_cdc_acm(USBD_DESC* desc, unsigned int ep_size, uint8_t function_str)
+{
+    CDC_HEADER_DESCRIPTOR* header;
+    CDC_ACM_DESCRIPTOR* acm;
+    CDC_UNION_DESCRIPTOR* cdc_union;
+    CDC_CALL_MANAGEMENT_DESCRIPTOR* call;
+    int comm;
+    if (!usbd_desc_iad(desc, 2, CDC_COMM_INTERFACE_CLASS, CDC_ACM, CDC_CP_V250, function_str))
+        return false;
+    if ((comm = usbd_desc_interface(desc, 0, CDC_COMM_INTERFACE_CLASS, CDC_ACM, CDC_CP_V250, 0)) < 0)
+        return false;
+
+    if ((header = usbd_desc_alloc(desc, sizeof(CDC_HEADER_DESCRIPTOR))) == NULL)
+        return false;
+    header->bFunctionLength = sizeof(CDC_HEADER_DESCRIPTOR);
+    header->bDescriptorType = CS_INTERFACE;
+    header->bDescriptorSybType = CDC_DESCRIPTOR_HEADER;
+    header->bcdCDC = 0x0120;
+
+    if ((acm = usbd_desc_alloc(desc, sizeof(CDC_ACM_DESCRIPTOR))) == NULL)
+        return false;
+    acm->bFunctionLength = sizeof(CDC_ACM_DESCRIPTOR);
+    acm->bDescriptorType = CS_INTERFACE;
+    acm->bDescriptorSybType = CDC_DESCRIPTOR_ACM;
+    acm->bmCapabilities = 0x2;
+
+    if ((cdc_union = usbd_desc_alloc(desc, sizeof(CDC_UNION_DESCRIPTOR) + 1)) == NULL)
+        return false;
+    cdc_union->bFunctionLength = sizeof(CDC_UNION_DESCRIPTOR) + 1;
+    cdc_union->bDescriptorType = CS_INTERFACE;
+    cdc_union->bDescriptorSybType = CDC_DESCRIPTOR_UNION;
+    cdc_union->bControlInterface = comm;
+    ((uint8_t*)cdc_union)[sizeof(CDC_UNION_DESCRIPTOR)] = comm + 1;
+
+    if ((call = usbd_desc_alloc(desc, sizeof(CDC_CALL_MANAGEMENT_DESCRIPTOR))) == NULL)
+        return false;
+    call->bFunctionLength = sizeof(CDC_CALL_MANAGEMENT_DESCRIPTOR);
+    call->bDescriptorType = CS_INTERFACE;
+    call->bDescriptorSybType = CDC_DESCRIPTOR_CALL_MANAGEMENT;
+    call->bmCapabilities = 3;
+    call->bDataInterface = comm + 1;
+
+    if (usbd_desc_endpoint(desc, true, USB_EP_INTERRUPT, USBD_DESC_CDC_NOTIFY_SIZE, USBD_DESC_CDC_NOTIFY_INTERVAL) < 0)
+        return false;
+    if (usbd_desc_interface(desc, 0, CDC_DATA_INTERFACE_CLASS, 0x00, CDC_DP_GENERIC, 0) < 0)
+        return false;
+    if (usbd_desc_endpoint(desc, true, USB_EP_BULK, ep_size, 0) < 0)
+        return false;
+    return usbd_desc_endpoint(desc, false, USB_EP_BULK, ep_size, 0) >= 0;
+}
+
+bool usbd_desc_cdc_ncm(USBD_DESC* desc, unsigned int ep_size, uint8_t mac_str, uint8_t function_str)
+{
+    CDC_HEADER_DESCRIPTOR* header;
+    CDC_UNION_DESCRIPTOR* cdc_union;
+    uint8_t* d;
+    int comm;
+    if (!usbd_desc_iad(desc, 2, CDC_COMM_INTERFACE_CLASS, CDC_NETWORK_CONTROL, CDC_CP_GENERIC, function_str))
+        return false;
+    if ((comm = usbd_desc_interface(desc, 0, CDC_COMM_INTERFACE_CLASS, CDC_NETWORK_CONTROL, CDC_CP_GENERIC, 0)) < 0)
+        return false;
+
+    if ((header = usbd_desc_alloc(desc, sizeof(CDC_HEADER_DESCRIPTOR))) == NULL)
+        return false;
+    header->bFunctionLength = sizeof(CDC_HEADER_DESCRIPTOR);
+    header->bDescriptorType = CS_INTERFACE;
+    header->bDescriptorSybType = CDC_DESCRIPTOR_HEADER;
+    header->bcdCDC = 0x0120;
+
+    if ((cdc_union = usbd_desc_alloc(desc, sizeof(CDC_UNION_DESCRIPTOR) + 1)) == NULL)
+        return false;
+    cdc_union->bFunctionLength = sizeof(CDC_UNION_DESCRIPTOR) + 1;
+    cdc_union->bDescriptorType = CS_INTERFACE;
+    cdc_union->bDescriptorSybType = CDC_DESCRIPTOR_UNION;
+    cdc_union->bControlInterface = comm;
+    ((uint8_t*)cdc_union)[sizeof(CDC_UNION_DESCRIPTOR)] = comm + 1;
+
+    //ethernet networking functional descriptor. No statistics, no multicast and power filters
+    if ((d = usbd_desc_alloc(desc, 13)) == NULL)
+        return false;
+    d[0] = 13;
+    d[1] = CS_INTERFACE;
+    d[2] = CDC_DESCRIPTOR_ETHERNET;
+    d[3] = mac_str;
+    d[8] = USBD_DESC_ETHERNET_SEGMENT_SIZE & 0xff;
+    d[9] = USBD_DESC_ETHERNET_SEGMENT_SIZE >> 8;
+
+    //NCM functional descriptor, version 1.0
+    if ((d = usbd_desc_alloc(desc, 6)) == NULL)
+        return false;
+    d[0] = 6;
+    d[1] = CS_INTERFACE;
+    d[2] = CDC_DESCRIPTOR_NCM;
+    d[3] = 0x00;
+    d[4] = 0x01;
+
+    if (usbd_desc_endpoint(desc, true, USB_EP_INTERRUPT, USBD_DESC_CDC_NOTIFY_SIZE, USBD_DESC_CDC_NOTIFY_INTERVAL) < 0)
+        return false;
+    //data interface: alt 0 - no traffic, alt 1 - active
+    if (usbd_desc_interface(desc, 0, CDC_DATA_INTERFACE_CLASS, 0x00, CDC_DP_NETWORK_TRANSFER_BLOCK, 0) < 0)
+        return false;
+    if (usbd_desc_interface(desc, 1, CDC_DATA_INTERFACE_CLASS, 0x00, CDC_DP_NETWORK_TRANSFER_BLOCK, 0) < 0)
+        return false;
+    if (usbd_desc_endpoint(desc, true, USB_EP_BULK, ep_size, 0) < 0)
+        return false;
+    return usbd_desc_endpoint(desc, false, USB_EP_BULK, ep_size, 0) >= 0;
+}
+
+bool usbd_desc_msc(USBD_DESC* desc, unsigned int ep_size, uint8_t iface_str)
+{
+    if (usbd_desc_interface(desc, 0, MSC_INTERFACE_CLASS, MSC_SUBCLASS_SCSI, MSC_PROTOCOL_BULK_ONLY, iface_str) < 0)
+        return false;
+    if (usbd_desc_endpoint(desc, true, USB_EP_BULK, ep_size, 0) < 0)
+        return false;
+    return usbd_desc_endpoint(desc, false, USB_EP_BULK, ep_size, 0) >= 0;
+}
+
+static bool usbd_desc_append_utf16(USBD_DESC* desc, const char* str, unsigned int len)
+{
+    unsigned int i;
+    uint8_t* d = usbd_desc_alloc(desc, len * 2);
+    if (d == NULL)
+        return false;
+    //terminating zeroes are already set
+    for (i = 0; str[i] && (i < len); ++i)
+        d[i * 2] = (uint8_t)str[i];
+    return true;
+}
+
+static void usbd_desc_ms_os_20_subset_update(USBD_DESC* desc)
+{
+    if (desc->iad_offset)
+        ((uint16_t*)USBD_DESC_PTR(desc, desc->iad_offset))[3] = desc->io->data_size - desc->iad_offset;
+    if (desc->iface_offset)
+        ((uint16_t*)USBD_DESC_PTR(desc, desc->iface_offset))[3] = desc->io->data_size - desc->iface_offset;
+}
+
+bool usbd_desc_ms_os_20_open(USBD_DESC* desc, unsigned int size)
+{
+    USB_MS_OS_20_SET_HEADER* set;
+    memset(desc, 0x00, sizeof(USBD_DESC));
+    desc->io = io_create(size);
+    if (desc->io == NULL)
+        return false;
+    if ((set = usbd_desc_alloc(desc, sizeof(USB_MS_OS_20_SET_HEADER))) == NULL)
+        return false;
+    set->wLength = sizeof(USB_MS_OS_20_SET_HEADER);
+    set->wDescriptorType = USB_MS_OS_20_SET_HEADER_DESCRIPTOR;
+    set->dwWindowsVersion = USB_MS_OS_20_WINDOWS_8_1;
+    return true;
+}
+
+bool usbd_desc_ms_os_20_function(USBD_DESC* desc, uint8_t first_iface, const char* compatible_id, const char* guid)
+{
+    uint8_t* d;
+    unsigned int len, offset;
+    if (first_iface != USBD_DESC_MS_OS_20_DEVICE)
+    {
+        //configuration subset is required before any function subset
+        if (desc->iface_offset == 0)
+        {
+            if ((d = usbd_desc_alloc(desc, 8)) == NULL)
+                return false;
+            d[0] = 8;
+            d[2] = USB_MS_OS_20_SUBSET_HEADER_CONFIGURATION;
+            desc->iface_offset = desc->io->data_size - 8;
+        }
+        if ((d = usbd_desc_alloc(desc, 8)) == NULL)
+            return false;
+        d[0] = 8;
+        d[2] = USB_MS_OS_20_SUBSET_HEADER_FUNCTION;
+        d[4] = first_iface;
+        desc->iad_offset = desc->io->data_size - 8;
+    }
+
+    //compatible ID feature descriptor, sub-compatible ID is empty
+    if ((d = usbd_desc_alloc(desc, 20)) == NULL)
+        return false;
+    d[0] = 20;
+    d[2] = USB_MS_OS_20_FEATURE_COMPATIBLE_ID;
+    len = strlen(compatible_id);
+    memcpy(d + 4, compatible_id, len > 8 ? 8 : len);
+
+    if (guid != NULL)
+    {
+        //registry property: REG_MULTI_SZ, double zero terminated
+        offset = desc->io->data_size;
+        len = strlen(guid);
+        if ((d = usbd_desc_alloc(desc, 8)) == NULL)
+            return false;
+        d[2] = USB_MS_OS_20_FEATURE_REG_PROPERTY;
+        d[4] = USB_MS_OS_20_REG_MULTI_SZ;
+        d[6] = sizeof(__MS_OS_20_GUIDS_PROPERTY) * 2;
+        if (!usbd_desc_append_utf16(desc, __MS_OS_20_GUIDS_PROPERTY, sizeof(__MS_OS_20_GUIDS_PROPERTY)))
+            return false;
+        if ((d = usbd_desc_alloc(desc, 2)) == NULL)
+            return false;
+        d[0] = ((len + 2) * 2) & 0xff;
+        d[1] = ((len + 2) * 2) >> 8;
+        if (!usbd_desc_append_utf16(desc, guid, len + 2))
+            return false;
+        *((uint16_t*)USBD_DESC_PTR(desc, offset)) = desc->io->data_size - offset;
+    }
+    usbd_desc_ms_os_20_subset_update(desc);
+    return true;
+}
+
+USB_MS_OS_20_SET_HEADER* usbd_desc_ms_os_20_get(USBD_DESC* desc)
+{
+    USB_MS_OS_20_SET_HEADER* set;
+    if (desc->io == NULL || desc->overflow)
+        return NULL;
+    set = io_data(desc->io);
+    set->wTotalLength = desc->io->data_size;
+    return set;
+}
+
+void usbd_desc_bos_ms_os_20(USBD_DESC_BOS_MS_OS_20* bos, const USB_MS_OS_20_SET_HEADER* set, uint8_t vendor_code)
+{
+    memset(bos, 0x00, sizeof(USBD_DESC_BOS_MS_OS_20));
+    bos->bos.bLength = sizeof(USB_BOS_DESCRIPTOR);
+    bos->bos.bDescriptorType = USB_BOS_DESCRIPTOR_TYPE;
+    bos->bos.wTotalLength = sizeof(USBD_DESC_BOS_MS_OS_20);
+    bos->bos.bNumDeviceCaps = 1;
+    bos->platform.bLength = sizeof(USB_MS_OS_20_PLATFORM_DESCRIPTOR);
+    bos->platform.bDescriptorType = USB_DEVICE_CAPABILITY_DESCRIPTOR_TYPE;
+    bos->platform.bDevCapabilityType = USB_DEVICE_CAPABILITY_PLATFORM;
+    memcpy(bos->platform.PlatformCapabilityUUID, __MS_OS_20_UUID, 16);
+    bos->platform.dwWindowsVersion = USB_MS_OS_20_WINDOWS_8_1;
+    bos->platform.wMSOSDescriptorSetTotalLength = set->wTotalLength;
+    bos->platform.bMS_VendorCode = vendor_code;
+}
@@ -0,0 +1,70 @@
+/*
+    RExOS - embedded RTOS
+    Copyright (c) 2011-2017, Alexey Kramarenko
+    All rights reserved.
+*/
+
+#ifndef USBD_DESC_H
+#define USBD_DESC_H
+
+/*
+        USB device configuration descriptor builder. Interface numbers and endpoint addresses are assigned
+        in order of adding, within hardware endpoints count and FIFO memory.
+ */
+
+#include "usb.h"
+#include "io.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+//MS OS 2.0 descriptors for whole device, not for function of composite device
+#define USBD_DESC_MS_OS_20_DEVICE                                               0xff
+
+typedef struct {
+    IO* io;
+    unsigned int fifo_free;
+    //last interface (MS OS 2.0: configuration subset) and IAD (MS OS 2.0: function subset). 0 - none
+    uint16_t iface_offset, iad_offset;
+    //used endpoints bitmask. ep_iface - numbers owned by last interface
+    uint16_t ep_in, ep_out, ep_iface;
+    uint8_t ep_count, ifaces;
+    bool overflow;
+} USBD_DESC;
+
+#pragma pack(push, 1)
+
+typedef struct {
+    USB_BOS_DESCRIPTOR bos;
+    USB_MS_OS_20_PLATFORM_DESCRIPTOR platform;
+} USBD_DESC_BOS_MS_OS_20;
+
+#pragma pack(pop)
+
+//ep_count - hardware endpoints, including EP0. fifo_size - endpoint memory, except EP0. 0 - no limit
+bool usbd_desc_open(USBD_DESC* desc, unsigned int size, uint8_t attributes, uint8_t max_power, unsigned int ep_count, unsigned int fifo_size);
+void usbd_desc_close(USBD_DESC* desc);
+//class-specific descriptor
+bool usbd_desc_append(USBD_DESC* desc, const void* d, unsigned int size);
+//count interfaces following are associated
+bool usbd_desc_iad(USBD_DESC* desc, uint8_t count, uint8_t function_class, uint8_t subclass, uint8_t protocol, uint8_t function_str);
+//alternate setting is using number of last interface. Return interface number or -1
+int usbd_desc_interface(USBD_DESC* desc, uint8_t alt, uint8_t iface_class, uint8_t subclass, uint8_t protocol, uint8_t iface_str);
+//IN and OUT of same interface share number, number is never shared between interfaces. Return endpoint address or -1
+int usbd_desc_endpoint(USBD_DESC* desc, bool in, USB_EP_TYPE type, unsigned int size, uint8_t interval);
+//NULL on overflow or error
+USB_CONFIGURATION_DESCRIPTOR* usbd_desc_get(USBD_DESC* desc);
+
+//class templates
+bool usbd_desc_cdc_acm(USBD_DESC* desc, unsigned int ep_size, uint8_t function_str);
+bool usbd_desc_cdc_ncm(USBD_DESC* desc, unsigned int ep_size, uint8_t mac_str, uint8_t function_str);
+bool usbd_desc_msc(USBD_DESC* desc, unsigned int ep_size, uint8_t iface_str);
+
+//Microsoft OS 2.0 descriptor set. Registered with usbd_register_descriptor, index 0, lang 0
+bool usbd_desc_ms_os_20_open(USBD_DESC* desc, unsigned int size);
+//compatible_id - "WINUSB" for example. guid - DeviceInterfaceGUIDs in "{...}" form, can be NULL
+bool usbd_desc_ms_os_20_function(USBD_DESC* desc, uint8_t first_iface, const char* compatible_id, const char* guid);
+USB_MS_OS_20_SET_HEADER* usbd_desc_ms_os_20_get(USBD_DESC* desc);
+//BOS with MS OS 2.0 platform capability. Registered with usbd_register_descriptor, index 0, lang 0
+void usbd_desc_bos_ms_os_20(USBD_DESC_BOS_MS_OS_20* bos, const USB_MS_OS_20_SET_HEADER* set, uint8_t vendor_code);
+
+#endif // USBD_DESC_H
@@ -83,9 +83,18 @@ typedef struct {
 
 typedef struct {
     unsigned int crc_blocks, bad_blocks, crc_errors_count;
+    //erase count of good blocks
+    unsigned int erase_min, erase_max, erase_avg;
+    //free blocks and cold blocks moved by wear leveling since mount
+    unsigned int free_blocks, moved_blocks;
 } VFS_BER_STAT_TYPE;
 
 typedef struct {
+    unsigned int hits, misses, write_backs, dirty;
+} VFS_CACHE_STAT_TYPE;
+
+typedef struct {
+    //0 - format as FAT32
     unsigned int root_entries;
     unsigned short cluster_sectors, fat_count;
     uint32_t serial;
@@ -98,6 +107,9 @@ void vfs_record_destroy(VFS_RECORD_TYPE* vfs_record);
 
 bool vfs_open_volume(VFS_RECORD_TYPE* vfs_record, VFS_VOLUME_TYPE* volume);
 void vfs_close_volume(VFS_RECORD_TYPE* vfs_record);
+//write delayed sectors to storage
+bool vfs_flush(VFS_RECORD_TYPE* vfs_record);
+bool vfs_get_cache_stat(VFS_RECORD_TYPE* vfs_record, VFS_CACHE_STAT_TYPE* stat);
 
 bool vfs_open_ber(VFS_RECORD_TYPE* vfs_record, unsigned int block_sectors);
 void vfs_close_ber(VFS_RECORD_TYPE* vfs_record);
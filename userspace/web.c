@@ -62,6 +62,26 @@ void web_server_unregister_error(HANDLE web_server, WEB_RESPONSE code)
     ack(web_server, HAL_REQ(HAL_WEBS, WEBS_UNREGISTER_RESPONSE), (unsigned int)code, 0, 0);
 }
 
+void web_server_register_handler(HANDLE web_server)
+{
+    ack(web_server, HAL_REQ(HAL_WEBS, WEBS_REGISTER_HANDLER), 0, 0, 0);
+}
+
+void web_server_unregister_handler(HANDLE web_server)
+{
+    ack(web_server, HAL_REQ(HAL_WEBS, WEBS_UNREGISTER_HANDLER), 0, 0, 0);
+}
+
+void web_server_register_asset(HANDLE web_server, HANDLE node, const WEB_ASSET* asset)
+{
+    ack(web_server, HAL_REQ(HAL_WEBS, WEBS_REGISTER_ASSET), node, (unsigned int)asset, 0);
+}
+
+void web_server_unregister_asset(HANDLE web_server, HANDLE node)
+{
+    ack(web_server, HAL_REQ(HAL_WEBS, WEBS_UNREGISTER_ASSET), node, 0, 0);
+}
+
 void web_server_read(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max)
 {
     io_read(web_server, HAL_REQ(HAL_WEBS, IPC_READ), session, io, size_max);
@@ -84,6 +104,18 @@ int web_server_write_sync(HANDLE web_server, HANDLE session, WEB_RESPONSE code,
     return io_write_sync(web_server, HAL_IO_REQ(HAL_WEBS, IPC_WRITE), session, io);
 }
 
+void web_server_write_chunk(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io)
+{
+    *((WEB_RESPONSE*)io_push(io, sizeof(WEB_RESPONSE))) = code;
+    io_write(web_server, HAL_IO_REQ(HAL_WEBS, WEBS_WRITE_CHUNK), session, io);
+}
+
+int web_server_write_chunk_sync(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io)
+{
+    *((WEB_RESPONSE*)io_push(io, sizeof(WEB_RESPONSE))) = code;
+    return io_write_sync(web_server, HAL_IO_REQ(HAL_WEBS, WEBS_WRITE_CHUNK), session, io);
+}
+
 char *web_server_get_param(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max, char *param)
 {
     unsigned int len = strlen(param);
@@ -123,3 +155,19 @@ char *web_server_get_url(HANDLE web_server, HANDLE session, IO* io, unsigned int
         return NULL;
     return io_data(io);
 }
+
+char* web_server_get_path_param(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max, const char* name)
+{
+    unsigned int len = strlen(name);
+    if (len + 1 > size_max)
+    {
+        error(ERROR_IO_BUFFER_TOO_SMALL);
+        return NULL;
+    }
+    strcpy(io_data(io), name);
+    io->data_size = len + 1;
+    int res = io_read_sync(web_server, HAL_IO_REQ(HAL_WEBS, WEBS_GET_PATH_PARAM), session, io, size_max);
+    if (res <= 0)
+        return NULL;
+    return io_data(io);
+}
@@ -26,7 +26,13 @@ typedef enum {
     WEBS_UNREGISTER_RESPONSE,
     WEBS_GET_PARAM,
     WEBS_SET_PARAM,
-    WEBS_GET_URL
+    WEBS_GET_URL,
+    WEBS_REGISTER_HANDLER,
+    WEBS_UNREGISTER_HANDLER,
+    WEBS_WRITE_CHUNK,
+    WEBS_GET_PATH_PARAM,
+    WEBS_REGISTER_ASSET,
+    WEBS_UNREGISTER_ASSET
 } WEBS_IPCS;
 
 typedef enum {
@@ -45,6 +51,9 @@ typedef enum {
 #define WEB_GENERIC_ERROR           0
 #define WEB_ROOT_NODE                INVALID_HANDLE
 #define WEB_OBJ_WILDCARD            "*"
+//node named "{name}" matches any path segment. Value is available by web_server_get_path_param(name)
+#define WEB_OBJ_PARAM_OPEN          '{'
+#define WEB_OBJ_PARAM_CLOSE         '}'
 
 typedef enum {
     HTTP_CONTENT_PLAIN_TEXT = 0,
@@ -105,6 +114,22 @@ typedef enum {
     WEB_RESPONSE_HTTP_VERSION_NOT_SUPPORTED = 505
 } WEB_RESPONSE;
 
+//static asset, must be located in flash with all data
+typedef struct {
+    const char* content_type;
+    const void* data;
+    unsigned int data_size;
+    //precompressed variant, optional
+    const void* gzip;
+    unsigned int gzip_size;
+    //content hash, generated on image build
+    uint32_t etag;
+    //HTTP-date, optional
+    const char* last_modified;
+    //Cache-Control max-age in seconds. 0 - revalidate each time
+    unsigned int max_age;
+} WEB_ASSET;
+
 typedef struct {
     unsigned int processed, content_size;
     HTTP_CONTENT_TYPE content_type;
@@ -120,13 +145,25 @@ void web_server_destroy_node(HANDLE web_server, HANDLE obj);
 //html must be located in flash
 void web_server_register_error(HANDLE web_server, WEB_RESPONSE code, const char *html);
 void web_server_unregister_error(HANDLE web_server, WEB_RESPONSE code);
+//additional request handler process. Requests are dispatched to any free handler, owner included.
+//If session is closed during request, handler gets next request after its next call for closed session
+void web_server_register_handler(HANDLE web_server);
+//GET/HEAD on node are served by web server itself, handler is not involved
+void web_server_register_asset(HANDLE web_server, HANDLE node, const WEB_ASSET* asset);
+void web_server_unregister_asset(HANDLE web_server, HANDLE node);
+void web_server_unregister_handler(HANDLE web_server);
 
+//request body is streamed, each read returns next part up to io size. Zero size on end of body
 void web_server_read(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max);
 int web_server_read_sync(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max);
 void web_server_write(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io);
 int web_server_write_sync(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io);
+//chunked response. Completed after chunk is transmitted. Empty io is the last chunk
+void web_server_write_chunk(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io);
+int web_server_write_chunk_sync(HANDLE web_server, HANDLE session, WEB_RESPONSE code,  IO* io);
 char* web_server_get_param(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max, char* param);
 void web_server_set_param(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max, const char* param, const char* value);
 char* web_server_get_url(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max);
+char* web_server_get_path_param(HANDLE web_server, HANDLE session, IO* io, unsigned int size_max, const char* name);
 
 #endif // WEB_H